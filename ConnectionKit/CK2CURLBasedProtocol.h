@@ -54,6 +54,8 @@
 
 #pragma mark Customization
 + (BOOL)usesMultiHandle;    // defaults to YES. Subclasses can override to be NO and fall back to the old synchronous "easy" backend
+- (CURLTransferStack *)transferStackForRequest:(NSURLRequest *)request credential:(NSURLCredential *)credential;    // multi handle backend only. Defaults to one stack shared across the file manager
+- (void)transferStackForRequest:(NSURLRequest *)request credential:(NSURLCredential *)credential completionHandler:(void (^)(CURLTransferStack *stack))handler;    // defaults to calling the above straight away. Override if the transfer may have to wait for a stack
 - (void)popCompletionHandlerByExecutingWithError:(NSError *)error;
 - (void)reportToProtocolWithError:(NSError*)error;
 
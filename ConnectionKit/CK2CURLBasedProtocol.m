@@ -16,6 +16,234 @@
 #import <objc/runtime.h>
 
 
+// Tries to take into account tricky encoding issues in names from a listing
+// https://github.com/karelia/ConnectionKit/issues/41
+static NSString *CK2DecodeListingString(NSString *result)
+{
+    // For strings which fall outside of ASCII, hope that they're UTF-8
+    if (result && ![result canBeConvertedToEncoding:NSASCIIStringEncoding])
+    {
+        NSData *source = [result dataUsingEncoding:NSMacOSRomanStringEncoding];
+        // technically, this is a little dodgy. -dataUsingEncoding: could generate some sort of BOM, but I don't believe MacRoman has such a concept so we're safe for now
+        
+        if (source)
+        {
+            NSString *utf8 = [[NSString alloc] initWithData:source encoding:NSUTF8StringEncoding];
+            if (utf8)
+            {
+                result = [utf8 autorelease];
+            }
+        }
+    }
+    
+    return result;
+}
+
+
+/**
+ One item from a directory listing, boiled down to the raw details its resource values are derived
+ from. Attached to the item's URL, so that dates, UTIs, file security objects etc. are only built
+ for the keys a client actually looks up, rather than every key of every item.
+ */
+@interface CK2CURLListingEntry : NSObject <CK2ResourceValueProvider>
+{
+  @public
+    NSString        *_name;
+    NSString        *_link;             // still encoded as in the listing
+    NSURL           *_directoryURL;
+    NSString        *_directoryPath;
+    Class           _protocolClass;
+    
+    CFAbsoluteTime  _modificationDate;
+    int64_t         _size;
+    uint16_t        _mode;
+    uint8_t         _type;              // DT_*
+    
+    unsigned        _hasModificationDate:1;
+    unsigned        _hasSize:1;
+    unsigned        _hasMode:1;
+}
+
+- (id)initWithName:(NSString *)name parsedResourceListing:(CFDictionaryRef)parsedDict directoryURL:(NSURL *)directoryURL path:(NSString *)directoryPath protocolClass:(Class)protocolClass;
+
+@end
+
+
+@implementation CK2CURLListingEntry
+
+- (id)initWithName:(NSString *)name parsedResourceListing:(CFDictionaryRef)parsedDict directoryURL:(NSURL *)directoryURL path:(NSString *)directoryPath protocolClass:(Class)protocolClass;
+{
+    if (self = [self init])
+    {
+        _name = [name copy];
+        _link = [CFDictionaryGetValue(parsedDict, kCFFTPResourceLink) copy];
+        _directoryURL = [directoryURL retain];
+        _directoryPath = [directoryPath copy];
+        _protocolClass = protocolClass;
+        
+        _type = [(NSNumber *)CFDictionaryGetValue(parsedDict, kCFFTPResourceType) intValue];
+        
+        NSDate *date = CFDictionaryGetValue(parsedDict, kCFFTPResourceModDate);
+        if (date)
+        {
+            _modificationDate = date.timeIntervalSinceReferenceDate;
+            _hasModificationDate = YES;
+        }
+        
+        NSNumber *size = CFDictionaryGetValue(parsedDict, kCFFTPResourceSize);
+        if (size)
+        {
+            _size = size.longLongValue;
+            _hasSize = YES;
+        }
+        
+        NSNumber *mode = CFDictionaryGetValue(parsedDict, kCFFTPResourceMode);
+        if (mode)
+        {
+            _mode = mode.unsignedShortValue;
+            _hasMode = YES;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc;
+{
+    [_name release];
+    [_link release];
+    [_directoryURL release];
+    [_directoryPath release];
+    
+    [super dealloc];
+}
+
+- (BOOL)getResourceValue:(out id *)value forKey:(NSString *)key ofURL:(NSURL *)url;
+{
+    BOOL isDirectory = (_type == DT_DIR);
+    
+    if ([key isEqualToString:NSURLContentModificationDateKey])
+    {
+        *value = (_hasModificationDate ? [NSDate dateWithTimeIntervalSinceReferenceDate:_modificationDate] : nil);
+    }
+    else if ([key isEqualToString:NSURLIsDirectoryKey])
+    {
+        *value = @(isDirectory);
+    }
+    else if ([key isEqualToString:NSURLIsHiddenKey])
+    {
+        *value = @([_name hasPrefix:@"."]);
+    }
+    else if ([key isEqualToString:NSURLIsRegularFileKey])
+    {
+        *value = @(_type == DT_REG);
+    }
+    else if ([key isEqualToString:NSURLIsSymbolicLinkKey])
+    {
+        *value = @(_type == DT_LNK);
+    }
+    else if ([key isEqualToString:NSURLNameKey])
+    {
+        *value = _name;
+    }
+    else if ([key isEqualToString:NSURLParentDirectoryURLKey])
+    {
+        *value = _directoryPath;
+    }
+    else if ([key isEqualToString:NSURLTypeIdentifierKey])
+    {
+        // Guess from symlink, extension, and directory
+        if (_type == DT_LNK)
+        {
+            *value = (NSString *)kUTTypeSymLink;
+        }
+        else
+        {
+            NSString *extension = [_name pathExtension];
+            if ([extension length])
+            {
+                CFStringRef type = UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension,
+                                                                         (CFStringRef)extension,
+                                                                         (isDirectory ? kUTTypeDirectory : kUTTypeData));
+                
+                *value = [(NSString *)type autorelease];
+            }
+            else
+            {
+                *value = (NSString *)kUTTypeData;
+            }
+        }
+    }
+    else if ([key isEqualToString:NSURLFileSizeKey])
+    {
+        *value = (_hasSize ? @(_size) : nil);
+    }
+    else if ([key isEqualToString:CK2URLSymbolicLinkDestinationKey])
+    {
+        NSString *path = CK2DecodeListingString(_link);
+        if ([path length])
+        {
+            // Servers in my experience hand include a trailing slash to indicate if the target is a directory
+            // Could generate a CK2RemoteURL instead so as to explicitly mark it as a directory, but that seems unecessary for now
+            // According to the original CKConnectionOpenPanel source, some servers use a backslash instead. I don't know what though – Windows based ones? If so, do they use backslashes for all path components?
+            *value = [_protocolClass URLWithPath:path relativeToURL:_directoryURL];
+        }
+        else
+        {
+            *value = nil;
+        }
+    }
+    else if (&NSURLFileResourceTypeKey &&   // not available till 10.7
+             [key isEqualToString:NSURLFileResourceTypeKey])
+    {
+        switch (_type)
+        {
+            case DT_CHR:
+                *value = NSURLFileResourceTypeCharacterSpecial;
+                break;
+            case DT_DIR:
+                *value = NSURLFileResourceTypeDirectory;
+                break;
+            case DT_BLK:
+                *value = NSURLFileResourceTypeBlockSpecial;
+                break;
+            case DT_REG:
+                *value = NSURLFileResourceTypeRegular;
+                break;
+            case DT_LNK:
+                *value = NSURLFileResourceTypeSymbolicLink;
+                break;
+            case DT_SOCK:
+                *value = NSURLFileResourceTypeSocket;
+                break;
+            default:
+                *value = NSURLFileResourceTypeUnknown;
+        }
+    }
+    else if (&NSURLFileSecurityKey && [key isEqualToString:NSURLFileSecurityKey])
+    {
+        *value = nil;
+        
+        if (_hasMode)
+        {
+            CFFileSecurityRef security = CFFileSecurityCreate(NULL);
+            if (CFFileSecuritySetMode(security, _mode))
+            {
+                *value = [[(NSFileSecurity *)security retain] autorelease];
+            }
+            CFRelease(security);
+        }
+    }
+    else
+    {
+        return NO;
+    }
+    
+    return YES;
+}
+
+@end
+
+
 @implementation CK2CURLBasedProtocol
 
 - (id)initWithRequest:(NSURLRequest *)request client:(id <CK2ProtocolClient>)client completionHandler:(void (^)(NSError *))handler;
@@ -107,7 +335,8 @@
     return YES;
 }
 
-- (NSError*)processData:(NSMutableData*)data request:(NSURLRequest *)request url:(NSURL*)directoryURL path:(NSString*)directoryPath keys:(NSArray*)keys options:(NSDirectoryEnumerationOptions)mask
+// Parses as many complete entries as data holds beyond *consumed, advancing it past them. A trailing partial entry is left for when more data arrives
+- (NSError*)processData:(NSData*)data consumedLength:(NSUInteger *)consumed request:(NSURLRequest *)request url:(NSURL*)directoryURL path:(NSString*)directoryPath options:(NSDirectoryEnumerationOptions)mask
 {
     NSError* result = nil;
 
@@ -116,150 +345,36 @@
     {
         CFDictionaryRef parsedDict = NULL;
         CFIndex bytesConsumed = CFFTPCreateParsedResourceListing(NULL,
-                                                                 [data bytes], [data length],
+                                                                 (const UInt8 *)[data bytes] + *consumed, [data length] - *consumed,
                                                                  &parsedDict);
 
         if (bytesConsumed > 0)
         {
-            [data replaceBytesInRange:NSMakeRange(0, bytesConsumed) withBytes:NULL length:0];
+            *consumed += bytesConsumed;
 
             // Make sure CFFTPCreateParsedResourceListing was able to properly
             // parse the incoming data
             if (parsedDict)
             {
-                NSString *name = [self pathForKey:kCFFTPResourceName inDictionary:parsedDict];
+                NSString *name = CK2DecodeListingString(CFDictionaryGetValue(parsedDict, kCFFTPResourceName));
 
                 if ([self shouldEnumerateFilename:name options:mask])
                 {
-                    NSNumber *type = CFDictionaryGetValue(parsedDict, kCFFTPResourceType);
-                    BOOL isDirectory = [type intValue] == DT_DIR;
+                    // Resource values are only worked out as and when clients ask for them
+                    CK2CURLListingEntry *entry = [[CK2CURLListingEntry alloc] initWithName:name
+                                                                     parsedResourceListing:parsedDict
+                                                                              directoryURL:directoryURL
+                                                                                      path:directoryPath
+                                                                             protocolClass:self.class];
 
                     NSURL *aURL = [directoryURL URLByAppendingPathComponent:name];
-                    if (isDirectory && !CFURLHasDirectoryPath((CFURLRef)aURL))
+                    if (entry->_type == DT_DIR && !CFURLHasDirectoryPath((CFURLRef)aURL))
                     {
                         aURL = [aURL URLByAppendingPathComponent:@""];  // http://www.mikeabdullah.net/guaranteeing-directory-urls.html
                     }
 
-                    // Fill in requested keys as best we can
-                    NSArray *keysToFill = (keys ? keys : self.class.defaultPropertyKeys);
-
-                    for (NSString *aKey in keysToFill)
-                    {
-                        if ([aKey isEqualToString:NSURLContentModificationDateKey])
-                        {
-                            [CK2FileManager setTemporaryResourceValue:CFDictionaryGetValue(parsedDict, kCFFTPResourceModDate) forKey:aKey inURL:aURL];
-                        }
-                        else if ([aKey isEqualToString:NSURLIsDirectoryKey])
-                        {
-                            [CK2FileManager setTemporaryResourceValue:@(isDirectory) forKey:aKey inURL:aURL];
-                        }
-                        else if ([aKey isEqualToString:NSURLIsHiddenKey])
-                        {
-                            [CK2FileManager setTemporaryResourceValue:@([name hasPrefix:@"."]) forKey:aKey inURL:aURL];
-                        }
-                        else if ([aKey isEqualToString:NSURLIsRegularFileKey])
-                        {
-                            [CK2FileManager setTemporaryResourceValue:@([type intValue] == DT_REG) forKey:aKey inURL:aURL];
-                        }
-                        else if ([aKey isEqualToString:NSURLIsSymbolicLinkKey])
-                        {
-                            [CK2FileManager setTemporaryResourceValue:@([type intValue] == DT_LNK) forKey:aKey inURL:aURL];
-                        }
-                        else if ([aKey isEqualToString:NSURLLocalizedTypeDescriptionKey])
-                        {
-                            // Could guess from extension
-                        }
-                        else if ([aKey isEqualToString:NSURLNameKey])
-                        {
-                            [CK2FileManager setTemporaryResourceValue:name forKey:aKey inURL:aURL];
-                        }
-                        else if ([aKey isEqualToString:NSURLParentDirectoryURLKey])
-                        {
-                            [CK2FileManager setTemporaryResourceValue:directoryPath forKey:NSURLParentDirectoryURLKey inURL:aURL];
-                        }
-                        else if ([aKey isEqualToString:NSURLTypeIdentifierKey])
-                        {
-                            // Guess from symlink, extension, and directory
-                            if ([type intValue] == DT_LNK)
-                            {
-                                [CK2FileManager setTemporaryResourceValue:(NSString *)kUTTypeSymLink forKey:aKey inURL:aURL];
-                            }
-                            else
-                            {
-                                NSString *extension = [name pathExtension];
-                                if ([extension length])
-                                {
-                                    CFStringRef type = UTTypeCreatePreferredIdentifierForTag(kUTTagClassFilenameExtension,
-                                                                                             (CFStringRef)extension,
-                                                                                             (isDirectory ? kUTTypeDirectory : kUTTypeData));
-
-                                    [CK2FileManager setTemporaryResourceValue:(NSString *)type forKey:aKey inURL:aURL];
-                                    CFRelease(type);
-                                }
-                                else
-                                {
-                                    [CK2FileManager setTemporaryResourceValue:(NSString *)kUTTypeData forKey:aKey inURL:aURL];
-                                }
-                            }
-                        }
-                        else if ([aKey isEqualToString:NSURLFileSizeKey])
-                        {
-                            [CK2FileManager setTemporaryResourceValue:CFDictionaryGetValue(parsedDict, kCFFTPResourceSize) forKey:aKey inURL:aURL];
-                        }
-                        else if ([aKey isEqualToString:CK2URLSymbolicLinkDestinationKey])
-                        {
-                            NSString *path = [self pathForKey:kCFFTPResourceLink inDictionary:parsedDict];
-                            if ([path length])
-                            {
-                                // Servers in my experience hand include a trailing slash to indicate if the target is a directory
-                                // Could generate a CK2RemoteURL instead so as to explicitly mark it as a directory, but that seems unecessary for now
-                                // According to the original CKConnectionOpenPanel source, some servers use a backslash instead. I don't know what though – Windows based ones? If so, do they use backslashes for all path components?
-                                [CK2FileManager setTemporaryResourceValue:[self.class URLWithPath:path relativeToURL:directoryURL] forKey:aKey inURL:aURL];
-                            }
-                        }
-                        else if (&NSURLFileResourceTypeKey &&   // not available till 10.7
-                                 [aKey isEqualToString:NSURLFileResourceTypeKey])
-                        {
-                                NSString *typeValue;
-                                switch ([type integerValue])
-                                {
-                                    case DT_CHR:
-                                        typeValue = NSURLFileResourceTypeCharacterSpecial;
-                                        break;
-                                    case DT_DIR:
-                                        typeValue = NSURLFileResourceTypeDirectory;
-                                        break;
-                                    case DT_BLK:
-                                        typeValue = NSURLFileResourceTypeBlockSpecial;
-                                        break;
-                                    case DT_REG:
-                                        typeValue = NSURLFileResourceTypeRegular;
-                                        break;
-                                    case DT_LNK:
-                                        typeValue = NSURLFileResourceTypeSymbolicLink;
-                                        break;
-                                    case DT_SOCK:
-                                        typeValue = NSURLFileResourceTypeSocket;
-                                        break;
-                                    default:
-                                        typeValue = NSURLFileResourceTypeUnknown;
-                                }
-
-                                [CK2FileManager setTemporaryResourceValue:typeValue forKey:aKey inURL:aURL];
-                        }
-                        else if (&NSURLFileSecurityKey && [aKey isEqualToString:NSURLFileSecurityKey])
-                        {
-                                CFFileSecurityRef security = CFFileSecurityCreate(NULL);
-
-                                NSNumber *mode = CFDictionaryGetValue(parsedDict, kCFFTPResourceMode);
-                                if (CFFileSecuritySetMode(security, mode.unsignedShortValue))
-                                {
-                                    [CK2FileManager setTemporaryResourceValue:(NSFileSecurity *)security forKey:aKey inURL:aURL];
-                                }
-
-                                CFRelease(security);
-                        }
-                    }
+                    [CK2FileManager setTemporaryResourceValueProvider:entry inURL:aURL];
+                    [entry release];
 
                     [self.client protocol:self didDiscoverItemAtURL:aURL];
                 }
@@ -288,40 +403,44 @@
     return result;
 }
 
-// Retrieves the path/filename for a given key, and then tries to take into account tricky encoding issues
-// https://github.com/karelia/ConnectionKit/issues/41
-- (NSString *)pathForKey:(CFStringRef)key inDictionary:(CFDictionaryRef)dictionary;
+- (id)initForEnumeratingDirectoryWithRequest:(NSURLRequest *)request includingPropertiesForKeys:(NSArray *)keys options:(NSDirectoryEnumerationOptions)mask client:(id<CK2ProtocolClient>)client;
 {
-    NSString *result = CFDictionaryGetValue(dictionary, key);
-    
-    // For strings which fall outside of ASCII, hope that they're UTF-8
-    if (![result canBeConvertedToEncoding:NSASCIIStringEncoding])
-    {
-        NSData *source = [result dataUsingEncoding:NSMacOSRomanStringEncoding];
-        // technically, this is a little dodgy. -dataUsingEncoding: could generate some sort of BOM, but I don't believe MacRoman has such a concept so we're safe for now
-        
-        if (source)
+    request = [[self class] newRequestWithRequest:request isDirectory:YES];
+
+    // Entries are parsed as the listing arrives, so the client hears about them progressively.
+    // Parsed bytes are skipped over with a cursor, and only cut from the front of the buffer once
+    // they make up most of it, so each byte is moved a bounded number of times
+    NSMutableData *buffer = [[NSMutableData alloc] init];
+    __block NSUInteger consumed = 0;
+    __block NSURL *directoryURL = nil;
+    __block NSString *directoryPath = nil;
+    __block NSError *parseError = nil;
+
+    self = [self initWithRequest:request client:client dataHandler:^(NSData *data) {
+
+        if (!directoryURL)
         {
-            NSString *utf8 = [[NSString alloc] initWithData:source encoding:NSUTF8StringEncoding];
-            if (utf8)
+            directoryURL = [[self URLOfDirectoryListedByRequest:request path:&directoryPath] retain];
+            [directoryPath retain];
+
+            // Report directory itself
+            if (mask & CK2DirectoryEnumerationIncludesDirectory)
             {
-                result = [utf8 autorelease];
+                [self.client protocol:self didDiscoverItemAtURL:directoryURL];
             }
         }
-    }
-    
-    return result;
-}
 
-- (id)initForEnumeratingDirectoryWithRequest:(NSURLRequest *)request includingPropertiesForKeys:(NSArray *)keys options:(NSDirectoryEnumerationOptions)mask client:(id<CK2ProtocolClient>)client;
-{
-    request = [[self class] newRequestWithRequest:request isDirectory:YES];
+        // Once the listing has proved unparseable, there's no point carrying on
+        if (parseError) return;
 
-    NSMutableData *totalData = [[NSMutableData alloc] init];
+        [buffer appendData:data];
+        parseError = [[self processData:buffer consumedLength:&consumed request:request url:directoryURL path:directoryPath options:mask] retain];
 
-    self = [self initWithRequest:request client:client dataHandler:^(NSData *data) {
-
-        [totalData appendData:data];
+        if (consumed > buffer.length / 2)
+        {
+            [buffer replaceBytesInRange:NSMakeRange(0, consumed) withBytes:NULL length:0];
+            consumed = 0;
+        }
 
     } completionHandler:^(NSError *error) {
 
@@ -331,47 +450,50 @@
         }
         else
         {
-            // Correct relative paths if we can
-            NSURL *directoryURL = request.URL;
-            NSString *directoryPath = [self.class pathOfURLRelativeToHomeDirectory:directoryURL];
-
-            NSURL *home = [self.class homeDirectoryURLForServerAtURL:directoryURL];
-            if (home && ![directoryPath isAbsolutePath])
+            // An empty directory might not have sent any data at all
+            if (!directoryURL)
             {
-                if (directoryPath.length && ![directoryPath hasSuffix:@"/"]) directoryPath = [directoryPath stringByAppendingString:@"/"];
-                directoryURL = [home URLByAppendingPathComponent:directoryPath];
+                directoryURL = [[self URLOfDirectoryListedByRequest:request path:&directoryPath] retain];
+                [directoryPath retain];
+
+                if (mask & CK2DirectoryEnumerationIncludesDirectory)
+                {
+                    [self.client protocol:self didDiscoverItemAtURL:directoryURL];
+                }
             }
 
-            // Report directory itself
-            if (mask & CK2DirectoryEnumerationIncludesDirectory)
+            // Process whatever's left of the listing
+            if (!parseError)
             {
-                [self.client protocol:self didDiscoverItemAtURL:directoryURL];
+                parseError = [[self processData:buffer consumedLength:&consumed request:request url:directoryURL path:directoryPath options:mask] retain];
             }
-
-           // Process the data to make a directory listing
-            NSError* error = [self processData:totalData request:request url:directoryURL path:directoryPath keys:keys options:mask];
-            [self.client protocol:self didCompleteWithError:error];
+            [self.client protocol:self didCompleteWithError:parseError];
         }
+
+        [directoryURL release]; directoryURL = nil;
+        [directoryPath release]; directoryPath = nil;
+        [parseError release]; parseError = nil;
     }];
 
-    [totalData release];
+    [buffer release];
     [request release];
     return self;
 }
 
-+ (NSArray *)defaultPropertyKeys;
+// Corrects relative paths if we can. -transfer:didReceiveData: makes sure the home directory is known before any of the listing is handed over
+- (NSURL *)URLOfDirectoryListedByRequest:(NSURLRequest *)request path:(NSString **)path;
 {
-    NSArray *result = @[NSURLContentModificationDateKey,
-                        NSURLIsDirectoryKey,
-                        NSURLIsRegularFileKey,
-                        NSURLIsSymbolicLinkKey,
-                        NSURLNameKey,
-                        NSURLFileSizeKey,
-                        CK2URLSymbolicLinkDestinationKey];
-    
-    if (&NSURLFileResourceTypeKey) result = [result arrayByAddingObject:NSURLFileResourceTypeKey];
-    if (&NSURLFileSecurityKey) result = [result arrayByAddingObject:NSURLFileSecurityKey];
-    
+    NSURL *result = request.URL;
+    NSString *directoryPath = [self.class pathOfURLRelativeToHomeDirectory:result];
+
+    NSURL *home = [self.class homeDirectoryURLForServerAtURL:result];
+    if (home && ![directoryPath isAbsolutePath])
+    {
+        if (directoryPath.length && ![directoryPath hasSuffix:@"/"]) directoryPath = [directoryPath stringByAppendingString:@"/"];
+        result = [home URLByAppendingPathComponent:directoryPath];
+    }
+
+    if (path) *path = directoryPath;
     return result;
 }
 
@@ -483,21 +605,13 @@
 
     if ([[self class] usesMultiHandle])
     {
-        // Nasty, nasty HACK here, to share across the file manager
-        CK2FileManager *fileManager = [self valueForKeyPath:@"client.fileManager"];
-        @synchronized(fileManager) {
-            static void *key = &key;
-            multi = [objc_getAssociatedObject(fileManager, key) transferStack];
-            if (!multi) {
-                CK2CurlTransferStackManager *manager = [[CK2CurlTransferStackManager alloc] init];
-                multi = manager.transferStack;
-                objc_setAssociatedObject(fileManager, key, manager, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
-                [manager release];
-            }
-        }
-        
-        _transfer = [[multi transferWithRequest:request credential:credential delegate:self] retain];
-        [_transfer resume];
+        [self transferStackForRequest:request credential:credential completionHandler:^(CURLTransferStack *stack) {
+            
+            if (_cancelled) return;
+            
+            _transfer = [[stack transferWithRequest:request credential:credential delegate:self] retain];
+            [_transfer resume];
+        }];
     }
     else
     {
@@ -533,6 +647,31 @@
     }
 }
 
+- (CURLTransferStack *)transferStackForRequest:(NSURLRequest *)request credential:(NSURLCredential *)credential;
+{
+    CURLTransferStack *result;
+    
+    // Nasty, nasty HACK here, to share across the file manager
+    CK2FileManager *fileManager = [self valueForKeyPath:@"client.fileManager"];
+    @synchronized(fileManager) {
+        static void *key = &key;
+        result = [objc_getAssociatedObject(fileManager, key) transferStack];
+        if (!result) {
+            CK2CurlTransferStackManager *manager = [[CK2CurlTransferStackManager alloc] init];
+            result = manager.transferStack;
+            objc_setAssociatedObject(fileManager, key, manager, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+            [manager release];
+        }
+    }
+    
+    return result;
+}
+
+- (void)transferStackForRequest:(NSURLRequest *)request credential:(NSURLCredential *)credential completionHandler:(void (^)(CURLTransferStack *stack))handler;
+{
+    handler([self transferStackForRequest:request credential:credential]);
+}
+
 - (void)reportToProtocolWithError:(NSError*)error
 {
     [[self client] protocol:self didCompleteWithError:error];
@@ -19,8 +19,8 @@ typedef NS_OPTIONS(NSInteger, CK2DirectoryEnumerationOptions) {
 };
 
 
-@protocol CK2FileManagerDelegate;
-@class CK2FileOperation;
+@protocol CK2FileManagerDelegate, CK2ResourceValueProvider;
+@class CK2FileOperation, CK2ListingCache;
 
 
 /**
@@ -57,6 +57,7 @@ typedef NS_OPTIONS(NSInteger, CK2DirectoryEnumerationOptions) {
   @private
     id <CK2FileManagerDelegate> _delegate;
     NSOperationQueue            *_delegateQueue;
+    CK2ListingCache             *_listingCache;
 }
 
 #pragma mark Creating a File Manager
@@ -107,6 +108,18 @@ typedef NS_OPTIONS(NSInteger, CK2DirectoryEnumerationOptions) {
 extern NSString * const CK2URLSymbolicLinkDestinationKey; // The destination URL of a symlink
 
 
+#pragma mark Caching Listings
+
+/**
+ Where recent directory listings are remembered, so repeat requests for them needn't go to the server.
+ 
+ Defaults to `+[CK2ListingCache sharedCache]`. Set to `nil` to have every listing fetched afresh.
+ Creating, removing, renaming or setting attributes of items through the receiver discards the
+ affected listings from this cache.
+ */
+@property(retain) CK2ListingCache *listingCache;
+
+
 #pragma mark Creating Items
 
 /**
@@ -396,9 +409,9 @@ extern NSString * const CK2URLSymbolicLinkDestinationKey; // The destination URL
  Equivalent of CFURLSetTemporaryResourcePropertyForKey() that supports non-file URLs
  
  Calls through to Core Foundation for file URLs, but provides its own storage for others
- When first used for a non-file URL, -[NSURL getResourceValue:forKey:error:] is swizzled so the value can be easily retreived by clients later
+ Values for non-file URLs are kept in a shared table, and -[NSURL getResourceValue:forKey:error:] on that URL consults it, so clients can retrieve them as normal later
  This method is primarily used by non-file protocols to populate URLs returned during a directory listing. But it could be helpful to clients for adding in other info
- CRITICAL: keys are tested using POINTER equality for non-file URLs, so you must pass in a CONSTANT
+ Keys are compared by value, but the standard constants are quickest
  
  @param value to cache. Retained
  @param key to store under. Any existing value is overwritten
@@ -406,6 +419,26 @@ extern NSString * const CK2URLSymbolicLinkDestinationKey; // The destination URL
  */
 + (void)setTemporaryResourceValue:(id)value forKey:(NSString *)key inURL:(NSURL *)url __attribute((nonnull(2,3)));
 
+/**
+ Supplies resource values for a non-file URL on demand
+ 
+ Rather than setting every key of every item in a large directory listing up front, a protocol can
+ attach one object holding the item's raw details. The first time a key is looked up that hasn't
+ been set explicitly, the provider is asked for it, and the answer is cached in the URL.
+ 
+ @param provider to consult. Retained until the URL is deallocated, so must not itself retain the URL
+ @param url to provide for. Any existing provider is replaced
+ */
++ (void)setTemporaryResourceValueProvider:(id <CK2ResourceValueProvider>)provider inURL:(NSURL *)url __attribute((nonnull(2)));
+
+@end
+
+
+@protocol CK2ResourceValueProvider <NSObject>
+/**
+ @return NO if the provider doesn't know about key, in which case the usual lookup continues
+ */
+- (BOOL)getResourceValue:(out id *)value forKey:(NSString *)key ofURL:(NSURL *)url;
 @end
 
 
@@ -8,9 +8,9 @@
 
 #import "CK2FileManager.h"
 #import "CK2FileOperation.h"
+#import "CK2ListingCache.h"
 #import "CK2Protocol.h"
-
-#import <objc/runtime.h>
+#import "CK2ResourceValueStore.h"
 
 
 NSString * const CK2FileMIMEType = @"CK2FileMIMEType";
@@ -102,6 +102,7 @@ NSString * const CK2URLSymbolicLinkDestinationKey = @"CK2URLSymbolicLinkDestinat
             _delegateQueue.maxConcurrentOperationCount = 1;
         }
         
+        _listingCache = [[CK2ListingCache sharedCache] retain];
         self.delegate = delegate;
     }
     
@@ -115,6 +116,7 @@ NSString * const CK2URLSymbolicLinkDestinationKey = @"CK2URLSymbolicLinkDestinat
 
 - (void)dealloc {
     [_delegateQueue release];
+    [_listingCache release];
     
     [super dealloc];
 }
@@ -158,6 +160,10 @@ NSString * const CK2URLSymbolicLinkDestinationKey = @"CK2URLSymbolicLinkDestinat
     return [operation autorelease];
 }
 
+#pragma mark Caching Listings
+
+@synthesize listingCache = _listingCache;
+
 #pragma mark Creating and Deleting Items
 
 - (CK2FileOperation *)createDirectoryAtURL:(NSURL *)url withIntermediateDirectories:(BOOL)createIntermediates openingAttributes:(NSDictionary *)attributes completionHandler:(void (^)(NSError *error))handler;
@@ -409,32 +415,24 @@ NSString * const CK2URLSymbolicLinkDestinationKey = @"CK2URLSymbolicLinkDestinat
     // Ideally, would use CFURLSetTemporaryResourcePropertyForKey() first for all URLs as a test, but on 10.7.5 at least, it crashes with non-file URLs
     if ([url isFileURL])
     {
-        CFURLSetTemporaryResourcePropertyForKey((CFURLRef)value, (CFStringRef)key, value);
+        CFURLSetTemporaryResourcePropertyForKey((CFURLRef)url, (CFStringRef)key, value);
     }
     else
     {
-        [self setTemporaryResourceValueForKey:key inURL:url asBlock:^id{
-            return value;
-        }];
+        [[CK2ResourceValueStore sharedStore] setValue:value forKey:key inURL:url];
     }
 }
 
 // The block is responsible for returning the value on-demand
 + (void)setTemporaryResourceValueForKey:(NSString *)key inURL:(NSURL *)url asBlock:(id (^)(void))block;
 {
-    // Store the block as an associated object
-    objc_setAssociatedObject(url, key, block, OBJC_ASSOCIATION_COPY);
-    
-    
-    // Swizzle so getter method includes cache in its search
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        
-        Class class = NSURL.class;
-        Method originalMethod = class_getInstanceMethod(class, @selector(getResourceValue:forKey:error:));
-        Method overrideMethod = class_getInstanceMethod(class, @selector(ck2_getResourceValue:forKey:error:));
-        method_exchangeImplementations(originalMethod, overrideMethod);
-    });
+    [[CK2ResourceValueStore sharedStore] setValueBlock:block forKey:key inURL:url];
+}
+
++ (void)setTemporaryResourceValueProvider:(id <CK2ResourceValueProvider>)provider inURL:(NSURL *)url;
+{
+    NSParameterAssert(![url isFileURL]);
+    [[CK2ResourceValueStore sharedStore] setProvider:provider inURL:url];
 }
 
 /*!
@@ -460,90 +458,3 @@ NSString * const CK2URLSymbolicLinkDestinationKey = @"CK2URLSymbolicLinkDestinat
 }
 
 @end
-
-
-#pragma mark -
-
-
-@implementation NSURL (CK2TemporaryResourceProperties)
-
-#pragma mark Getting and Setting File System Resource Properties
-
-- (BOOL)ck2_getResourceValue:(out id *)value forKey:(NSString *)key error:(out NSError **)error;
-{
-    // Special case, as for the setter method
-    if ([self isFileURL])
-    {
-        return [self ck2_getResourceValue:value forKey:key error:error];    // calls the original implementation
-    }
-    
-    
-    // See if key has been cached
-    id (^block)(void) = objc_getAssociatedObject(self, key);
-    
-    if (block)
-    {
-        *value = block();
-        return YES;
-    }
-    
-    
-    // A few special keys we generate on-demand pretty much by guessing since the server isn't up to providing that sort of info
-        if ([key isEqualToString:NSURLHasHiddenExtensionKey])
-        {
-            *value = [NSNumber numberWithBool:NO];
-            return YES;
-        }
-        else if ([key isEqualToString:NSURLLocalizedNameKey])
-        {
-            *value = [self lastPathComponent];
-            return YES;
-        }
-        
-        // Have to define NSURLPathKey as a macro for older releases:
-#if (!defined MAC_OS_X_VERSION_10_8) || MAC_OS_X_VERSION_MIN_REQUIRED < MAC_OS_X_VERSION_10_8
-#define NSURLPathKey @"_NSURLPathKey"
-#endif
-        else if ([key isEqualToString:NSURLPathKey])
-        {
-            *value = [CK2FileManager pathOfURL:self];
-            return YES;
-        }
-#undef NSURLPathKey
-        
-        else if ([key isEqualToString:NSURLIsPackageKey])
-        {
-            NSString        *extension;
-            
-            *value = @NO;
-            extension = [self pathExtension];
-            
-            if ([extension length] > 0)
-            {
-                NSArray         *baseUTIs;
-                
-                baseUTIs = (NSArray *)UTTypeCreateAllIdentifiersForTag(kUTTagClassFilenameExtension, (CFStringRef)extension, NULL);
-
-                for (NSString *uti in baseUTIs)
-                {
-                    if (UTTypeConformsTo((CFStringRef)uti, CFSTR("com.apple.package")))
-                    {
-                        *value = @YES;
-                        break;
-                    }
-                }
-                
-                [baseUTIs release];
-            }
-            
-            return YES;
-        }
-        else
-        {
-            return [self ck2_getResourceValue:value forKey:key error:error];    // calls the original implementation
-        }
-    
-    return YES;
-}
-
-@end
@@ -8,6 +8,11 @@
 #import <CURLHandle/CURLHandle.h>
 
 
+@interface CK2FileManager (TestSupport)
+- initWithDelegate:(id <CK2FileManagerDelegate>)delegate delegateQueue:(NSOperationQueue *)queue;
+@end
+
+
 @interface CURLTransfer (Testing)
 + (void)cleanupStandaloneMulti:(CURLTransferStack *)multi;
 + (CURLTransferStack *)standaloneMultiForTestPurposes;
@@ -19,6 +24,16 @@
 @synthesize dontShareConnections = _dontShareConnections;
 @synthesize multi = _multi;
 
+- initWithDelegate:(id <CK2FileManagerDelegate>)delegate delegateQueue:(NSOperationQueue *)queue;
+{
+    if (self = [super initWithDelegate:delegate delegateQueue:queue])
+    {
+        // Test servers change their contents from one test to the next, so listings mustn't carry over
+        self.listingCache = nil;
+    }
+    return self;
+}
+
 - (void)dealloc
 {
     [CURLTransfer cleanupStandaloneMulti:_multi];
@@ -38,6 +38,7 @@ typedef NS_ENUM(NSInteger, CK2FileOperationState) {
     void    (^_completionBlock)(NSError *);
     void    (^_enumerationBlock)(NSURL *);
     NSURL   *_localURL;
+    void    (^_listingInvalidationBlock)(CK2ListingCache *);    // run on completion, for operations which change the server's contents
     
     int64_t _bytesWritten;
     int64_t _bytesExpectedToWrite;
@@ -7,6 +7,7 @@
 //
 
 #import "CK2FileOperation.h"
+#import "CK2ListingCache.h"
 #import "CK2Protocol.h"
 
 #import <AppKit/AppKit.h>   // so icon handling can use NSImage and NSWorkspace for now
@@ -61,6 +62,16 @@ callbacks:(CK2FileOperationCallbacks *)callbacks NS_DESIGNATED_INITIALIZER;
 @end
 
 
+@interface CK2ListingCache (Internals)
+// Replays a fresh cached listing, or else enumerates using protocolClass, remembering the listing as it goes
+- (CK2Protocol *)newProtocolForEnumeratingDirectoryWithRequest:(NSURLRequest *)request
+                                    includingPropertiesForKeys:(NSArray *)keys
+                                                       options:(NSDirectoryEnumerationOptions)mask
+                                                 protocolClass:(Class)protocolClass
+                                                        client:(id <CK2ProtocolClient>)client NS_RETURNS_RETAINED;
+@end
+
+
 #pragma mark -
 
 
@@ -128,6 +139,17 @@ callbacks:(CK2FileOperationCallbacks *)callbacks;
         // If we try to do this outside the block there's a risk the protocol object will be created *before* the enum block has been stored, which ends real badly
         fileOp->_enumerationBlock = [enumBlock copy];
         
+        // The cache decides whether the listing needs fetching
+        CK2ListingCache *cache = fileOp.fileManager.listingCache;
+        if (cache)
+        {
+            return [cache newProtocolForEnumeratingDirectoryWithRequest:[fileOp requestWithURL:url]
+                                             includingPropertiesForKeys:keys
+                                                                options:mask
+                                                          protocolClass:protocolClass
+                                                                 client:fileOp];
+        }
+        
         return [[protocolClass alloc] initForEnumeratingDirectoryWithRequest:[fileOp requestWithURL:url]
                                                   includingPropertiesForKeys:keys
                                                                      options:mask
@@ -161,6 +183,10 @@ callbacks:(CK2FileOperationCallbacks *)callbacks;
         _createIntermediateDirectories = createIntermediates;
     }
     
+    _listingInvalidationBlock = [^(CK2ListingCache *cache) {
+        [CK2FileOperation invalidateListingsContainingURL:url includingAncestors:createIntermediates cache:cache];
+    } copy];
+    
     return self;
 }
 
@@ -199,6 +225,10 @@ callbacks:(CK2FileOperationCallbacks *)callbacks;
     if ([url.scheme caseInsensitiveCompare:@"sftp"] == NSOrderedSame) {
         _createIntermediateDirectories = createIntermediates;
     }
+    
+    _listingInvalidationBlock = [^(CK2ListingCache *cache) {
+        [CK2FileOperation invalidateListingsContainingURL:url includingAncestors:createIntermediates cache:cache];
+    } copy];
 
     return self;
 }
@@ -274,6 +304,10 @@ callbacks:(CK2FileOperationCallbacks *)callbacks;
         _createIntermediateDirectories = createIntermediates;
     }
     
+    _listingInvalidationBlock = [^(CK2ListingCache *cache) {
+        [CK2FileOperation invalidateListingsContainingURL:url includingAncestors:createIntermediates cache:cache];
+    } copy];
+    
     return self;
 }
 
@@ -288,7 +322,14 @@ callbacks:(CK2FileOperationCallbacks *)callbacks;
         return [[protocolClass alloc] initForRemovingItemWithRequest:[fileOp requestWithURL:url] client:fileOp];
     }];
     
-    return [self initWithURL:url errorDescription:description manager:manager completionHandler:block callbacks:callbacks];
+    self = [self initWithURL:url errorDescription:description manager:manager completionHandler:block callbacks:callbacks];
+    
+    _listingInvalidationBlock = [^(CK2ListingCache *cache) {
+        [CK2FileOperation invalidateListingsContainingURL:url includingAncestors:NO cache:cache];
+        [cache invalidateListingOfDirectoryAtURL:url];
+    } copy];
+    
+    return self;
 }
 
 - (id)initRenameOperationWithSourceURL:(NSURL *)srcURL
@@ -303,7 +344,15 @@ callbacks:(CK2FileOperationCallbacks *)callbacks;
         return [[protocolClass alloc] initForRenamingItemWithRequest:[fileOp requestWithURL:srcURL] newName:newName client:fileOp];
     }];
     
-    return [self initWithURL:srcURL errorDescription:description manager:manager completionHandler:block callbacks:callbacks];
+    self = [self initWithURL:srcURL errorDescription:description manager:manager completionHandler:block callbacks:callbacks];
+    
+    // The destination is in the same directory, so only the source's listings need discarding
+    _listingInvalidationBlock = [^(CK2ListingCache *cache) {
+        [CK2FileOperation invalidateListingsContainingURL:srcURL includingAncestors:NO cache:cache];
+        [cache invalidateListingOfDirectoryAtURL:srcURL];
+    } copy];
+    
+    return self;
 }
 
 - (id)initResourceValueSettingOperationWithURL:(NSURL *)url
@@ -321,7 +370,32 @@ callbacks:(CK2FileOperationCallbacks *)callbacks;
                                                         client:fileOp];
     }];
     
-    return [self initWithURL:url errorDescription:description manager:manager completionHandler:block callbacks:callbacks];
+    self = [self initWithURL:url errorDescription:description manager:manager completionHandler:block callbacks:callbacks];
+    
+    // Attributes are reported as part of the parent directory's listing
+    _listingInvalidationBlock = [^(CK2ListingCache *cache) {
+        [CK2FileOperation invalidateListingsContainingURL:url includingAncestors:NO cache:cache];
+    } copy];
+    
+    return self;
+}
+
++ (void)invalidateListingsContainingURL:(NSURL *)url includingAncestors:(BOOL)ancestors cache:(CK2ListingCache *)cache;
+{
+    NSString *path = [CK2FileManager pathOfURL:url];
+    
+    // Creating intermediate directories could have added an item to any of the ancestors, up to the root or home directory
+    do
+    {
+        [cache invalidateListingContainingURL:url];
+        if (!ancestors) break;
+        
+        url = [url URLByDeletingLastPathComponent];
+        NSString *parentPath = [CK2FileManager pathOfURL:url];
+        if ([parentPath isEqualToString:path]) break;
+        path = parentPath;
+    }
+    while (path.length && ![path isEqualToString:@"/"]);
 }
 
 - (void)completeWithError:(NSError *)error;
@@ -336,6 +410,15 @@ callbacks:(CK2FileOperationCallbacks *)callbacks;
             // It's now safe to stop the protocol as it can't misinterpret the message and issue its own cancellation error (or at least if it does, goes ignored)
             [_protocol stop];
             
+            // Listings the operation might have changed can't be trusted any more, even if it failed part way through.
+            // Done before the completion handler so the client sees the change if it lists again straight away
+            if (_listingInvalidationBlock)
+            {
+                CK2ListingCache *cache = self.fileManager.listingCache;
+                if (cache) _listingInvalidationBlock(cache);
+                [_listingInvalidationBlock release]; _listingInvalidationBlock = nil;
+            }
+            
             // Store the error and notify completion handler
             // Make all notifications — including KVO — happen on the delegate queue
             // Grab the handler now since we're about to clear out the original storage. The
@@ -370,6 +453,7 @@ callbacks:(CK2FileOperationCallbacks *)callbacks;
     if (_queue) dispatch_release(_queue);
     [_completionBlock release];
     [_enumerationBlock release];
+    [_listingInvalidationBlock release];
     [_callbacks release];
     [_progressBlock release];
     [_localURL release];
@@ -0,0 +1,90 @@
+//
+//  CK2ListingCache.h
+//  Connection
+//
+//  Created by agent on 18/10/2026.
+//
+//
+
+#import "CK2FileManager.h"
+
+
+@class CK2ListingCacheEntry;
+
+/**
+ Remembers recent directory listings so CK2FileManager can answer repeat enumerations without
+ going back to the server.
+
+ A listing is reused as-is until its host's time-to-live runs out. After that, the next enumeration
+ goes to the server again, and what it brings back replaces the old listing. A directory's own
+ modification date isn't trusted to say whether a listing is still good: it only changes when items
+ are added, removed or renamed, FTP and SFTP only give it to the minute, and WebDAV has sent the whole
+ PROPFIND response by the time it's known anyway.
+
+ The cache is bounded by the total number of URLs it holds, discarding the least recently used
+ listings first.
+
+ Only shallow enumerations of non-file URLs are cached. The properties requested by a client don't
+ form part of the key, since protocols supply the same set regardless.
+ */
+@interface CK2ListingCache : NSObject
+{
+  @private
+    NSMutableDictionary     *_entriesByKey;
+    CK2ListingCacheEntry    *_leastRecentlyUsed;    // ends of a list running through the entries, not retained
+    CK2ListingCacheEntry    *_mostRecentlyUsed;
+    NSUInteger          _totalCost;
+    NSUInteger          _totalCostLimit;
+    NSCountedSet        *_invalidatedHosts;     // listings fetched across an invalidation of their host aren't trusted
+    NSUInteger          _allInvalidationCount;
+
+    NSTimeInterval      _defaultTimeToLive;
+    NSMutableDictionary *_timesToLiveByHost;
+
+    NSUInteger  _hitCount;
+}
+
+// Used by all file managers unless they're given a different cache
++ (CK2ListingCache *)sharedCache;
+
+
+#pragma mark Expiry
+
+// Default is 30 seconds. 0 turns off caching, other than for hosts with a time of their own
+@property(nonatomic) NSTimeInterval defaultTimeToLive;
+
+// Pass a negative time to go back to the default for host
+- (void)setTimeToLive:(NSTimeInterval)timeToLive forHost:(NSString *)host __attribute((nonnull(2)));
+- (NSTimeInterval)timeToLiveForHost:(NSString *)host;
+
+
+#pragma mark Size
+
+// Counted in URLs. Default is 50,000
+@property(nonatomic) NSUInteger totalCostLimit;
+@property(nonatomic, readonly) NSUInteger totalCost;
+
+
+#pragma mark Looking Up Listings
+
+/**
+ @return The contents of the directory, if a listing is cached and hasn't expired. Doesn't include the directory itself
+ */
+- (NSArray *)cachedContentsOfDirectoryAtURL:(NSURL *)url __attribute((nonnull(1)));
+
+// How many enumerations have been answered from the cache
+@property(nonatomic, readonly) NSUInteger hitCount;
+
+
+#pragma mark Invalidating Listings
+
+// Also discards listings of any subdirectories
+- (void)invalidateListingOfDirectoryAtURL:(NSURL *)url __attribute((nonnull(1)));
+
+// Discards the listing of the directory containing url
+- (void)invalidateListingContainingURL:(NSURL *)url __attribute((nonnull(1)));
+
+- (void)removeListingsForHost:(NSString *)host __attribute((nonnull(1)));
+- (void)removeAllListings;
+
+@end
@@ -0,0 +1,634 @@
+//
+//  CK2ListingCache.m
+//  Connection
+//
+//  Created by agent on 18/10/2026.
+//
+//
+
+#import "CK2ListingCache.h"
+#import "CK2Protocol.h"
+
+
+@interface CK2Protocol (Internals)
++ (Class)classForURL:(NSURL *)url;    // only suitable for stateless calls to the protocol class
+@end
+
+
+@interface CK2ListingCacheEntry : NSObject
+{
+  @public
+    NSString        *_host;
+    NSString        *_hostKey;
+    NSString        *_path;
+    NSArray         *_URLs;         // the directory itself comes first
+    CFAbsoluteTime  _fetched;
+
+    id                      _key;
+    CK2ListingCacheEntry    *_older;    // neighbours by recency of use; not retained, the cache's dictionary owns entries
+    CK2ListingCacheEntry    *_newer;
+}
+@end
+
+
+@implementation CK2ListingCacheEntry
+
+- (void)dealloc;
+{
+    [_host release];
+    [_hostKey release];
+    [_path release];
+    [_URLs release];
+    [_key release];
+
+    [super dealloc];
+}
+
+@end
+
+
+#pragma mark -
+
+
+@interface CK2ListingCache ()
+- (CK2ListingCacheEntry *)entryForURL:(NSURL *)url;
+- (BOOL)isEntryFresh:(CK2ListingCacheEntry *)entry;
+- (void)entryWasHit;
+- (void)storeURLs:(NSArray *)URLs forURL:(NSURL *)url ifNotInvalidatedSince:(NSUInteger)invalidationCount;
+- (NSUInteger)invalidationCountForHost:(NSString *)host;
+@end
+
+
+/**
+ Stands in for the real protocol when enumerating, either replaying a cached listing, or passing
+ the real protocol's results through and remembering them.
+ */
+@interface CK2CachedListingProtocol : CK2Protocol <CK2ProtocolClient>
+{
+  @private
+    CK2ListingCache                 *_cache;
+    NSDirectoryEnumerationOptions   _mask;          // as the client asked for it
+    NSUInteger                      _invalidationCount;
+
+    CK2ListingCacheEntry    *_entry;        // to replay
+    CK2Protocol             *_protocol;     // nil when replaying
+    NSMutableArray          *_URLs;         // as the real protocol discovers them
+    BOOL                    _stopped;
+}
+@end
+
+
+@implementation CK2CachedListingProtocol
+
+- (id)initWithCache:(CK2ListingCache *)cache
+            request:(NSURLRequest *)request
+includingPropertiesForKeys:(NSArray *)keys
+            options:(NSDirectoryEnumerationOptions)mask
+      protocolClass:(Class)protocolClass
+             client:(id <CK2ProtocolClient>)client;
+{
+    if (self = [self initWithRequest:request client:client])
+    {
+        _cache = [cache retain];
+        _mask = mask;
+        _invalidationCount = [cache invalidationCountForHost:request.URL.host];
+
+        CK2ListingCacheEntry *entry = [cache entryForURL:request.URL];
+        if (entry && [cache isEntryFresh:entry])
+        {
+            _entry = [entry retain];
+            return self;
+        }
+
+        // Have the directory itself and hidden files always reported, so the listing suits any client
+        NSDirectoryEnumerationOptions protocolMask = (mask | CK2DirectoryEnumerationIncludesDirectory) & ~NSDirectoryEnumerationSkipsHiddenFiles;
+
+        _protocol = [[protocolClass alloc] initForEnumeratingDirectoryWithRequest:request
+                                                       includingPropertiesForKeys:keys
+                                                                          options:protocolMask
+                                                                           client:self];
+        if (!_protocol)
+        {
+            [self release];
+            return nil;
+        }
+
+        _URLs = [[NSMutableArray alloc] init];
+    }
+
+    return self;
+}
+
+- (void)dealloc;
+{
+    [_cache release];
+    [_entry release];
+    [_protocol release];
+    [_URLs release];
+
+    [super dealloc];
+}
+
+#pragma mark Paths
+
+// Path handling is a matter for whichever protocol really deals with the URL
+
++ (BOOL)canHandleURL:(NSURL *)url; { return NO; }
+
++ (NSURL *)URLWithPath:(NSString *)path relativeToURL:(NSURL *)baseURL;
+{
+    Class protocolClass = [CK2Protocol classForURL:baseURL];
+    return (protocolClass ? [protocolClass URLWithPath:path relativeToURL:baseURL] : [super URLWithPath:path relativeToURL:baseURL]);
+}
+
++ (NSString *)pathOfURLRelativeToHomeDirectory:(NSURL *)URL;
+{
+    Class protocolClass = [CK2Protocol classForURL:URL];
+    return (protocolClass ? [protocolClass pathOfURLRelativeToHomeDirectory:URL] : [super pathOfURLRelativeToHomeDirectory:URL]);
+}
+
++ (BOOL)isHomeDirectoryAtURL:(NSURL *)url;
+{
+    Class protocolClass = [CK2Protocol classForURL:url];
+    return (protocolClass ? [protocolClass isHomeDirectoryAtURL:url] : [super isHomeDirectoryAtURL:url]);
+}
+
+#pragma mark Running
+
+- (void)start;
+{
+    if (_protocol)
+    {
+        [_protocol start];
+    }
+    else
+    {
+        [_cache entryWasHit];
+        [self replayEntry];
+    }
+}
+
+- (void)stop;
+{
+    CK2Protocol *protocol;
+    @synchronized(self)
+    {
+        _stopped = YES;
+        protocol = [_protocol retain];
+    }
+
+    [protocol stop];
+    [protocol release];
+}
+
+- (BOOL)shouldReportURL:(NSURL *)url isDirectoryItself:(BOOL)isDirectory;
+{
+    if (isDirectory) return (_mask & CK2DirectoryEnumerationIncludesDirectory) != 0;
+    if ((_mask & NSDirectoryEnumerationSkipsHiddenFiles) && [url.lastPathComponent hasPrefix:@"."]) return NO;
+    return YES;
+}
+
+- (void)replayEntry;
+{
+    id <CK2ProtocolClient> client = self.client;
+
+    [_entry->_URLs enumerateObjectsUsingBlock:^(id aURL, NSUInteger idx, BOOL *stop) {
+        if ([self shouldReportURL:aURL isDirectoryItself:(idx == 0)])
+        {
+            [client protocol:self didDiscoverItemAtURL:aURL];
+        }
+    }];
+
+    [client protocol:self didCompleteWithError:nil];
+}
+
+#pragma mark CK2ProtocolClient
+
+- (void)protocol:(CK2Protocol *)protocol didDiscoverItemAtURL:(NSURL *)url;
+{
+    if (protocol != _protocol) return;
+
+    BOOL isDirectory = (_URLs.count == 0);
+    [_URLs addObject:url];
+
+    if ([self shouldReportURL:url isDirectoryItself:isDirectory])
+    {
+        [self.client protocol:self didDiscoverItemAtURL:url];
+    }
+}
+
+- (void)protocol:(CK2Protocol *)protocol didCompleteWithError:(NSError *)error;
+{
+    if (protocol != _protocol) return;
+
+    if (!error)
+    {
+        // Only worth remembering complete listings
+        BOOL stopped;
+        @synchronized(self)
+        {
+            stopped = _stopped;
+        }
+        if (!stopped) [_cache storeURLs:_URLs forURL:self.request.URL ifNotInvalidatedSince:_invalidationCount];
+    }
+
+    [self.client protocol:self didCompleteWithError:error];
+
+    @synchronized(self)
+    {
+        [_protocol autorelease]; _protocol = nil;
+    }
+}
+
+- (NSURLRequest *)protocol:(CK2Protocol *)protocol willSendRequest:(NSURLRequest *)request redirectResponse:(NSURLResponse *)response;
+{
+    return [self.client protocol:self willSendRequest:request redirectResponse:response];
+}
+
+- (void)protocol:(CK2Protocol *)protocol didReceiveChallenge:(NSURLAuthenticationChallenge *)challenge completionHandler:(void (^)(CK2AuthChallengeDisposition, NSURLCredential *))completionHandler;
+{
+    [self.client protocol:self didReceiveChallenge:challenge completionHandler:completionHandler];
+}
+
+- (void)protocol:(CK2Protocol *)protocol appendString:(NSString *)info toTranscript:(CK2TranscriptType)transcript;
+{
+    [self.client protocol:self appendString:info toTranscript:transcript];
+}
+
+- (void)protocol:(CK2Protocol *)protocol didSendBodyData:(int64_t)bytesSent totalBytesSent:(int64_t)totalBytesSent totalBytesExpectedToSend:(int64_t)totalBytesExpectedToSend;
+{
+    [self.client protocol:self didSendBodyData:bytesSent totalBytesSent:totalBytesSent totalBytesExpectedToSend:totalBytesExpectedToSend];
+}
+
+- (NSInputStream *)protocol:(CK2Protocol *)protocol needNewBodyStream:(NSURLRequest *)request;
+{
+    return [self.client protocol:self needNewBodyStream:request];
+}
+
+@end
+
+
+#pragma mark -
+
+
+@implementation CK2ListingCache
+
++ (CK2ListingCache *)sharedCache;
+{
+    static CK2ListingCache *sharedCache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedCache = [[CK2ListingCache alloc] init];
+    });
+
+    return sharedCache;
+}
+
+- (id)init;
+{
+    if (self = [super init])
+    {
+        _entriesByKey = [[NSMutableDictionary alloc] init];
+        _totalCostLimit = 50000;
+        _defaultTimeToLive = 30.0;
+        _timesToLiveByHost = [[NSMutableDictionary alloc] init];
+        _invalidatedHosts = [[NSCountedSet alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc;
+{
+    [_entriesByKey release];
+    [_timesToLiveByHost release];
+    [_invalidatedHosts release];
+
+    [super dealloc];
+}
+
+#pragma mark Keys
+
++ (NSString *)hostKeyForURL:(NSURL *)url;
+{
+    NSString *result = [NSString stringWithFormat:@"%@://%@@%@:%@",
+                        url.scheme.lowercaseString,
+                        (url.user ? url.user : @""),
+                        url.host.lowercaseString,
+                        (url.port ? url.port : @"")];
+    return result;
+}
+
++ (NSString *)invalidationKeyForHost:(NSString *)host;
+{
+    return (host ? host.lowercaseString : @"");
+}
+
++ (id)keyWithHostKey:(NSString *)hostKey path:(NSString *)path;
+{
+    return @[hostKey, path];
+}
+
+// Relative paths are relative to the home directory, @""
++ (BOOL)path:(NSString *)path isWithinDirectoryAtPath:(NSString *)directoryPath;
+{
+    if ([path isEqualToString:directoryPath]) return YES;
+    if (!directoryPath.length) return ![path isAbsolutePath];
+    if ([directoryPath isEqualToString:@"/"]) return [path isAbsolutePath];
+    return [path hasPrefix:[directoryPath stringByAppendingString:@"/"]];
+}
+
+#pragma mark Expiry
+
+@synthesize defaultTimeToLive = _defaultTimeToLive;
+
+- (void)setTimeToLive:(NSTimeInterval)timeToLive forHost:(NSString *)host;
+{
+    @synchronized(self)
+    {
+        if (timeToLive < 0)
+        {
+            [_timesToLiveByHost removeObjectForKey:host.lowercaseString];
+        }
+        else
+        {
+            [_timesToLiveByHost setObject:@(timeToLive) forKey:host.lowercaseString];
+        }
+    }
+}
+
+- (NSTimeInterval)timeToLiveForHost:(NSString *)host;
+{
+    @synchronized(self)
+    {
+        NSNumber *result = (host ? [_timesToLiveByHost objectForKey:host.lowercaseString] : nil);
+        return (result ? result.doubleValue : self.defaultTimeToLive);
+    }
+}
+
+- (BOOL)isEntryFresh:(CK2ListingCacheEntry *)entry;
+{
+    NSTimeInterval timeToLive = [self timeToLiveForHost:entry->_host];
+    return (CFAbsoluteTimeGetCurrent() - entry->_fetched < timeToLive);
+}
+
+#pragma mark Size
+
+@synthesize totalCostLimit = _totalCostLimit;
+
+- (void)setTotalCostLimit:(NSUInteger)limit;
+{
+    @synchronized(self)
+    {
+        _totalCostLimit = limit;
+        [self evictEntriesToFitCost:0];
+    }
+}
+
+@synthesize totalCost = _totalCost;
+
+// Caller must be synchronized on self
+- (void)evictEntriesToFitCost:(NSUInteger)cost;
+{
+    while (_leastRecentlyUsed && _totalCost + cost > _totalCostLimit)
+    {
+        [self removeEntryForKey:_leastRecentlyUsed->_key];
+    }
+}
+
+// Caller must be synchronized on self
+- (void)removeEntryForKey:(id)key;
+{
+    CK2ListingCacheEntry *entry = [_entriesByKey objectForKey:key];
+    if (!entry) return;
+
+    // key may well be the entry's own, so keep it alive till the dictionary's done with it
+    [entry retain];
+    _totalCost -= entry->_URLs.count;
+    [self unlinkEntry:entry];
+    [_entriesByKey removeObjectForKey:key];
+    [entry release];
+}
+
+#pragma mark Recency
+
+// Caller must be synchronized on self
+- (void)unlinkEntry:(CK2ListingCacheEntry *)entry;
+{
+    if (entry->_older)
+    {
+        entry->_older->_newer = entry->_newer;
+    }
+    else
+    {
+        _leastRecentlyUsed = entry->_newer;
+    }
+
+    if (entry->_newer)
+    {
+        entry->_newer->_older = entry->_older;
+    }
+    else
+    {
+        _mostRecentlyUsed = entry->_older;
+    }
+
+    entry->_older = entry->_newer = nil;
+}
+
+// Caller must be synchronized on self
+- (void)linkEntryAsMostRecentlyUsed:(CK2ListingCacheEntry *)entry;
+{
+    entry->_older = _mostRecentlyUsed;
+    entry->_newer = nil;
+
+    if (_mostRecentlyUsed)
+    {
+        _mostRecentlyUsed->_newer = entry;
+    }
+    else
+    {
+        _leastRecentlyUsed = entry;
+    }
+    _mostRecentlyUsed = entry;
+}
+
+#pragma mark Looking Up Listings
+
+@synthesize hitCount = _hitCount;
+
+- (CK2ListingCacheEntry *)entryForURL:(NSURL *)url;
+{
+    NSString *path = [CK2FileManager pathOfURL:url];
+    if (!path) return nil;
+
+    id key = [self.class keyWithHostKey:[self.class hostKeyForURL:url] path:path];
+
+    @synchronized(self)
+    {
+        CK2ListingCacheEntry *result = [_entriesByKey objectForKey:key];
+        if (result && result != _mostRecentlyUsed)
+        {
+            [self unlinkEntry:result];
+            [self linkEntryAsMostRecentlyUsed:result];
+        }
+
+        return [[result retain] autorelease];
+    }
+}
+
+- (NSArray *)cachedContentsOfDirectoryAtURL:(NSURL *)url;
+{
+    CK2ListingCacheEntry *entry = [self entryForURL:url];
+    if (!entry || ![self isEntryFresh:entry]) return nil;
+
+    NSArray *URLs = entry->_URLs;
+    return [URLs subarrayWithRange:NSMakeRange(1, URLs.count - 1)];
+}
+
+- (void)entryWasHit;
+{
+    @synchronized(self)
+    {
+        _hitCount++;
+    }
+}
+
+- (void)storeURLs:(NSArray *)URLs forURL:(NSURL *)url ifNotInvalidatedSince:(NSUInteger)invalidationCount;
+{
+    if (!URLs.count) return;
+
+    NSString *path = [CK2FileManager pathOfURL:url];
+    if (!path) return;
+
+    CK2ListingCacheEntry *entry = [[CK2ListingCacheEntry alloc] init];
+    entry->_host = [url.host.lowercaseString copy];
+    entry->_hostKey = [[self.class hostKeyForURL:url] retain];
+    entry->_path = [path copy];
+    entry->_URLs = [URLs copy];
+    entry->_fetched = CFAbsoluteTimeGetCurrent();
+
+    id key = [self.class keyWithHostKey:entry->_hostKey path:path];
+    entry->_key = [key retain];
+
+    @synchronized(self)
+    {
+        // Something may have changed on the server while the listing was coming in
+        if (invalidationCount == [self invalidationCountForHost:url.host] && URLs.count <= _totalCostLimit)
+        {
+            [self removeEntryForKey:key];
+            [self evictEntriesToFitCost:URLs.count];
+
+            [_entriesByKey setObject:entry forKey:key];
+            [self linkEntryAsMostRecentlyUsed:entry];
+            _totalCost += URLs.count;
+        }
+    }
+
+    [entry release];
+}
+
+#pragma mark Invalidating Listings
+
+// Only ever goes up, so a listing can tell if its host was invalidated while it was being fetched
+- (NSUInteger)invalidationCountForHost:(NSString *)host;
+{
+    @synchronized(self)
+    {
+        return _allInvalidationCount + [_invalidatedHosts countForObject:[self.class invalidationKeyForHost:host]];
+    }
+}
+
+- (void)invalidateListingOfDirectoryAtURL:(NSURL *)url;
+{
+    NSString *path = [CK2FileManager pathOfURL:url];
+    NSString *hostKey = [self.class hostKeyForURL:url];
+
+    @synchronized(self)
+    {
+        [_invalidatedHosts addObject:[self.class invalidationKeyForHost:url.host]];
+        if (!path) return;
+
+        for (id key in [_entriesByKey allKeys])
+        {
+            CK2ListingCacheEntry *entry = [_entriesByKey objectForKey:key];
+            if ([entry->_hostKey isEqualToString:hostKey] && [self.class path:entry->_path isWithinDirectoryAtPath:path])
+            {
+                [self removeEntryForKey:key];
+            }
+        }
+    }
+}
+
+- (void)invalidateListingContainingURL:(NSURL *)url;
+{
+    NSString *path = [CK2FileManager pathOfURL:[url URLByDeletingLastPathComponent]];
+    NSString *hostKey = [self.class hostKeyForURL:url];
+
+    @synchronized(self)
+    {
+        [_invalidatedHosts addObject:[self.class invalidationKeyForHost:url.host]];
+        if (path) [self removeEntryForKey:[self.class keyWithHostKey:hostKey path:path]];
+    }
+}
+
+- (void)removeListingsForHost:(NSString *)host;
+{
+    host = host.lowercaseString;
+
+    @synchronized(self)
+    {
+        [_invalidatedHosts addObject:[self.class invalidationKeyForHost:host]];
+
+        for (id key in [_entriesByKey allKeys])
+        {
+            CK2ListingCacheEntry *entry = [_entriesByKey objectForKey:key];
+            if ([entry->_host isEqualToString:host])
+            {
+                [self removeEntryForKey:key];
+            }
+        }
+    }
+}
+
+- (void)removeAllListings;
+{
+    @synchronized(self)
+    {
+        _allInvalidationCount++;
+
+        [_entriesByKey removeAllObjects];
+        _leastRecentlyUsed = _mostRecentlyUsed = nil;
+        _totalCost = 0;
+    }
+}
+
+#pragma mark Enumerating Directories
+
+- (CK2Protocol *)newProtocolForEnumeratingDirectoryWithRequest:(NSURLRequest *)request
+                                    includingPropertiesForKeys:(NSArray *)keys
+                                                       options:(NSDirectoryEnumerationOptions)mask
+                                                 protocolClass:(Class)protocolClass
+                                                        client:(id <CK2ProtocolClient>)client;
+{
+    NSURL *url = request.URL;
+
+    // Local listings are cheap enough already, and deep ones too big to be worth it
+    if ([url isFileURL] ||
+        !(mask & NSDirectoryEnumerationSkipsSubdirectoryDescendants) ||
+        [self timeToLiveForHost:url.host] <= 0)
+    {
+        return [[protocolClass alloc] initForEnumeratingDirectoryWithRequest:request
+                                                  includingPropertiesForKeys:keys
+                                                                     options:mask
+                                                                      client:client];
+    }
+
+    return [[CK2CachedListingProtocol alloc] initWithCache:self
+                                                   request:request
+                                includingPropertiesForKeys:keys
+                                                   options:mask
+                                             protocolClass:protocolClass
+                                                    client:client];
+}
+
+@end
@@ -55,6 +55,7 @@
 #import "CK2IconView.h"
 #import "CK2PathFieldWindowController.h"
 #import <ConnectionKit/CK2FileManager.h>
+#import <ConnectionKit/CK2ListingCache.h>
 
 #define DEFAULT_OPERATION_TIMEOUT       20
 
@@ -424,6 +425,10 @@
         _currentLoadingOperation = nil;
     }
 
+    // Starting over means fetching listings afresh
+    NSString *host = [[self directoryURL] host];
+    if (host) [[_fileManager listingCache] removeListingsForHost:host];
+    
     [_urlCache removeAllObjects];
     [_historyManager removeAllActions];
 
@@ -860,6 +865,8 @@
     {
         for (url in urls)
         {
+            // Otherwise reloading would just be handed the remembered listing again
+            [[_fileManager listingCache] invalidateListingOfDirectoryAtURL:url];
             [self cacheChildren:nil forURL:url];
         }
     }
@@ -0,0 +1,60 @@
+//
+//  CK2ResourceValueStore.h
+//  Connection
+//
+//  Created by agent on 18/10/2026.
+//
+//
+
+#import "CK2FileManager.h"
+
+#import <pthread.h>
+
+
+/**
+ Backs CK2FileManager's temporary resource values for non-file URLs.
+
+ Everything lives in one table keyed by URL identity. Each URL gets a fixed slot for each of the
+ keys directory listings commonly fill in, plus a dictionary for any others, and optionally a
+ provider to work out values on demand.
+
+ Each URL given values has a sentinel object associated with it, which clears its entry out when
+ the URL is deallocated. NSURL's getter is swizzled to consult the table, but returns to the original
+ straight away for file URLs, or while the store is empty. Lookups only take a read lock, so getters
+ on different threads don't queue up behind one another.
+ */
+@interface CK2ResourceValueStore : NSObject
+{
+  @private
+    CFMutableDictionaryRef  _valuesByURL;
+    NSUInteger              _otherValueCount;
+    pthread_rwlock_t        _lock;
+}
+
++ (CK2ResourceValueStore *)sharedStore;
+
+// value may be nil, which is remembered as such
+- (void)setValue:(id)value forKey:(NSString *)key inURL:(NSURL *)url;
+
+// block is called each time the value is asked for
+- (void)setValueBlock:(id (^)(void))block forKey:(NSString *)key inURL:(NSURL *)url;
+
+- (void)setProvider:(id <CK2ResourceValueProvider>)provider inURL:(NSURL *)url;
+
+// NO if nothing is known about key for url
+- (BOOL)getValue:(out id *)value forKey:(NSString *)key inURL:(NSURL *)url;
+
+// As above, also saying whether the store holds anything at all for url. known may be NULL
+- (BOOL)getValue:(out id *)value forKey:(NSString *)key inURL:(NSURL *)url known:(out BOOL *)known;
+
+
+#pragma mark Memory Accounting
+
+@property(readonly) NSUInteger numberOfURLs;
+
+/**
+ Approximate bytes of bookkeeping held by the store, not counting the values themselves
+ */
+@property(readonly) NSUInteger footprint;
+
+@end
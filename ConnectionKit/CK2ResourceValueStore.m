@@ -0,0 +1,450 @@
+//
+//  CK2ResourceValueStore.m
+//  Connection
+//
+//  Created by agent on 18/10/2026.
+//
+//
+
+#import "CK2ResourceValueStore.h"
+
+#import <objc/runtime.h>
+
+
+// Keys given a slot of their own, since nearly every listed item has them set
+#define CK2ResourceValueSlotCount 14
+static NSString *sSlotKeys[CK2ResourceValueSlotCount];
+
+typedef struct _CK2ResourceValues {
+    uint16_t    present;                            // slots holding something, even if that something is nil
+    uint16_t    blocks;                             // slots holding a block to call, rather than the value itself
+    id          slots[CK2ResourceValueSlotCount];
+
+    NSMutableDictionary *others;                    // any other keys, with NSNull standing in for nil
+    NSMutableDictionary *otherBlocks;
+
+    id <CK2ResourceValueProvider>   provider;
+} CK2ResourceValues;
+
+static NSInteger CK2ResourceValueSlotForKey(NSString *key)
+{
+    // Clients are meant to pass the constants, so this nearly always hits first time round
+    for (NSInteger i = 0; i < CK2ResourceValueSlotCount; i++)
+    {
+        if (sSlotKeys[i] == key) return i;
+    }
+
+    for (NSInteger i = 0; i < CK2ResourceValueSlotCount; i++)
+    {
+        if (sSlotKeys[i] && [sSlotKeys[i] isEqualToString:key]) return i;
+    }
+
+    return -1;
+}
+
+// How many URLs have values. Read without the lock so the swizzled getter can bail out cheaply
+static volatile NSUInteger sURLCount;
+
+
+#pragma mark -
+
+
+@interface CK2ResourceValueStore ()
+- (void)removeValuesForURLPointer:(void *)url;
+@end
+
+
+@interface NSURL (CK2TemporaryResourceProperties)
+- (BOOL)ck2_getResourceValue:(out id *)value forKey:(NSString *)key error:(out NSError **)error;
+- (BOOL)ck2_getGuessedResourceValue:(out id *)value forKey:(NSString *)key;
+@end
+
+
+/**
+ Hung off each URL given values, so its entry is cleared out when the URL is deallocated
+ */
+@interface CK2ResourceValuesSentinel : NSObject
+{
+  @public
+    void    *_URL;  // not retained; only used as a key
+}
+@end
+
+
+@implementation CK2ResourceValuesSentinel
+
+- (void)dealloc;
+{
+    [[CK2ResourceValueStore sharedStore] removeValuesForURLPointer:_URL];
+    [super dealloc];
+}
+
+@end
+
+
+#pragma mark -
+
+
+@implementation CK2ResourceValueStore
+
++ (CK2ResourceValueStore *)sharedStore;
+{
+    static CK2ResourceValueStore *sharedStore;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+
+        NSString *keys[CK2ResourceValueSlotCount] = {
+            NSURLNameKey,
+            NSURLIsDirectoryKey,
+            NSURLIsRegularFileKey,
+            NSURLIsSymbolicLinkKey,
+            NSURLIsHiddenKey,
+            NSURLFileSizeKey,
+            NSURLContentModificationDateKey,
+            NSURLCreationDateKey,
+            NSURLTypeIdentifierKey,
+            NSURLParentDirectoryURLKey,
+            NSURLEffectiveIconKey,
+            CK2URLSymbolicLinkDestinationKey,
+            (&NSURLFileResourceTypeKey ? NSURLFileResourceTypeKey : nil),  // not available till 10.7
+            (&NSURLFileSecurityKey ? NSURLFileSecurityKey : nil),
+        };
+        memcpy(sSlotKeys, keys, sizeof(keys));
+
+        sharedStore = [[CK2ResourceValueStore alloc] init];
+    });
+
+    return sharedStore;
+}
+
+- (id)init;
+{
+    if (self = [super init])
+    {
+        // Keyed by pointer, neither retained nor compared by value
+        _valuesByURL = CFDictionaryCreateMutable(NULL, 0, NULL, NULL);
+        pthread_rwlock_init(&_lock, NULL);
+    }
+    return self;
+}
+
+#pragma mark Entries
+
+// Caller must hold the write lock
+- (CK2ResourceValues *)valuesForURL:(NSURL *)url;
+{
+    CK2ResourceValues *result = (CK2ResourceValues *)CFDictionaryGetValue(_valuesByURL, url);
+    if (result) return result;
+
+    // The getter only needs to look here once something's been stored
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        Method originalMethod = class_getInstanceMethod([NSURL class], @selector(getResourceValue:forKey:error:));
+        Method overrideMethod = class_getInstanceMethod([NSURL class], @selector(ck2_getResourceValue:forKey:error:));
+        method_exchangeImplementations(originalMethod, overrideMethod);
+    });
+
+    result = calloc(1, sizeof(CK2ResourceValues));
+    CFDictionarySetValue(_valuesByURL, url, result);
+    sURLCount = CFDictionaryGetCount(_valuesByURL);
+
+    // Make sure the entry goes away with the URL
+    static void *sSentinelKey = &sSentinelKey;
+    CK2ResourceValuesSentinel *sentinel = [[CK2ResourceValuesSentinel alloc] init];
+    sentinel->_URL = url;
+    objc_setAssociatedObject(url, sSentinelKey, sentinel, OBJC_ASSOCIATION_RETAIN);
+    [sentinel release];
+
+    return result;
+}
+
+- (void)removeValuesForURLPointer:(void *)url;
+{
+    CK2ResourceValues *values;
+    pthread_rwlock_wrlock(&_lock);
+    {
+        values = (CK2ResourceValues *)CFDictionaryGetValue(_valuesByURL, url);
+        if (values)
+        {
+            CFDictionaryRemoveValue(_valuesByURL, url);
+            sURLCount = CFDictionaryGetCount(_valuesByURL);
+            _otherValueCount -= (values->others.count + values->otherBlocks.count);
+        }
+    }
+    pthread_rwlock_unlock(&_lock);
+    if (!values) return;
+
+    // Releasing values could run arbitrary code, so do it outside the lock
+    for (NSUInteger i = 0; i < CK2ResourceValueSlotCount; i++)
+    {
+        [values->slots[i] release];
+    }
+    [values->others release];
+    [values->otherBlocks release];
+    [values->provider release];
+    free(values);
+}
+
+#pragma mark Setting Values
+
+- (void)setObject:(id)object isBlock:(BOOL)isBlock forKey:(NSString *)key inURL:(NSURL *)url;
+{
+    NSInteger slot = CK2ResourceValueSlotForKey(key);
+    id replaced = nil;
+
+    pthread_rwlock_wrlock(&_lock);
+    {
+        CK2ResourceValues *values = [self valuesForURL:url];
+
+        if (slot >= 0)
+        {
+            uint16_t bit = (1 << slot);
+            replaced = values->slots[slot];
+
+            values->slots[slot] = (isBlock ? [object copy] : [object retain]);
+            values->present |= bit;
+            if (isBlock)
+            {
+                values->blocks |= bit;
+            }
+            else
+            {
+                values->blocks &= ~bit;
+            }
+        }
+        else
+        {
+            NSUInteger count = values->others.count + values->otherBlocks.count;
+
+            // Anything replaced is let go once the lock's dropped, as it could be a URL with values of its own
+            [[[values->others objectForKey:key] retain] autorelease];
+            [[[values->otherBlocks objectForKey:key] retain] autorelease];
+
+            if (isBlock)
+            {
+                if (!values->otherBlocks) values->otherBlocks = [[NSMutableDictionary alloc] initWithCapacity:1];
+                [values->others removeObjectForKey:key];
+
+                id block = [object copy];
+                [values->otherBlocks setObject:block forKey:key];
+                [block release];
+            }
+            else
+            {
+                if (!values->others) values->others = [[NSMutableDictionary alloc] initWithCapacity:1];
+                [values->otherBlocks removeObjectForKey:key];
+                [values->others setObject:(object ? object : [NSNull null]) forKey:key];
+            }
+
+            _otherValueCount += (values->others.count + values->otherBlocks.count) - count;
+        }
+    }
+    pthread_rwlock_unlock(&_lock);
+
+    [replaced release];
+}
+
+- (void)setValue:(id)value forKey:(NSString *)key inURL:(NSURL *)url;
+{
+    [self setObject:value isBlock:NO forKey:key inURL:url];
+}
+
+- (void)setValueBlock:(id (^)(void))block forKey:(NSString *)key inURL:(NSURL *)url;
+{
+    NSParameterAssert(block);
+    [self setObject:block isBlock:YES forKey:key inURL:url];
+}
+
+- (void)setProvider:(id <CK2ResourceValueProvider>)provider inURL:(NSURL *)url;
+{
+    id replaced;
+    pthread_rwlock_wrlock(&_lock);
+    {
+        CK2ResourceValues *values = [self valuesForURL:url];
+        replaced = values->provider;
+        values->provider = [provider retain];
+    }
+    pthread_rwlock_unlock(&_lock);
+    [replaced release];
+}
+
+#pragma mark Getting Values
+
+- (BOOL)getValue:(out id *)value forKey:(NSString *)key inURL:(NSURL *)url;
+{
+    return [self getValue:value forKey:key inURL:url known:NULL];
+}
+
+- (BOOL)getValue:(out id *)value forKey:(NSString *)key inURL:(NSURL *)url known:(out BOOL *)known;
+{
+    NSInteger slot = CK2ResourceValueSlotForKey(key);
+    id (^block)(void) = nil;
+    id <CK2ResourceValueProvider> provider = nil;
+    BOOL found = NO;
+
+    // Only ever read under here, so lookups from any number of threads can go at once
+    pthread_rwlock_rdlock(&_lock);
+    {
+        CK2ResourceValues *values = (CK2ResourceValues *)CFDictionaryGetValue(_valuesByURL, url);
+        if (known) *known = (values != NULL);
+
+        if (values && slot >= 0)
+        {
+            uint16_t bit = (1 << slot);
+            if (values->present & bit)
+            {
+                if (values->blocks & bit)
+                {
+                    block = [[values->slots[slot] retain] autorelease];
+                }
+                else
+                {
+                    *value = [[values->slots[slot] retain] autorelease];
+                    found = YES;
+                }
+            }
+        }
+        else if (values)
+        {
+            id stored = [values->others objectForKey:key];
+            if (stored)
+            {
+                *value = (stored == [NSNull null] ? nil : [[stored retain] autorelease]);
+                found = YES;
+            }
+            else
+            {
+                block = [[[values->otherBlocks objectForKey:key] retain] autorelease];
+            }
+        }
+
+        if (values && !found && !block) provider = [[values->provider retain] autorelease];
+    }
+    pthread_rwlock_unlock(&_lock);
+
+    if (found) return YES;
+
+    // Blocks and providers may well want to get or set other values, so are called outside the lock
+    if (block)
+    {
+        *value = block();
+        return YES;
+    }
+
+    // Remember the provider's answer for next time
+    if (provider && [provider getResourceValue:value forKey:key ofURL:url])
+    {
+        [self setValue:*value forKey:key inURL:url];
+        return YES;
+    }
+
+    return NO;
+}
+
+#pragma mark Memory Accounting
+
+- (NSUInteger)numberOfURLs;
+{
+    pthread_rwlock_rdlock(&_lock);
+    NSUInteger result = CFDictionaryGetCount(_valuesByURL);
+    pthread_rwlock_unlock(&_lock);
+    return result;
+}
+
+- (NSUInteger)footprint;
+{
+    pthread_rwlock_rdlock(&_lock);
+
+    // Per URL: the entry itself, plus the table's key and value. Per other key: roughly a dictionary's key, value and hash slot
+    NSUInteger result = CFDictionaryGetCount(_valuesByURL) * (sizeof(CK2ResourceValues) + 2 * sizeof(void *));
+    result += _otherValueCount * 3 * sizeof(void *);
+
+    pthread_rwlock_unlock(&_lock);
+    return result;
+}
+
+@end
+
+
+#pragma mark -
+
+
+@implementation NSURL (CK2TemporaryResourceProperties)
+
+#pragma mark Getting and Setting File System Resource Properties
+
+// Swapped in for -getResourceValue:forKey:error: once the first URL has been given values
+- (BOOL)ck2_getResourceValue:(out id *)value forKey:(NSString *)key error:(out NSError **)error;
+{
+    // Special case, as for the setter method. Nor is there anything to look up while the store's empty
+    if ([self isFileURL] || !sURLCount)
+    {
+        return [self ck2_getResourceValue:value forKey:key error:error];    // calls the original implementation
+    }
+
+    BOOL known;
+    if ([[CK2ResourceValueStore sharedStore] getValue:value forKey:key inURL:self known:&known]) return YES;
+
+    // Guesses are only for URLs a protocol has filled in, not every other URL in the process
+    if (known && [self ck2_getGuessedResourceValue:value forKey:key]) return YES;
+
+    return [self ck2_getResourceValue:value forKey:key error:error];    // calls the original implementation
+}
+
+// A few special keys we generate on-demand pretty much by guessing since the server isn't up to providing that sort of info
+- (BOOL)ck2_getGuessedResourceValue:(out id *)value forKey:(NSString *)key;
+{
+    if ([key isEqualToString:NSURLHasHiddenExtensionKey])
+    {
+        *value = [NSNumber numberWithBool:NO];
+        return YES;
+    }
+    else if ([key isEqualToString:NSURLLocalizedNameKey])
+    {
+        *value = [self lastPathComponent];
+        return YES;
+    }
+
+    // Have to define NSURLPathKey as a macro for older releases:
+#if (!defined MAC_OS_X_VERSION_10_8) || MAC_OS_X_VERSION_MIN_REQUIRED < MAC_OS_X_VERSION_10_8
+#define NSURLPathKey @"_NSURLPathKey"
+#endif
+    else if ([key isEqualToString:NSURLPathKey])
+    {
+        *value = [CK2FileManager pathOfURL:self];
+        return YES;
+    }
+#undef NSURLPathKey
+
+    else if ([key isEqualToString:NSURLIsPackageKey])
+    {
+        NSString        *extension;
+
+        *value = @NO;
+        extension = [self pathExtension];
+
+        if ([extension length] > 0)
+        {
+            NSArray         *baseUTIs;
+
+            baseUTIs = (NSArray *)UTTypeCreateAllIdentifiersForTag(kUTTagClassFilenameExtension, (CFStringRef)extension, NULL);
+
+            for (NSString *uti in baseUTIs)
+            {
+                if (UTTypeConformsTo((CFStringRef)uti, CFSTR("com.apple.package")))
+                {
+                    *value = @YES;
+                    break;
+                }
+            }
+
+            [baseUTIs release];
+        }
+
+        return YES;
+    }
+
+    return NO;
+}
+
+@end
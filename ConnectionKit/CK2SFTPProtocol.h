@@ -16,5 +16,8 @@
     dispatch_semaphore_t            _fingerprintSemaphore;
     
     NSString    *_transcriptMessage;
+    
+    CURLTransferStack   *_pooledTransferStack;  // borrowed from CK2SSHSessionPool for the current transfer
+    BOOL                _reusedConnection;      // libcurl reported picking up a connection it already had
 }
 @end
@@ -8,6 +8,7 @@
 
 #import "CK2SFTPProtocol.h"
 #import "CK2Authentication.h"
+#import "CK2SSHSessionPool.h"
 
 #import <CURLHandle/CK2SSHCredential.h>
 
@@ -288,6 +289,7 @@
 
 - (void)dealloc;
 {
+    [self returnPooledTransferStackReusable:NO];
     [_fingerprintChallenge release];
     if (_fingerprintSemaphore) dispatch_release(_fingerprintSemaphore);
     [_transcriptMessage release];
@@ -332,6 +334,56 @@
     [super popCompletionHandlerByExecutingWithError:error];
 }
 
+#pragma mark Session Pool
+
+- (void)transferStackForRequest:(NSURLRequest *)request credential:(NSURLCredential *)credential completionHandler:(void (^)(CURLTransferStack *))handler;
+{
+    // Borrow a stack that may well still be logged in to the server, rather than connecting afresh for every operation.
+    // If the pool's already got as many connections open to the host as it allows, this waits for one of them
+    [self returnPooledTransferStackReusable:NO];
+    _reusedConnection = NO;
+    
+    [[CK2SSHSessionPool sharedPool] borrowTransferStackForURL:request.URL user:credential.user completionHandler:^(CURLTransferStack *stack) {
+        
+        if (_cancelled)
+        {
+            // Stopped while waiting its turn, so let the next in line have it
+            [[CK2SSHSessionPool sharedPool] returnTransferStack:stack reusable:YES];
+            return;
+        }
+        
+        _pooledTransferStack = [stack retain];
+        handler(stack);
+    }];
+}
+
+- (void)returnPooledTransferStackReusable:(BOOL)reusable;
+{
+    if (!_pooledTransferStack) return;
+    
+    [[CK2SSHSessionPool sharedPool] returnTransferStack:_pooledTransferStack reusable:reusable];
+    [_pooledTransferStack release]; _pooledTransferStack = nil;
+}
+
+- (void)transfer:(CURLTransfer *)transfer didCompleteWithError:(NSError *)error;
+{
+    // Hand back before completion handlers run, as they may well start another transfer
+    if (_pooledTransferStack) [[CK2SSHSessionPool sharedPool] recordTransferReusingConnection:_reusedConnection];
+    [self returnPooledTransferStackReusable:[CK2SSHSessionPool isConnectionReusableAfterError:error]];
+    [super transfer:transfer didCompleteWithError:error];
+}
+
+- (void)transfer:(CURLTransfer *)transfer didReceiveDebugInformation:(NSString *)string ofType:(curl_infotype)type;
+{
+    // Only libcurl knows whether the pooled stack's connection was still alive to be picked up again
+    if (type == CURLINFO_TEXT && [string hasPrefix:@"Re-using existing"])
+    {
+        _reusedConnection = YES;
+    }
+    
+    [super transfer:transfer didReceiveDebugInformation:string ofType:type];
+}
+
 #pragma mark Host Fingerprint
 
 - (enum curl_khstat)transfer:(CURLTransfer *)transfer didFindHostFingerprint:(const struct curl_khkey *)foundKey knownFingerprint:(const struct curl_khkey *)knownkey match:(enum curl_khmatch)match;
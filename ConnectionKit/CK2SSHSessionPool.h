@@ -0,0 +1,98 @@
+//
+//  CK2SSHSessionPool.h
+//  Connection
+//
+//  Created by agent on 18/10/2026.
+//
+//
+
+#import <CURLHandle/CURLHandle.h>
+
+
+/**
+ Keeps authenticated SSH connections around between operations, keyed by scheme, user, host and
+ port. libcurl caches live connections per transfer stack, so the pool hands out whole stacks: a
+ stack that last finished a transfer cleanly still holds an open, authenticated session, and the
+ next transfer through it skips the TCP connect, key exchange, host key check and userauth.
+
+ Stacks left idle longer than idleTimeout are invalidated, closing their connections. A stack
+ whose transfer failed at the transport level is discarded rather than handed out again.
+ */
+@interface CK2SSHSessionPool : NSObject
+{
+  @private
+    NSMutableDictionary *_sessionsByKey;
+    NSMutableDictionary *_waitersByKey;
+    NSUInteger          _maximumSessionsPerHost;
+    NSTimeInterval      _idleTimeout;
+    NSUInteger          _handshakesAvoided;
+    NSUInteger          _handshakesPerformed;
+}
+
++ (CK2SSHSessionPool *)sharedPool;
+
+/**
+ Most stacks, and so SSH connections, for a single scheme/user/host/port. A stack is only lent to
+ one borrower at a time, so it runs one transfer over one connection; once that many are out,
+ further borrowers wait their turn. Defaults to 4.
+ */
+@property(nonatomic) NSUInteger maximumSessionsPerHost;
+
+/**
+ How long an unused session is kept open. Defaults to 60 seconds, comfortably inside the
+ ClientAliveInterval most servers are configured with.
+ */
+@property(nonatomic) NSTimeInterval idleTimeout;
+
+
+#pragma mark Borrowing
+
+/**
+ Borrow a transfer stack for the given URL and user, reusing an idle authenticated one if there
+ is one. If maximumSessionsPerHost are already out, the handler is queued and called (on a global
+ queue) once one is returned; otherwise it's called straight away. Every stack handed out must be
+ balanced by -returnTransferStack:reusable: once the transfer is complete.
+ */
+- (void)borrowTransferStackForURL:(NSURL *)url user:(NSString *)user completionHandler:(void (^)(CURLTransferStack *stack))handler;
+
+/**
+ As above, but returns nil rather than wait if maximumSessionsPerHost are already out
+ */
+- (CURLTransferStack *)borrowTransferStackForURL:(NSURL *)url user:(NSString *)user;
+
+/**
+ reusable should be NO if the transfer failed in a way that suggests the connection is gone.
+ */
+- (void)returnTransferStack:(CURLTransferStack *)stack reusable:(BOOL)reusable;
+
+/**
+ Call once per completed transfer through a borrowed stack, saying whether libcurl ran it over a
+ connection it already had open. Borrowing alone can't tell, since the server may have dropped an
+ idle connection, leaving libcurl to make a new one.
+ */
+- (void)recordTransferReusingConnection:(BOOL)reusedConnection;
+
+/**
+ YES unless error indicates the connection itself failed, rather than the operation
+ */
++ (BOOL)isConnectionReusableAfterError:(NSError *)error;
+
+/**
+ Close all idle sessions now
+ */
+- (void)invalidateIdleSessions;
+
+
+#pragma mark Metrics
+
+/**
+ Transfers that went over an existing authenticated connection
+ */
+@property(nonatomic, readonly) NSUInteger handshakesAvoided;
+
+/**
+ Transfers that had to connect and authenticate from scratch
+ */
+@property(nonatomic, readonly) NSUInteger handshakesPerformed;
+
+@end
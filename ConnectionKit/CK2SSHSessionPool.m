@@ -0,0 +1,319 @@
+//
+//  CK2SSHSessionPool.m
+//  Connection
+//
+//  Created by agent on 18/10/2026.
+//
+//
+
+#import "CK2SSHSessionPool.h"
+
+
+@interface CK2SSHPooledSession : NSObject
+{
+  @public
+    CURLTransferStack   *_transferStack;
+    BOOL                _borrowed;          // lent to one transfer at a time, so never more than one connection
+    BOOL                _authenticated;     // a transfer has completed cleanly, so libcurl is holding a live session
+    CFAbsoluteTime      _lastUsed;
+}
+@end
+
+
+@implementation CK2SSHPooledSession
+
+- (void)dealloc;
+{
+    [_transferStack finishTransfersAndInvalidate];
+    [_transferStack release];
+
+    [super dealloc];
+}
+
+@end
+
+
+@implementation CK2SSHSessionPool
+
++ (CK2SSHSessionPool *)sharedPool;
+{
+    static CK2SSHSessionPool *sharedPool;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedPool = [[CK2SSHSessionPool alloc] init];
+    });
+
+    return sharedPool;
+}
+
+- (id)init;
+{
+    if (self = [super init])
+    {
+        _sessionsByKey = [[NSMutableDictionary alloc] init];
+        _waitersByKey = [[NSMutableDictionary alloc] init];
+        _maximumSessionsPerHost = 4;
+        _idleTimeout = 60.0;
+    }
+    return self;
+}
+
+- (void)dealloc;
+{
+    [_sessionsByKey release];
+    [_waitersByKey release];
+    [super dealloc];
+}
+
+@synthesize maximumSessionsPerHost = _maximumSessionsPerHost;
+@synthesize idleTimeout = _idleTimeout;
+@synthesize handshakesAvoided = _handshakesAvoided;
+@synthesize handshakesPerformed = _handshakesPerformed;
+
+#pragma mark Borrowing
+
++ (NSString *)keyForURL:(NSURL *)url user:(NSString *)user;
+{
+    NSString *result = [NSString stringWithFormat:@"%@://%@@%@:%@",
+                        url.scheme.lowercaseString,
+                        (user ? user : @""),
+                        url.host.lowercaseString,
+                        (url.port ? url.port : @22)];
+    return result;
+}
+
+// Caller must be synchronized on self. Returns nil if maximumSessionsPerHost are already out
+- (CURLTransferStack *)borrowTransferStackForKey:(NSString *)key;
+{
+    [self pruneIdleSessions];
+
+    NSMutableArray *sessions = [_sessionsByKey objectForKey:key];
+    if (!sessions)
+    {
+        sessions = [NSMutableArray array];
+        [_sessionsByKey setObject:sessions forKey:key];
+    }
+
+    // Prefer an idle session that's already logged in, then an idle one that isn't
+    CK2SSHPooledSession *session = nil;
+    for (CK2SSHPooledSession *aSession in sessions)
+    {
+        if (aSession->_borrowed) continue;
+        if (aSession->_authenticated)
+        {
+            session = aSession;
+            break;
+        }
+        if (!session) session = aSession;
+    }
+
+    if (!session)
+    {
+        if (sessions.count >= self.maximumSessionsPerHost) return nil;
+
+        session = [[CK2SSHPooledSession alloc] init];
+        session->_transferStack = [[CURLTransferStack transferStackWithDelegate:nil delegateQueue:nil] retain];
+        [sessions addObject:session];
+        [session release];
+    }
+
+    session->_borrowed = YES;
+    return session->_transferStack;
+}
+
+- (CURLTransferStack *)borrowTransferStackForURL:(NSURL *)url user:(NSString *)user;
+{
+    NSString *key = [self.class keyForURL:url user:user];
+
+    @synchronized(self)
+    {
+        return [self borrowTransferStackForKey:key];
+    }
+}
+
+- (void)borrowTransferStackForURL:(NSURL *)url user:(NSString *)user completionHandler:(void (^)(CURLTransferStack *stack))handler;
+{
+    NSParameterAssert(handler);
+
+    NSString *key = [self.class keyForURL:url user:user];
+    CURLTransferStack *stack;
+
+    @synchronized(self)
+    {
+        stack = [self borrowTransferStackForKey:key];
+        if (!stack)
+        {
+            // Every connection allowed to this host is in use; wait for one to come back rather than open another
+            NSMutableArray *waiters = [_waitersByKey objectForKey:key];
+            if (!waiters)
+            {
+                waiters = [NSMutableArray array];
+                [_waitersByKey setObject:waiters forKey:key];
+            }
+
+            id waiter = [handler copy];
+            [waiters addObject:waiter];
+            [waiter release];
+            return;
+        }
+    }
+
+    handler(stack);
+}
+
+- (void)returnTransferStack:(CURLTransferStack *)stack reusable:(BOOL)reusable;
+{
+    NSParameterAssert(stack);
+
+    void (^waiter)(CURLTransferStack *) = nil;
+    CURLTransferStack *nextStack = nil;
+
+    @synchronized(self)
+    {
+        NSString *returnedKey = nil;
+
+        for (NSString *key in _sessionsByKey)
+        {
+            NSMutableArray *sessions = [_sessionsByKey objectForKey:key];
+
+            for (CK2SSHPooledSession *session in sessions)
+            {
+                if (session->_transferStack != stack) continue;
+
+                NSAssert(session->_borrowed, @"Returning transfer stack %@ to the pool when it wasn't borrowed", stack);
+                session->_borrowed = NO;
+                session->_lastUsed = CFAbsoluteTimeGetCurrent();
+
+                if (reusable)
+                {
+                    session->_authenticated = YES;
+                    [self schedulePrune];
+                }
+                else
+                {
+                    // Connection looks to have gone away; not worth trying again
+                    [sessions removeObjectIdenticalTo:session];
+                }
+
+                returnedKey = key;
+                break;
+            }
+
+            if (returnedKey) break;
+        }
+
+        // The next in line for that host gets the stack just returned, or a fresh one in place of a discarded one
+        NSMutableArray *waiters = (returnedKey ? [_waitersByKey objectForKey:returnedKey] : nil);
+        if (waiters.count)
+        {
+            nextStack = [[self borrowTransferStackForKey:returnedKey] retain];
+            NSAssert(nextStack, @"A stack was just returned, so there must be one to lend");
+
+            waiter = [[waiters objectAtIndex:0] retain];
+            [waiters removeObjectAtIndex:0];
+            if (!waiters.count) [_waitersByKey removeObjectForKey:returnedKey];
+        }
+    }
+
+    // Not called from here, the returning transfer is still in the middle of finishing up
+    if (waiter)
+    {
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            waiter(nextStack);
+            [waiter release];
+            [nextStack release];
+        });
+    }
+}
+
+- (void)recordTransferReusingConnection:(BOOL)reusedConnection;
+{
+    @synchronized(self)
+    {
+        if (reusedConnection)
+        {
+            _handshakesAvoided++;
+        }
+        else
+        {
+            _handshakesPerformed++;
+        }
+    }
+}
+
++ (BOOL)isConnectionReusableAfterError:(NSError *)error;
+{
+    if (!error) return YES;
+
+    if ([error.domain isEqualToString:CURLcodeErrorDomain])
+    {
+        switch (error.code)
+        {
+            case CURLE_COULDNT_RESOLVE_HOST:
+            case CURLE_COULDNT_CONNECT:
+            case CURLE_OPERATION_TIMEDOUT:
+            case CURLE_SSH:
+            case CURLE_SEND_ERROR:
+            case CURLE_RECV_ERROR:
+            case CURLE_GOT_NOTHING:
+                return NO;
+        }
+    }
+    else if ([error.domain isEqualToString:NSURLErrorDomain])
+    {
+        switch (error.code)
+        {
+            case NSURLErrorNetworkConnectionLost:
+            case NSURLErrorNotConnectedToInternet:
+            case NSURLErrorTimedOut:
+            case NSURLErrorCannotConnectToHost:
+                return NO;
+        }
+    }
+
+    return YES;
+}
+
+#pragma mark Idle Sessions
+
+- (void)schedulePrune;
+{
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)((self.idleTimeout + 1.0) * NSEC_PER_SEC)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        @synchronized(self)
+        {
+            [self pruneIdleSessions];
+        }
+    });
+}
+
+// Caller must be synchronized on self
+- (void)pruneIdleSessionsOlderThan:(CFAbsoluteTime)cutoff;
+{
+    for (NSString *key in [_sessionsByKey allKeys])
+    {
+        NSMutableArray *sessions = [_sessionsByKey objectForKey:key];
+
+        NSIndexSet *expired = [sessions indexesOfObjectsPassingTest:^BOOL(id obj, NSUInteger idx, BOOL *stop) {
+            CK2SSHPooledSession *session = obj;
+            return (!session->_borrowed && session->_lastUsed <= cutoff);
+        }];
+        [sessions removeObjectsAtIndexes:expired];
+
+        if (!sessions.count) [_sessionsByKey removeObjectForKey:key];
+    }
+}
+
+- (void)pruneIdleSessions;
+{
+    [self pruneIdleSessionsOlderThan:(CFAbsoluteTimeGetCurrent() - self.idleTimeout)];
+}
+
+- (void)invalidateIdleSessions;
+{
+    @synchronized(self)
+    {
+        [self pruneIdleSessionsOlderThan:CFAbsoluteTimeGetCurrent()];
+    }
+}
+
+@end
@@ -41,6 +41,16 @@ typedef NSUInteger CKUploadingOptions;
     NSMutableArray      *_queue;
     NSMutableDictionary *_recordsByOperation;
     
+    NSUInteger          _maximumConcurrentOperationsPerHost;
+    NSMutableSet        *_runningOperations;
+    NSCountedSet        *_runningHosts;             // a count per running operation
+    NSMutableDictionary *_hostsByOperation;
+    NSMutableDictionary *_readyOperationsByHost;    // dependencies met, waiting for a slot
+    NSMutableDictionary *_lastOperationsByPath;
+    NSMutableDictionary *_pathKeysByOperation;      // the reverse of _lastOperationsByPath
+    NSMutableDictionary *_dependentsByOperation;
+    NSCountedSet        *_unfinishedDependencies;   // a count per operation still to complete
+    
     CKTransferRecord    *_rootRecord;
     CKTransferRecord    *_baseRecord;
     
@@ -87,6 +97,21 @@ typedef NSUInteger CKUploadingOptions;
 - (void)invalidateAndCancel;             // bails out as quickly as possible
 
 
+#pragma mark Concurrency
+
+/**
+ How many operations may run at once against each host. Defaults to 1, i.e. strictly one at a time
+ in the order queued. Raising it lets small-file publishes overlap their round trips, which is
+ where most of the time goes on high-latency servers; some FTP servers cap connections per
+ client, so don't go beyond what the server allows.
+ 
+ Whatever the limit, operations on the same path run in the order queued (e.g. delete-then-upload,
+ or upload-then-set-permissions), and the first operation into a directory — which creates it —
+ completes before anything else goes into that directory or below it.
+ */
+@property (nonatomic) NSUInteger maximumConcurrentOperationsPerHost;
+
+
 #pragma mark Suspending Operations
 @property (nonatomic, getter=isSuspended) BOOL suspended;
 
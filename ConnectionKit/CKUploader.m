@@ -39,6 +39,16 @@
         
         _queue = [[NSMutableArray alloc] init];
         _recordsByOperation = [[NSMutableDictionary alloc] init];
+        
+        _maximumConcurrentOperationsPerHost = 1;
+        _runningOperations = [[NSMutableSet alloc] init];
+        _runningHosts = [[NSCountedSet alloc] init];
+        _hostsByOperation = [[NSMutableDictionary alloc] init];
+        _readyOperationsByHost = [[NSMutableDictionary alloc] init];
+        _lastOperationsByPath = [[NSMutableDictionary alloc] init];
+        _pathKeysByOperation = [[NSMutableDictionary alloc] init];
+        _dependentsByOperation = [[NSMutableDictionary alloc] init];
+        _unfinishedDependencies = [[NSCountedSet alloc] init];
         _rootRecord = [[CKTransferRecord rootRecordWithPath:[[request URL] path]] retain];
         _baseRecord = [_rootRecord retain];
     }
@@ -74,6 +84,14 @@
     [_rootRecord release];
     [_baseRecord release];
     [_recordsByOperation release];
+    [_runningOperations release];
+    [_runningHosts release];
+    [_hostsByOperation release];
+    [_readyOperationsByHost release];
+    [_lastOperationsByPath release];
+    [_pathKeysByOperation release];
+    [_dependentsByOperation release];
+    [_unfinishedDependencies release];
     
     [super dealloc];
 }
@@ -231,15 +249,19 @@ static void *sOperationStateObservationContext = &sOperationStateObservationCont
     // Note the transfer record this op corresponds to
     if (record) [_recordsByOperation setObject:record forKey:operation];
     
+    // Work out what has to happen first
+    NSString *host = [self.class hostKeyForURL:operation.originalURL];
+    [_hostsByOperation setObject:host forKey:operation];
+    
+    [self addDependenciesForOperation:operation host:host];
+    
     // Watch for it to complete
     [operation addObserver:self forKeyPath:@"state" options:NSKeyValueObservingOptionNew context:sOperationStateObservationContext];
     
     // Add to the queue
     [_queue addObject:operation];
-    if (_queue.count == 1)
-    {
-        [self startNextOperationIfNotSuspended];
-    }
+    if (![_unfinishedDependencies countForObject:operation]) [self operationIsReady:operation];
+    [self startOperationsIfNotSuspended];
 }
 
 - (void)removeOperationAndStartNextIfAppropriate:(CK2FileOperation *)operation;
@@ -248,36 +270,167 @@ static void *sOperationStateObservationContext = &sOperationStateObservationCont
     NSAssert([NSThread isMainThread], @"-%@ is only safe to call on the main thread", NSStringFromSelector(_cmd));
     
     // We assume the operation is only in the queue the once, and most likely near the front
-    NSUInteger index = [_queue indexOfObject:operation];
+    NSUInteger index = [_queue indexOfObjectIdenticalTo:operation];
     if (index != NSNotFound) [_queue removeObjectAtIndex:index];
     
-    // If was the current op, time to start the next
-    if (index == 0) [self startNextOperationIfNotSuspended];
+    NSString *host = [_hostsByOperation objectForKey:operation];
+    if ([_runningOperations containsObject:operation])
+    {
+        [_runningOperations removeObject:operation];
+        [_runningHosts removeObject:host];
+    }
+    else
+    {
+        // Cancelled before it got going
+        [[_readyOperationsByHost objectForKey:host] removeObjectIdenticalTo:operation];
+        while ([_unfinishedDependencies countForObject:operation]) [_unfinishedDependencies removeObject:operation];
+    }
+    [_hostsByOperation removeObjectForKey:operation];
+    
+    // Give up the paths it still has claimed
+    for (NSString *aKey in [_pathKeysByOperation objectForKey:operation])
+    {
+        if ([_lastOperationsByPath objectForKey:aKey] == operation) [_lastOperationsByPath removeObjectForKey:aKey];
+    }
+    [_pathKeysByOperation removeObjectForKey:operation];
+    
+    // Anything that was only waiting on this can go now
+    for (CK2FileOperation *aDependent in [_dependentsByOperation objectForKey:operation])
+    {
+        [_unfinishedDependencies removeObject:aDependent];
+        if (![_unfinishedDependencies countForObject:aDependent] && [_hostsByOperation objectForKey:aDependent])
+        {
+            [self operationIsReady:aDependent];
+        }
+    }
+    [_dependentsByOperation removeObjectForKey:operation];
+    
+    // Frees up a slot, and maybe readied others
+    [self startOperationsIfNotSuspended];
 }
 
-- (void)startNextOperationIfNotSuspended;
+- (void)startOperationsIfNotSuspended;
 {
     if (self.suspended) return;
     
-    if (_queue.count)
+    if (!_queue.count)
     {
-        // We don't actually know what state the operation is in at this point. Normally, it should
-        // be suspended, waiting for us to start it. Ideally, nothing outside of CKUploader should
-        // start the operation itself (similar contract as to NSOperationQueue).
-        // But if operations are being bulk-canceled (e.g. `invalidateAndCancel`), many of them may
-        // have moved on from the suspended state to be cancelling, or completed. We trust that
-        // we'll receive a KVO notification for each operation as it finishes cancelling (i.e. completes)
-        // and remove it from the queue in due course, until there's nothing left and we become
-        // invalid.
-        CK2FileOperation *operation = [_queue objectAtIndex:0];
-        [operation resume];
+        if (_invalidated) [self didBecomeInvalid];
+        return;
     }
-    else if (_invalidated)
+    
+    NSUInteger limit = MAX(self.maximumConcurrentOperationsPerHost, 1);
+    
+    // Resuming can call straight back into us via KVO, readying operations for hosts not seen yet, so
+    // go by a snapshot of the hosts. Each ready list is re-read every time round
+    for (NSString *host in [_readyOperationsByHost allKeys])
     {
-        [self didBecomeInvalid];
+        NSMutableArray *ready = [_readyOperationsByHost objectForKey:host];
+        while (ready.count && [_runningHosts countForObject:host] < limit)
+        {
+            CK2FileOperation *operation = [[ready objectAtIndex:0] retain];
+            [ready removeObjectAtIndex:0];
+        
+            [_runningOperations addObject:operation];
+            [_runningHosts addObject:host];
+        
+            // We don't actually know what state the operation is in at this point. Normally, it should
+            // be suspended, waiting for us to start it. Ideally, nothing outside of CKUploader should
+            // start the operation itself (similar contract as to NSOperationQueue).
+            // But if operations are being bulk-canceled (e.g. `invalidateAndCancel`), many of them may
+            // have moved on from the suspended state to be cancelling, or completed. We trust that
+            // we'll receive a KVO notification for each operation as it finishes cancelling (i.e. completes)
+            // and remove it from the queue in due course, until there's nothing left and we become
+            // invalid.
+            [operation resume];
+            [operation release];
+        }
     }
 }
 
+#pragma mark Concurrency
+
+@synthesize maximumConcurrentOperationsPerHost = _maximumConcurrentOperationsPerHost;
+- (void)setMaximumConcurrentOperationsPerHost:(NSUInteger)max;
+{
+    _maximumConcurrentOperationsPerHost = max;
+    [self startOperationsIfNotSuspended];
+}
+
++ (NSString *)hostKeyForURL:(NSURL *)url;
+{
+    return [NSString stringWithFormat:@"%@://%@:%@",
+            url.scheme.lowercaseString,
+            url.host.lowercaseString,
+            (url.port ? url.port : @"")];
+}
+
+/**
+ Operations on the same path stay in queue order. The first operation into a directory claims it,
+ and everything else going into that directory (or below) waits for it, since it's the one that
+ will create the directory. Only the nearest claimed directory counts; its claimant waits on
+ anything further up itself.
+ */
+- (void)addDependenciesForOperation:(CK2FileOperation *)operation host:(NSString *)host;
+{
+    NSMutableArray *claimedKeys = [NSMutableArray array];
+    
+    NSString *path = [CK2FileManager pathOfURL:operation.originalURL];
+    if (path.length > 1 && [path hasSuffix:@"/"]) path = [path substringToIndex:path.length - 1];
+    
+    NSString *key = [host stringByAppendingString:path];
+    CK2FileOperation *previous = [_lastOperationsByPath objectForKey:key];
+    if (previous) [self addDependency:previous toOperation:operation];
+    [_lastOperationsByPath setObject:operation forKey:key];
+    [claimedKeys addObject:key];
+    
+    NSString *directory = path;
+    while (directory.length && ![directory isEqualToString:@"/"])
+    {
+        directory = [directory stringByDeletingLastPathComponent];
+        key = [host stringByAppendingString:directory];
+        
+        CK2FileOperation *claimant = [_lastOperationsByPath objectForKey:key];
+        if (claimant)
+        {
+            if (claimant != previous) [self addDependency:claimant toOperation:operation];
+            break;
+        }
+        
+        [_lastOperationsByPath setObject:operation forKey:key];
+        [claimedKeys addObject:key];
+    }
+    
+    [_pathKeysByOperation setObject:claimedKeys forKey:operation];
+}
+
+// Fine even if dependency has just completed: its removal, which readies its dependents, is still to come
+- (void)addDependency:(CK2FileOperation *)dependency toOperation:(CK2FileOperation *)operation;
+{
+    NSMutableArray *dependents = [_dependentsByOperation objectForKey:dependency];
+    if (!dependents)
+    {
+        dependents = [NSMutableArray array];
+        [_dependentsByOperation setObject:dependents forKey:dependency];
+    }
+    [dependents addObject:operation];
+    
+    [_unfinishedDependencies addObject:operation];
+}
+
+- (void)operationIsReady:(CK2FileOperation *)operation;
+{
+    NSString *host = [_hostsByOperation objectForKey:operation];
+    
+    NSMutableArray *ready = [_readyOperationsByHost objectForKey:host];
+    if (!ready)
+    {
+        ready = [NSMutableArray array];
+        [_readyOperationsByHost setObject:ready forKey:host];
+    }
+    [ready addObject:operation];
+}
+
 - (void)operation:(CK2FileOperation *)operation didFinish:(NSError *)error;
 {
     NSAssert([NSThread isMainThread], @"Operation broke threading contract");
@@ -372,11 +525,7 @@ static void *sOperationStateObservationContext = &sOperationStateObservationCont
     
     if (!suspended)
     {
-        CK2FileOperation *firstOp = _queue.firstObject;
-        if (firstOp.state == CK2FileOperationStateSuspended)
-        {
-            [self startNextOperationIfNotSuspended];
-        }
+        [self startOperationsIfNotSuspended];
     }
 }
 
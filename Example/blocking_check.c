@@ -0,0 +1,180 @@
+/* Checks how packet.c reads in blocking and non-blocking sessions over a socket pair
+ *
+ * Not part of the library. packet.c is included directly so fcntl() can be counted, build it against the same
+ * objects, less packet.c:
+ *   cc -I. -o blocking_check blocking_check.c <libssh2 .c files other than packet.c> -lcrypto -lz && ./blocking_check
+ *
+ * Only plaintext packets are used, as before key exchange, so no server is needed. A blocking session mustn't
+ * flip its socket to O_NONBLOCK and back around each read, a non-blocking one should set it once and then
+ * return rather than wait. Anything that hangs is caught by an alarm
+ */
+
+#include <fcntl.h>
+
+int check_fcntl(int fd, int cmd, ...);
+#define fcntl check_fcntl
+#include "packet.c"
+#undef fcntl
+
+#include <sys/socket.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <signal.h>
+
+static int failures = 0;
+static int setfl_calls = 0;
+
+int check_fcntl(int fd, int cmd, ...)
+{
+	va_list args;
+	long arg;
+
+	va_start(args, cmd);
+	arg = va_arg(args, long);
+	va_end(args);
+
+	if (cmd == F_SETFL) {
+		setfl_calls++;
+	}
+	return fcntl(fd, cmd, arg);
+}
+
+static void check(const char *name, int ok)
+{
+	if (ok) {
+		printf("ok   %s\n", name);
+	} else {
+		printf("FAIL %s\n", name);
+		failures++;
+	}
+}
+
+static void timed_out(int sig)
+{
+	(void)sig;
+	printf("FAIL timed out, a read waited when it shouldn't have\n");
+	fflush(stdout);
+	_exit(1);
+}
+
+/* {{{ send_ignore
+ * Write an SSH_MSG_IGNORE as it would be sent before key exchange, only the first part_len bytes if part_len is set
+ */
+static unsigned long send_ignore(int sock, unsigned long offset, unsigned long part_len)
+{
+	unsigned char packet[32];
+	unsigned long len;
+
+	/* packet_length(4) padding_length(1) type(1) string(4 + 2) padding(4) */
+	libssh2_htonu32(packet, 1 + 1 + 4 + 2 + 4);
+	packet[4] = 4;
+	packet[5] = SSH_MSG_IGNORE;
+	libssh2_htonu32(packet + 6, 2);
+	memcpy(packet + 10, "hi", 2);
+	memset(packet + 12, 0, 4);
+
+	len = (part_len ? part_len : 16) - offset;
+	return (write(sock, packet + offset, len) == (ssize_t)len) ? (offset + len) : 0;
+}
+/* }}} */
+
+static int socket_nonblocking(int sock)
+{
+	return (fcntl(sock, F_GETFL) & O_NONBLOCK) ? 1 : 0;
+}
+
+static LIBSSH2_SESSION *new_session(int pair[2])
+{
+	LIBSSH2_SESSION *session;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair)) {
+		perror("socketpair");
+		exit(2);
+	}
+	session = libssh2_session_init();
+	session->socket_fd = pair[0];
+
+	return session;
+}
+
+static void free_session(LIBSSH2_SESSION *session, int pair[2])
+{
+	session->socket_state = LIBSSH2_SOCKET_DISCONNECTED;
+	close(pair[0]);
+	close(pair[1]);
+	libssh2_session_free(session);
+}
+
+static void check_blocking(void)
+{
+	LIBSSH2_SESSION *session;
+	int pair[2];
+
+	session = new_session(pair);
+	setfl_calls = 0;
+
+	check("blocking: nothing waiting, a non-blocking read returns 0", libssh2_packet_read(session, 0) == 0);
+	send_ignore(pair[1], 0, 0);
+	check("blocking: a waiting packet is read without waiting", libssh2_packet_read(session, 0) == SSH_MSG_IGNORE);
+	send_ignore(pair[1], 0, 0);
+	check("blocking: a blocking read gets the packet", libssh2_packet_read(session, 1) == SSH_MSG_IGNORE);
+	check("blocking: O_NONBLOCK never set", !setfl_calls && !socket_nonblocking(pair[0]));
+
+	shutdown(pair[1], SHUT_WR);
+	check("blocking: remote end closing ends a blocking read", libssh2_packet_read(session, 1) == 0);
+	check("blocking: and marks the session disconnected", session->socket_state == LIBSSH2_SOCKET_DISCONNECTED);
+
+	free_session(session, pair);
+}
+
+static void check_nonblocking(void)
+{
+	LIBSSH2_SESSION *session;
+	LIBSSH2_CHANNEL *channel;
+	unsigned long sent;
+	char buf[16];
+	int pair[2];
+
+	session = new_session(pair);
+	libssh2_session_set_blocking(session, 0);
+	setfl_calls = 0;
+
+	check("non-blocking: nothing waiting returns 0", libssh2_packet_read(session, 0) == 0);
+	check("non-blocking: and asks to wait for inbound", libssh2_session_block_directions(session) & LIBSSH2_SESSION_BLOCK_INBOUND);
+	check("non-blocking: socket is O_NONBLOCK", socket_nonblocking(pair[0]));
+
+	sent = send_ignore(pair[1], 0, 7);
+	check("non-blocking: half a packet returns 0", libssh2_packet_read(session, 0) == 0);
+	send_ignore(pair[1], sent, 0);
+	check("non-blocking: the rest completes it", libssh2_packet_read(session, 0) == SSH_MSG_IGNORE);
+
+	channel = LIBSSH2_ALLOC(session, sizeof(LIBSSH2_CHANNEL));
+	memset(channel, 0, sizeof(LIBSSH2_CHANNEL));
+	channel->session = session;
+	channel->blocking = 1;
+	channel->remote.window_size = LIBSSH2_CHANNEL_WINDOW_DEFAULT;
+	channel->remote.packet_size = LIBSSH2_CHANNEL_PACKET_DEFAULT;
+	libssh2_channel_add(session, channel);
+	check("non-blocking: channel read returns LIBSSH2_ERROR_EAGAIN", libssh2_channel_read(channel, buf, sizeof(buf)) == LIBSSH2_ERROR_EAGAIN);
+	libssh2_channel_unlink(session, channel);
+	LIBSSH2_FREE(session, channel);
+
+	check("non-blocking: O_NONBLOCK set just the once", setfl_calls == 1);
+
+	libssh2_session_set_blocking(session, 1);
+	check("back to blocking: nothing waiting returns 0", libssh2_packet_read(session, 0) == 0);
+	check("back to blocking: O_NONBLOCK cleared", (setfl_calls == 2) && !socket_nonblocking(pair[0]));
+
+	free_session(session, pair);
+}
+
+int main(void)
+{
+	signal(SIGALRM, timed_out);
+	alarm(10);
+
+	check_blocking();
+	check_nonblocking();
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,162 @@
+/* Checks crypt.c's built in ChaCha20 and Poly1305 against the RFC 8439 test vectors
+ *
+ * Not part of the library. crypt.c is included directly to get at its static functions:
+ *   cc -I. -o chachapoly_check chachapoly_check.c openssl.c misc.c -lcrypto && ./chachapoly_check
+ *
+ * RFC 8439's ChaCha20 takes a 32 bit block counter and 96 bit nonce, where chacha20-poly1305@openssh.com
+ * keeps the original 64 bit counter and 64 bit nonce. The vectors below all have a nonce whose first
+ * 32 bits are zero, so they map directly: the high counter word is zero and the remaining 64 bits of
+ * nonce are what crypt.c builds from the (big endian) sequence number. That needs a 64 bit unsigned long.
+ */
+
+#include "crypt.c"
+
+#include <stdio.h>
+
+static int failures = 0;
+
+static void check(const char *name, const unsigned char *got, const unsigned char *expected, size_t len)
+{
+	if (memcmp(got, expected, len)) {
+		size_t i;
+
+		printf("FAIL %s\n  got      ", name);
+		for(i = 0; i < len; i++) {
+			printf("%02x", got[i]);
+		}
+		printf("\n  expected ");
+		for(i = 0; i < len; i++) {
+			printf("%02x", expected[i]);
+		}
+		printf("\n");
+		failures++;
+	} else {
+		printf("ok   %s\n", name);
+	}
+}
+
+static void load_key(uint32_t key[8], const unsigned char bytes[32])
+{
+	int i;
+
+	for(i = 0; i < 8; i++) {
+		key[i] = CHACHA_U8TO32(bytes + 4 * i);
+	}
+}
+
+/* {{{ RFC 8439 2.4.2: ChaCha20 encryption, counter 1, nonce 00000000 000000004a 000000 */
+static void check_chacha20_encryption(void)
+{
+	static const unsigned char key_bytes[32] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+		0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+	};
+	static const char plaintext[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+	static const unsigned char ciphertext[114] = {
+		0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80, 0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+		0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2, 0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+		0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab, 0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+		0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab, 0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+		0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61, 0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+		0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06, 0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+		0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6, 0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+		0x87, 0x4d
+	};
+	uint32_t key[8];
+	unsigned char buf[114];
+
+	load_key(key, key_bytes);
+	memcpy(buf, plaintext, sizeof(buf));
+	chacha20_xor(key, 0x0000004a00000000UL, 1, buf, sizeof(buf));
+	check("ChaCha20 encryption (2.4.2)", buf, ciphertext, sizeof(buf));
+
+	/* Again a few bytes at a time, the way the header and payload are done separately */
+	memcpy(buf, plaintext, sizeof(buf));
+	chacha20_xor(key, 0x0000004a00000000UL, 1, buf, 64);
+	chacha20_xor(key, 0x0000004a00000000UL, 2, buf + 64, sizeof(buf) - 64);
+	check("ChaCha20 encryption, split at a block boundary", buf, ciphertext, sizeof(buf));
+}
+/* }}} */
+
+/* {{{ RFC 8439 2.5.2: Poly1305 */
+static void check_poly1305(void)
+{
+	static const unsigned char key[32] = {
+		0x85, 0xd6, 0xbe, 0x78, 0x57, 0x55, 0x6d, 0x33, 0x7f, 0x44, 0x52, 0xfe, 0x42, 0xd5, 0x06, 0xa8,
+		0x01, 0x03, 0x80, 0x8a, 0xfb, 0x0d, 0xb2, 0xfd, 0x4a, 0xbf, 0xf6, 0xaf, 0x41, 0x49, 0xf5, 0x1b
+	};
+	static const char message[] = "Cryptographic Forum Research Group";
+	static const unsigned char expected[16] = {
+		0xa8, 0x06, 0x1d, 0xc1, 0x30, 0x51, 0x36, 0xc6, 0xc2, 0x2b, 0x8b, 0xaf, 0x0c, 0x01, 0x27, 0xa9
+	};
+	unsigned char tag[16];
+
+	poly1305_auth(tag, (const unsigned char *)message, strlen(message), key);
+	check("Poly1305 (2.5.2)", tag, expected, sizeof(tag));
+}
+/* }}} */
+
+/* {{{ RFC 8439 A.3: Poly1305 vectors that exercise the final reduction mod 2^130 - 5 */
+static void check_poly1305_reduction(void)
+{
+	static const unsigned char expected[16] = { 0x03 };
+	static const unsigned char expected_wrap[16] = { 0x05 };
+	unsigned char key[32], message[48], tag[16];
+
+	/* #5: h reaches exactly p */
+	memset(key, 0, sizeof(key));
+	key[0] = 0x02;
+	memset(message, 0xff, 16);
+	poly1305_auth(tag, message, 16, key);
+	check("Poly1305 h == p (A.3 #5)", tag, expected, sizeof(tag));
+
+	/* #6: adding s wraps past 2^128 */
+	memset(key + 16, 0xff, 16);
+	memset(message, 0, 16);
+	message[0] = 0x02;
+	poly1305_auth(tag, message, 16, key);
+	check("Poly1305 h + s wraps (A.3 #6)", tag, expected, sizeof(tag));
+
+	/* #7: a carry that runs all the way through the limbs */
+	memset(key, 0, sizeof(key));
+	key[0] = 0x01;
+	memset(message, 0xff, 16);
+	message[16] = 0xf0;
+	memset(message + 17, 0xff, 15);
+	message[32] = 0x11;
+	memset(message + 33, 0, 15);
+	poly1305_auth(tag, message, 48, key);
+	check("Poly1305 full carry (A.3 #7)", tag, expected_wrap, sizeof(tag));
+}
+/* }}} */
+
+/* {{{ RFC 8439 2.6.2: Poly1305 key generation, the first 32 bytes of keystream for counter 0 */
+static void check_poly1305_key_generation(void)
+{
+	static const unsigned char key_bytes[32] = {
+		0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+		0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f
+	};
+	static const unsigned char expected[32] = {
+		0x8a, 0xd5, 0xa0, 0x8b, 0x90, 0x5f, 0x81, 0xcc, 0x81, 0x50, 0x40, 0x27, 0x4a, 0xb2, 0x94, 0x71,
+		0xa8, 0x33, 0xb6, 0x37, 0xe3, 0xfd, 0x0d, 0xa5, 0x08, 0xdb, 0xb8, 0xe2, 0xfd, 0xd1, 0xa6, 0x46
+	};
+	uint32_t key[8];
+	unsigned char poly_key[32];
+
+	load_key(key, key_bytes);
+	memset(poly_key, 0, sizeof(poly_key));
+	chacha20_xor(key, 0x0001020304050607UL, 0, poly_key, sizeof(poly_key));
+	check("Poly1305 key generation (2.6.2)", poly_key, expected, sizeof(poly_key));
+}
+/* }}} */
+
+int main(void)
+{
+	check_chacha20_encryption();
+	check_poly1305();
+	check_poly1305_reduction();
+	check_poly1305_key_generation();
+
+	return failures ? 1 : 0;
+}
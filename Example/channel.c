@@ -75,31 +75,87 @@ unsigned long libssh2_channel_nextid(LIBSSH2_SESSION *session)
  */
 LIBSSH2_CHANNEL *libssh2_channel_locate(LIBSSH2_SESSION *session, unsigned long channel_id)
 {
-	LIBSSH2_CHANNEL *channel = session->channels.head;
+	LIBSSH2_CHANNEL *channel = session->channel_index[channel_id & (LIBSSH2_CHANNEL_INDEX_BUCKETS - 1)];
 	while (channel) {
 		if (channel->local.id == channel_id) {
 			return channel;
 		}
-		channel = channel->next;
+		channel = channel->index_next;
 	}
 
 	return NULL;
 }
 /* }}} */
 
-#define libssh2_channel_add(session, channel)	\
-{	\
-	if ((session)->channels.tail) {	\
-		(session)->channels.tail->next = (channel);	\
-		(channel)->prev = (session)->channels.tail;	\
-	} else {	\
-		(session)->channels.head = (channel);	\
-		(channel)->prev = NULL;	\
-	}	\
-	(channel)->next = NULL;	\
-	(session)->channels.tail = (channel);	\
-	(channel)->session = (session); \
+/* {{{ libssh2_channel_add
+ * Link a channel into the session's channel brigade and index
+ */
+void libssh2_channel_add(LIBSSH2_SESSION *session, LIBSSH2_CHANNEL *channel)
+{
+	LIBSSH2_CHANNEL **bucket = &session->channel_index[channel->local.id & (LIBSSH2_CHANNEL_INDEX_BUCKETS - 1)];
+
+	if (session->channels.tail) {
+		session->channels.tail->next = channel;
+		channel->prev = session->channels.tail;
+	} else {
+		session->channels.head = channel;
+		channel->prev = NULL;
+	}
+	channel->next = NULL;
+	session->channels.tail = channel;
+	channel->session = session;
+
+	channel->index_next = *bucket;
+	*bucket = channel;
+}
+/* }}} */
+
+/* {{{ libssh2_channel_unlink
+ * Remove a channel from the session's channel brigade and index
+ */
+void libssh2_channel_unlink(LIBSSH2_SESSION *session, LIBSSH2_CHANNEL *channel)
+{
+	LIBSSH2_CHANNEL **bucket = &session->channel_index[channel->local.id & (LIBSSH2_CHANNEL_INDEX_BUCKETS - 1)];
+
+	if (channel->prev) {
+		channel->prev->next = channel->next;
+	} else if (session->channels.head == channel) {
+		session->channels.head = channel->next;
+	}
+	if (channel->next) {
+		channel->next->prev = channel->prev;
+	} else if (session->channels.tail == channel) {
+		session->channels.tail = channel->prev;
+	}
+	channel->next = channel->prev = NULL;
+
+	while (*bucket) {
+		if (*bucket == channel) {
+			*bucket = channel->index_next;
+			break;
+		}
+		bucket = &(*bucket)->index_next;
+	}
+	channel->index_next = NULL;
 }
+/* }}} */
+
+/* {{{ libssh2_channel_data_free
+ * Throw away any data queued for a channel which will never be read
+ */
+void libssh2_channel_data_free(LIBSSH2_CHANNEL *channel)
+{
+	LIBSSH2_SESSION *session = channel->session;
+
+	while (channel->data.head) {
+		LIBSSH2_PACKET *packet = channel->data.head;
+
+		channel->data.head = packet->next;
+		libssh2_packet_free(session, packet);
+	}
+	channel->data.tail = NULL;
+}
+/* }}} */
 
 /* {{{ libssh2_channel_open_session
  * Establish a generic session channel
@@ -199,28 +255,12 @@ LIBSSH2_API LIBSSH2_CHANNEL *libssh2_channel_open_ex(LIBSSH2_SESSION *session, c
 		LIBSSH2_FREE(session, packet);
 	}
 	if (channel) {
-		unsigned char channel_id[4];
 		LIBSSH2_FREE(session, channel->channel_type);
 
-		if (channel->next) {
-			channel->next->prev = channel->prev;
-		}
-		if (channel->prev) {
-			channel->prev->next = channel->next;
-		}
-		if (session->channels.head == channel) {
-			session->channels.head = channel->next;
-		}
-		if (session->channels.tail == channel) {
-			session->channels.tail = channel->prev;
-		}
+		libssh2_channel_unlink(session, channel);
 
 		/* Clear out packets meant for this channel */
-		libssh2_htonu32(channel_id, channel->local.id);
-		while  ((libssh2_packet_ask_ex(session, SSH_MSG_CHANNEL_DATA, 		  &data, &data_len, 1, channel_id, 4, 1) >= 0) ||
-				(libssh2_packet_ask_ex(session, SSH_MSG_CHANNEL_EXTENDED_DATA, &data, &data_len, 1, channel_id, 4, 1) >= 0)) {
-			LIBSSH2_FREE(session, data);
-		}
+		libssh2_channel_data_free(channel);
 
 		LIBSSH2_FREE(session, channel);
 	}
@@ -445,15 +485,7 @@ LIBSSH2_API LIBSSH2_CHANNEL *libssh2_channel_forward_accept(LIBSSH2_LISTENER *li
 			listener->queue->prev = NULL;
 		}
 
-		channel->prev = NULL;
-		channel->next = session->channels.head;
-		session->channels.head = channel;
-
-		if (channel->next) {
-			channel->next->prev = channel;
-		} else {
-			session->channels.tail = channel;
-		}
+		libssh2_channel_add(session, channel);
 		listener->queue_size--;
 
 		return channel;
@@ -746,43 +778,38 @@ LIBSSH2_API void libssh2_channel_set_blocking(LIBSSH2_CHANNEL *channel, int bloc
  */
 LIBSSH2_API int libssh2_channel_flush_ex(LIBSSH2_CHANNEL *channel, int streamid)
 {
-	LIBSSH2_PACKET *packet = channel->session->packets.head;
+	LIBSSH2_PACKET *packet = channel->data.head;
 	unsigned long refund_bytes = 0, flush_bytes = 0;
 
 	while (packet) {
 		LIBSSH2_PACKET *next = packet->next;
 		unsigned char packet_type = packet->data[0];
+		unsigned long packet_stream_id = (packet_type == SSH_MSG_CHANNEL_DATA) ? 0 : libssh2_ntohu32(packet->data + 5);
 
-		if (((packet_type == SSH_MSG_CHANNEL_DATA) || (packet_type == SSH_MSG_CHANNEL_EXTENDED_DATA)) &&
-			(libssh2_ntohu32(packet->data + 1) == channel->local.id)) {
-			/* It's our channel at least */
-			unsigned long packet_stream_id = (packet_type == SSH_MSG_CHANNEL_DATA) ? 0 : libssh2_ntohu32(packet->data + 5);
-			if ((streamid == LIBSSH2_CHANNEL_FLUSH_ALL) ||
-				((packet_type == SSH_MSG_CHANNEL_EXTENDED_DATA) && ((streamid == LIBSSH2_CHANNEL_FLUSH_EXTENDED_DATA) || (streamid == packet_stream_id))) ||
-				((packet_type == SSH_MSG_CHANNEL_DATA) && (streamid == 0))) {
-				int bytes_to_flush = packet->data_len - packet->data_head;
+		if ((streamid == LIBSSH2_CHANNEL_FLUSH_ALL) ||
+			((packet_type == SSH_MSG_CHANNEL_EXTENDED_DATA) && ((streamid == LIBSSH2_CHANNEL_FLUSH_EXTENDED_DATA) || (streamid == packet_stream_id))) ||
+			((packet_type == SSH_MSG_CHANNEL_DATA) && (streamid == 0))) {
+			int bytes_to_flush = packet->data_len - packet->data_head;
 #ifdef LIBSSH2_DEBUG_CONNECTION
 	_libssh2_debug(channel->session, LIBSSH2_DBG_CONN, "Flushing %d bytes of data from stream %lu on channel %lu/%lu", bytes_to_flush,
-																				packet_stream_id, channel->local.id, channel->remote.id);
+																			packet_stream_id, channel->local.id, channel->remote.id);
 #endif
 
-				/* It's one of the streams we wanted to flush */
-				refund_bytes += packet->data_len - 13;
-				flush_bytes += bytes_to_flush;
+			/* It's one of the streams we wanted to flush */
+			refund_bytes += packet->data_len - 13;
+			flush_bytes += bytes_to_flush;
 
-				LIBSSH2_FREE(channel->session, packet->data);
-				if (packet->prev) {
-					packet->prev->next = packet->next;
-				} else {
-					channel->session->packets.head = packet->next;
-				}
-				if (packet->next) {
-					packet->next->prev = packet->prev;
-				} else {
-					channel->session->packets.tail = packet->prev;
-				}
-				LIBSSH2_FREE(channel->session, packet);
+			if (packet->prev) {
+				packet->prev->next = packet->next;
+			} else {
+				channel->data.head = packet->next;
+			}
+			if (packet->next) {
+				packet->next->prev = packet->prev;
+			} else {
+				channel->data.tail = packet->prev;
 			}
+			libssh2_packet_free(channel->session, packet);
 		}
 		packet = next;
 	}
@@ -805,18 +832,83 @@ LIBSSH2_API int libssh2_channel_get_exit_status(LIBSSH2_CHANNEL* channel)
 
 /* }}} */
 
+/* {{{ libssh2_channel_window_grow
+ * The remote used up the whole window and the application has already read all of it,
+ * so the window rather than the reader is what's holding the transfer back.
+ * Aim for twice the measured bandwidth-delay product, at least doubling, never beyond window_max
+ *
+ * Returns the number of bytes to add to the window on top of what's been freed
+ */
+static unsigned long libssh2_channel_window_grow(LIBSSH2_CHANNEL *channel)
+{
+	unsigned long now = libssh2_time_ms();
+	unsigned long elapsed = now - channel->rate_start_ms;
+	unsigned long target = channel->window_target;
+	unsigned long growth;
+
+	if (target > channel->window_max / 2) {
+		target = channel->window_max;
+	} else {
+		target *= 2;
+	}
+
+	if (channel->window_stats.rtt_ms && elapsed) {
+		/* bytes per ms * rtt, doubled */
+		libssh2_uint64_t bdp = (channel->rate_bytes * channel->window_stats.rtt_ms * 2) / elapsed;
+
+		if (bdp > channel->window_max) {
+			bdp = channel->window_max;
+		}
+		if (bdp > target) {
+			target = (unsigned long)bdp;
+		}
+	}
+
+	growth = target - channel->window_target;
+	if (!growth) {
+		return 0;
+	}
+
+#ifdef LIBSSH2_DEBUG_CONNECTION
+	_libssh2_debug(channel->session, LIBSSH2_DBG_CONN, "Growing receive window for channel %lu/%lu from %lu to %lu bytes (rtt %lums)", channel->local.id, channel->remote.id, channel->window_target, target, channel->window_stats.rtt_ms);
+#endif
+	channel->window_target = target;
+	channel->window_stats.grows++;
+
+	/* Measure the next stretch at the new size */
+	channel->rate_start_ms = now;
+	channel->rate_bytes = 0;
+
+	return growth;
+}
+/* }}} */
+
 /* {{{ libssh2_channel_receive_window_adjust
  * Adjust the receive window for a channel by adjustment bytes
  * If the amount to be adjusted is less than LIBSSH2_CHANNEL_MINADJUST and force is 0
  * The adjustment amount will be queued for a later packet
+ * (on auto-tuned channels adjustments are batched up to a quarter of the window instead)
  *
  * Returns the new size of the receive window (as understood by remote end)
  */
 LIBSSH2_API unsigned long libssh2_channel_receive_window_adjust(LIBSSH2_CHANNEL *channel, unsigned long adjustment, unsigned char force)
 {
 	unsigned char adjust[9]; /* packet_type(1) + channel(4) + adjustment(4) */
+	unsigned long minadjust = LIBSSH2_CHANNEL_MINADJUST;
+	int reopening = 0;
+
+	if (channel->window_exhausted) {
+		/* The remote is stalled waiting on us, don't sit on the refund */
+		force = 1;
+		reopening = 1;
+		if (channel->window_max && !channel->data.head) {
+			adjustment += libssh2_channel_window_grow(channel);
+		}
+	} else if (channel->window_max && (channel->window_target / 4 > minadjust)) {
+		minadjust = channel->window_target / 4;
+	}
 
-	if (!force && (adjustment + channel->adjust_queue < LIBSSH2_CHANNEL_MINADJUST)) {
+	if (!force && (adjustment + channel->adjust_queue < minadjust)) {
 #ifdef LIBSSH2_DEBUG_CONNECTION
 		_libssh2_debug(channel->session, LIBSSH2_DBG_CONN, "Queing %lu bytes for receive window adjustment for channel %lu/%lu", adjustment, channel->local.id, channel->remote.id);
 #endif
@@ -845,6 +937,13 @@ LIBSSH2_API unsigned long libssh2_channel_receive_window_adjust(LIBSSH2_CHANNEL
 		channel->adjust_queue = adjustment;
 	} else {
 		channel->remote.window_size += adjustment;
+		if (reopening && (channel->remote.window_size >= channel->remote.packet_size)) {
+			channel->window_exhausted = 0;
+			if (channel->window_max) {
+				/* Time until the data this lets through arrives */
+				channel->adjust_sent_ms = libssh2_time_ms() | 1;
+			}
+		}
 	}
 
 	return channel->remote.window_size;
@@ -886,7 +985,7 @@ LIBSSH2_API int libssh2_channel_read_ex(LIBSSH2_CHANNEL *channel, int stream_id,
 
 		/* Process any waiting packets */
 		while (libssh2_packet_read(session, blocking_read) > 0) blocking_read = 0;
-		packet = session->packets.head;
+		packet = channel->data.head;
 
 		while (packet && (bytes_read < buflen)) {
 			/* In case packet gets destroyed during this iteration */
@@ -896,9 +995,9 @@ LIBSSH2_API int libssh2_channel_read_ex(LIBSSH2_CHANNEL *channel, int stream_id,
 			 * or the standard stream (and data was available),
 			 * or the standard stream with extended_data_merge enabled and data was available
 			 */
-			if ((stream_id  && (packet->data[0] == SSH_MSG_CHANNEL_EXTENDED_DATA) && (channel->local.id == libssh2_ntohu32(packet->data + 1)) && (stream_id == libssh2_ntohu32(packet->data + 5))) ||
-				(!stream_id && (packet->data[0] == SSH_MSG_CHANNEL_DATA) && (channel->local.id == libssh2_ntohu32(packet->data + 1))) ||
-				(!stream_id && (packet->data[0] == SSH_MSG_CHANNEL_EXTENDED_DATA) && (channel->local.id == libssh2_ntohu32(packet->data + 1)) && (channel->remote.extended_data_ignore_mode == LIBSSH2_CHANNEL_EXTENDED_DATA_MERGE))) {
+			if ((stream_id  && (packet->data[0] == SSH_MSG_CHANNEL_EXTENDED_DATA) && (stream_id == libssh2_ntohu32(packet->data + 5))) ||
+				(!stream_id && (packet->data[0] == SSH_MSG_CHANNEL_DATA)) ||
+				(!stream_id && (packet->data[0] == SSH_MSG_CHANNEL_EXTENDED_DATA) && (channel->remote.extended_data_ignore_mode == LIBSSH2_CHANNEL_EXTENDED_DATA_MERGE))) {
 				int want = buflen - bytes_read;
 				int unlink_packet = 0;
 
@@ -918,26 +1017,31 @@ LIBSSH2_API int libssh2_channel_read_ex(LIBSSH2_CHANNEL *channel, int stream_id,
 					if (packet->prev) {
 						packet->prev->next = packet->next;
 					} else {
-						session->packets.head = packet->next;
+						channel->data.head = packet->next;
 					}
 					if (packet->next) {
 						packet->next->prev = packet->prev;
 					} else {
-						session->packets.tail = packet->prev;
+						channel->data.tail = packet->prev;
 					}
-					LIBSSH2_FREE(session, packet->data);
 
 #ifdef LIBSSH2_DEBUG_CONNECTION
 	_libssh2_debug(session, LIBSSH2_DBG_CONN, "Unlinking empty packet buffer from channel %lu/%lu", channel->local.id, channel->remote.id);
 #endif
 					libssh2_channel_receive_window_adjust(channel, packet->data_len - (stream_id ? 13 : 9), 0);
-					LIBSSH2_FREE(session, packet);
+					libssh2_packet_free(session, packet);
 				}
 			}
 			packet = next;
 		}
 		blocking_read = 1;
-	} while (channel->blocking && (bytes_read == 0) && !channel->remote.close);
+	} while (channel->blocking && session->socket_block && (bytes_read == 0) && !channel->remote.close);
+
+	if ((bytes_read == 0) && !session->socket_block && !channel->remote.eof && !channel->remote.close) {
+		/* Nothing's arrived yet, libssh2_session_block_directions() says what to wait for */
+		libssh2_error(session, LIBSSH2_ERROR_EAGAIN, "Would block waiting for channel data", 0);
+		return LIBSSH2_ERROR_EAGAIN;
+	}
 
 	if (channel->blocking && (bytes_read == 0)) {
 		libssh2_error(session, LIBSSH2_ERROR_CHANNEL_CLOSED, "Remote end has closed this channel", 0);
@@ -968,6 +1072,20 @@ LIBSSH2_API int libssh2_channel_write_ex(LIBSSH2_CHANNEL *channel, int stream_id
 		libssh2_error(session, LIBSSH2_ERROR_CHANNEL_EOF_SENT, "EOF has already been sight, data might be ignored", 0);
 	}
 
+	if (!session->socket_block) {
+		/* Take in any window adjustments that have turned up, then don't queue more than the socket is keeping up with */
+		while (libssh2_packet_read(session, 0) > 0);
+		if ((channel->local.window_size <= 0) ||
+			((session->outbuf_len >= LIBSSH2_OUTBUF_FLUSH_AT) && (libssh2_session_flush(session) == LIBSSH2_ERROR_EAGAIN))) {
+			if (channel->local.window_size <= 0) {
+				session->block_directions |= LIBSSH2_SESSION_BLOCK_INBOUND;
+				channel->window_stats.write_stalls++;
+			}
+			libssh2_error(session, LIBSSH2_ERROR_EAGAIN, "Would block sending channel data", 0);
+			return LIBSSH2_ERROR_EAGAIN;
+		}
+	}
+
 	if (!channel->blocking && (channel->local.window_size <= 0)) {
 		/* Can't write anything */
 		return 0;
@@ -991,6 +1109,9 @@ LIBSSH2_API int libssh2_channel_write_ex(LIBSSH2_CHANNEL *channel, int stream_id
 		}
 
 		/* twiddle our thumbs until there's window space available */
+		if (channel->local.window_size <= 0) {
+			channel->window_stats.write_stalls++;
+		}
 		while (channel->local.window_size <= 0) {
 			/* Don't worry -- This is never hit unless it's a blocking channel anyway */
 			if (libssh2_packet_read(session, 1) < 0) {
@@ -1032,7 +1153,7 @@ LIBSSH2_API int libssh2_channel_write_ex(LIBSSH2_CHANNEL *channel, int stream_id
 		buf += bufwrite;
 		bufwrote += bufwrite;
 
-		if (!channel->blocking) {
+		if (!channel->blocking || !session->socket_block) {
 			break;
 		}
 	}
@@ -1071,16 +1192,9 @@ LIBSSH2_API int libssh2_channel_send_eof(LIBSSH2_CHANNEL *channel)
  */
 LIBSSH2_API int libssh2_channel_eof(LIBSSH2_CHANNEL *channel)
 {
-	LIBSSH2_SESSION *session = channel->session;
-	LIBSSH2_PACKET *packet = session->packets.head;
-
-	while (packet) {
-		if (((packet->data[0] == SSH_MSG_CHANNEL_DATA) || (packet->data[0] == SSH_MSG_CHANNEL_EXTENDED_DATA)) &&
-			(channel->local.id == libssh2_ntohu32(packet->data + 1))) {
-			/* There's data waiting to be read yet, mask the EOF status */
-			return 0;
-		}
-		packet = packet->next;
+	if (channel->data.head) {
+		/* There's data waiting to be read yet, mask the EOF status */
+		return 0;
 	}
 
 	return channel->remote.eof;
@@ -1157,8 +1271,6 @@ LIBSSH2_API int libssh2_channel_wait_closed(LIBSSH2_CHANNEL *channel)
 LIBSSH2_API int libssh2_channel_free(LIBSSH2_CHANNEL *channel)
 {
 	LIBSSH2_SESSION *session = channel->session;
-	unsigned char channel_id[4], *data;
-	unsigned long data_len;
 
 #ifdef LIBSSH2_DEBUG_CONNECTION
 	_libssh2_debug(session, LIBSSH2_DBG_CONN, "Freeing channel %lu/%lu resources", channel->local.id, channel->remote.id);
@@ -1175,11 +1287,7 @@ LIBSSH2_API int libssh2_channel_free(LIBSSH2_CHANNEL *channel)
 	 */
 
 	/* Clear out packets meant for this channel */
-	libssh2_htonu32(channel_id, channel->local.id);
-	while  ((libssh2_packet_ask_ex(session, SSH_MSG_CHANNEL_DATA, 		  &data, &data_len, 1, channel_id, 4, 1) >= 0) ||
-			(libssh2_packet_ask_ex(session, SSH_MSG_CHANNEL_EXTENDED_DATA, &data, &data_len, 1, channel_id, 4, 1) >= 0)) {
-		LIBSSH2_FREE(session, data);
-	}
+	libssh2_channel_data_free(channel);
 
 	/* free "channel_type" */
 	if (channel->channel_type) {
@@ -1187,16 +1295,7 @@ LIBSSH2_API int libssh2_channel_free(LIBSSH2_CHANNEL *channel)
 	}
 
 	/* Unlink from channel brigade */
-	if (channel->prev) {
-		channel->prev->next = channel->next;
-	} else {
-		session->channels.head = channel->next;
-	}
-	if (channel->next) {
-		channel->next->prev = channel->prev;
-	} else {
-		session->channels.tail = channel->prev;
-	}
+	libssh2_channel_unlink(session, channel);
 
 	LIBSSH2_FREE(session, channel);
 
@@ -1218,16 +1317,10 @@ LIBSSH2_API unsigned long libssh2_channel_window_read_ex(LIBSSH2_CHANNEL *channe
 
 	if (read_avail) {
 		unsigned long bytes_queued = 0;
-		LIBSSH2_PACKET *packet = channel->session->packets.head;
+		LIBSSH2_PACKET *packet = channel->data.head;
 
 		while (packet) {
-			unsigned char packet_type = packet->data[0];
-
-			if (((packet_type == SSH_MSG_CHANNEL_DATA) || (packet_type == SSH_MSG_CHANNEL_EXTENDED_DATA)) &&
-				(libssh2_ntohu32(packet->data + 1) == channel->local.id)) {
-				bytes_queued += packet->data_len - packet->data_head;
-			}
-
+			bytes_queued += packet->data_len - packet->data_head;
 			packet = packet->next;
 		}
 
@@ -1238,6 +1331,32 @@ LIBSSH2_API unsigned long libssh2_channel_window_read_ex(LIBSSH2_CHANNEL *channe
 }
 /* }}} */
 
+/* {{{ libssh2_channel_window_autotune
+ * Let the receive window grow, as the measured round trip time and throughput call for, up to window_max bytes
+ * The window starts out at the size the channel was opened with; window_max of 0 turns auto-tuning back off
+ */
+LIBSSH2_API void libssh2_channel_window_autotune(LIBSSH2_CHANNEL *channel, unsigned long window_max)
+{
+	if (window_max && (window_max < channel->remote.window_size_initial)) {
+		window_max = channel->remote.window_size_initial;
+	}
+	channel->window_max = window_max;
+	if (!channel->window_target) {
+		channel->window_target = channel->remote.window_size_initial;
+	}
+}
+/* }}} */
+
+/* {{{ libssh2_channel_window_stats
+ * Report how often this channel's windows have held transfers up and what auto-tuning has done about it
+ */
+LIBSSH2_API void libssh2_channel_window_stats(LIBSSH2_CHANNEL *channel, LIBSSH2_CHANNEL_WINDOW_STATS *stats)
+{
+	memcpy(stats, &channel->window_stats, sizeof(LIBSSH2_CHANNEL_WINDOW_STATS));
+	stats->window_size = channel->remote.window_size;
+}
+/* }}} */
+
 /* {{{ libssh2_channel_window_write_ex
  * Check the status of the write window
  * Returns the number of bytes which may be safely writen on the channel without blocking
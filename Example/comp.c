@@ -72,7 +72,8 @@ static LIBSSH2_COMP_METHOD libssh2_comp_method_none = {
 	(char *)"none",
 	NULL,
 	libssh2_comp_method_none_comp,
-	NULL
+	NULL,
+	0
 };
 
 #ifdef LIBSSH2_HAVE_ZLIB
@@ -100,37 +101,69 @@ static void libssh2_comp_method_zlib_free(voidpf opaque, voidpf address)
 }
 /* }}} */
 
+/* Per-direction state, the output buffer outlives each packet and only ever grows */
+typedef struct _libssh2_zlib_ctx {
+	z_stream strm;
+	int level;
+	unsigned char *buf;
+	unsigned long buf_size;
+} libssh2_zlib_ctx;
+
 /* {{{ libssh2_comp_method_zlib_init
  * All your bandwidth are belong to us (so save some)
  */
 static int libssh2_comp_method_zlib_init(LIBSSH2_SESSION *session, int compress, void **abstract)
 {
-	z_stream *strm;
+	libssh2_zlib_ctx *ctx;
 	int status;
 
-	strm = LIBSSH2_ALLOC(session, sizeof(z_stream));
-	if (!strm) {
+	ctx = LIBSSH2_ALLOC(session, sizeof(libssh2_zlib_ctx));
+	if (!ctx) {
 		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for zlib compression/decompression", 0);
 		return -1;
 	}
-	memset(strm, 0, sizeof(z_stream));
+	memset(ctx, 0, sizeof(libssh2_zlib_ctx));
 
-	strm->opaque = (voidpf)session;
-	strm->zalloc = (alloc_func)libssh2_comp_method_zlib_alloc;
-	strm->zfree = (free_func)libssh2_comp_method_zlib_free;
+	ctx->strm.opaque = (voidpf)session;
+	ctx->strm.zalloc = (alloc_func)libssh2_comp_method_zlib_alloc;
+	ctx->strm.zfree = (free_func)libssh2_comp_method_zlib_free;
 	if (compress) {
 		/* deflate */
-		status = deflateInit(strm, Z_DEFAULT_COMPRESSION);
+		ctx->level = session->comp_level;
+		status = deflateInit(&ctx->strm, ctx->level);
 	} else {
 		/* inflate */
-		status = inflateInit(strm);
+		status = inflateInit(&ctx->strm);
 	}
 
 	if (status != Z_OK) {
-		LIBSSH2_FREE(session, strm);
+		LIBSSH2_FREE(session, ctx);
 		return -1;
 	}
-	*abstract = strm;
+	*abstract = ctx;
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_comp_method_zlib_grow
+ * Make the output buffer at least size bytes
+ */
+static int libssh2_comp_method_zlib_grow(LIBSSH2_SESSION *session, libssh2_zlib_ctx *ctx, unsigned long size)
+{
+	unsigned char *buf;
+
+	if (ctx->buf_size >= size) {
+		return 0;
+	}
+
+	buf = LIBSSH2_REALLOC(session, ctx->buf, size);
+	if (!buf) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to expand compress/decompression buffer", 0);
+		return -1;
+	}
+	ctx->buf = buf;
+	ctx->buf_size = size;
 
 	return 0;
 }
@@ -138,6 +171,7 @@ static int libssh2_comp_method_zlib_init(LIBSSH2_SESSION *session, int compress,
 
 /* {{{ libssh2_comp_method_zlib_comp
  * zlib, a compression standard for all occasions
+ * The result is left in the context's own buffer (free_dest = 0), valid until the next call in the same direction
  */
 static int libssh2_comp_method_zlib_comp(LIBSSH2_SESSION *session,
 					 int compress,
@@ -149,32 +183,40 @@ static int libssh2_comp_method_zlib_comp(LIBSSH2_SESSION *session,
 					 unsigned long src_len,
 					 void **abstract)
 {
-	z_stream *strm = *abstract;
-	/* A short-term alloc of a full data chunk is better than a series of
-	   reallocs */
-	char *out;
-	int out_maxlen = compress ? (src_len + 4) : (2 * src_len);
-	int limiter = 0;
+	libssh2_zlib_ctx *ctx = *abstract;
+	z_stream *strm = &ctx->strm;
+	unsigned long out_len = 0;
+	/* Enough for nearly every packet first time round, deflate's worst case is a few bytes over src_len */
+	unsigned long out_maxlen = compress ? (src_len + (src_len >> 8) + 32) : (2 * src_len);
 
 	/* In practice they never come smaller than this */
-	if (out_maxlen < 25) {
-		out_maxlen = 25;
+	if (out_maxlen < 256) {
+		out_maxlen = 256;
 	}
 
-	if (out_maxlen > (int)payload_limit) {
+	if (out_maxlen > payload_limit) {
 		out_maxlen = payload_limit;
 	}
 
+	if (libssh2_comp_method_zlib_grow(session, ctx, out_maxlen)) {
+		return -1;
+	}
+
 	strm->next_in = (unsigned char *)src;
 	strm->avail_in = src_len;
-	strm->next_out = (unsigned char *)LIBSSH2_ALLOC(session, out_maxlen);
-	out = (char *)strm->next_out;
-	strm->avail_out = out_maxlen;
-	if (!strm->next_out) {
-		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate compression/decompression buffer", 0);
-		return -1;
+	strm->next_out = ctx->buf;
+	strm->avail_out = ctx->buf_size;
+
+	if (compress && (ctx->level != session->comp_level)) {
+		/* Everything before this packet has been flushed out already, so there's nothing for the new level to disturb */
+		if (deflateParams(strm, session->comp_level, Z_DEFAULT_STRATEGY) != Z_OK) {
+			libssh2_error(session, LIBSSH2_ERROR_ZLIB, "Unable to change compression level", 0);
+			return -1;
+		}
+		ctx->level = session->comp_level;
 	}
-	while (strm->avail_in) {
+
+	for(;;) {
 		int status;
 
 		if (compress) {
@@ -182,74 +224,39 @@ static int libssh2_comp_method_zlib_comp(LIBSSH2_SESSION *session,
 		} else {
 			status = inflate(strm, Z_PARTIAL_FLUSH);
 		}
-		if (status != Z_OK) {
+		/* Z_BUF_ERROR just means there was nothing more to do */
+		if ((status != Z_OK) && (status != Z_BUF_ERROR)) {
 			libssh2_error(session, LIBSSH2_ERROR_ZLIB, "compress/decompression failure", 0);
-			LIBSSH2_FREE(session, out);
 			return -1;
 		}
-		if (strm->avail_in) {
-			unsigned long out_ofs = out_maxlen - strm->avail_out;
-
-			out_maxlen += compress ? (strm->avail_in + 4) : (2 * strm->avail_in);
-
-			if ((out_maxlen > (int)payload_limit) &&
-			    !compress && limiter++) {
-				libssh2_error(session, LIBSSH2_ERROR_ZLIB,
-					      "Excessive growth in decompression phase", 0);
-				LIBSSH2_FREE(session, out);
-				return -1;
-			}
-
-			out = LIBSSH2_REALLOC(session, out, out_maxlen);
-			if (!out) {
-				libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to expand compress/decompression buffer", 0);
-				return -1;
-			}
-			strm->next_out = (unsigned char *)out + out_ofs;
-			strm->avail_out += compress ? (strm->avail_in + 4) : (2 * strm->avail_in);
-		} else while (!strm->avail_out) {
-			/* Done with input, might be a byte or two in internal buffer during compress
-			 * Or potentially many bytes if it's a decompress
-			 */
-			int grow_size = compress ? 8 : 1024;
-
-			if (out_maxlen >= (int)payload_limit) {
-				libssh2_error(session, LIBSSH2_ERROR_ZLIB, "Excessive growth in decompression phase", 0);
-				LIBSSH2_FREE(session, out);
-				return -1;
-			}
-
-			if (grow_size > (int)(payload_limit - out_maxlen)) {
-				grow_size = payload_limit - out_maxlen;
-			}
-
-			out_maxlen += grow_size;
-			strm->avail_out = grow_size;
-
-			out = LIBSSH2_REALLOC(session, out, out_maxlen);
-			if (!out) {
-				libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to expand final compress/decompress buffer", 0);
-				return -1;
-			}
-			strm->next_out = (unsigned char *)out + out_maxlen -
-				grow_size;
-
-			if (compress) {
-				status = deflate(strm, Z_PARTIAL_FLUSH);
-			} else {
-				status = inflate(strm, Z_PARTIAL_FLUSH);
-			}
-			if (status != Z_OK) {
-				libssh2_error(session, LIBSSH2_ERROR_ZLIB, "compress/decompression failure", 0);
-				LIBSSH2_FREE(session, out);
-				return -1;
-			}
+		out_len = ctx->buf_size - strm->avail_out;
+
+		if (!strm->avail_in && strm->avail_out) {
+			/* All input taken and the flush fitted, done */
+			break;
+		}
+
+		/* Out of room, might be a byte or two left in the internal buffer during compress
+		 * Or potentially many bytes if it's a decompress
+		 */
+		if (ctx->buf_size >= payload_limit) {
+			libssh2_error(session, LIBSSH2_ERROR_ZLIB, "Excessive growth in decompression phase", 0);
+			return -1;
+		}
+		out_maxlen = ctx->buf_size * 2;
+		if (out_maxlen > payload_limit) {
+			out_maxlen = payload_limit;
 		}
+		if (libssh2_comp_method_zlib_grow(session, ctx, out_maxlen)) {
+			return -1;
+		}
+		strm->next_out = ctx->buf + out_len;
+		strm->avail_out = ctx->buf_size - out_len;
 	}
 
-	*dest = (unsigned char *)out;
-	*dest_len = out_maxlen - strm->avail_out;
-	*free_dest = 1;
+	*dest = ctx->buf;
+	*dest_len = out_len;
+	*free_dest = 0;
 
 	return 0;
 }
@@ -260,18 +267,21 @@ static int libssh2_comp_method_zlib_comp(LIBSSH2_SESSION *session,
  */
 static int libssh2_comp_method_zlib_dtor(LIBSSH2_SESSION *session, int compress, void **abstract)
 {
-	z_stream *strm = *abstract;
+	libssh2_zlib_ctx *ctx = *abstract;
 
-	if (strm) {
+	if (ctx) {
 		if (compress) {
 			/* deflate */
-			deflateEnd(strm);
+			deflateEnd(&ctx->strm);
 		} else {
 			/* inflate */
-			inflateEnd(strm);
+			inflateEnd(&ctx->strm);
 		}
 
-		LIBSSH2_FREE(session, strm);
+		if (ctx->buf) {
+			LIBSSH2_FREE(session, ctx->buf);
+		}
+		LIBSSH2_FREE(session, ctx);
 	}
 
 	*abstract = NULL;
@@ -285,6 +295,16 @@ static LIBSSH2_COMP_METHOD libssh2_comp_method_zlib = {
 	libssh2_comp_method_zlib_init,
 	libssh2_comp_method_zlib_comp,
 	libssh2_comp_method_zlib_dtor,
+	0
+};
+
+/* OpenSSH's variant, identical but for leaving authentication uncompressed */
+static LIBSSH2_COMP_METHOD libssh2_comp_method_zlib_openssh = {
+	(char *)"zlib@openssh.com",
+	libssh2_comp_method_zlib_init,
+	libssh2_comp_method_zlib_comp,
+	libssh2_comp_method_zlib_dtor,
+	LIBSSH2_COMP_FLAG_DELAYED
 };
 #endif /* LIBSSH2_HAVE_ZLIB */
 
@@ -295,6 +315,7 @@ static LIBSSH2_COMP_METHOD libssh2_comp_method_zlib = {
 static LIBSSH2_COMP_METHOD *_libssh2_comp_methods[] = {
 	&libssh2_comp_method_none,
 #ifdef LIBSSH2_HAVE_ZLIB
+	&libssh2_comp_method_zlib_openssh,
 	&libssh2_comp_method_zlib,
 #endif /* LIBSSH2_HAVE_ZLIB */
 	NULL
@@ -56,12 +56,19 @@ static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_none = {
 	0, /* flags */
 	NULL,
 	libssh2_crypt_none_crypt,
+	NULL,
+	NULL,
+	NULL,
+	0, /* tag length */
+	NULL,
+	NULL,
 	NULL
 };
 #endif /* LIBSSH2_CRYPT_NONE */
 
 struct crypt_ctx {
 	int encrypt;
+	int blocksize;
 	_libssh2_cipher_type(algo);
 	_libssh2_cipher_ctx h;
 };
@@ -78,6 +85,7 @@ static int init (LIBSSH2_SESSION *session,
 		return -1;
 	}
 	ctx->encrypt = encrypt;
+	ctx->blocksize = method->blocksize;
 	ctx->algo = method->algo;
 	if (_libssh2_cipher_init (&ctx->h, ctx->algo, iv, secret, encrypt))
 	{
@@ -93,8 +101,16 @@ static int init (LIBSSH2_SESSION *session,
 static int crypt(LIBSSH2_SESSION *session, unsigned char *block, void **abstract)
 {
 	struct crypt_ctx *cctx = *(struct crypt_ctx **)abstract;
-	return _libssh2_cipher_crypt(&cctx->h, cctx->algo,
-				     cctx->encrypt, block);
+	/* The method's blocksize, not the EVP one, which is 1 for stream and counter modes */
+	return _libssh2_cipher_crypt_bulk(&cctx->h, cctx->algo,
+					  cctx->encrypt, block, cctx->blocksize);
+}
+
+static int crypt_bulk(LIBSSH2_SESSION *session, unsigned char *buf, size_t len, void **abstract)
+{
+	struct crypt_ctx *cctx = *(struct crypt_ctx **)abstract;
+	return _libssh2_cipher_crypt_bulk(&cctx->h, cctx->algo,
+					  cctx->encrypt, buf, len);
 }
 
 static int dtor(LIBSSH2_SESSION *session, void **abstract)
@@ -108,6 +124,340 @@ static int dtor(LIBSSH2_SESSION *session, void **abstract)
 	return 0;
 }
 
+#if LIBSSH2_AES_GCM
+/* {{{ aes*-gcm@openssh.com
+ * RFC 5647 as OpenSSH does it: packet_length stays in the clear as AAD,
+ * the 96 bit nonce is a fixed 32 bit field followed by a 64 bit invocation counter bumped every packet
+ */
+struct crypt_gcm_ctx {
+	int encrypt;
+	_libssh2_cipher_ctx h;
+	unsigned char iv[12];
+};
+
+static int gcm_init(LIBSSH2_SESSION *session,
+		    LIBSSH2_CRYPT_METHOD *method,
+		    unsigned char *iv, int *free_iv,
+		    unsigned char *secret, int *free_secret,
+		    int encrypt, void **abstract)
+{
+	struct crypt_gcm_ctx *ctx = LIBSSH2_ALLOC(session,
+						  sizeof(struct crypt_gcm_ctx));
+	if (!ctx) {
+		return -1;
+	}
+	ctx->encrypt = encrypt;
+	memcpy(ctx->iv, iv, sizeof(ctx->iv));
+	if (_libssh2_cipher_gcm_init(&ctx->h, method->algo, secret, encrypt)) {
+		LIBSSH2_FREE(session, ctx);
+		return -1;
+	}
+	*abstract = ctx;
+	*free_iv = 1;
+	*free_secret = 1;
+	return 0;
+}
+
+static int gcm_length(LIBSSH2_SESSION *session, unsigned long seqno, const unsigned char *buf, unsigned long *packet_len, void **abstract)
+{
+	*packet_len = libssh2_ntohu32(buf);
+	return 0;
+}
+
+static void gcm_next_iv(struct crypt_gcm_ctx *ctx)
+{
+	int i;
+
+	for(i = sizeof(ctx->iv) - 1; i >= 4; i--) {
+		if (++ctx->iv[i]) {
+			break;
+		}
+	}
+}
+
+static int gcm_crypt(LIBSSH2_SESSION *session, unsigned long seqno, unsigned char *buf, size_t len, unsigned char *tag, void **abstract)
+{
+	struct crypt_gcm_ctx *ctx = *(struct crypt_gcm_ctx **)abstract;
+	int ret = _libssh2_cipher_gcm_crypt(&ctx->h, ctx->encrypt, ctx->iv, buf, 4, buf + 4, len - 4, tag);
+
+	gcm_next_iv(ctx);
+	return ret;
+}
+
+static int gcm_open(LIBSSH2_SESSION *session, unsigned long seqno, unsigned char *buf, size_t len, const unsigned char *tag, void **abstract)
+{
+	return gcm_crypt(session, seqno, buf, len, (unsigned char *)tag, abstract);
+}
+
+static int gcm_dtor(LIBSSH2_SESSION *session, void **abstract)
+{
+	struct crypt_gcm_ctx **ctx = (struct crypt_gcm_ctx **)abstract;
+	if (ctx && *ctx) {
+		_libssh2_cipher_dtor(&(*ctx)->h);
+		memset(*ctx, 0, sizeof(struct crypt_gcm_ctx));
+		LIBSSH2_FREE(session, *ctx);
+		*abstract = NULL;
+	}
+	return 0;
+}
+/* }}} */
+#endif /* LIBSSH2_AES_GCM */
+
+#if LIBSSH2_CHACHA20_POLY1305
+/* {{{ chacha20-poly1305@openssh.com
+ * Self contained, like OpenSSH's own, since few crypto libraries offer the original 64 bit nonce ChaCha20
+ * The first 32 bytes of key material encrypt the payload, the second 32 bytes encrypt packet_length,
+ * both use the sequence number as nonce, and the Poly1305 key is the first block of payload keystream
+ */
+#define CHACHA_ROTL(v, n)		(((v) << (n)) | ((v) >> (32 - (n))))
+#define CHACHA_QUARTERROUND(x, a, b, c, d)	\
+{	\
+	x[a] += x[b]; x[d] = CHACHA_ROTL(x[d] ^ x[a], 16);	\
+	x[c] += x[d]; x[b] = CHACHA_ROTL(x[b] ^ x[c], 12);	\
+	x[a] += x[b]; x[d] = CHACHA_ROTL(x[d] ^ x[a], 8);	\
+	x[c] += x[d]; x[b] = CHACHA_ROTL(x[b] ^ x[c], 7);	\
+}
+#define CHACHA_U8TO32(p)		(((uint32_t)(p)[0]) | ((uint32_t)(p)[1] << 8) | ((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+#define CHACHA_U32TO8(p, v)		{ (p)[0] = (v); (p)[1] = (v) >> 8; (p)[2] = (v) >> 16; (p)[3] = (v) >> 24; }
+
+struct crypt_chachapoly_ctx {
+	uint32_t main_key[8];
+	uint32_t header_key[8];
+};
+
+/* XOR len bytes of ChaCha20 keystream for (key, nonce=seqno) starting at block counter into buf */
+static void chacha20_xor(const uint32_t key[8], unsigned long seqno, uint64_t counter, unsigned char *buf, size_t len)
+{
+	static const unsigned char sigma[16] = "expand 32-byte k";
+	uint32_t input[16], x[16];
+	unsigned char stream[64];
+	size_t i;
+	int r;
+
+	for(i = 0; i < 4; i++) {
+		input[i] = CHACHA_U8TO32(sigma + 4 * i);
+	}
+	memcpy(input + 4, key, 8 * sizeof(uint32_t));
+	/* Nonce is the big endian 64 bit sequence number, read as two little endian words like every other input */
+	{
+		unsigned char nonce[8];
+		uint64_t seq = seqno;
+
+		for(i = 0; i < 8; i++) {
+			nonce[i] = seq >> (56 - 8 * i);
+		}
+		input[14] = CHACHA_U8TO32(nonce);
+		input[15] = CHACHA_U8TO32(nonce + 4);
+	}
+
+	while (len) {
+		size_t n = (len < 64) ? len : 64;
+
+		input[12] = (uint32_t)counter;
+		input[13] = (uint32_t)(counter >> 32);
+		memcpy(x, input, sizeof(x));
+		for(r = 0; r < 10; r++) {
+			CHACHA_QUARTERROUND(x, 0, 4,  8, 12)
+			CHACHA_QUARTERROUND(x, 1, 5,  9, 13)
+			CHACHA_QUARTERROUND(x, 2, 6, 10, 14)
+			CHACHA_QUARTERROUND(x, 3, 7, 11, 15)
+			CHACHA_QUARTERROUND(x, 0, 5, 10, 15)
+			CHACHA_QUARTERROUND(x, 1, 6, 11, 12)
+			CHACHA_QUARTERROUND(x, 2, 7,  8, 13)
+			CHACHA_QUARTERROUND(x, 3, 4,  9, 14)
+		}
+		for(i = 0; i < 16; i++) {
+			uint32_t v = x[i] + input[i];
+			CHACHA_U32TO8(stream + 4 * i, v);
+		}
+		for(i = 0; i < n; i++) {
+			buf[i] ^= stream[i];
+		}
+
+		buf += n;
+		len -= n;
+		counter++;
+	}
+	memset(x, 0, sizeof(x));
+	memset(stream, 0, sizeof(stream));
+}
+
+/* Poly1305 one-time authenticator, 26 bit limbs */
+static void poly1305_auth(unsigned char tag[16], const unsigned char *m, size_t len, const unsigned char key[32])
+{
+	uint32_t r0, r1, r2, r3, r4, s1, s2, s3, s4;
+	uint32_t h0 = 0, h1 = 0, h2 = 0, h3 = 0, h4 = 0;
+	uint32_t g0, g1, g2, g3, g4, mask;
+	uint64_t d0, d1, d2, d3, d4, f;
+	unsigned char block[16];
+
+	r0 = (CHACHA_U8TO32(key +  0)     ) & 0x3ffffff;
+	r1 = (CHACHA_U8TO32(key +  3) >> 2) & 0x3ffff03;
+	r2 = (CHACHA_U8TO32(key +  6) >> 4) & 0x3ffc0ff;
+	r3 = (CHACHA_U8TO32(key +  9) >> 6) & 0x3f03fff;
+	r4 = (CHACHA_U8TO32(key + 12) >> 8) & 0x00fffff;
+	s1 = r1 * 5; s2 = r2 * 5; s3 = r3 * 5; s4 = r4 * 5;
+
+	while (len) {
+		const unsigned char *p = m;
+		uint32_t hibit = 1 << 24;
+		size_t n = 16;
+
+		if (len < 16) {
+			/* Final partial block is padded with a 1 byte then zeros, instead of the implicit 2^128 */
+			memset(block, 0, sizeof(block));
+			memcpy(block, m, len);
+			block[len] = 1;
+			p = block;
+			hibit = 0;
+			n = len;
+		}
+
+		h0 += (CHACHA_U8TO32(p +  0)     ) & 0x3ffffff;
+		h1 += (CHACHA_U8TO32(p +  3) >> 2) & 0x3ffffff;
+		h2 += (CHACHA_U8TO32(p +  6) >> 4) & 0x3ffffff;
+		h3 += (CHACHA_U8TO32(p +  9) >> 6) & 0x3ffffff;
+		h4 += (CHACHA_U8TO32(p + 12) >> 8) | hibit;
+
+		d0 = ((uint64_t)h0 * r0) + ((uint64_t)h1 * s4) + ((uint64_t)h2 * s3) + ((uint64_t)h3 * s2) + ((uint64_t)h4 * s1);
+		d1 = ((uint64_t)h0 * r1) + ((uint64_t)h1 * r0) + ((uint64_t)h2 * s4) + ((uint64_t)h3 * s3) + ((uint64_t)h4 * s2);
+		d2 = ((uint64_t)h0 * r2) + ((uint64_t)h1 * r1) + ((uint64_t)h2 * r0) + ((uint64_t)h3 * s4) + ((uint64_t)h4 * s3);
+		d3 = ((uint64_t)h0 * r3) + ((uint64_t)h1 * r2) + ((uint64_t)h2 * r1) + ((uint64_t)h3 * r0) + ((uint64_t)h4 * s4);
+		d4 = ((uint64_t)h0 * r4) + ((uint64_t)h1 * r3) + ((uint64_t)h2 * r2) + ((uint64_t)h3 * r1) + ((uint64_t)h4 * r0);
+
+		f = d0 >> 26; h0 = (uint32_t)d0 & 0x3ffffff;
+		d1 += f; f = d1 >> 26; h1 = (uint32_t)d1 & 0x3ffffff;
+		d2 += f; f = d2 >> 26; h2 = (uint32_t)d2 & 0x3ffffff;
+		d3 += f; f = d3 >> 26; h3 = (uint32_t)d3 & 0x3ffffff;
+		d4 += f; f = d4 >> 26; h4 = (uint32_t)d4 & 0x3ffffff;
+		h0 += (uint32_t)f * 5; f = h0 >> 26; h0 &= 0x3ffffff;
+		h1 += (uint32_t)f;
+
+		m += n;
+		len -= n;
+	}
+
+	/* Fully carry h */
+	g0 = h1 >> 26; h1 &= 0x3ffffff;
+	h2 += g0; g0 = h2 >> 26; h2 &= 0x3ffffff;
+	h3 += g0; g0 = h3 >> 26; h3 &= 0x3ffffff;
+	h4 += g0; g0 = h4 >> 26; h4 &= 0x3ffffff;
+	h0 += g0 * 5; g0 = h0 >> 26; h0 &= 0x3ffffff;
+	h1 += g0;
+
+	/* h - p, then pick h or h - p without branching */
+	g0 = h0 + 5; f = g0 >> 26; g0 &= 0x3ffffff;
+	g1 = h1 + (uint32_t)f; f = g1 >> 26; g1 &= 0x3ffffff;
+	g2 = h2 + (uint32_t)f; f = g2 >> 26; g2 &= 0x3ffffff;
+	g3 = h3 + (uint32_t)f; f = g3 >> 26; g3 &= 0x3ffffff;
+	g4 = h4 + (uint32_t)f - (1 << 26);
+
+	mask = (g4 >> 31) - 1;
+	h0 = (h0 & ~mask) | (g0 & mask);
+	h1 = (h1 & ~mask) | (g1 & mask);
+	h2 = (h2 & ~mask) | (g2 & mask);
+	h3 = (h3 & ~mask) | (g3 & mask);
+	h4 = (h4 & ~mask) | (g4 & mask);
+
+	/* h = (h + s) % 2^128 */
+	f = (uint64_t)(h0 | (h1 << 26)) + CHACHA_U8TO32(key + 16);					h0 = (uint32_t)f;
+	f = (uint64_t)((h1 >> 6) | (h2 << 20)) + CHACHA_U8TO32(key + 20) + (f >> 32);	h1 = (uint32_t)f;
+	f = (uint64_t)((h2 >> 12) | (h3 << 14)) + CHACHA_U8TO32(key + 24) + (f >> 32);	h2 = (uint32_t)f;
+	f = (uint64_t)((h3 >> 18) | (h4 << 8)) + CHACHA_U8TO32(key + 28) + (f >> 32);	h3 = (uint32_t)f;
+
+	CHACHA_U32TO8(tag +  0, h0);
+	CHACHA_U32TO8(tag +  4, h1);
+	CHACHA_U32TO8(tag +  8, h2);
+	CHACHA_U32TO8(tag + 12, h3);
+}
+
+static int chachapoly_init(LIBSSH2_SESSION *session,
+			   LIBSSH2_CRYPT_METHOD *method,
+			   unsigned char *iv, int *free_iv,
+			   unsigned char *secret, int *free_secret,
+			   int encrypt, void **abstract)
+{
+	struct crypt_chachapoly_ctx *ctx = LIBSSH2_ALLOC(session,
+							 sizeof(struct crypt_chachapoly_ctx));
+	int i;
+
+	if (!ctx) {
+		return -1;
+	}
+	for(i = 0; i < 8; i++) {
+		ctx->main_key[i] = CHACHA_U8TO32(secret + 4 * i);
+		ctx->header_key[i] = CHACHA_U8TO32(secret + 32 + 4 * i);
+	}
+	*abstract = ctx;
+	*free_iv = 1;
+	*free_secret = 1;
+	return 0;
+}
+
+static int chachapoly_length(LIBSSH2_SESSION *session, unsigned long seqno, const unsigned char *buf, unsigned long *packet_len, void **abstract)
+{
+	struct crypt_chachapoly_ctx *ctx = *(struct crypt_chachapoly_ctx **)abstract;
+	unsigned char len[4];
+
+	memcpy(len, buf, 4);
+	chacha20_xor(ctx->header_key, seqno, 0, len, 4);
+	*packet_len = libssh2_ntohu32(len);
+	return 0;
+}
+
+static void chachapoly_tag(struct crypt_chachapoly_ctx *ctx, unsigned long seqno, const unsigned char *buf, size_t len, unsigned char *tag)
+{
+	unsigned char poly_key[32];
+
+	memset(poly_key, 0, sizeof(poly_key));
+	chacha20_xor(ctx->main_key, seqno, 0, poly_key, sizeof(poly_key));
+	poly1305_auth(tag, buf, len, poly_key);
+	memset(poly_key, 0, sizeof(poly_key));
+}
+
+static int chachapoly_seal(LIBSSH2_SESSION *session, unsigned long seqno, unsigned char *buf, size_t len, unsigned char *tag, void **abstract)
+{
+	struct crypt_chachapoly_ctx *ctx = *(struct crypt_chachapoly_ctx **)abstract;
+
+	chacha20_xor(ctx->header_key, seqno, 0, buf, 4);
+	chacha20_xor(ctx->main_key, seqno, 1, buf + 4, len - 4);
+	chachapoly_tag(ctx, seqno, buf, len, tag);
+	return 0;
+}
+
+static int chachapoly_open(LIBSSH2_SESSION *session, unsigned long seqno, unsigned char *buf, size_t len, const unsigned char *tag, void **abstract)
+{
+	struct crypt_chachapoly_ctx *ctx = *(struct crypt_chachapoly_ctx **)abstract;
+	unsigned char expected[16];
+	unsigned char diff = 0;
+	int i;
+
+	chachapoly_tag(ctx, seqno, buf, len, expected);
+	for(i = 0; i < 16; i++) {
+		diff |= expected[i] ^ tag[i];
+	}
+	if (diff) {
+		return -1;
+	}
+
+	chacha20_xor(ctx->header_key, seqno, 0, buf, 4);
+	chacha20_xor(ctx->main_key, seqno, 1, buf + 4, len - 4);
+	return 0;
+}
+
+static int chachapoly_dtor(LIBSSH2_SESSION *session, void **abstract)
+{
+	struct crypt_chachapoly_ctx **ctx = (struct crypt_chachapoly_ctx **)abstract;
+	if (ctx && *ctx) {
+		memset(*ctx, 0, sizeof(struct crypt_chachapoly_ctx));
+		LIBSSH2_FREE(session, *ctx);
+		*abstract = NULL;
+	}
+	return 0;
+}
+/* }}} */
+#endif /* LIBSSH2_CHACHA20_POLY1305 */
+
 #if LIBSSH2_AES
 static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes128_cbc = {
 	"aes128-cbc",
@@ -118,7 +468,12 @@ static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes128_cbc = {
 	&init,
 	&crypt,
 	&dtor,
-	_libssh2_cipher_aes128
+	_libssh2_cipher_aes128,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
 };
 
 static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes192_cbc = {
@@ -130,7 +485,12 @@ static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes192_cbc = {
 	&init,
 	&crypt,
 	&dtor,
-	_libssh2_cipher_aes192
+	_libssh2_cipher_aes192,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
 };
 
 static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes256_cbc = {
@@ -142,7 +502,12 @@ static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes256_cbc = {
 	&init,
 	&crypt,
 	&dtor,
-	_libssh2_cipher_aes256
+	_libssh2_cipher_aes256,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
 };
 
 /* rijndael-cbc@lysator.liu.se == aes256-cbc */
@@ -155,10 +520,123 @@ static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_rijndael_cbc_lysator_liu_se = {
 	&init,
 	&crypt,
 	&dtor,
-	_libssh2_cipher_aes256
+	_libssh2_cipher_aes256,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
 };
 #endif /* LIBSSH2_AES */
 
+#if LIBSSH2_AES_CTR
+static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes128_ctr = {
+	"aes128-ctr",
+	16, /* blocksize */
+	16, /* initial value length */
+	16, /* secret length -- 16*8 == 128bit */
+	0, /* flags */
+	&init,
+	&crypt,
+	&dtor,
+	_libssh2_cipher_aes128ctr,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
+};
+
+static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes192_ctr = {
+	"aes192-ctr",
+	16, /* blocksize */
+	16, /* initial value length */
+	24, /* secret length -- 24*8 == 192bit */
+	0, /* flags */
+	&init,
+	&crypt,
+	&dtor,
+	_libssh2_cipher_aes192ctr,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
+};
+
+static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes256_ctr = {
+	"aes256-ctr",
+	16, /* blocksize */
+	16, /* initial value length */
+	32, /* secret length -- 32*8 == 256bit */
+	0, /* flags */
+	&init,
+	&crypt,
+	&dtor,
+	_libssh2_cipher_aes256ctr,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
+};
+#endif /* LIBSSH2_AES_CTR */
+
+#if LIBSSH2_AES_GCM
+static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes128_gcm_openssh_com = {
+	"aes128-gcm@openssh.com",
+	16, /* blocksize */
+	12, /* initial value length */
+	16, /* secret length -- 16*8 == 128bit */
+	LIBSSH2_CRYPT_FLAG_AEAD, /* flags */
+	&gcm_init,
+	NULL,
+	&gcm_dtor,
+	_libssh2_cipher_aes128gcm,
+	NULL,
+	16, /* tag length */
+	&gcm_length,
+	&gcm_crypt,
+	&gcm_open
+};
+
+static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_aes256_gcm_openssh_com = {
+	"aes256-gcm@openssh.com",
+	16, /* blocksize */
+	12, /* initial value length */
+	32, /* secret length -- 32*8 == 256bit */
+	LIBSSH2_CRYPT_FLAG_AEAD, /* flags */
+	&gcm_init,
+	NULL,
+	&gcm_dtor,
+	_libssh2_cipher_aes256gcm,
+	NULL,
+	16, /* tag length */
+	&gcm_length,
+	&gcm_crypt,
+	&gcm_open
+};
+#endif /* LIBSSH2_AES_GCM */
+
+#if LIBSSH2_CHACHA20_POLY1305
+static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_chacha20_poly1305_openssh_com = {
+	"chacha20-poly1305@openssh.com",
+	8, /* blocksize */
+	0, /* initial value length */
+	64, /* secret length -- two 256bit keys */
+	LIBSSH2_CRYPT_FLAG_AEAD, /* flags */
+	&chachapoly_init,
+	NULL,
+	&chachapoly_dtor,
+	NULL,
+	NULL,
+	16, /* tag length */
+	&chachapoly_length,
+	&chachapoly_seal,
+	&chachapoly_open
+};
+#endif /* LIBSSH2_CHACHA20_POLY1305 */
+
 #if LIBSSH2_BLOWFISH
 static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_blowfish_cbc = {
 	"blowfish-cbc",
@@ -169,7 +647,12 @@ static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_blowfish_cbc = {
 	&init,
 	&crypt,
 	&dtor,
-	_libssh2_cipher_blowfish
+	_libssh2_cipher_blowfish,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
 };
 #endif /* LIBSSH2_BLOWFISH */
 
@@ -183,7 +666,12 @@ static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_arcfour = {
 	&init,
 	&crypt,
 	&dtor,
-	_libssh2_cipher_arcfour
+	_libssh2_cipher_arcfour,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
 };
 #endif /* LIBSSH2_RC4 */
 
@@ -197,7 +685,12 @@ static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_cast128_cbc = {
 	&init,
 	&crypt,
 	&dtor,
-	_libssh2_cipher_cast5
+	_libssh2_cipher_cast5,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
 };
 #endif /* LIBSSH2_CAST */
 
@@ -211,11 +704,28 @@ static LIBSSH2_CRYPT_METHOD libssh2_crypt_method_3des_cbc = {
 	&init,
 	&crypt,
 	&dtor,
-	_libssh2_cipher_3des
+	_libssh2_cipher_3des,
+	&crypt_bulk,
+	0, /* tag length */
+	NULL,
+	NULL,
+	NULL
 };
 #endif
 
 static LIBSSH2_CRYPT_METHOD *_libssh2_crypt_methods[] = {
+#if LIBSSH2_CHACHA20_POLY1305
+	&libssh2_crypt_method_chacha20_poly1305_openssh_com,
+#endif /* LIBSSH2_CHACHA20_POLY1305 */
+#if LIBSSH2_AES_GCM
+	&libssh2_crypt_method_aes256_gcm_openssh_com,
+	&libssh2_crypt_method_aes128_gcm_openssh_com,
+#endif /* LIBSSH2_AES_GCM */
+#if LIBSSH2_AES_CTR
+	&libssh2_crypt_method_aes256_ctr,
+	&libssh2_crypt_method_aes192_ctr,
+	&libssh2_crypt_method_aes128_ctr,
+#endif /* LIBSSH2_AES_CTR */
 #if LIBSSH2_AES
 	&libssh2_crypt_method_aes256_cbc,
 	&libssh2_crypt_method_rijndael_cbc_lysator_liu_se, /* == aes256-cbc */
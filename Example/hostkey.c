@@ -370,7 +370,303 @@ static LIBSSH2_HOSTKEY_METHOD libssh2_hostkey_method_ssh_dss = {
 };
 #endif /* LIBSSH2_DSA */
 
+#if LIBSSH2_ECDSA
+/* ***********************
+   * ecdsa-sha2-nistp256 *
+   * ecdsa-sha2-nistp384 *
+   *********************** */
+
+/* {{{ libssh2_hostkey_method_ecdsa_curve
+ * Curve and hash that go with each ecdsa-sha2-* name. The name has to be the negotiated method's own, for the key
+ * and for the signature alike, so a signature can't pick a different curve or hash from the key it's checked against
+ */
+static int libssh2_hostkey_method_ecdsa_curve(LIBSSH2_SESSION *session, const unsigned char *name, unsigned long name_len, int *curve, unsigned long *hash_len)
+{
+	if ((name_len != strlen(session->hostkey->name)) || strncmp((const char *)name, session->hostkey->name, name_len)) {
+		return -1;
+	}
+	if ((name_len == 19) && !strncmp((const char *)name, "ecdsa-sha2-nistp256", 19)) {
+		*curve = LIBSSH2_EC_CURVE_NISTP256;
+		*hash_len = SHA256_DIGEST_LENGTH;
+		return 0;
+	}
+	if ((name_len == 19) && !strncmp((const char *)name, "ecdsa-sha2-nistp384", 19)) {
+		*curve = LIBSSH2_EC_CURVE_NISTP384;
+		*hash_len = SHA384_DIGEST_LENGTH;
+		return 0;
+	}
+
+	return -1;
+}
+/* }}} */
+
+/* {{{ libssh2_hostkey_method_ecdsa_init
+ * Initialize the server hostkey working area with the curve's public point
+ */
+static int libssh2_hostkey_method_ecdsa_init(LIBSSH2_SESSION *session,
+					     unsigned char *hostkey_data,
+					     unsigned long hostkey_data_len,
+					     void **abstract)
+{
+	libssh2_ecdsa_ctx *ecctx;
+	unsigned char *s = hostkey_data, *end = hostkey_data + hostkey_data_len;
+	unsigned long len, q_len, hash_len;
+	int curve;
+
+	if (*abstract) {
+		_libssh2_ecdsa_free((libssh2_ecdsa_ctx *)*abstract);
+		*abstract = NULL;
+	}
+
+	/* keyname(string) + curve identifier(string) + Q(string) */
+	if (hostkey_data_len < 4) {
+		return -1;
+	}
+	len = libssh2_ntohu32(s);					s += 4;
+	if ((len > (unsigned long)(end - s)) || libssh2_hostkey_method_ecdsa_curve(session, s, len, &curve, &hash_len)) {
+		return -1;
+	}											s += len;
+
+	if ((end - s) < 4) {
+		return -1;
+	}
+	len = libssh2_ntohu32(s);					s += 4;
+	if (len > (unsigned long)(end - s)) {
+		return -1;
+	}											s += len;
+
+	if ((end - s) < 4) {
+		return -1;
+	}
+	q_len = libssh2_ntohu32(s);					s += 4;
+	if (q_len > (unsigned long)(end - s)) {
+		return -1;
+	}
+
+	if (_libssh2_ecdsa_new_public(&ecctx, curve, s, q_len)) {
+		libssh2_error(session, LIBSSH2_ERROR_HOSTKEY_INIT, "Invalid ECDSA public key", 0);
+		return -1;
+	}
+
+	*abstract = ecctx;
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_hostkey_method_ecdsa_sig_verify
+ * Verify signature created by remote
+ */
+static int libssh2_hostkey_method_ecdsa_sig_verify(LIBSSH2_SESSION *session,
+						   const unsigned char *sig,
+						   unsigned long sig_len,
+						   const unsigned char *m,
+						   unsigned long m_len,
+						   void **abstract)
+{
+	libssh2_ecdsa_ctx *ecctx = (libssh2_ecdsa_ctx*)(*abstract);
+	const unsigned char *s = sig, *end = sig + sig_len, *r_value, *s_value;
+	unsigned char hash[SHA384_DIGEST_LENGTH];
+	unsigned long len, r_len, s_len, hash_len;
+	int curve;
+
+	/* keyname(string) + signature blob(string){ r(mpint) + s(mpint) } */
+	if (sig_len < 4) {
+		goto invalid;
+	}
+	len = libssh2_ntohu32(s);					s += 4;
+	if ((len > (unsigned long)(end - s)) || libssh2_hostkey_method_ecdsa_curve(session, s, len, &curve, &hash_len)) {
+		goto invalid;
+	}											s += len;
+
+	if ((end - s) < 4) {
+		goto invalid;
+	}
+	len = libssh2_ntohu32(s);					s += 4;
+	if (len > (unsigned long)(end - s)) {
+		goto invalid;
+	}
+	end = s + len;
+
+	if ((end - s) < 4) {
+		goto invalid;
+	}
+	r_len = libssh2_ntohu32(s);					s += 4;
+	if (r_len > (unsigned long)(end - s)) {
+		goto invalid;
+	}
+	r_value = s;								s += r_len;
+
+	if ((end - s) < 4) {
+		goto invalid;
+	}
+	s_len = libssh2_ntohu32(s);					s += 4;
+	if (s_len > (unsigned long)(end - s)) {
+		goto invalid;
+	}
+	s_value = s;
+
+	if (hash_len == SHA256_DIGEST_LENGTH) {
+		libssh2_sha256(m, m_len, hash);
+	} else {
+		libssh2_sha384(m, m_len, hash);
+	}
+
+	return _libssh2_ecdsa_verify(ecctx, r_value, r_len, s_value, s_len, hash, hash_len);
+
+ invalid:
+	libssh2_error(session, LIBSSH2_ERROR_PROTO, "Invalid ECDSA signature", 0);
+	return -1;
+}
+/* }}} */
+
+/* {{{ libssh2_hostkey_method_ecdsa_dtor
+ * Shutdown the hostkey
+ */
+static int libssh2_hostkey_method_ecdsa_dtor(LIBSSH2_SESSION *session,
+					     void **abstract)
+{
+	libssh2_ecdsa_ctx *ecctx = (libssh2_ecdsa_ctx*)(*abstract);
+	(void)session;
+
+	if (ecctx) {
+		_libssh2_ecdsa_free(ecctx);
+	}
+
+	*abstract = NULL;
+
+	return 0;
+}
+/* }}} */
+
+/* Server host keys only for now, so no initPEM/signv for publickey auth */
+static LIBSSH2_HOSTKEY_METHOD libssh2_hostkey_method_ecdsa_ssh_nistp256 = {
+	"ecdsa-sha2-nistp256",
+	SHA256_DIGEST_LENGTH,
+	libssh2_hostkey_method_ecdsa_init,
+	NULL, /* initPEM */
+	libssh2_hostkey_method_ecdsa_sig_verify,
+	NULL, /* signv */
+	NULL, /* encrypt */
+	libssh2_hostkey_method_ecdsa_dtor,
+};
+
+static LIBSSH2_HOSTKEY_METHOD libssh2_hostkey_method_ecdsa_ssh_nistp384 = {
+	"ecdsa-sha2-nistp384",
+	SHA384_DIGEST_LENGTH,
+	libssh2_hostkey_method_ecdsa_init,
+	NULL, /* initPEM */
+	libssh2_hostkey_method_ecdsa_sig_verify,
+	NULL, /* signv */
+	NULL, /* encrypt */
+	libssh2_hostkey_method_ecdsa_dtor,
+};
+#endif /* LIBSSH2_ECDSA */
+
+#if LIBSSH2_ED25519
+/* ***************
+   * ssh-ed25519 *
+   *************** */
+
+/* {{{ libssh2_hostkey_method_ssh_ed25519_init
+ * Initialize the server hostkey working area with the raw public key
+ */
+static int libssh2_hostkey_method_ssh_ed25519_init(LIBSSH2_SESSION *session,
+						   unsigned char *hostkey_data,
+						   unsigned long hostkey_data_len,
+						   void **abstract)
+{
+	libssh2_ed25519_ctx *edctx;
+	unsigned char *s = hostkey_data;
+	unsigned long len;
+
+	if (*abstract) {
+		_libssh2_ed25519_free((libssh2_ed25519_ctx *)*abstract);
+		*abstract = NULL;
+	}
+
+	/* keyname_len(4) + keyname(11){"ssh-ed25519"} + key_len(4) + key(32) */
+	if (hostkey_data_len != 19 + LIBSSH2_ED25519_KEY_LEN) {
+		return -1;
+	}
+	len = libssh2_ntohu32(s);					s += 4;
+	if (len != 11 || strncmp((char *)s, "ssh-ed25519", 11) != 0) {
+		return -1;
+	}											s += 11;
+	len = libssh2_ntohu32(s);					s += 4;
+
+	if (_libssh2_ed25519_new_public(&edctx, s, len)) {
+		libssh2_error(session, LIBSSH2_ERROR_HOSTKEY_INIT, "Invalid Ed25519 public key", 0);
+		return -1;
+	}
+
+	*abstract = edctx;
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_hostkey_method_ssh_ed25519_sig_verify
+ * Verify signature created by remote
+ */
+static int libssh2_hostkey_method_ssh_ed25519_sig_verify(LIBSSH2_SESSION *session,
+							 const unsigned char *sig,
+							 unsigned long sig_len,
+							 const unsigned char *m,
+							 unsigned long m_len,
+							 void **abstract)
+{
+	libssh2_ed25519_ctx *edctx = (libssh2_ed25519_ctx*)(*abstract);
+
+	/* keyname_len(4) + keyname(11){"ssh-ed25519"} + signature_len(4) + signature(64) */
+	if ((sig_len != 19 + LIBSSH2_ED25519_SIG_LEN) || (libssh2_ntohu32(sig + 15) != LIBSSH2_ED25519_SIG_LEN)) {
+		libssh2_error(session, LIBSSH2_ERROR_PROTO, "Invalid Ed25519 signature length", 0);
+		return -1;
+	}
+
+	return _libssh2_ed25519_verify(edctx, sig + 19, LIBSSH2_ED25519_SIG_LEN, m, m_len);
+}
+/* }}} */
+
+/* {{{ libssh2_hostkey_method_ssh_ed25519_dtor
+ * Shutdown the hostkey
+ */
+static int libssh2_hostkey_method_ssh_ed25519_dtor(LIBSSH2_SESSION *session,
+						   void **abstract)
+{
+	libssh2_ed25519_ctx *edctx = (libssh2_ed25519_ctx*)(*abstract);
+	(void)session;
+
+	if (edctx) {
+		_libssh2_ed25519_free(edctx);
+	}
+
+	*abstract = NULL;
+
+	return 0;
+}
+/* }}} */
+
+static LIBSSH2_HOSTKEY_METHOD libssh2_hostkey_method_ssh_ed25519 = {
+	"ssh-ed25519",
+	SHA256_DIGEST_LENGTH,
+	libssh2_hostkey_method_ssh_ed25519_init,
+	NULL, /* initPEM */
+	libssh2_hostkey_method_ssh_ed25519_sig_verify,
+	NULL, /* signv */
+	NULL, /* encrypt */
+	libssh2_hostkey_method_ssh_ed25519_dtor,
+};
+#endif /* LIBSSH2_ED25519 */
+
 static LIBSSH2_HOSTKEY_METHOD *_libssh2_hostkey_methods[] = {
+#if LIBSSH2_ED25519
+	&libssh2_hostkey_method_ssh_ed25519,
+#endif /* LIBSSH2_ED25519 */
+#if LIBSSH2_ECDSA
+	&libssh2_hostkey_method_ecdsa_ssh_nistp256,
+	&libssh2_hostkey_method_ecdsa_ssh_nistp384,
+#endif /* LIBSSH2_ECDSA */
 #if LIBSSH2_RSA
 	&libssh2_hostkey_method_ssh_rsa,
 #endif /* LIBSSH2_RSA */
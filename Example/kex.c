@@ -37,81 +37,151 @@
 
 #include "libssh2_priv.h"
 
-/* TODO: Switch this to an inline and handle alloc() failures */
-/* Helper macro called from libssh2_kex_method_diffie_hellman_group1_sha1_key_exchange */
-#define LIBSSH2_KEX_METHOD_DIFFIE_HELLMAN_SHA1_HASH(value, reqlen, version)	\
-{	\
-	libssh2_sha1_ctx hash;	\
-	unsigned long len = 0;	\
-	if (!(value)) {	\
-		value = LIBSSH2_ALLOC(session, reqlen + SHA_DIGEST_LENGTH); \
-	}								\
-	while (len < reqlen) {						\
-		libssh2_sha1_init(&hash);				\
-		libssh2_sha1_update(hash, k_value, k_value_len);	\
-		libssh2_sha1_update(hash, h_sig_comp, SHA_DIGEST_LENGTH); \
-		if (len > 0) {						\
-			libssh2_sha1_update(hash, value, len);		\
-		}	else {						\
-			libssh2_sha1_update(hash, (version), 1);	\
-			libssh2_sha1_update(hash, session->session_id, session->session_id_len); \
-		}							\
-		libssh2_sha1_final(hash, (value) + len);		\
-		len += SHA_DIGEST_LENGTH;				\
-	}								\
+/* {{{ libssh2_kex_hash_ctx
+ * Exchange hash state, SHA1 for the diffie-hellman methods or SHA2 for the elliptic curve ones
+ */
+typedef struct _libssh2_kex_hash_ctx {
+	unsigned long len;
+	union {
+		libssh2_sha1_ctx sha1;
+#if LIBSSH2_ECDSA || LIBSSH2_ED25519
+		libssh2_sha256_ctx sha256;
+		libssh2_sha384_ctx sha384;
+#endif
+	} u;
+} libssh2_kex_hash_ctx;
+
+#if LIBSSH2_ECDSA || LIBSSH2_ED25519
+#define LIBSSH2_KEX_HASH_MAX_LEN	SHA384_DIGEST_LENGTH
+#else
+#define LIBSSH2_KEX_HASH_MAX_LEN	SHA_DIGEST_LENGTH
+#endif
+
+static void libssh2_kex_hash_init(libssh2_kex_hash_ctx *hash, unsigned long len)
+{
+	hash->len = len;
+	switch (len) {
+#if LIBSSH2_ECDSA || LIBSSH2_ED25519
+		case SHA256_DIGEST_LENGTH:
+			libssh2_sha256_init(&hash->u.sha256);
+			break;
+		case SHA384_DIGEST_LENGTH:
+			libssh2_sha384_init(&hash->u.sha384);
+			break;
+#endif
+		default:
+			libssh2_sha1_init(&hash->u.sha1);
+			break;
+	}
 }
 
-/* {{{ libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange
- * Diffie Hellman Key Exchange, Group Agnostic
+static void libssh2_kex_hash_update(libssh2_kex_hash_ctx *hash, const void *data, unsigned long len)
+{
+	switch (hash->len) {
+#if LIBSSH2_ECDSA || LIBSSH2_ED25519
+		case SHA256_DIGEST_LENGTH:
+			libssh2_sha256_update(hash->u.sha256, data, len);
+			break;
+		case SHA384_DIGEST_LENGTH:
+			libssh2_sha384_update(hash->u.sha384, data, len);
+			break;
+#endif
+		default:
+			libssh2_sha1_update(hash->u.sha1, data, len);
+			break;
+	}
+}
+
+static void libssh2_kex_hash_final(libssh2_kex_hash_ctx *hash, unsigned char *out)
+{
+	switch (hash->len) {
+#if LIBSSH2_ECDSA || LIBSSH2_ED25519
+		case SHA256_DIGEST_LENGTH:
+			libssh2_sha256_final(hash->u.sha256, out);
+			break;
+		case SHA384_DIGEST_LENGTH:
+			libssh2_sha384_final(hash->u.sha384, out);
+			break;
+#endif
+		default:
+			libssh2_sha1_final(hash->u.sha1, out);
+			break;
+	}
+}
+/* }}} */
+
+/* {{{ libssh2_kex_derive_key
+ * HASH(K || H || version || session_id), extended with HASH(K || H || K1 || ...) until reqlen is covered (RFC 4253 section 7.2)
  */
-static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_SESSION *session, _libssh2_bn *g, _libssh2_bn *p, int group_order,
-																		unsigned char packet_type_init, unsigned char packet_type_reply,
-																		unsigned char *midhash, unsigned long midhash_len)
+static int libssh2_kex_derive_key(LIBSSH2_SESSION *session, unsigned char **value, unsigned long reqlen, const char *version,
+								  const unsigned char *k_value, unsigned long k_value_len, const unsigned char *h, unsigned long h_len)
 {
-	unsigned char *e_packet = NULL, *s_packet = NULL, *tmp, h_sig_comp[SHA_DIGEST_LENGTH], c;
-	unsigned long e_packet_len, s_packet_len, tmp_len;
-	int ret = 0;
-	_libssh2_bn_ctx *ctx = _libssh2_bn_ctx_new();
-	_libssh2_bn *x = _libssh2_bn_init(); /* Random from client */
-	_libssh2_bn *e = _libssh2_bn_init(); /* g^x mod p */
-	_libssh2_bn *f = _libssh2_bn_init(); /* g^(Random from server) mod p */
-	_libssh2_bn *k = _libssh2_bn_init(); /* The shared secret: f^x mod p */
-	unsigned char *s, *f_value, *k_value = NULL, *h_sig;
-	unsigned long f_value_len, k_value_len, h_sig_len;
-	libssh2_sha1_ctx exchange_hash;
+	libssh2_kex_hash_ctx hash;
+	unsigned long len = 0;
 
-	/* Generate x and e */
-	_libssh2_bn_rand(x, group_order, 0, -1);
-	_libssh2_bn_mod_exp(e, g, x, p, ctx);
+	*value = LIBSSH2_ALLOC(session, reqlen + h_len);
+	if (!*value) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate buffer for derived key", 0);
+		return -1;
+	}
 
-	/* Send KEX init */
-	e_packet_len = _libssh2_bn_bytes(e) + 6; /* packet_type(1) + String Length(4) + leading 0(1) */
-	if (_libssh2_bn_bits(e) % 8) {
-		/* Leading 00 not needed */
-		e_packet_len--;
+	while (len < reqlen) {
+		libssh2_kex_hash_init(&hash, h_len);
+		libssh2_kex_hash_update(&hash, k_value, k_value_len);
+		libssh2_kex_hash_update(&hash, h, h_len);
+		if (len > 0) {
+			libssh2_kex_hash_update(&hash, *value, len);
+		} else {
+			libssh2_kex_hash_update(&hash, version, 1);
+			libssh2_kex_hash_update(&hash, session->session_id, session->session_id_len);
+		}
+		libssh2_kex_hash_final(&hash, *value + len);
+		len += h_len;
 	}
-	e_packet = LIBSSH2_ALLOC(session, e_packet_len);
-	if (!e_packet) {
-		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Out of memory error", 0);
-		ret = -1;
-		goto clean_exit;
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_kex_bn_to_mpint
+ * Encode the shared secret as an SSH mpint, length included
+ */
+static int libssh2_kex_bn_to_mpint(LIBSSH2_SESSION *session, _libssh2_bn *k, unsigned char **k_value, unsigned long *k_value_len)
+{
+	*k_value_len = _libssh2_bn_bytes(k) + 5;
+	if (_libssh2_bn_bits(k) % 8) {
+		/* don't need leading 00 */
+		(*k_value_len)--;
 	}
-	e_packet[0] = packet_type_init;
-	libssh2_htonu32(e_packet + 1, e_packet_len - 5);
-	if (_libssh2_bn_bits(e) % 8) {
-		_libssh2_bn_to_bin(e, e_packet + 5);
+	*k_value = LIBSSH2_ALLOC(session, *k_value_len);
+	if (!*k_value) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate buffer for K", 0);
+		return -1;
+	}
+	libssh2_htonu32(*k_value, *k_value_len - 4);
+	if (_libssh2_bn_bits(k) % 8) {
+		_libssh2_bn_to_bin(k, *k_value + 4);
 	} else {
-		e_packet[5] = 0;
-		_libssh2_bn_to_bin(e, e_packet + 6);
+		(*k_value)[4] = 0;
+		_libssh2_bn_to_bin(k, *k_value + 5);
 	}
 
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_kex_exchange_init
+ * Send our half of the exchange and wait for the server's reply, skipping any badly guessed KEX packet
+ */
+static int libssh2_kex_exchange_init(LIBSSH2_SESSION *session, unsigned char *init_packet, unsigned long init_packet_len,
+									 unsigned char packet_type_reply, unsigned char **s_packet, unsigned long *s_packet_len)
+{
 #ifdef LIBSSH2_DEBUG_KEX
-	_libssh2_debug(session, LIBSSH2_DBG_KEX, "Sending KEX packet %d", (int)packet_type_init);
+	_libssh2_debug(session, LIBSSH2_DBG_KEX, "Sending KEX packet %d", (int)init_packet[0]);
 #endif
-	if (libssh2_packet_write(session, e_packet, e_packet_len)) {
+	if (libssh2_packet_write(session, init_packet, init_packet_len)) {
 		libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send KEX init message", 0);
-		ret = -11;
-		goto clean_exit;
+		return -11;
 	}
 
 	if (session->burn_optimistic_kexinit) {
@@ -124,8 +194,7 @@ static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_S
 		burn_type = libssh2_packet_burn(session);
 		if (burn_type <= 0) {
 			/* Failed to receive a packet */
-			ret = -1;
-			goto clean_exit;
+			return -1;
 		}
 		session->burn_optimistic_kexinit = 0;
 
@@ -135,24 +204,36 @@ static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_S
 	}
 
 	/* Wait for KEX reply */
-	if (libssh2_packet_require(session, packet_type_reply, &s_packet, &s_packet_len)) {
+	if (libssh2_packet_require(session, packet_type_reply, s_packet, s_packet_len)) {
 		libssh2_error(session, LIBSSH2_ERROR_TIMEOUT, "Timed out waiting for KEX reply", 0);
-		ret = -1;
-		goto clean_exit;
+		return -1;
 	}
 
-	/* Parse KEXDH_REPLY */
-	s = s_packet + 1;
+	return 0;
+}
+/* }}} */
 
+/* {{{ libssh2_kex_hostkey_import
+ * Copy the server's host key out of a KEX reply, fingerprint it and hand it to the negotiated hostkey method
+ * end is the end of the reply, a key claiming to run past it is refused
+ */
+static int libssh2_kex_hostkey_import(LIBSSH2_SESSION *session, unsigned char **data, unsigned char *end)
+{
+	unsigned char *s = *data;
+
+	if (((end - s) < 4) || (libssh2_ntohu32(s) > (unsigned long)(end - s - 4))) {
+		libssh2_error(session, LIBSSH2_ERROR_PROTO, "Host key runs past the end of the KEX reply", 0);
+		return -1;
+	}
 	session->server_hostkey_len = libssh2_ntohu32(s);			s += 4;
 	session->server_hostkey = LIBSSH2_ALLOC(session, session->server_hostkey_len);
 	if (!session->server_hostkey) {
 		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for a copy of the host key", 0);
-		ret = -1;
-		goto clean_exit;
+		return -1;
 	}
 	memcpy(session->server_hostkey, s, session->server_hostkey_len);
 	s += session->server_hostkey_len;
+	*data = s;
 
 #if LIBSSH2_MD5
 {
@@ -196,101 +277,59 @@ static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_S
 
 	if (session->hostkey->init(session, session->server_hostkey, session->server_hostkey_len, &session->server_hostkey_abstract)) {
 		libssh2_error(session, LIBSSH2_ERROR_HOSTKEY_INIT, "Unable to initialize hostkey importer", 0);
-		ret = -1;
-		goto clean_exit;
+		return -1;
 	}
 
-	f_value_len = libssh2_ntohu32(s);							s += 4;
-	f_value = s;												s += f_value_len;
-	_libssh2_bn_from_bin(f, f_value_len, f_value);
-
-	h_sig_len = libssh2_ntohu32(s);								s += 4;
-	h_sig = s;
+	return 0;
+}
+/* }}} */
 
-	/* Compute the shared secret */
-	_libssh2_bn_mod_exp(k, f, x, p, ctx);
-	k_value_len = _libssh2_bn_bytes(k) + 5;
-	if (_libssh2_bn_bits(k) % 8) {
-		/* don't need leading 00 */
-		k_value_len--;
-	}
-	k_value = LIBSSH2_ALLOC(session, k_value_len);
-	if (!k_value) {
-		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate buffer for K", 0);
-		ret = -1;
-		goto clean_exit;
-	}
-	libssh2_htonu32(k_value, k_value_len - 4);
-	if (_libssh2_bn_bits(k) % 8) {
-		_libssh2_bn_to_bin(k, k_value + 4);
-	} else {
-		k_value[4] = 0;
-		_libssh2_bn_to_bin(k, k_value + 5);
-	}
+/* {{{ libssh2_kex_exchange_hash_start
+ * Feed the fields every exchange hash starts with: V_C, V_S, I_C, I_S and K_S
+ */
+static void libssh2_kex_exchange_hash_start(LIBSSH2_SESSION *session, libssh2_kex_hash_ctx *exchange_hash)
+{
+	unsigned char len[4];
 
-	libssh2_sha1_init(&exchange_hash);
 	if (session->local.banner) {
-		libssh2_htonu32(h_sig_comp,
-				strlen((char *)session->local.banner) - 2);
-		libssh2_sha1_update(exchange_hash, h_sig_comp, 4);
-		libssh2_sha1_update(exchange_hash, (char *)session->local.banner,
+		libssh2_htonu32(len, strlen((char *)session->local.banner) - 2);
+		libssh2_kex_hash_update(exchange_hash, len, 4);
+		libssh2_kex_hash_update(exchange_hash, (char *)session->local.banner,
 			    strlen((char *)session->local.banner) - 2);
 	} else {
-		libssh2_htonu32(h_sig_comp, sizeof(LIBSSH2_SSH_DEFAULT_BANNER) - 1);
-		libssh2_sha1_update(exchange_hash, h_sig_comp, 4);
-		libssh2_sha1_update(exchange_hash, LIBSSH2_SSH_DEFAULT_BANNER,
+		libssh2_htonu32(len, sizeof(LIBSSH2_SSH_DEFAULT_BANNER) - 1);
+		libssh2_kex_hash_update(exchange_hash, len, 4);
+		libssh2_kex_hash_update(exchange_hash, LIBSSH2_SSH_DEFAULT_BANNER,
 			    sizeof(LIBSSH2_SSH_DEFAULT_BANNER) - 1);
 	}
 
-	libssh2_htonu32(h_sig_comp, strlen((char *)session->remote.banner));
-	libssh2_sha1_update(exchange_hash, h_sig_comp, 4);
-	libssh2_sha1_update(exchange_hash, session->remote.banner,
+	libssh2_htonu32(len, strlen((char *)session->remote.banner));
+	libssh2_kex_hash_update(exchange_hash, len, 4);
+	libssh2_kex_hash_update(exchange_hash, session->remote.banner,
 		    strlen((char *)session->remote.banner));
 
-	libssh2_htonu32(h_sig_comp, session->local.kexinit_len);
-	libssh2_sha1_update(exchange_hash,		h_sig_comp,							4);
-	libssh2_sha1_update(exchange_hash,		session->local.kexinit,				session->local.kexinit_len);
-
-	libssh2_htonu32(h_sig_comp, session->remote.kexinit_len);
-	libssh2_sha1_update(exchange_hash,		h_sig_comp,							4);
-	libssh2_sha1_update(exchange_hash,		session->remote.kexinit,			session->remote.kexinit_len);
-
-	libssh2_htonu32(h_sig_comp, session->server_hostkey_len);
-	libssh2_sha1_update(exchange_hash,		h_sig_comp,							4);
-	libssh2_sha1_update(exchange_hash,		session->server_hostkey,			session->server_hostkey_len);
-
-	if (packet_type_init == SSH_MSG_KEX_DH_GEX_INIT) {
-		/* diffie-hellman-group-exchange hashes additional fields */
-#ifdef LIBSSH2_DH_GEX_NEW
-		libssh2_htonu32(h_sig_comp,		LIBSSH2_DH_GEX_MINGROUP);
-		libssh2_htonu32(h_sig_comp + 4,	LIBSSH2_DH_GEX_OPTGROUP);
-		libssh2_htonu32(h_sig_comp + 8, LIBSSH2_DH_GEX_MAXGROUP);
-		libssh2_sha1_update(exchange_hash,	h_sig_comp,							12);
-#else
-		libssh2_htonu32(h_sig_comp,		LIBSSH2_DH_GEX_OPTGROUP);
-		libssh2_sha1_update(exchange_hash,	h_sig_comp,							4);
-#endif
-	}
-
-	if (midhash) {
-		libssh2_sha1_update(exchange_hash, midhash,							midhash_len);
-	}
+	libssh2_htonu32(len, session->local.kexinit_len);
+	libssh2_kex_hash_update(exchange_hash,		len,								4);
+	libssh2_kex_hash_update(exchange_hash,		session->local.kexinit,				session->local.kexinit_len);
 
-	libssh2_sha1_update(exchange_hash,		e_packet + 1,						e_packet_len - 1);
+	libssh2_htonu32(len, session->remote.kexinit_len);
+	libssh2_kex_hash_update(exchange_hash,		len,								4);
+	libssh2_kex_hash_update(exchange_hash,		session->remote.kexinit,			session->remote.kexinit_len);
 
-	libssh2_htonu32(h_sig_comp, f_value_len);
-	libssh2_sha1_update(exchange_hash,		h_sig_comp,							4);
-	libssh2_sha1_update(exchange_hash,		f_value,							f_value_len);
-
-	libssh2_sha1_update(exchange_hash,		k_value,							k_value_len);
-
-	libssh2_sha1_final(exchange_hash, h_sig_comp);
+	libssh2_htonu32(len, session->server_hostkey_len);
+	libssh2_kex_hash_update(exchange_hash,		len,								4);
+	libssh2_kex_hash_update(exchange_hash,		session->server_hostkey,			session->server_hostkey_len);
+}
+/* }}} */
 
-	if (session->hostkey->sig_verify(session, h_sig, h_sig_len, h_sig_comp, 20, &session->server_hostkey_abstract)) {
-		libssh2_error(session, LIBSSH2_ERROR_HOSTKEY_SIGN, "Unable to verify hostkey signature", 0);
-		ret = -1;
-		goto clean_exit;
-	}
+/* {{{ libssh2_kex_newkeys
+ * Exchange hash has been verified; swap NEWKEYS and derive IV/Secret/Key for each direction from K and H
+ */
+static int libssh2_kex_newkeys(LIBSSH2_SESSION *session, const unsigned char *k_value, unsigned long k_value_len,
+							   const unsigned char *h_sig_comp, unsigned long h_len)
+{
+	unsigned char *tmp, c;
+	unsigned long tmp_len;
 
 #ifdef LIBSSH2_DEBUG_KEX
 	_libssh2_debug(session, LIBSSH2_DBG_KEX, "Sending NEWKEYS message");
@@ -298,14 +337,12 @@ static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_S
 	c = SSH_MSG_NEWKEYS;
 	if (libssh2_packet_write(session, &c, 1)) {
 		libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send NEWKEYS message", 0);
-		ret = -1;
-		goto clean_exit;
+		return -1;
 	}
 
 	if (libssh2_packet_require(session, SSH_MSG_NEWKEYS, &tmp, &tmp_len)) {
 		libssh2_error(session, LIBSSH2_ERROR_TIMEOUT, "Timed out waiting for NEWKEYS", 0);
-		ret = -1;
-		goto clean_exit;
+		return -1;
 	}
 	/* The first key exchange has been performed, switch to active crypt/comp/mac mode */
 	session->state |= LIBSSH2_STATE_NEWKEYS;
@@ -317,13 +354,12 @@ static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_S
 	LIBSSH2_FREE(session, tmp);
 
 	if (!session->session_id) {
-		session->session_id = LIBSSH2_ALLOC(session, SHA_DIGEST_LENGTH);
+		session->session_id = LIBSSH2_ALLOC(session, h_len);
 		if (!session->session_id) {
-			ret = -1;
-			goto clean_exit;
+			return -1;
 		}
-		memcpy(session->session_id, h_sig_comp, SHA_DIGEST_LENGTH);
-		session->session_id_len = SHA_DIGEST_LENGTH;
+		memcpy(session->session_id, h_sig_comp, h_len);
+		session->session_id_len = h_len;
 #ifdef LIBSSH2_DEBUG_KEX
 	_libssh2_debug(session, LIBSSH2_DBG_KEX, "session_id calculated");
 #endif
@@ -339,13 +375,12 @@ static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_S
 		unsigned char *iv = NULL, *secret = NULL;
 		int free_iv = 0, free_secret = 0;
 
-		LIBSSH2_KEX_METHOD_DIFFIE_HELLMAN_SHA1_HASH(iv, session->local.crypt->iv_len, "A");
-		LIBSSH2_KEX_METHOD_DIFFIE_HELLMAN_SHA1_HASH(secret, session->local.crypt->secret_len, "C");
-		if (session->local.crypt->init(session, session->local.crypt, iv, &free_iv, secret, &free_secret, 1, &session->local.crypt_abstract)) {
-		  LIBSSH2_FREE(session, iv);
-		  LIBSSH2_FREE(session, secret);
-		  ret = -1;
-		  goto clean_exit;
+		if (libssh2_kex_derive_key(session, &iv, session->local.crypt->iv_len, "A", k_value, k_value_len, h_sig_comp, h_len) ||
+			libssh2_kex_derive_key(session, &secret, session->local.crypt->secret_len, "C", k_value, k_value_len, h_sig_comp, h_len) ||
+			session->local.crypt->init(session, session->local.crypt, iv, &free_iv, secret, &free_secret, 1, &session->local.crypt_abstract)) {
+			if (iv) LIBSSH2_FREE(session, iv);
+			if (secret) LIBSSH2_FREE(session, secret);
+			return -1;
 		}
 
 		if (free_iv) {
@@ -371,13 +406,12 @@ static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_S
 		unsigned char *iv = NULL, *secret = NULL;
 		int free_iv = 0, free_secret = 0;
 
-		LIBSSH2_KEX_METHOD_DIFFIE_HELLMAN_SHA1_HASH(iv, session->remote.crypt->iv_len, "B");
-		LIBSSH2_KEX_METHOD_DIFFIE_HELLMAN_SHA1_HASH(secret, session->remote.crypt->secret_len, "D");
-		if (session->remote.crypt->init(session, session->remote.crypt, iv, &free_iv, secret, &free_secret, 0, &session->remote.crypt_abstract)) {
-		  LIBSSH2_FREE(session, iv);
-		  LIBSSH2_FREE(session, secret);
-		  ret = -1;
-		  goto clean_exit;
+		if (libssh2_kex_derive_key(session, &iv, session->remote.crypt->iv_len, "B", k_value, k_value_len, h_sig_comp, h_len) ||
+			libssh2_kex_derive_key(session, &secret, session->remote.crypt->secret_len, "D", k_value, k_value_len, h_sig_comp, h_len) ||
+			session->remote.crypt->init(session, session->remote.crypt, iv, &free_iv, secret, &free_secret, 0, &session->remote.crypt_abstract)) {
+			if (iv) LIBSSH2_FREE(session, iv);
+			if (secret) LIBSSH2_FREE(session, secret);
+			return -1;
 		}
 
 		if (free_iv) {
@@ -402,7 +436,9 @@ static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_S
 		unsigned char *key = NULL;
 		int free_key = 0;
 
-		LIBSSH2_KEX_METHOD_DIFFIE_HELLMAN_SHA1_HASH(key, session->local.mac->key_len, "E");
+		if (libssh2_kex_derive_key(session, &key, session->local.mac->key_len, "E", k_value, k_value_len, h_sig_comp, h_len)) {
+			return -1;
+		}
 		session->local.mac->init(session, key, &free_key, &session->local.mac_abstract);
 
 		if (free_key) {
@@ -422,7 +458,9 @@ static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_S
 		unsigned char *key = NULL;
 		int free_key = 0;
 
-		LIBSSH2_KEX_METHOD_DIFFIE_HELLMAN_SHA1_HASH(key, session->remote.mac->key_len, "F");
+		if (libssh2_kex_derive_key(session, &key, session->remote.mac->key_len, "F", k_value, k_value_len, h_sig_comp, h_len)) {
+			return -1;
+		}
 		session->remote.mac->init(session, key, &free_key, &session->remote.mac_abstract);
 
 		if (free_key) {
@@ -434,6 +472,117 @@ static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_S
 	_libssh2_debug(session, LIBSSH2_DBG_KEX, "Server to Client HMAC Key calculated");
 #endif
 
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange
+ * Diffie Hellman Key Exchange, Group Agnostic
+ */
+static int libssh2_kex_method_diffie_hellman_groupGP_sha1_key_exchange(LIBSSH2_SESSION *session, _libssh2_bn *g, _libssh2_bn *p, int group_order,
+																		unsigned char packet_type_init, unsigned char packet_type_reply,
+																		unsigned char *midhash, unsigned long midhash_len)
+{
+	unsigned char *e_packet = NULL, *s_packet = NULL, h_sig_comp[SHA_DIGEST_LENGTH];
+	unsigned long e_packet_len, s_packet_len = 0;
+	int ret = 0;
+	_libssh2_bn_ctx *ctx = _libssh2_bn_ctx_new();
+	_libssh2_bn *x = _libssh2_bn_init(); /* Random from client */
+	_libssh2_bn *e = _libssh2_bn_init(); /* g^x mod p */
+	_libssh2_bn *f = _libssh2_bn_init(); /* g^(Random from server) mod p */
+	_libssh2_bn *k = _libssh2_bn_init(); /* The shared secret: f^x mod p */
+	unsigned char *s, *f_value, *k_value = NULL, *h_sig;
+	unsigned long f_value_len, k_value_len, h_sig_len;
+	libssh2_kex_hash_ctx exchange_hash;
+
+	/* Generate x and e */
+	_libssh2_bn_rand(x, group_order, 0, -1);
+	_libssh2_bn_mod_exp(e, g, x, p, ctx);
+
+	/* Send KEX init */
+	e_packet_len = _libssh2_bn_bytes(e) + 6; /* packet_type(1) + String Length(4) + leading 0(1) */
+	if (_libssh2_bn_bits(e) % 8) {
+		/* Leading 00 not needed */
+		e_packet_len--;
+	}
+	e_packet = LIBSSH2_ALLOC(session, e_packet_len);
+	if (!e_packet) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Out of memory error", 0);
+		ret = -1;
+		goto clean_exit;
+	}
+	e_packet[0] = packet_type_init;
+	libssh2_htonu32(e_packet + 1, e_packet_len - 5);
+	if (_libssh2_bn_bits(e) % 8) {
+		_libssh2_bn_to_bin(e, e_packet + 5);
+	} else {
+		e_packet[5] = 0;
+		_libssh2_bn_to_bin(e, e_packet + 6);
+	}
+
+	if ((ret = libssh2_kex_exchange_init(session, e_packet, e_packet_len, packet_type_reply, &s_packet, &s_packet_len))) {
+		goto clean_exit;
+	}
+
+	/* Parse KEXDH_REPLY */
+	s = s_packet + 1;
+	if (libssh2_kex_hostkey_import(session, &s, s_packet + s_packet_len)) {
+		ret = -1;
+		goto clean_exit;
+	}
+
+	f_value_len = libssh2_ntohu32(s);							s += 4;
+	f_value = s;												s += f_value_len;
+	_libssh2_bn_from_bin(f, f_value_len, f_value);
+
+	h_sig_len = libssh2_ntohu32(s);								s += 4;
+	h_sig = s;
+
+	/* Compute the shared secret */
+	_libssh2_bn_mod_exp(k, f, x, p, ctx);
+	if (libssh2_kex_bn_to_mpint(session, k, &k_value, &k_value_len)) {
+		ret = -1;
+		goto clean_exit;
+	}
+
+	libssh2_kex_hash_init(&exchange_hash, SHA_DIGEST_LENGTH);
+	libssh2_kex_exchange_hash_start(session, &exchange_hash);
+
+	if (packet_type_init == SSH_MSG_KEX_DH_GEX_INIT) {
+		/* diffie-hellman-group-exchange hashes additional fields */
+#ifdef LIBSSH2_DH_GEX_NEW
+		libssh2_htonu32(h_sig_comp,		LIBSSH2_DH_GEX_MINGROUP);
+		libssh2_htonu32(h_sig_comp + 4,	LIBSSH2_DH_GEX_OPTGROUP);
+		libssh2_htonu32(h_sig_comp + 8, LIBSSH2_DH_GEX_MAXGROUP);
+		libssh2_kex_hash_update(&exchange_hash,	h_sig_comp,						12);
+#else
+		libssh2_htonu32(h_sig_comp,		LIBSSH2_DH_GEX_OPTGROUP);
+		libssh2_kex_hash_update(&exchange_hash,	h_sig_comp,						4);
+#endif
+	}
+
+	if (midhash) {
+		libssh2_kex_hash_update(&exchange_hash, midhash,						midhash_len);
+	}
+
+	libssh2_kex_hash_update(&exchange_hash,		e_packet + 1,						e_packet_len - 1);
+
+	libssh2_htonu32(h_sig_comp, f_value_len);
+	libssh2_kex_hash_update(&exchange_hash,		h_sig_comp,							4);
+	libssh2_kex_hash_update(&exchange_hash,		f_value,							f_value_len);
+
+	libssh2_kex_hash_update(&exchange_hash,		k_value,							k_value_len);
+
+	libssh2_kex_hash_final(&exchange_hash, h_sig_comp);
+
+	if (session->hostkey->sig_verify(session, h_sig, h_sig_len, h_sig_comp, SHA_DIGEST_LENGTH, &session->server_hostkey_abstract)) {
+		libssh2_error(session, LIBSSH2_ERROR_HOSTKEY_SIGN, "Unable to verify hostkey signature", 0);
+		ret = -1;
+		goto clean_exit;
+	}
+
+	ret = libssh2_kex_newkeys(session, k_value, k_value_len, h_sig_comp, SHA_DIGEST_LENGTH);
+
  clean_exit:
 	_libssh2_bn_free(x);
 	_libssh2_bn_free(e);
@@ -626,6 +775,204 @@ static int libssh2_kex_method_diffie_hellman_group_exchange_sha1_key_exchange(LI
 }
 /* }}} */
 
+#if LIBSSH2_ECDSA || LIBSSH2_ED25519
+/* Computes K from our private key and the server's public value Q_S */
+typedef int (*libssh2_kex_ecdh_secret_func)(void *keyctx, const unsigned char *peer_q, unsigned long peer_q_len, _libssh2_bn *k);
+
+/* {{{ libssh2_kex_method_ecdh_key_exchange
+ * Elliptic Curve Diffie Hellman Key Exchange, Curve Agnostic (RFC 5656 section 4, also used by curve25519-sha256)
+ * q_packet holds packet_type(1) + Q_C(string), h_len picks the exchange hash
+ */
+static int libssh2_kex_method_ecdh_key_exchange(LIBSSH2_SESSION *session, unsigned char *q_packet, unsigned long q_packet_len, unsigned long h_len,
+												libssh2_kex_ecdh_secret_func shared_secret, void *keyctx)
+{
+	unsigned char *s_packet = NULL, *s, *end, *q_s, *k_value = NULL, *h_sig, h_sig_comp[LIBSSH2_KEX_HASH_MAX_LEN];
+	unsigned long s_packet_len = 0, q_s_len, k_value_len, h_sig_len;
+	_libssh2_bn *k = _libssh2_bn_init(); /* The shared secret */
+	libssh2_kex_hash_ctx exchange_hash;
+	int ret;
+
+	if ((ret = libssh2_kex_exchange_init(session, q_packet, q_packet_len, SSH_MSG_KEX_ECDH_REPLY, &s_packet, &s_packet_len))) {
+		goto clean_exit;
+	}
+
+	/* Parse KEX_ECDH_REPLY */
+	s = s_packet + 1;
+	end = s_packet + s_packet_len;
+	if (libssh2_kex_hostkey_import(session, &s, end)) {
+		ret = -1;
+		goto clean_exit;
+	}
+
+	if ((end - s) < 4) {
+		goto invalid_reply;
+	}
+	q_s_len = libssh2_ntohu32(s);								s += 4;
+	if (q_s_len > (unsigned long)(end - s)) {
+		goto invalid_reply;
+	}
+	q_s = s;													s += q_s_len;
+
+	if ((end - s) < 4) {
+		goto invalid_reply;
+	}
+	h_sig_len = libssh2_ntohu32(s);								s += 4;
+	if (h_sig_len > (unsigned long)(end - s)) {
+		goto invalid_reply;
+	}
+	h_sig = s;
+
+	/* Compute the shared secret */
+	if (shared_secret(keyctx, q_s, q_s_len, k)) {
+		libssh2_error(session, LIBSSH2_ERROR_KEX_FAILURE, "Unable to compute shared secret from server's public key", 0);
+		ret = -1;
+		goto clean_exit;
+	}
+	if (libssh2_kex_bn_to_mpint(session, k, &k_value, &k_value_len)) {
+		ret = -1;
+		goto clean_exit;
+	}
+
+	libssh2_kex_hash_init(&exchange_hash, h_len);
+	libssh2_kex_exchange_hash_start(session, &exchange_hash);
+
+	libssh2_kex_hash_update(&exchange_hash,		q_packet + 1,						q_packet_len - 1);
+
+	libssh2_htonu32(h_sig_comp, q_s_len);
+	libssh2_kex_hash_update(&exchange_hash,		h_sig_comp,							4);
+	libssh2_kex_hash_update(&exchange_hash,		q_s,								q_s_len);
+
+	libssh2_kex_hash_update(&exchange_hash,		k_value,							k_value_len);
+
+	libssh2_kex_hash_final(&exchange_hash, h_sig_comp);
+
+	if (session->hostkey->sig_verify(session, h_sig, h_sig_len, h_sig_comp, h_len, &session->server_hostkey_abstract)) {
+		libssh2_error(session, LIBSSH2_ERROR_HOSTKEY_SIGN, "Unable to verify hostkey signature", 0);
+		ret = -1;
+		goto clean_exit;
+	}
+
+	ret = libssh2_kex_newkeys(session, k_value, k_value_len, h_sig_comp, h_len);
+	goto clean_exit;
+
+ invalid_reply:
+	libssh2_error(session, LIBSSH2_ERROR_PROTO, "Invalid KEX_ECDH_REPLY", 0);
+	ret = -1;
+
+ clean_exit:
+	_libssh2_bn_free(k);
+
+	if (s_packet) {
+		LIBSSH2_FREE(session, s_packet);
+	}
+
+	if (k_value) {
+		LIBSSH2_FREE(session, k_value);
+	}
+
+	if (session->server_hostkey) {
+		LIBSSH2_FREE(session, session->server_hostkey);
+		session->server_hostkey = NULL;
+	}
+
+	return ret;
+}
+/* }}} */
+#endif /* LIBSSH2_ECDSA || LIBSSH2_ED25519 */
+
+#if LIBSSH2_ECDSA
+static int libssh2_kex_ecdh_sha2_nistp_secret(void *keyctx, const unsigned char *peer_q, unsigned long peer_q_len, _libssh2_bn *k)
+{
+	return _libssh2_ecdh_shared_secret((libssh2_ecdsa_ctx *)keyctx, peer_q, peer_q_len, k);
+}
+
+/* {{{ libssh2_kex_method_ecdh_sha2_nistp_key_exchange
+ * ECDH on a NIST curve, hashed with the SHA2 variant matching the curve size
+ */
+static int libssh2_kex_method_ecdh_sha2_nistp_key_exchange(LIBSSH2_SESSION *session, int curve, unsigned long h_len)
+{
+	/* packet_type(1) + String Length(4) + uncompressed point, big enough for nistp521 */
+	unsigned char q_packet[5 + 133];
+	unsigned long q_len = sizeof(q_packet) - 5;
+	libssh2_ecdsa_ctx *ecctx;
+	int ret;
+
+	if (_libssh2_ecdh_new_keypair(&ecctx, curve, q_packet + 5, &q_len)) {
+		libssh2_error(session, LIBSSH2_ERROR_KEX_FAILURE, "Unable to generate ECDH key pair", 0);
+		return -1;
+	}
+	q_packet[0] = SSH_MSG_KEX_ECDH_INIT;
+	libssh2_htonu32(q_packet + 1, q_len);
+
+	ret = libssh2_kex_method_ecdh_key_exchange(session, q_packet, q_len + 5, h_len, libssh2_kex_ecdh_sha2_nistp_secret, ecctx);
+
+	_libssh2_ecdsa_free(ecctx);
+
+	return ret;
+}
+/* }}} */
+
+/* {{{ libssh2_kex_method_ecdh_sha2_nistp256_key_exchange
+ */
+static int libssh2_kex_method_ecdh_sha2_nistp256_key_exchange(LIBSSH2_SESSION *session)
+{
+#ifdef LIBSSH2_DEBUG_KEX
+	_libssh2_debug(session, LIBSSH2_DBG_KEX, "Initiating ECDH nistp256 Key Exchange");
+#endif
+	return libssh2_kex_method_ecdh_sha2_nistp_key_exchange(session, LIBSSH2_EC_CURVE_NISTP256, SHA256_DIGEST_LENGTH);
+}
+/* }}} */
+
+/* {{{ libssh2_kex_method_ecdh_sha2_nistp384_key_exchange
+ */
+static int libssh2_kex_method_ecdh_sha2_nistp384_key_exchange(LIBSSH2_SESSION *session)
+{
+#ifdef LIBSSH2_DEBUG_KEX
+	_libssh2_debug(session, LIBSSH2_DBG_KEX, "Initiating ECDH nistp384 Key Exchange");
+#endif
+	return libssh2_kex_method_ecdh_sha2_nistp_key_exchange(session, LIBSSH2_EC_CURVE_NISTP384, SHA384_DIGEST_LENGTH);
+}
+/* }}} */
+#endif /* LIBSSH2_ECDSA */
+
+#if LIBSSH2_ED25519
+static int libssh2_kex_curve25519_secret(void *keyctx, const unsigned char *peer_q, unsigned long peer_q_len, _libssh2_bn *k)
+{
+	if (peer_q_len != LIBSSH2_X25519_KEY_LEN) {
+		return -1;
+	}
+
+	return _libssh2_x25519_shared_secret((libssh2_x25519_ctx *)keyctx, peer_q, k);
+}
+
+/* {{{ libssh2_kex_method_curve25519_sha256_key_exchange
+ * X25519 Key Exchange using SHA256 (RFC 8731)
+ */
+static int libssh2_kex_method_curve25519_sha256_key_exchange(LIBSSH2_SESSION *session)
+{
+	unsigned char q_packet[5 + LIBSSH2_X25519_KEY_LEN]; /* packet_type(1) + String Length(4) + public key(32) */
+	libssh2_x25519_ctx *xctx;
+	int ret;
+
+#ifdef LIBSSH2_DEBUG_KEX
+	_libssh2_debug(session, LIBSSH2_DBG_KEX, "Initiating Curve25519 Key Exchange");
+#endif
+	if (_libssh2_x25519_new_keypair(&xctx, q_packet + 5)) {
+		libssh2_error(session, LIBSSH2_ERROR_KEX_FAILURE, "Unable to generate X25519 key pair", 0);
+		return -1;
+	}
+	q_packet[0] = SSH_MSG_KEX_ECDH_INIT;
+	libssh2_htonu32(q_packet + 1, LIBSSH2_X25519_KEY_LEN);
+
+	ret = libssh2_kex_method_ecdh_key_exchange(session, q_packet, sizeof(q_packet), SHA256_DIGEST_LENGTH, libssh2_kex_curve25519_secret, xctx);
+
+	_libssh2_x25519_free(xctx);
+
+	return ret;
+}
+/* }}} */
+#endif /* LIBSSH2_ED25519 */
+
 #define LIBSSH2_KEX_METHOD_FLAG_REQ_ENC_HOSTKEY		0x0001
 #define LIBSSH2_KEX_METHOD_FLAG_REQ_SIGN_HOSTKEY	0x0002
 
@@ -647,7 +994,45 @@ LIBSSH2_KEX_METHOD libssh2_kex_method_diffie_helman_group_exchange_sha1 = {
 	LIBSSH2_KEX_METHOD_FLAG_REQ_SIGN_HOSTKEY,
 };
 
+#if LIBSSH2_ED25519
+LIBSSH2_KEX_METHOD libssh2_kex_method_curve25519_sha256 = {
+	"curve25519-sha256",
+	libssh2_kex_method_curve25519_sha256_key_exchange,
+	LIBSSH2_KEX_METHOD_FLAG_REQ_SIGN_HOSTKEY,
+};
+
+/* Same exchange under the name servers used before RFC 8731 */
+LIBSSH2_KEX_METHOD libssh2_kex_method_curve25519_sha256_libssh = {
+	"curve25519-sha256@libssh.org",
+	libssh2_kex_method_curve25519_sha256_key_exchange,
+	LIBSSH2_KEX_METHOD_FLAG_REQ_SIGN_HOSTKEY,
+};
+#endif /* LIBSSH2_ED25519 */
+
+#if LIBSSH2_ECDSA
+LIBSSH2_KEX_METHOD libssh2_kex_method_ecdh_sha2_nistp256 = {
+	"ecdh-sha2-nistp256",
+	libssh2_kex_method_ecdh_sha2_nistp256_key_exchange,
+	LIBSSH2_KEX_METHOD_FLAG_REQ_SIGN_HOSTKEY,
+};
+
+LIBSSH2_KEX_METHOD libssh2_kex_method_ecdh_sha2_nistp384 = {
+	"ecdh-sha2-nistp384",
+	libssh2_kex_method_ecdh_sha2_nistp384_key_exchange,
+	LIBSSH2_KEX_METHOD_FLAG_REQ_SIGN_HOSTKEY,
+};
+#endif /* LIBSSH2_ECDSA */
+
+/* Elliptic curve exchanges first: a fraction of the CPU time of group14 for equal or better strength */
 LIBSSH2_KEX_METHOD *libssh2_kex_methods[] = {
+#if LIBSSH2_ED25519
+	&libssh2_kex_method_curve25519_sha256,
+	&libssh2_kex_method_curve25519_sha256_libssh,
+#endif /* LIBSSH2_ED25519 */
+#if LIBSSH2_ECDSA
+	&libssh2_kex_method_ecdh_sha2_nistp256,
+	&libssh2_kex_method_ecdh_sha2_nistp384,
+#endif /* LIBSSH2_ECDSA */
 	&libssh2_kex_method_diffie_helman_group14_sha1,
 	&libssh2_kex_method_diffie_helman_group_exchange_sha1,
 	&libssh2_kex_method_diffie_helman_group1_sha1,
@@ -1051,6 +1436,12 @@ static int libssh2_kex_agree_mac(LIBSSH2_SESSION *session, libssh2_endpoint_data
 	LIBSSH2_MAC_METHOD **macp = libssh2_mac_methods();
 	unsigned char *s;
 
+	if (endpoint->crypt->flags & LIBSSH2_CRYPT_FLAG_AEAD) {
+		/* The cipher authenticates packets itself, whatever MAC the lists might agree on goes unused */
+		endpoint->mac = libssh2_mac_method_implicit();
+		return 0;
+	}
+
 	if (endpoint->mac_prefs) {
 		s = (unsigned char *)endpoint->mac_prefs;
 
@@ -139,6 +139,7 @@ typedef struct _LIBSSH2_USERAUTH_KBDINT_RESPONSE
 #define LIBSSH2_MACERROR_FUNC(name)					int	 name(LIBSSH2_SESSION *session, const char *packet, int packet_len, void **abstract)
 #define LIBSSH2_X11_OPEN_FUNC(name)					void name(LIBSSH2_SESSION *session, LIBSSH2_CHANNEL *channel, char *shost, int sport, void **abstract)
 
+#define LIBSSH2_SCP_PROGRESS_FUNC(name)				int	 name(LIBSSH2_SESSION *session, libssh2_uint64_t transferred, libssh2_uint64_t total, void *abstract)
 #define LIBSSH2_CHANNEL_CLOSE_FUNC(name)			void name(LIBSSH2_SESSION *session, void **session_abstract, LIBSSH2_CHANNEL *channel, void **channel_abstract)
 
 /* libssh2_session_callback_set() constants */
@@ -166,6 +167,7 @@ typedef struct _LIBSSH2_USERAUTH_KBDINT_RESPONSE
 typedef struct _LIBSSH2_SESSION						LIBSSH2_SESSION;
 typedef struct _LIBSSH2_CHANNEL						LIBSSH2_CHANNEL;
 typedef struct _LIBSSH2_LISTENER					LIBSSH2_LISTENER;
+typedef struct _LIBSSH2_POLLER						LIBSSH2_POLLER;
 
 typedef struct _LIBSSH2_POLLFD {
 	unsigned char type; /* LIBSSH2_POLLFD_* below */
@@ -180,6 +182,24 @@ typedef struct _LIBSSH2_POLLFD {
 	unsigned long revents; /* Returned Events */
 } LIBSSH2_POLLFD;
 
+/* Packet pool counters, see libssh2_session_pool_stats() */
+typedef struct _LIBSSH2_POOL_STATS {
+	unsigned long hits;			/* Headers/buffers handed out from the pool */
+	unsigned long misses;		/* Headers/buffers which had to be allocated */
+	unsigned long cached_bytes;	/* Memory currently held by spare headers/buffers */
+	unsigned long high_water;	/* Most memory ever held by spare headers/buffers */
+} LIBSSH2_POOL_STATS;
+
+/* Channel window counters, see libssh2_channel_window_stats() */
+typedef struct _LIBSSH2_CHANNEL_WINDOW_STATS {
+	unsigned long read_stalls;		/* Times the receive window fell below a full packet, leaving the remote waiting on us */
+	unsigned long write_stalls;		/* Times a write had to wait for the remote to open its window */
+	unsigned long grows;			/* Times auto-tuning enlarged the receive window */
+	unsigned long window_size;		/* Receive window currently offered */
+	unsigned long rtt_ms;			/* Smoothed round trip estimate, 0 until one has been measured */
+	libssh2_uint64_t bytes_read;	/* Channel data received */
+} LIBSSH2_CHANNEL_WINDOW_STATS;
+
 /* Poll FD Descriptor Types */
 #define LIBSSH2_POLLFD_SOCKET		1
 #define LIBSSH2_POLLFD_CHANNEL		2
@@ -258,6 +278,8 @@ typedef struct _LIBSSH2_POLLFD {
 #define LIBSSH2_ERROR_INVAL						-34
 #define LIBSSH2_ERROR_INVALID_POLL_TYPE			-35
 #define LIBSSH2_ERROR_PUBLICKEY_PROTOCOL		-36
+#define LIBSSH2_ERROR_ENCRYPT					-37
+#define LIBSSH2_ERROR_EAGAIN					-38
 
 /* Session API */
 LIBSSH2_API LIBSSH2_SESSION *libssh2_session_init_ex(LIBSSH2_ALLOC_FUNC((*my_alloc)), LIBSSH2_FREE_FUNC((*my_free)), LIBSSH2_REALLOC_FUNC((*my_realloc)), void *abstract);
@@ -283,6 +305,22 @@ LIBSSH2_API const char *libssh2_session_methods(LIBSSH2_SESSION *session, int me
 LIBSSH2_API int libssh2_session_last_error(LIBSSH2_SESSION *session, char **errmsg, int *errmsg_len, int want_buf);
 
 LIBSSH2_API int libssh2_session_flag(LIBSSH2_SESSION *session, int flag, int value);
+LIBSSH2_API void libssh2_session_pool_stats(LIBSSH2_SESSION *session, LIBSSH2_POOL_STATS *stats);
+LIBSSH2_API void libssh2_session_batch_begin(LIBSSH2_SESSION *session);
+LIBSSH2_API int libssh2_session_batch_end(LIBSSH2_SESSION *session);
+LIBSSH2_API int libssh2_session_compression_level(LIBSSH2_SESSION *session, int level);
+
+/* Non-blocking sessions
+ * Only channel reads and writes, libssh2_session_flush() and libssh2_session_batch_end() return LIBSSH2_ERROR_EAGAIN;
+ * startup, authentication, opening channels and SFTP still wait until they're done. Switch after libssh2_session_startup()
+ */
+#define LIBSSH2_SESSION_BLOCK_INBOUND			0x0001
+#define LIBSSH2_SESSION_BLOCK_OUTBOUND			0x0002
+
+LIBSSH2_API void libssh2_session_set_blocking(LIBSSH2_SESSION *session, int blocking);
+LIBSSH2_API int libssh2_session_get_blocking(LIBSSH2_SESSION *session);
+LIBSSH2_API int libssh2_session_block_directions(LIBSSH2_SESSION *session);
+LIBSSH2_API int libssh2_session_flush(LIBSSH2_SESSION *session);
 
 /* Userauth API */
 LIBSSH2_API char *libssh2_userauth_list(LIBSSH2_SESSION *session, const char *username, unsigned int username_len);
@@ -316,10 +354,23 @@ LIBSSH2_API int libssh2_userauth_keyboard_interactive_ex(LIBSSH2_SESSION* sessio
 
 LIBSSH2_API int libssh2_poll(LIBSSH2_POLLFD *fds, unsigned int nfds, long timeout);
 
+/* Persistent poller: descriptors are registered once and stay registered across waits.
+ * Registered LIBSSH2_POLLFDs are referenced, not copied, so must outlive their registration,
+ * and channels/listeners must be removed before they are freed.
+ * A session's descriptors can only be registered with one poller at a time. */
+LIBSSH2_API LIBSSH2_POLLER *libssh2_poller_init_ex(LIBSSH2_ALLOC_FUNC((*my_alloc)), LIBSSH2_FREE_FUNC((*my_free)), LIBSSH2_REALLOC_FUNC((*my_realloc)), void *abstract);
+#define libssh2_poller_init()						libssh2_poller_init_ex(NULL, NULL, NULL, NULL)
+LIBSSH2_API int libssh2_poller_add(LIBSSH2_POLLER *poller, LIBSSH2_POLLFD *fd);
+LIBSSH2_API int libssh2_poller_remove(LIBSSH2_POLLER *poller, LIBSSH2_POLLFD *fd);
+LIBSSH2_API int libssh2_poller_wait(LIBSSH2_POLLER *poller, LIBSSH2_POLLFD **ready, unsigned int max_ready, long timeout);
+LIBSSH2_API void libssh2_poller_free(LIBSSH2_POLLER *poller);
+
 /* Channel API */
 #define LIBSSH2_CHANNEL_WINDOW_DEFAULT	65536
 #define LIBSSH2_CHANNEL_PACKET_DEFAULT	16384
 #define LIBSSH2_CHANNEL_MINADJUST		1024
+/* Largest receive window auto-tuning grows to for libssh2's own bulk channels (SFTP, streaming SCP) */
+#define LIBSSH2_CHANNEL_WINDOW_MAX		(16 * 1024 * 1024)
 
 /* Extended Data Handling */
 #define LIBSSH2_CHANNEL_EXTENDED_DATA_NORMAL		0
@@ -365,6 +416,8 @@ LIBSSH2_API unsigned long libssh2_channel_window_read_ex(LIBSSH2_CHANNEL *channe
 #define libssh2_channel_window_read(channel)			libssh2_channel_window_read_ex((channel), NULL, NULL)
 
 LIBSSH2_API unsigned long libssh2_channel_receive_window_adjust(LIBSSH2_CHANNEL *channel, unsigned long adjustment, unsigned char force);
+LIBSSH2_API void libssh2_channel_window_autotune(LIBSSH2_CHANNEL *channel, unsigned long window_max);
+LIBSSH2_API void libssh2_channel_window_stats(LIBSSH2_CHANNEL *channel, LIBSSH2_CHANNEL_WINDOW_STATS *stats);
 
 LIBSSH2_API int libssh2_channel_write_ex(LIBSSH2_CHANNEL *channel, int stream_id, const char *buf, size_t buflen);
 #define libssh2_channel_write(channel, buf, buflen)					libssh2_channel_write_ex((channel), 0, (char *)(buf), (buflen))
@@ -399,6 +452,16 @@ LIBSSH2_API LIBSSH2_CHANNEL *libssh2_scp_recv(LIBSSH2_SESSION *session, const ch
 LIBSSH2_API LIBSSH2_CHANNEL *libssh2_scp_send_ex(LIBSSH2_SESSION *session, const char *path, int mode, size_t size, long mtime, long atime);
 #define libssh2_scp_send(session, path, mode, size)					libssh2_scp_send_ex((session), (path), (mode), (size), 0, 0)
 
+/* Whole file transfers, progress (may be NULL) is called after each chunk and can return non-zero to cancel */
+LIBSSH2_API int libssh2_scp_send_fd(LIBSSH2_SESSION *session, const char *path, int fd, int mode, size_t size, long mtime, long atime,
+										LIBSSH2_SCP_PROGRESS_FUNC((*progress)), void *abstract);
+LIBSSH2_API int libssh2_scp_send_mem(LIBSSH2_SESSION *session, const char *path, const char *buf, int mode, size_t size, long mtime, long atime,
+										LIBSSH2_SCP_PROGRESS_FUNC((*progress)), void *abstract);
+LIBSSH2_API int libssh2_scp_recv_fd(LIBSSH2_SESSION *session, const char *path, int fd, struct stat *sb,
+										LIBSSH2_SCP_PROGRESS_FUNC((*progress)), void *abstract);
+LIBSSH2_API int libssh2_scp_recv_mem(LIBSSH2_SESSION *session, const char *path, char *buf, size_t buf_len, struct stat *sb,
+										LIBSSH2_SCP_PROGRESS_FUNC((*progress)), void *abstract);
+
 LIBSSH2_API int libssh2_base64_decode(LIBSSH2_SESSION *session, char **dest, unsigned int *dest_len, char *src, unsigned int src_len);
 
 #ifdef __cplusplus
@@ -37,6 +37,13 @@
 /* Define to 1 if you have the <string.h> header file. */
 #define HAVE_STRING_H 1
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+/* Not from configure: this header is shared by every platform, and only Linux has epoll. Everywhere else,
+   the Mac included, libssh2_poller_wait() runs on its poll() fallback */
+#ifdef __linux__
+#define HAVE_SYS_EPOLL_H 1
+#endif
+
 /* Define to 1 if you have the <sys/select.h> header file. */
 #define HAVE_SYS_SELECT_H 1
 
@@ -82,6 +82,9 @@ typedef struct _LIBSSH2_PACKET				LIBSSH2_PACKET;
 typedef struct _LIBSSH2_PACKET_BRIGADE		LIBSSH2_PACKET_BRIGADE;
 typedef struct _LIBSSH2_CHANNEL_BRIGADE		LIBSSH2_CHANNEL_BRIGADE;
 
+/* Must be a power of two, channel ids are handed out sequentially so they spread evenly */
+#define LIBSSH2_CHANNEL_INDEX_BUCKETS	32
+
 struct _LIBSSH2_PACKET {
 	unsigned char type;
 
@@ -96,6 +99,9 @@ struct _LIBSSH2_PACKET {
 	/* Can the message be confirmed? */
 	int mac;
 
+	/* Allocated size of data if it came from libssh2_packet_buffer_alloc(), 0 otherwise */
+	unsigned long data_size;
+
 	LIBSSH2_PACKET_BRIGADE *brigade;
 
 	LIBSSH2_PACKET *next, *prev;
@@ -105,6 +111,22 @@ struct _LIBSSH2_PACKET_BRIGADE {
 	LIBSSH2_PACKET *head, *tail;
 };
 
+/* Payload size classes recycled by the packet pool, the largest covers LIBSSH2_PACKET_MAXPAYLOAD */
+#define LIBSSH2_PACKET_POOL_CLASSES		4
+/* Most spare buffers kept per class, and most spare packet headers */
+#define LIBSSH2_PACKET_POOL_DEPTH		16
+#define LIBSSH2_PACKET_POOL_HEADERS		64
+
+typedef struct _libssh2_packet_pool {
+	LIBSSH2_PACKET *headers;
+	unsigned long headers_count;
+
+	unsigned char *buffers[LIBSSH2_PACKET_POOL_CLASSES][LIBSSH2_PACKET_POOL_DEPTH];
+	unsigned long buffers_count[LIBSSH2_PACKET_POOL_CLASSES];
+
+	LIBSSH2_POOL_STATS stats;
+} libssh2_packet_pool;
+
 typedef struct _libssh2_channel_data {
 	/* Identifier */
 	unsigned long id;
@@ -128,10 +150,24 @@ struct _LIBSSH2_CHANNEL {
 	libssh2_channel_data local, remote;
 	unsigned long adjust_queue; /* Amount of bytes to be refunded to receive window (but not yet sent) */
 
+	/* Receive window auto-tuning, window_max of 0 leaves the window at the size it was opened with */
+	unsigned long window_max, window_target;
+	int window_exhausted;		/* The remote has used up the whole window since the last adjustment */
+	unsigned long adjust_sent_ms;	/* When an adjustment reopened an exhausted window, 0 once the data it let through arrives */
+	unsigned long rate_start_ms;
+	libssh2_uint64_t rate_bytes;	/* Received since rate_start_ms, for the throughput half of the bandwidth-delay product */
+	LIBSSH2_CHANNEL_WINDOW_STATS window_stats;
+
 	LIBSSH2_SESSION *session;
 
 	LIBSSH2_CHANNEL *next, *prev;
 
+	/* Next channel in the same session->channel_index bucket */
+	LIBSSH2_CHANNEL *index_next;
+
+	/* CHANNEL_DATA/CHANNEL_EXTENDED_DATA received for this channel, in arrival order */
+	LIBSSH2_PACKET_BRIGADE data;
+
 	void *abstract;
 	LIBSSH2_CHANNEL_CLOSE_FUNC((*close_cb));
 };
@@ -176,6 +212,8 @@ typedef struct _libssh2_endpoint_data {
 	char *lang_prefs;
 } libssh2_endpoint_data;
 
+typedef struct _LIBSSH2_POLLER_SOCKET LIBSSH2_POLLER_SOCKET;
+
 struct _LIBSSH2_SESSION {
 	/* Memory management callbacks */
 	void *abstract;
@@ -229,19 +267,48 @@ struct _LIBSSH2_SESSION {
 	/* (local as source of data -- packet_write ) */
 	libssh2_endpoint_data local;
 
+	/* zlib level for outgoing packets, -1 for zlib's default */
+	int comp_level;
+
 	/* Inbound Data buffer -- Sometimes the packet that comes in isn't the packet we're ready for */
 	LIBSSH2_PACKET_BRIGADE packets;
 
+	/* Spare packet headers and payload buffers */
+	libssh2_packet_pool packet_pool;
+
 	/* Active connection channels */
 	LIBSSH2_CHANNEL_BRIGADE channels;
 	unsigned long next_channel;
 
+	/* Active channels hashed on local.id for libssh2_channel_locate() */
+	LIBSSH2_CHANNEL *channel_index[LIBSSH2_CHANNEL_INDEX_BUCKETS];
+
 	LIBSSH2_LISTENER *listeners;
 
 	/* Actual I/O socket */
 	int socket_fd;
+	/* 0 for a non-blocking session, see libssh2_session_set_blocking() */
 	int socket_block;
 	int socket_state;
+	/* LIBSSH2_SESSION_BLOCK_* directions the last call was held up by */
+	int block_directions;
+	/* LIBSSH2_SOCKET_MODE_* last applied to socket_fd, so it's only changed when it needs to be */
+	int socket_mode;
+
+	/* Encrypted packets waiting to go out, the buffer is kept and only ever grows */
+	unsigned char *outbuf;
+	unsigned long outbuf_len, outbuf_size;
+	/* libssh2_session_batch_begin() nesting depth, while non-zero packets are held in outbuf */
+	int batch_depth;
+
+	/* Raw bytes read ahead by non-blocking sessions, consumed from inbuf_pos */
+	unsigned char *inbuf;
+	unsigned long inbuf_pos, inbuf_len, inbuf_size;
+	/* The first cipher block at inbuf_pos has already been decrypted */
+	int read_preamble;
+
+	/* Registration with a LIBSSH2_POLLER, marked whenever a packet arrives so the poller rechecks this session */
+	LIBSSH2_POLLER_SOCKET *poller_socket;
 
 	/* Error tracking */
 	char *err_msg;
@@ -251,6 +318,17 @@ struct _LIBSSH2_SESSION {
 };
 
 /* session.state bits */
+#define LIBSSH2_SOCKET_MODE_UNKNOWN		0
+#define LIBSSH2_SOCKET_MODE_BLOCKING	1
+#define LIBSSH2_SOCKET_MODE_NONBLOCKING	2
+
+/* Held packets are sent once this much has built up, even mid-batch */
+#define LIBSSH2_OUTBUF_FLUSH_AT			32768
+
+/* Non-blocking input buffer, starting size and the most it grows to (room for a whole packet and the start of the next) */
+#define LIBSSH2_INBUF_SIZE				16384
+#define LIBSSH2_INBUF_MAX				(2 * (LIBSSH2_PACKET_MAXPAYLOAD + 256))
+
 #define LIBSSH2_STATE_EXCHANGING_KEYS	0x00000001
 #define LIBSSH2_STATE_NEWKEYS			0x00000002
 #define LIBSSH2_STATE_AUTHENTICATED		0x00000004
@@ -304,8 +382,23 @@ struct _LIBSSH2_CRYPT_METHOD {
 	int (*dtor)(LIBSSH2_SESSION *session, void **abstract);
 
 	_libssh2_cipher_type(algo);
+
+	/* Optional: process len bytes (a multiple of blocksize) in one go, rather than a block per crypt() call */
+	int (*crypt_bulk)(LIBSSH2_SESSION *session, unsigned char *buf, size_t len, void **abstract);
+
+	/* LIBSSH2_CRYPT_FLAG_AEAD ciphers only, crypt/crypt_bulk aren't used and neither is the negotiated MAC
+	 * tag_len bytes of tag follow each packet instead
+	 * aead_length recovers packet_length from the first 4 bytes of a packet without altering them
+	 * aead_seal/aead_open encrypt/decrypt len bytes of packet (packet_length field included) in place, writing/checking the tag
+	 */
+	int tag_len;
+	int (*aead_length)(LIBSSH2_SESSION *session, unsigned long seqno, const unsigned char *buf, unsigned long *packet_len, void **abstract);
+	int (*aead_seal)(LIBSSH2_SESSION *session, unsigned long seqno, unsigned char *buf, size_t len, unsigned char *tag, void **abstract);
+	int (*aead_open)(LIBSSH2_SESSION *session, unsigned long seqno, unsigned char *buf, size_t len, const unsigned char *tag, void **abstract);
 };
 
+#define LIBSSH2_CRYPT_FLAG_AEAD		0x00000001
+
 struct _LIBSSH2_COMP_METHOD {
 	const char *name;
 
@@ -313,8 +406,18 @@ struct _LIBSSH2_COMP_METHOD {
 	int (*comp)(LIBSSH2_SESSION *session, int compress, unsigned char **dest, unsigned long *dest_len, unsigned long payload_limit, int *free_dest,
 												  const unsigned char *src, unsigned long src_len, void **abstract);
 	int (*dtor)(LIBSSH2_SESSION *session, int compress, void **abstract);
+
+	long flags;
 };
 
+/* Compression only starts once the server has accepted authentication (zlib@openssh.com) */
+#define LIBSSH2_COMP_FLAG_DELAYED	0x00000001
+
+/* Whether packets in this direction actually go through endpoint->comp yet */
+#define LIBSSH2_COMP_ACTIVE(session, endpoint)	\
+	((endpoint)->comp && strcmp((endpoint)->comp->name, "none") &&	\
+	 (!((endpoint)->comp->flags & LIBSSH2_COMP_FLAG_DELAYED) || ((session)->state & LIBSSH2_STATE_AUTHENTICATED)))
+
 struct _LIBSSH2_MAC_METHOD {
 	const char *name;
 
@@ -410,6 +513,10 @@ void _libssh2_debug(LIBSSH2_SESSION *session, int context, const char *format, .
 #define SSH_MSG_KEX_DH_GEX_INIT						32
 #define SSH_MSG_KEX_DH_GEX_REPLY					33
 
+/* ecdh-sha2-nistp256, ecdh-sha2-nistp384 and curve25519-sha256 */
+#define SSH_MSG_KEX_ECDH_INIT						30
+#define SSH_MSG_KEX_ECDH_REPLY						31
+
 /* User Authentication */
 #define SSH_MSG_USERAUTH_REQUEST					50
 #define SSH_MSG_USERAUTH_FAILURE					51
@@ -447,6 +554,10 @@ unsigned long libssh2_ntohu32(const unsigned char *buf);
 libssh2_uint64_t libssh2_ntohu64(const unsigned char *buf);
 void libssh2_htonu32(unsigned char *buf, unsigned long val);
 void libssh2_htonu64(unsigned char *buf, libssh2_uint64_t val);
+unsigned long libssh2_time_ms(void);
+
+void libssh2_poller_mark(LIBSSH2_POLLER_SOCKET *sock);
+void libssh2_poller_detach_session(LIBSSH2_SESSION *session);
 
 int libssh2_packet_read(LIBSSH2_SESSION *session, int block);
 int libssh2_packet_ask_ex(LIBSSH2_SESSION *session, unsigned char packet_type, unsigned char **data, unsigned long *data_len, unsigned long match_ofs, const unsigned char *match_buf, unsigned long match_len, int poll_socket);
@@ -463,9 +574,20 @@ int libssh2_packet_requirev_ex(LIBSSH2_SESSION *session, unsigned char *packet_t
 		libssh2_packet_requirev_ex((session), (packet_types), (data), (data_len), 0, NULL, 0)
 int libssh2_packet_burn(LIBSSH2_SESSION *session);
 int libssh2_packet_write(LIBSSH2_SESSION *session, unsigned char *data, unsigned long data_len);
+int libssh2_packet_flush(LIBSSH2_SESSION *session);
 int libssh2_kex_exchange(LIBSSH2_SESSION *session, int reexchange);
 unsigned long libssh2_channel_nextid(LIBSSH2_SESSION *session);
 LIBSSH2_CHANNEL *libssh2_channel_locate(LIBSSH2_SESSION *session, unsigned long channel_id);
+void libssh2_channel_add(LIBSSH2_SESSION *session, LIBSSH2_CHANNEL *channel);
+void libssh2_channel_unlink(LIBSSH2_SESSION *session, LIBSSH2_CHANNEL *channel);
+void libssh2_channel_data_free(LIBSSH2_CHANNEL *channel);
+LIBSSH2_PACKET *libssh2_packet_header_alloc(LIBSSH2_SESSION *session);
+void libssh2_packet_header_free(LIBSSH2_SESSION *session, LIBSSH2_PACKET *packet);
+unsigned char *libssh2_packet_buffer_alloc(LIBSSH2_SESSION *session, unsigned long size, unsigned long *data_size);
+void libssh2_packet_buffer_free(LIBSSH2_SESSION *session, unsigned char *data, unsigned long data_size);
+void libssh2_packet_free(LIBSSH2_SESSION *session, LIBSSH2_PACKET *packet);
+void libssh2_packet_pool_empty(LIBSSH2_SESSION *session);
+LIBSSH2_MAC_METHOD *libssh2_mac_method_implicit(void);
 
 /* Let crypt.c/hostkey.c/comp.c/mac.c expose their method structs */
 LIBSSH2_CRYPT_METHOD **libssh2_crypt_methods(void);
@@ -50,7 +50,26 @@ extern "C" {
 #define LIBSSH2_SFTP_VERSION		3
 #define LIBSSH2_SFTP_PACKET_MAXLEN	40000
 
+/* Largest FXP_READ issued by a pipelined handle, keeps the FXP_DATA reply inside LIBSSH2_SFTP_PACKET_MAXLEN */
+#define LIBSSH2_SFTP_READ_CHUNK_MAX	32768
+/* Largest FXP_WRITE issued by a pipelined handle, bigger writes are split */
+#define LIBSSH2_SFTP_WRITE_CHUNK_MAX	32768
+
+/* Most FXP_STAT requests libssh2_sftp_stat_batch() keeps in flight at once */
+#define LIBSSH2_SFTP_STAT_WINDOW		64
+
+/* Default share of a file each channel of an SFTP group takes at a time, and FXP_READ/FXP_WRITE requests each keeps in flight */
+#define LIBSSH2_SFTP_GROUP_STRIPE_DEFAULT	(4 * 1024 * 1024)
+#define LIBSSH2_SFTP_GROUP_WINDOW_DEFAULT	8
+
+/* Group transfer callback, hands over (download) or fills in (upload) len bytes at offset of the remote file
+ * Ranges arrive in no particular order, and a range whose channel failed is asked for again
+ * Return non-zero to abandon the transfer
+ */
+#define LIBSSH2_SFTP_STRIPE_FUNC(name)	int name(libssh2_uint64_t offset, char *buffer, unsigned long len, void **abstract)
+
 typedef struct _LIBSSH2_SFTP				LIBSSH2_SFTP;
+typedef struct _LIBSSH2_SFTP_GROUP			LIBSSH2_SFTP_GROUP;
 typedef struct _LIBSSH2_SFTP_HANDLE			LIBSSH2_SFTP_HANDLE;
 typedef struct _LIBSSH2_SFTP_ATTRIBUTES		LIBSSH2_SFTP_ATTRIBUTES;
 
@@ -92,6 +111,45 @@ struct _LIBSSH2_SFTP_ATTRIBUTES {
 	unsigned long atime, mtime;
 };
 
+/* Server extensions, as advertised in the FXP_VERSION reply, see libssh2_sftp_extensions() */
+#define LIBSSH2_SFTP_EXT_COPY_DATA			0x00000001
+#define LIBSSH2_SFTP_EXT_COPY_FILE			0x00000002
+#define LIBSSH2_SFTP_EXT_CHECK_FILE_HANDLE	0x00000004
+#define LIBSSH2_SFTP_EXT_CHECK_FILE_NAME	0x00000008
+#define LIBSSH2_SFTP_EXT_POSIX_RENAME		0x00000010
+#define LIBSSH2_SFTP_EXT_STATVFS			0x00000020
+#define LIBSSH2_SFTP_EXT_FSTATVFS			0x00000040
+#define LIBSSH2_SFTP_EXT_FSYNC				0x00000080
+
+/* statvfs@openssh.com f_flag bits */
+#define LIBSSH2_SFTP_ST_RDONLY				0x00000001
+#define LIBSSH2_SFTP_ST_NOSUID				0x00000002
+
+typedef struct _LIBSSH2_SFTP_STATVFS {
+	libssh2_uint64_t f_bsize;		/* file system block size */
+	libssh2_uint64_t f_frsize;		/* fragment size */
+	libssh2_uint64_t f_blocks;		/* size of fs in f_frsize units */
+	libssh2_uint64_t f_bfree;		/* # free blocks */
+	libssh2_uint64_t f_bavail;		/* # free blocks for non-root */
+	libssh2_uint64_t f_files;		/* # inodes */
+	libssh2_uint64_t f_ffree;		/* # free inodes */
+	libssh2_uint64_t f_favail;		/* # free inodes for non-root */
+	libssh2_uint64_t f_fsid;		/* file system ID */
+	libssh2_uint64_t f_flag;		/* LIBSSH2_SFTP_ST_* */
+	libssh2_uint64_t f_namemax;		/* maximum filename length */
+} LIBSSH2_SFTP_STATVFS;
+
+/* Directory entry as handed back by libssh2_sftp_readdir_batch()
+ * filename and longentry are null terminated and owned by the handle
+ */
+typedef struct _LIBSSH2_SFTP_DIRENT {
+	const char *filename;
+	unsigned long filename_len;
+	const char *longentry;
+	unsigned long longentry_len;
+	LIBSSH2_SFTP_ATTRIBUTES attrs;
+} LIBSSH2_SFTP_DIRENT;
+
 /* SFTP filetypes */
 #define LIBSSH2_SFTP_TYPE_REGULAR			1
 #define LIBSSH2_SFTP_TYPE_DIRECTORY			2
@@ -180,8 +238,16 @@ LIBSSH2_API LIBSSH2_SFTP_HANDLE *libssh2_sftp_open_ex(LIBSSH2_SFTP *sftp, char *
 #define libssh2_sftp_opendir(sftp, path)						libssh2_sftp_open_ex((sftp), (char *)(path), strlen((char *)path), 0, 0, LIBSSH2_SFTP_OPENDIR)
 
 LIBSSH2_API size_t libssh2_sftp_read(LIBSSH2_SFTP_HANDLE *handle, char *buffer, size_t buffer_maxlen);
+LIBSSH2_API int libssh2_sftp_read_window_ex(LIBSSH2_SFTP_HANDLE *handle, unsigned int window, unsigned long chunk_len);
+#define libssh2_sftp_read_window(handle, window)				libssh2_sftp_read_window_ex((handle), (window), LIBSSH2_SFTP_READ_CHUNK_MAX)
+LIBSSH2_API size_t libssh2_sftp_read_borrow(LIBSSH2_SFTP_HANDLE *handle, const char **buffer, size_t buffer_maxlen);
+LIBSSH2_API void libssh2_sftp_read_release(LIBSSH2_SFTP_HANDLE *handle);
 LIBSSH2_API int libssh2_sftp_readdir(LIBSSH2_SFTP_HANDLE *handle, char *buffer, size_t buffer_maxlen, LIBSSH2_SFTP_ATTRIBUTES *attrs);
+LIBSSH2_API int libssh2_sftp_readdir_prefetch(LIBSSH2_SFTP_HANDLE *handle, int enable);
+LIBSSH2_API int libssh2_sftp_readdir_batch(LIBSSH2_SFTP_HANDLE *handle, LIBSSH2_SFTP_DIRENT **entries);
 LIBSSH2_API size_t libssh2_sftp_write(LIBSSH2_SFTP_HANDLE *handle, const char *buffer, size_t count);
+LIBSSH2_API int libssh2_sftp_write_window(LIBSSH2_SFTP_HANDLE *handle, unsigned int window);
+LIBSSH2_API int libssh2_sftp_write_flush(LIBSSH2_SFTP_HANDLE *handle, libssh2_uint64_t *failed_offset);
 
 LIBSSH2_API int libssh2_sftp_close_handle(LIBSSH2_SFTP_HANDLE *handle);
 #define libssh2_sftp_close(handle)					libssh2_sftp_close_handle(handle)
@@ -218,12 +284,61 @@ LIBSSH2_API int libssh2_sftp_stat_ex(LIBSSH2_SFTP *sftp, char *path, unsigned in
 #define libssh2_sftp_stat(sftp, path, attrs)				libssh2_sftp_stat_ex((sftp), (path), strlen(path), LIBSSH2_SFTP_STAT, (attrs))
 #define libssh2_sftp_lstat(sftp, path, attrs)				libssh2_sftp_stat_ex((sftp), (path), strlen(path), LIBSSH2_SFTP_LSTAT, (attrs))
 #define libssh2_sftp_setstat(sftp, path, attrs)				libssh2_sftp_stat_ex((sftp), (path), strlen(path), LIBSSH2_SFTP_SETSTAT, (attrs))
+LIBSSH2_API int libssh2_sftp_stat_batch(LIBSSH2_SFTP *sftp, const char **paths, unsigned int count, int stat_type, LIBSSH2_SFTP_ATTRIBUTES *attrs, unsigned long *errors);
 
 LIBSSH2_API int libssh2_sftp_symlink_ex(LIBSSH2_SFTP *sftp, const char *path, unsigned int path_len, char *target, unsigned int target_len, int link_type);
 #define libssh2_sftp_symlink(sftp, orig, linkpath)			libssh2_sftp_symlink_ex((sftp), (orig), strlen(orig), (linkpath), strlen(linkpath), LIBSSH2_SFTP_SYMLINK)
 #define libssh2_sftp_readlink(sftp, path, target, maxlen)	libssh2_sftp_symlink_ex((sftp), (path), strlen(path), (target), (maxlen), LIBSSH2_SFTP_READLINK)
 #define libssh2_sftp_realpath(sftp, path, target, maxlen)	libssh2_sftp_symlink_ex((sftp), (path), strlen(path), (target), (maxlen), LIBSSH2_SFTP_REALPATH)
 
+/* Server extensions
+ * Each fails with LIBSSH2_ERROR_METHOD_NOT_SUPPORTED if the server doesn't offer what it needs,
+ * so the caller can fall back to doing the work over the wire
+ */
+LIBSSH2_API unsigned long libssh2_sftp_extensions(LIBSSH2_SFTP *sftp);
+
+LIBSSH2_API int libssh2_sftp_copy_data(LIBSSH2_SFTP_HANDLE *src, libssh2_uint64_t src_offset, libssh2_uint64_t len,
+																LIBSSH2_SFTP_HANDLE *dest, libssh2_uint64_t dest_offset);
+LIBSSH2_API int libssh2_sftp_copy_file_ex(LIBSSH2_SFTP *sftp, const char *source_filename, unsigned int source_filename_len,
+															const char *dest_filename, unsigned int dest_filename_len, int overwrite);
+#define libssh2_sftp_copy_file(sftp, sourcefile, destfile, overwrite)	libssh2_sftp_copy_file_ex((sftp), (sourcefile), strlen(sourcefile), (destfile), strlen(destfile), (overwrite))
+
+LIBSSH2_API int libssh2_sftp_check_file_handle(LIBSSH2_SFTP_HANDLE *handle, const char *algorithms, libssh2_uint64_t offset, libssh2_uint64_t length,
+												unsigned long block_size, char *algorithm, size_t algorithm_maxlen, unsigned char *hashes, size_t hashes_maxlen);
+LIBSSH2_API int libssh2_sftp_check_file_name_ex(LIBSSH2_SFTP *sftp, const char *path, unsigned int path_len, const char *algorithms,
+												libssh2_uint64_t offset, libssh2_uint64_t length, unsigned long block_size,
+												char *algorithm, size_t algorithm_maxlen, unsigned char *hashes, size_t hashes_maxlen);
+#define libssh2_sftp_check_file_name(sftp, path, algorithms, algorithm, algorithm_maxlen, hashes, hashes_maxlen) \
+	libssh2_sftp_check_file_name_ex((sftp), (path), strlen(path), (algorithms), 0, 0, 0, (algorithm), (algorithm_maxlen), (hashes), (hashes_maxlen))
+
+LIBSSH2_API int libssh2_sftp_posix_rename_ex(LIBSSH2_SFTP *sftp, const char *source_filename, unsigned int source_filename_len,
+																const char *dest_filename, unsigned int dest_filename_len);
+#define libssh2_sftp_posix_rename(sftp, sourcefile, destfile)	libssh2_sftp_posix_rename_ex((sftp), (sourcefile), strlen(sourcefile), (destfile), strlen(destfile))
+
+LIBSSH2_API int libssh2_sftp_statvfs_ex(LIBSSH2_SFTP *sftp, const char *path, unsigned int path_len, LIBSSH2_SFTP_STATVFS *st);
+#define libssh2_sftp_statvfs(sftp, path, st)					libssh2_sftp_statvfs_ex((sftp), (path), strlen(path), (st))
+LIBSSH2_API int libssh2_sftp_fstatvfs(LIBSSH2_SFTP_HANDLE *handle, LIBSSH2_SFTP_STATVFS *st);
+
+LIBSSH2_API int libssh2_sftp_fsync(LIBSSH2_SFTP_HANDLE *handle);
+
+/* SFTP groups
+ * Several "sftp" subsystem channels on one session, with the ranges of a file striped across them
+ */
+LIBSSH2_API LIBSSH2_SFTP_GROUP *libssh2_sftp_group_init(LIBSSH2_SESSION *session, unsigned int channels);
+LIBSSH2_API int libssh2_sftp_group_shutdown(LIBSSH2_SFTP_GROUP *group);
+LIBSSH2_API unsigned int libssh2_sftp_group_channels(LIBSSH2_SFTP_GROUP *group);
+LIBSSH2_API LIBSSH2_SFTP *libssh2_sftp_group_member(LIBSSH2_SFTP_GROUP *group, unsigned int index);
+LIBSSH2_API void libssh2_sftp_group_stripe(LIBSSH2_SFTP_GROUP *group, unsigned long stripe_len, unsigned int window);
+LIBSSH2_API int libssh2_sftp_group_download_ex(LIBSSH2_SFTP_GROUP *group, const char *path, unsigned int path_len,
+											   libssh2_uint64_t offset, libssh2_uint64_t length,
+											   LIBSSH2_SFTP_STRIPE_FUNC((*sink)), void *abstract);
+#define libssh2_sftp_group_download(group, path, sink, abstract)	libssh2_sftp_group_download_ex((group), (path), strlen(path), 0, 0, (sink), (abstract))
+LIBSSH2_API int libssh2_sftp_group_upload_ex(LIBSSH2_SFTP_GROUP *group, const char *path, unsigned int path_len, long mode,
+											 libssh2_uint64_t length, LIBSSH2_SFTP_STRIPE_FUNC((*source)), void *abstract);
+#define libssh2_sftp_group_upload(group, path, mode, length, source, abstract)	libssh2_sftp_group_upload_ex((group), (path), strlen(path), (mode), (length), (source), (abstract))
+LIBSSH2_API unsigned long libssh2_sftp_group_last_error(LIBSSH2_SFTP_GROUP *group);
+LIBSSH2_API unsigned long libssh2_sftp_group_retries(LIBSSH2_SFTP_GROUP *group);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -272,3 +272,28 @@ LIBSSH2_MAC_METHOD **libssh2_mac_methods(void) {
 	return _libssh2_mac_methods;
 }
 
+/* {{{ libssh2_mac_implicit_MAC
+ * AEAD ciphers authenticate packets themselves
+ */
+static int libssh2_mac_implicit_MAC(LIBSSH2_SESSION *session, unsigned char *buf, unsigned long seqno,
+															  const unsigned char *packet, unsigned long packet_len,
+															  const unsigned char *addtl, unsigned long addtl_len, void **abstract)
+{
+	return 0;
+}
+/* }}} */
+
+/* Never negotiated, stands in as endpoint->mac whenever the cipher is LIBSSH2_CRYPT_FLAG_AEAD */
+static LIBSSH2_MAC_METHOD libssh2_mac_method_implicit_aead = {
+	"<implicit>",
+	0,
+	0,
+	NULL,
+	libssh2_mac_implicit_MAC,
+	NULL
+};
+
+LIBSSH2_MAC_METHOD *libssh2_mac_method_implicit(void) {
+	return &libssh2_mac_method_implicit_aead;
+}
+
@@ -36,6 +36,11 @@
  */
 
 #include "libssh2_priv.h"
+#ifdef HAVE_GETTIMEOFDAY
+#include <sys/time.h>
+#else
+#include <time.h>
+#endif
 
 /* {{{ libssh2_ntohu32
  */
@@ -89,6 +94,22 @@ void libssh2_htonu64(unsigned char *buf, libssh2_uint64_t value)
 }
 /* }}} */
 
+/* {{{ libssh2_time_ms
+ * Millisecond clock for interval measurements, wraps after ~49 days so only differences are meaningful
+ */
+unsigned long libssh2_time_ms(void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#else
+	return (unsigned long)time(NULL) * 1000;
+#endif
+}
+/* }}} */
+
 /* Base64 Conversion */
 
 /* {{{ */
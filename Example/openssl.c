@@ -163,8 +163,14 @@ int _libssh2_cipher_init (_libssh2_cipher_ctx *h,
 			  unsigned char *secret,
 			  int encrypt)
 {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if (!(*h = EVP_CIPHER_CTX_new())) {
+		return -1;
+	}
+#else
 	EVP_CIPHER_CTX_init(h);
-	EVP_CipherInit(h, algo(), secret, iv, encrypt);
+#endif
+	EVP_CipherInit(_libssh2_cipher_evp(h), algo(), secret, iv, encrypt);
 	return 0;
 }
 
@@ -173,7 +179,7 @@ int _libssh2_cipher_crypt(_libssh2_cipher_ctx *ctx,
 			  int encrypt,
 			  unsigned char *block)
 {
-	int blocksize = ctx->cipher->block_size;
+	int blocksize = EVP_CIPHER_CTX_block_size(_libssh2_cipher_evp(ctx));
 	unsigned char buf[EVP_MAX_BLOCK_LENGTH];
 	int ret;
 	(void)algo;
@@ -183,13 +189,78 @@ int _libssh2_cipher_crypt(_libssh2_cipher_ctx *ctx,
 /* Hack for arcfour. */
 		blocksize = 8;
 	}
-	ret = EVP_Cipher(ctx, buf, block, blocksize);
+	ret = EVP_Cipher(_libssh2_cipher_evp(ctx), buf, block, blocksize);
 	if (ret == 1) {
 		memcpy(block, buf, blocksize);
 	}
 	return ret == 1 ? 0 : 1;
 }
 
+/* Whole packets at a time, in place, so OpenSSL can use its multi-block code paths */
+int _libssh2_cipher_crypt_bulk(_libssh2_cipher_ctx *ctx,
+			       _libssh2_cipher_type(algo),
+			       int encrypt,
+			       unsigned char *buf,
+			       size_t len)
+{
+	(void)algo;
+	(void)encrypt;
+
+	return EVP_Cipher(_libssh2_cipher_evp(ctx), buf, buf, len) == 1 ? 0 : 1;
+}
+
+int _libssh2_cipher_gcm_init(_libssh2_cipher_ctx *h,
+			     _libssh2_cipher_type(algo),
+			     unsigned char *secret,
+			     int encrypt)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if (!(*h = EVP_CIPHER_CTX_new())) {
+		return -1;
+	}
+#else
+	EVP_CIPHER_CTX_init(h);
+#endif
+	if ((EVP_CipherInit_ex(_libssh2_cipher_evp(h), algo(), NULL, secret, NULL, encrypt) != 1) ||
+	    (EVP_CIPHER_CTX_ctrl(_libssh2_cipher_evp(h), EVP_CTRL_GCM_SET_IVLEN, 12, NULL) != 1)) {
+		_libssh2_cipher_dtor(h);
+		return -1;
+	}
+	return 0;
+}
+
+/* One packet: aad is authenticated only, buf is en/decrypted in place
+ * tag (16 bytes) is written when encrypting and checked when decrypting
+ */
+int _libssh2_cipher_gcm_crypt(_libssh2_cipher_ctx *h,
+			      int encrypt,
+			      const unsigned char *iv,
+			      const unsigned char *aad,
+			      size_t aad_len,
+			      unsigned char *buf,
+			      size_t len,
+			      unsigned char *tag)
+{
+	EVP_CIPHER_CTX *evp = _libssh2_cipher_evp(h);
+	int outlen;
+
+	if (EVP_CipherInit_ex(evp, NULL, NULL, NULL, iv, -1) != 1) {
+		return -1;
+	}
+	if (!encrypt && (EVP_CIPHER_CTX_ctrl(evp, EVP_CTRL_GCM_SET_TAG, 16, tag) != 1)) {
+		return -1;
+	}
+	if ((EVP_CipherUpdate(evp, NULL, &outlen, aad, aad_len) != 1) ||
+	    (EVP_CipherUpdate(evp, buf, &outlen, buf, len) != 1) ||
+	    (EVP_CipherFinal_ex(evp, buf + outlen, &outlen) != 1)) {
+		return -1;
+	}
+	if (encrypt && (EVP_CIPHER_CTX_ctrl(evp, EVP_CTRL_GCM_GET_TAG, 16, tag) != 1)) {
+		return -1;
+	}
+	return 0;
+}
+
 /* TODO: Optionally call a passphrase callback specified by the
  * calling program
  */
@@ -311,3 +382,221 @@ int _libssh2_dsa_sha1_sign(libssh2_dsa_ctx *dsactx,
 
 	return 0;
 }
+
+#if LIBSSH2_ECDSA
+int _libssh2_ecdsa_new_public(libssh2_ecdsa_ctx **ecctx,
+			      int curve,
+			      const unsigned char *q,
+			      unsigned long q_len)
+{
+	EC_KEY *key = EC_KEY_new_by_curve_name(curve);
+	EC_POINT *point;
+
+	if (!key) {
+		return -1;
+	}
+
+	point = EC_POINT_new(EC_KEY_get0_group(key));
+	if (!point ||
+	    (EC_POINT_oct2point(EC_KEY_get0_group(key), point, q, q_len, NULL) != 1) ||
+	    (EC_KEY_set_public_key(key, point) != 1)) {
+		if (point) {
+			EC_POINT_free(point);
+		}
+		EC_KEY_free(key);
+		return -1;
+	}
+	EC_POINT_free(point);
+
+	*ecctx = key;
+
+	return 0;
+}
+
+int _libssh2_ecdsa_verify(libssh2_ecdsa_ctx *ecctx,
+			  const unsigned char *r,
+			  unsigned long r_len,
+			  const unsigned char *s,
+			  unsigned long s_len,
+			  const unsigned char *hash,
+			  unsigned long hash_len)
+{
+	ECDSA_SIG *sig = ECDSA_SIG_new();
+	BIGNUM *sig_r, *sig_s;
+	int ret;
+
+	if (!sig) {
+		return -1;
+	}
+	sig_r = BN_bin2bn(r, r_len, NULL);
+	sig_s = BN_bin2bn(s, s_len, NULL);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	ECDSA_SIG_set0(sig, sig_r, sig_s);
+#else
+	BN_free(sig->r);
+	sig->r = sig_r;
+	BN_free(sig->s);
+	sig->s = sig_s;
+#endif
+
+	ret = ECDSA_do_verify(hash, hash_len, sig, ecctx);
+	ECDSA_SIG_free(sig);
+
+	return (ret == 1) ? 0 : -1;
+}
+
+/* q should have room for an uncompressed point, *q_len says how much on the way in and is set to the point's size */
+int _libssh2_ecdh_new_keypair(libssh2_ecdsa_ctx **ecctx,
+			      int curve,
+			      unsigned char *q,
+			      unsigned long *q_len)
+{
+	EC_KEY *key = EC_KEY_new_by_curve_name(curve);
+	size_t len;
+
+	if (!key) {
+		return -1;
+	}
+	if (EC_KEY_generate_key(key) != 1) {
+		EC_KEY_free(key);
+		return -1;
+	}
+
+	len = EC_POINT_point2oct(EC_KEY_get0_group(key), EC_KEY_get0_public_key(key), POINT_CONVERSION_UNCOMPRESSED, q, *q_len, NULL);
+	if (!len) {
+		EC_KEY_free(key);
+		return -1;
+	}
+	*q_len = len;
+	*ecctx = key;
+
+	return 0;
+}
+
+int _libssh2_ecdh_shared_secret(libssh2_ecdsa_ctx *ecctx,
+				const unsigned char *peer_q,
+				unsigned long peer_q_len,
+				BIGNUM *k)
+{
+	const EC_GROUP *group = EC_KEY_get0_group(ecctx);
+	unsigned char secret[66];
+	int secret_len = (EC_GROUP_get_degree(group) + 7) / 8;
+	EC_POINT *point;
+	int ret = -1;
+
+	if (secret_len > (int)sizeof(secret)) {
+		return -1;
+	}
+
+	point = EC_POINT_new(group);
+	if (!point) {
+		return -1;
+	}
+	if ((EC_POINT_oct2point(group, point, peer_q, peer_q_len, NULL) == 1) &&
+	    (ECDH_compute_key(secret, secret_len, point, ecctx, NULL) == secret_len)) {
+		BN_bin2bn(secret, secret_len, k);
+		ret = 0;
+	}
+	OPENSSL_cleanse(secret, sizeof(secret));
+	EC_POINT_free(point);
+
+	return ret;
+}
+#endif /* LIBSSH2_ECDSA */
+
+#if LIBSSH2_ED25519
+int _libssh2_ed25519_new_public(libssh2_ed25519_ctx **edctx,
+				const unsigned char *key,
+				unsigned long key_len)
+{
+	if (key_len != LIBSSH2_ED25519_KEY_LEN) {
+		return -1;
+	}
+
+	*edctx = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, NULL, key, key_len);
+
+	return *edctx ? 0 : -1;
+}
+
+int _libssh2_ed25519_verify(libssh2_ed25519_ctx *edctx,
+			    const unsigned char *sig,
+			    unsigned long sig_len,
+			    const unsigned char *m,
+			    unsigned long m_len)
+{
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	int ret;
+
+	if (!ctx) {
+		return -1;
+	}
+
+	/* Ed25519 hashes the message itself, so no digest here */
+	ret = (EVP_DigestVerifyInit(ctx, NULL, NULL, NULL, edctx) == 1) &&
+	      (EVP_DigestVerify(ctx, sig, sig_len, m, m_len) == 1);
+	EVP_MD_CTX_free(ctx);
+
+	return ret ? 0 : -1;
+}
+
+/* public_key receives LIBSSH2_X25519_KEY_LEN bytes */
+int _libssh2_x25519_new_keypair(libssh2_x25519_ctx **xctx,
+				unsigned char *public_key)
+{
+	EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+	EVP_PKEY *key = NULL;
+	size_t len = LIBSSH2_X25519_KEY_LEN;
+
+	if (!pctx) {
+		return -1;
+	}
+	if ((EVP_PKEY_keygen_init(pctx) != 1) ||
+	    (EVP_PKEY_keygen(pctx, &key) != 1)) {
+		EVP_PKEY_CTX_free(pctx);
+		return -1;
+	}
+	EVP_PKEY_CTX_free(pctx);
+
+	if ((EVP_PKEY_get_raw_public_key(key, public_key, &len) != 1) ||
+	    (len != LIBSSH2_X25519_KEY_LEN)) {
+		EVP_PKEY_free(key);
+		return -1;
+	}
+	*xctx = key;
+
+	return 0;
+}
+
+/* peer_key is LIBSSH2_X25519_KEY_LEN bytes, the result goes into k as a big-endian integer (RFC 8731) */
+int _libssh2_x25519_shared_secret(libssh2_x25519_ctx *xctx,
+				  const unsigned char *peer_key,
+				  BIGNUM *k)
+{
+	EVP_PKEY *peer = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, peer_key, LIBSSH2_X25519_KEY_LEN);
+	EVP_PKEY_CTX *ctx;
+	unsigned char secret[LIBSSH2_X25519_KEY_LEN];
+	size_t secret_len = sizeof(secret);
+	int ret = -1;
+
+	if (!peer) {
+		return -1;
+	}
+	ctx = EVP_PKEY_CTX_new(xctx, NULL);
+	if (ctx &&
+	    (EVP_PKEY_derive_init(ctx) == 1) &&
+	    (EVP_PKEY_derive_set_peer(ctx, peer) == 1) &&
+	    (EVP_PKEY_derive(ctx, secret, &secret_len) == 1) &&
+	    (secret_len == sizeof(secret))) {
+		BN_bin2bn(secret, secret_len, k);
+		/* An all-zero result means the peer sent a low order point */
+		ret = BN_is_zero(k) ? -1 : 0;
+	}
+	OPENSSL_cleanse(secret, sizeof(secret));
+	if (ctx) {
+		EVP_PKEY_CTX_free(ctx);
+	}
+	EVP_PKEY_free(peer);
+
+	return ret;
+}
+#endif /* LIBSSH2_ED25519 */
@@ -76,6 +76,17 @@
 # define LIBSSH2_AES 0
 #endif
 
+#if OPENSSL_VERSION_NUMBER >= 0x10001000L && !defined(OPENSSL_NO_AES)
+# define LIBSSH2_AES_CTR 1
+# define LIBSSH2_AES_GCM 1
+#else
+# define LIBSSH2_AES_CTR 0
+# define LIBSSH2_AES_GCM 0
+#endif
+
+/* Built in, doesn't depend on anything OpenSSL provides */
+#define LIBSSH2_CHACHA20_POLY1305 1
+
 #ifdef OPENSSL_NO_BLOWFISH
 # define LIBSSH2_BLOWFISH 0
 #else
@@ -100,6 +111,25 @@
 # define LIBSSH2_3DES 1
 #endif
 
+#if OPENSSL_VERSION_NUMBER >= 0x0090800fL && !defined(OPENSSL_NO_EC) && !defined(OPENSSL_NO_ECDH) && !defined(OPENSSL_NO_ECDSA)
+# define LIBSSH2_ECDSA 1
+#else
+# define LIBSSH2_ECDSA 0
+#endif
+
+/* X25519 and Ed25519 both arrived with the raw key EVP_PKEY calls */
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(OPENSSL_NO_EC)
+# define LIBSSH2_ED25519 1
+#else
+# define LIBSSH2_ED25519 0
+#endif
+
+#if LIBSSH2_ECDSA
+#include <openssl/ec.h>
+#include <openssl/ecdh.h>
+#include <openssl/ecdsa.h>
+#endif
+
 #define libssh2_random(buf, len)		\
   RAND_bytes ((buf), (len))
 
@@ -109,6 +139,18 @@
 #define libssh2_sha1_final(ctx, out) SHA1_Final(out, &(ctx))
 #define libssh2_sha1(message, len, out) SHA1(message, len, out)
 
+#define libssh2_sha256_ctx SHA256_CTX
+#define libssh2_sha256_init(ctx) SHA256_Init(ctx)
+#define libssh2_sha256_update(ctx, data, len) SHA256_Update(&(ctx), data, len)
+#define libssh2_sha256_final(ctx, out) SHA256_Final(out, &(ctx))
+#define libssh2_sha256(message, len, out) SHA256(message, len, out)
+
+#define libssh2_sha384_ctx SHA512_CTX
+#define libssh2_sha384_init(ctx) SHA384_Init(ctx)
+#define libssh2_sha384_update(ctx, data, len) SHA384_Update(&(ctx), data, len)
+#define libssh2_sha384_final(ctx, out) SHA384_Final(out, &(ctx))
+#define libssh2_sha384(message, len, out) SHA384(message, len, out)
+
 #define libssh2_md5_ctx MD5_CTX
 #define libssh2_md5_init(ctx) MD5_Init(ctx)
 #define libssh2_md5_update(ctx, data, len) MD5_Update(&(ctx), data, len)
@@ -194,12 +236,81 @@ int _libssh2_dsa_sha1_sign(libssh2_dsa_ctx *dsactx,
 
 #define _libssh2_dsa_free(dsactx) DSA_free(dsactx)
 
+#if LIBSSH2_ECDSA
+#define libssh2_ecdsa_ctx EC_KEY
+
+/* Curves by OpenSSL NID */
+#define LIBSSH2_EC_CURVE_NISTP256 NID_X9_62_prime256v1
+#define LIBSSH2_EC_CURVE_NISTP384 NID_secp384r1
+
+int _libssh2_ecdsa_new_public(libssh2_ecdsa_ctx **ecctx,
+			      int curve,
+			      const unsigned char *q,
+			      unsigned long q_len);
+int _libssh2_ecdsa_verify(libssh2_ecdsa_ctx *ecctx,
+			  const unsigned char *r,
+			  unsigned long r_len,
+			  const unsigned char *s,
+			  unsigned long s_len,
+			  const unsigned char *hash,
+			  unsigned long hash_len);
+int _libssh2_ecdh_new_keypair(libssh2_ecdsa_ctx **ecctx,
+			      int curve,
+			      unsigned char *q,
+			      unsigned long *q_len);
+int _libssh2_ecdh_shared_secret(libssh2_ecdsa_ctx *ecctx,
+				const unsigned char *peer_q,
+				unsigned long peer_q_len,
+				BIGNUM *k);
+
+#define _libssh2_ecdsa_free(ecctx) EC_KEY_free(ecctx)
+#endif /* LIBSSH2_ECDSA */
+
+#if LIBSSH2_ED25519
+#define libssh2_ed25519_ctx EVP_PKEY
+#define libssh2_x25519_ctx EVP_PKEY
+
+#define LIBSSH2_ED25519_KEY_LEN		32
+#define LIBSSH2_ED25519_SIG_LEN		64
+#define LIBSSH2_X25519_KEY_LEN		32
+
+int _libssh2_ed25519_new_public(libssh2_ed25519_ctx **edctx,
+				const unsigned char *key,
+				unsigned long key_len);
+int _libssh2_ed25519_verify(libssh2_ed25519_ctx *edctx,
+			    const unsigned char *sig,
+			    unsigned long sig_len,
+			    const unsigned char *m,
+			    unsigned long m_len);
+int _libssh2_x25519_new_keypair(libssh2_x25519_ctx **xctx,
+				unsigned char *public_key);
+int _libssh2_x25519_shared_secret(libssh2_x25519_ctx *xctx,
+				  const unsigned char *peer_key,
+				  BIGNUM *k);
+
+#define _libssh2_ed25519_free(edctx) EVP_PKEY_free(edctx)
+#define _libssh2_x25519_free(xctx) EVP_PKEY_free(xctx)
+#endif /* LIBSSH2_ED25519 */
+
 #define _libssh2_cipher_type(name) const EVP_CIPHER *(*name)(void)
-#define _libssh2_cipher_ctx EVP_CIPHER_CTX
+/* OpenSSL 1.1 made EVP_CIPHER_CTX opaque, so from then on it's allocated rather than embedded
+ * _libssh2_cipher_evp() gets at the EVP_CIPHER_CTX either way */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+# define _libssh2_cipher_ctx EVP_CIPHER_CTX *
+# define _libssh2_cipher_evp(ctx) (*(ctx))
+#else
+# define _libssh2_cipher_ctx EVP_CIPHER_CTX
+# define _libssh2_cipher_evp(ctx) (ctx)
+#endif
 
 #define _libssh2_cipher_aes256 EVP_aes_256_cbc
 #define _libssh2_cipher_aes192 EVP_aes_192_cbc
 #define _libssh2_cipher_aes128 EVP_aes_128_cbc
+#define _libssh2_cipher_aes256ctr EVP_aes_256_ctr
+#define _libssh2_cipher_aes192ctr EVP_aes_192_ctr
+#define _libssh2_cipher_aes128ctr EVP_aes_128_ctr
+#define _libssh2_cipher_aes256gcm EVP_aes_256_gcm
+#define _libssh2_cipher_aes128gcm EVP_aes_128_gcm
 #define _libssh2_cipher_blowfish EVP_bf_cbc
 #define _libssh2_cipher_arcfour EVP_rc4
 #define _libssh2_cipher_cast5 EVP_cast5_cbc
@@ -216,7 +327,31 @@ int _libssh2_cipher_crypt(_libssh2_cipher_ctx *ctx,
 			  int encrypt,
 			  unsigned char *block);
 
-#define _libssh2_cipher_dtor(ctx) EVP_CIPHER_CTX_cleanup(ctx)
+int _libssh2_cipher_crypt_bulk(_libssh2_cipher_ctx *ctx,
+			       _libssh2_cipher_type(algo),
+			       int encrypt,
+			       unsigned char *buf,
+			       size_t len);
+
+int _libssh2_cipher_gcm_init(_libssh2_cipher_ctx *h,
+			     _libssh2_cipher_type(algo),
+			     unsigned char *secret,
+			     int encrypt);
+
+int _libssh2_cipher_gcm_crypt(_libssh2_cipher_ctx *h,
+			      int encrypt,
+			      const unsigned char *iv,
+			      const unsigned char *aad,
+			      size_t aad_len,
+			      unsigned char *buf,
+			      size_t len,
+			      unsigned char *tag);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+# define _libssh2_cipher_dtor(ctx) EVP_CIPHER_CTX_free(*(ctx))
+#else
+# define _libssh2_cipher_dtor(ctx) EVP_CIPHER_CTX_cleanup(ctx)
+#endif
 
 #define _libssh2_bn BIGNUM
 #define _libssh2_bn_ctx BN_CTX
@@ -285,15 +285,7 @@ inline int libssh2_packet_x11_open(LIBSSH2_SESSION *session, unsigned char *data
 		}
 
 		/* Link the channel into the session */
-		if (session->channels.tail) {
-			session->channels.tail->next = channel;
-			channel->prev = session->channels.tail;
-		} else {
-			session->channels.head = channel;
-			channel->prev = NULL;
-		}
-		channel->next = NULL;
-		session->channels.tail = channel;
+		libssh2_channel_add(session, channel);
 		
 		/*
 		 * Pass control to the callback, they may turn right around and 
@@ -323,11 +315,175 @@ inline int libssh2_packet_x11_open(LIBSSH2_SESSION *session, unsigned char *data
 }
 /* }}} */
 
+/* {{{ Packet pool
+ * Inbound packets are allocated and freed at a furious pace during bulk transfers,
+ * keep a few spare headers and payload buffers around for reuse rather than bouncing every one off the allocator
+ */
+static const unsigned long libssh2_packet_pool_sizes[LIBSSH2_PACKET_POOL_CLASSES] = { 256, 2048, 16384, LIBSSH2_PACKET_MAXPAYLOAD };
+
+#define libssh2_packet_pool_cache(pool, bytes)	\
+{	\
+	(pool)->stats.cached_bytes += (bytes);	\
+	if ((pool)->stats.cached_bytes > (pool)->stats.high_water) {	\
+		(pool)->stats.high_water = (pool)->stats.cached_bytes;	\
+	}	\
+}
+
+/* {{{ libssh2_packet_header_alloc
+ */
+LIBSSH2_PACKET *libssh2_packet_header_alloc(LIBSSH2_SESSION *session)
+{
+	libssh2_packet_pool *pool = &session->packet_pool;
+	LIBSSH2_PACKET *packet = pool->headers;
+
+	if (packet) {
+		pool->headers = packet->next;
+		pool->headers_count--;
+		pool->stats.cached_bytes -= sizeof(LIBSSH2_PACKET);
+		pool->stats.hits++;
+	} else {
+		packet = LIBSSH2_ALLOC(session, sizeof(LIBSSH2_PACKET));
+		if (!packet) {
+			return NULL;
+		}
+		pool->stats.misses++;
+	}
+	memset(packet, 0, sizeof(LIBSSH2_PACKET));
+
+	return packet;
+}
+/* }}} */
+
+/* {{{ libssh2_packet_header_free
+ */
+void libssh2_packet_header_free(LIBSSH2_SESSION *session, LIBSSH2_PACKET *packet)
+{
+	libssh2_packet_pool *pool = &session->packet_pool;
+
+	if (pool->headers_count >= LIBSSH2_PACKET_POOL_HEADERS) {
+		LIBSSH2_FREE(session, packet);
+		return;
+	}
+
+	packet->next = pool->headers;
+	pool->headers = packet;
+	pool->headers_count++;
+	libssh2_packet_pool_cache(pool, sizeof(LIBSSH2_PACKET));
+}
+/* }}} */
+
+/* {{{ libssh2_packet_buffer_alloc
+ * Allocate a payload buffer of at least size bytes
+ * data_size is set to the actual size, which libssh2_packet_buffer_free() needs back
+ * The buffer is an ordinary LIBSSH2_ALLOC() allocation, so whoever ends up owning it may LIBSSH2_FREE() it instead
+ */
+unsigned char *libssh2_packet_buffer_alloc(LIBSSH2_SESSION *session, unsigned long size, unsigned long *data_size)
+{
+	libssh2_packet_pool *pool = &session->packet_pool;
+	unsigned char *data;
+	int i;
+
+	for(i = 0; i < LIBSSH2_PACKET_POOL_CLASSES; i++) {
+		if (size <= libssh2_packet_pool_sizes[i]) {
+			break;
+		}
+	}
+	if (i == LIBSSH2_PACKET_POOL_CLASSES) {
+		/* Too big to be worth pooling, which is still a trip to the allocator */
+		*data_size = 0;
+		data = LIBSSH2_ALLOC(session, size);
+		if (data) {
+			pool->stats.misses++;
+		}
+		return data;
+	}
+
+	if (pool->buffers_count[i]) {
+		data = pool->buffers[i][--pool->buffers_count[i]];
+		pool->stats.cached_bytes -= libssh2_packet_pool_sizes[i];
+		pool->stats.hits++;
+	} else {
+		data = LIBSSH2_ALLOC(session, libssh2_packet_pool_sizes[i]);
+		if (!data) {
+			return NULL;
+		}
+		pool->stats.misses++;
+	}
+	*data_size = libssh2_packet_pool_sizes[i];
+
+	return data;
+}
+/* }}} */
+
+/* {{{ libssh2_packet_buffer_free
+ * Return a payload buffer to the pool, data_size as reported by libssh2_packet_buffer_alloc()
+ */
+void libssh2_packet_buffer_free(LIBSSH2_SESSION *session, unsigned char *data, unsigned long data_size)
+{
+	libssh2_packet_pool *pool = &session->packet_pool;
+	int i;
+
+	for(i = 0; i < LIBSSH2_PACKET_POOL_CLASSES; i++) {
+		if (data_size == libssh2_packet_pool_sizes[i]) {
+			break;
+		}
+	}
+	if ((i == LIBSSH2_PACKET_POOL_CLASSES) || (pool->buffers_count[i] >= LIBSSH2_PACKET_POOL_DEPTH)) {
+		LIBSSH2_FREE(session, data);
+		return;
+	}
+
+	pool->buffers[i][pool->buffers_count[i]++] = data;
+	libssh2_packet_pool_cache(pool, data_size);
+}
+/* }}} */
+
+/* {{{ libssh2_packet_free
+ * Dispose of a packet and its payload once it's been consumed
+ */
+void libssh2_packet_free(LIBSSH2_SESSION *session, LIBSSH2_PACKET *packet)
+{
+	if (packet->data_size) {
+		libssh2_packet_buffer_free(session, packet->data, packet->data_size);
+	} else {
+		LIBSSH2_FREE(session, packet->data);
+	}
+	libssh2_packet_header_free(session, packet);
+}
+/* }}} */
+
+/* {{{ libssh2_packet_pool_empty
+ * Release everything the pool is holding on to
+ */
+void libssh2_packet_pool_empty(LIBSSH2_SESSION *session)
+{
+	libssh2_packet_pool *pool = &session->packet_pool;
+	int i;
+
+	while (pool->headers) {
+		LIBSSH2_PACKET *packet = pool->headers;
+
+		pool->headers = packet->next;
+		LIBSSH2_FREE(session, packet);
+	}
+	pool->headers_count = 0;
+
+	for(i = 0; i < LIBSSH2_PACKET_POOL_CLASSES; i++) {
+		while (pool->buffers_count[i]) {
+			LIBSSH2_FREE(session, pool->buffers[i][--pool->buffers_count[i]]);
+		}
+	}
+	pool->stats.cached_bytes = 0;
+}
+/* }}} */
+/* }}} */
+
 /* {{{ libssh2_packet_new
  * Create a new packet and attach it to the brigade
  */
-static int libssh2_packet_add(LIBSSH2_SESSION *session, unsigned char *data, size_t datalen, int macstate)
+static int libssh2_packet_add(LIBSSH2_SESSION *session, unsigned char *data, size_t datalen, unsigned long data_size, int macstate)
 {
+	LIBSSH2_PACKET_BRIGADE *brigade = &session->packets;
 	LIBSSH2_PACKET *packet;
 	unsigned long data_head = 0;
 
@@ -355,6 +511,16 @@ static int libssh2_packet_add(LIBSSH2_SESSION *session, unsigned char *data, siz
 		}
 	}
 
+	if (session->poller_socket) {
+		/* Data, window adjusts and closes all change what a poller should report */
+		libssh2_poller_mark(session->poller_socket);
+	}
+
+	if (data[0] == SSH_MSG_USERAUTH_SUCCESS) {
+		/* Delayed compression kicks in from the next packet, both ways */
+		session->state |= LIBSSH2_STATE_AUTHENTICATED;
+	}
+
 	/* A couple exceptions to the packet adding rule: */
 	switch (data[0]) {
 		case SSH_MSG_DISCONNECT:
@@ -491,6 +657,32 @@ static int libssh2_packet_add(LIBSSH2_SESSION *session, unsigned char *data, siz
 					/* Now that we've received it, shrink our window */
 					channel->remote.window_size -= datalen - data_head;
 				}
+
+				channel->window_stats.bytes_read += datalen - data_head;
+				if (channel->window_max) {
+					unsigned long now = libssh2_time_ms();
+
+					if (!channel->rate_start_ms) {
+						channel->rate_start_ms = now;
+					}
+					channel->rate_bytes += datalen - data_head;
+
+					if (channel->adjust_sent_ms) {
+						/* First data through since we reopened an exhausted window: that's a round trip */
+						unsigned long sample = now - channel->adjust_sent_ms;
+
+						channel->window_stats.rtt_ms = channel->window_stats.rtt_ms ? (channel->window_stats.rtt_ms * 7 + sample) / 8 : sample;
+						channel->adjust_sent_ms = 0;
+					}
+				}
+				if (!channel->window_exhausted && (channel->remote.window_size < channel->remote.packet_size)) {
+					/* Remote can't send another full packet until we adjust */
+					channel->window_exhausted = 1;
+					channel->window_stats.read_stalls++;
+				}
+
+				/* Queue it on the channel itself so reads don't have to wade through everyone else's data */
+				brigade = &channel->data;
 			}
 			break;
 		case SSH_MSG_CHANNEL_EOF:
@@ -589,23 +781,28 @@ static int libssh2_packet_add(LIBSSH2_SESSION *session, unsigned char *data, siz
 			break;
 	}
 
-	packet = LIBSSH2_ALLOC(session, sizeof(LIBSSH2_PACKET));
-	memset(packet, 0, sizeof(LIBSSH2_PACKET));
+	packet = libssh2_packet_header_alloc(session);
+	if (!packet) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for LIBSSH2_PACKET", 0);
+		LIBSSH2_FREE(session, data);
+		return -1;
+	}
 
 	packet->data = data;
 	packet->data_len = datalen;
+	packet->data_size = data_size;
 	packet->data_head = data_head;
 	packet->mac = macstate;
-	packet->brigade = &session->packets;
+	packet->brigade = brigade;
 	packet->next = NULL;
 
-	if (session->packets.tail) {
-		packet->prev = session->packets.tail;
+	if (brigade->tail) {
+		packet->prev = brigade->tail;
 		packet->prev->next = packet;
-		session->packets.tail = packet;
+		brigade->tail = packet;
 	} else {
-		session->packets.head = packet;
-		session->packets.tail = packet;
+		brigade->head = packet;
+		brigade->tail = packet;
 		packet->prev = NULL;
 	}
 
@@ -625,6 +822,268 @@ static int libssh2_packet_add(LIBSSH2_SESSION *session, unsigned char *data, siz
 }
 /* }}} */
 
+/* {{{ libssh2_packet_crypt
+ * Run len bytes (a multiple of the cipher's blocksize) through an endpoint's cipher, in place
+ */
+static int libssh2_packet_crypt(LIBSSH2_SESSION *session, libssh2_endpoint_data *endpoint, unsigned char *buf, unsigned long len)
+{
+	unsigned char *s;
+
+	if (endpoint->crypt->crypt_bulk) {
+		return endpoint->crypt->crypt_bulk(session, buf, len, &endpoint->crypt_abstract);
+	}
+
+	for(s = buf; (s - buf) < len; s += endpoint->crypt->blocksize) {
+		if (endpoint->crypt->crypt(session, s, &endpoint->crypt_abstract)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_packet_decompress
+ * Inflate a received payload in place of the original, if compression is in effect
+ */
+static int libssh2_packet_decompress(LIBSSH2_SESSION *session, unsigned char **payload, unsigned long *payload_len, unsigned long *payload_size)
+{
+	int free_payload = 1;
+
+	if (LIBSSH2_COMP_ACTIVE(session, &session->remote)) {
+		/* Decompress */
+		unsigned char *data;
+		unsigned long data_len;
+
+		if (session->remote.comp->comp(session, 0, &data, &data_len, LIBSSH2_PACKET_MAXDECOMP, &free_payload, *payload, *payload_len, &session->remote.comp_abstract)) {
+			LIBSSH2_FREE(session, *payload);
+			return -1;
+		}
+#ifdef LIBSSH2_DEBUG_TRANSPORT
+	_libssh2_debug(session, LIBSSH2_DBG_TRANS, "Payload decompressed: %lu bytes(compressed) to %lu bytes(uncompressed)", data_len, *payload_len);
+#endif
+		if (free_payload) {
+			LIBSSH2_FREE(session, *payload);
+			*payload = data;
+			*payload_len = data_len;
+			*payload_size = 0;
+		} else {
+			if (data == *payload) {
+				/* It's not to be freed, because the compression layer reused payload,
+				 * So let's do the same!
+				 */
+				*payload_len = data_len;
+			} else if (*payload_size >= data_len) {
+				/* Inflated into the compression layer's own scratch buffer, and it fits back where it came from */
+				memcpy(*payload, data, data_len);
+				*payload_len = data_len;
+			} else {
+				/* The brigade needs a buffer of its own, take a bigger one from the pool */
+				if (*payload_size) {
+					libssh2_packet_buffer_free(session, *payload, *payload_size);
+				} else {
+					LIBSSH2_FREE(session, *payload);
+				}
+
+				*payload = libssh2_packet_buffer_alloc(session, data_len, payload_size);
+				if (!*payload) {
+					libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for copy of uncompressed data", 0);
+					return -1;
+				}
+				memcpy(*payload, data, data_len);
+				*payload_len = data_len;
+			}
+		}
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_socket_mode
+ * Bring the socket into line with the session: O_NONBLOCK for a non-blocking session, blocking otherwise
+ * The syscall only happens when the session's mode has changed, a blocking session's socket is never toggled per read;
+ * one that's never been non-blocking is left as the application handed it over
+ */
+static void libssh2_socket_mode(LIBSSH2_SESSION *session)
+{
+	int mode = session->socket_block ? LIBSSH2_SOCKET_MODE_BLOCKING : LIBSSH2_SOCKET_MODE_NONBLOCKING;
+
+	if ((session->socket_mode == mode) ||
+		((session->socket_mode == LIBSSH2_SOCKET_MODE_UNKNOWN) && (mode == LIBSSH2_SOCKET_MODE_BLOCKING))) {
+		return;
+	}
+
+#ifndef WIN32
+	fcntl(session->socket_fd, F_SETFL, (mode == LIBSSH2_SOCKET_MODE_NONBLOCKING) ? O_NONBLOCK : 0);
+#else
+	{
+		u_long non_block = (mode == LIBSSH2_SOCKET_MODE_NONBLOCKING) ? TRUE : FALSE;
+		ioctlsocket(session->socket_fd, FIONBIO, &non_block);
+	}
+#endif
+	session->socket_mode = mode;
+}
+/* }}} */
+
+/* {{{ libssh2_socket_errno
+ * Winsock reports through WSAGetLastError(), fold the cases we care about back into errno
+ */
+static void libssh2_socket_errno(void)
+{
+#ifdef WIN32
+	switch (WSAGetLastError()) {
+		case WSAEWOULDBLOCK:	errno = EAGAIN;		break;
+		case WSAENOTSOCK:		errno = EBADF;		break;
+		case WSAENOTCONN:
+		case WSAECONNABORTED:	errno = ENOTCONN;	break;
+		case WSAEINTR:			errno = EINTR;		break;
+	}
+#endif
+}
+/* }}} */
+
+/* {{{ libssh2_socket_wait
+ * Wait (up to 30 seconds) for the socket to become ready in any of the LIBSSH2_SESSION_BLOCK_* directions given
+ * Returns 0 when it's worth trying again, -1 on timeout or error
+ */
+static int libssh2_socket_wait(LIBSSH2_SESSION *session, int directions)
+{
+#ifdef HAVE_POLL
+	struct pollfd sock;
+
+	sock.fd = session->socket_fd;
+	sock.events = ((directions & LIBSSH2_SESSION_BLOCK_INBOUND) ? POLLIN : 0) | ((directions & LIBSSH2_SESSION_BLOCK_OUTBOUND) ? POLLOUT : 0);
+
+	return (poll(&sock, 1, 30000) <= 0) ? -1 : 0;
+#elif defined(HAVE_SELECT)
+	fd_set read_socket, write_socket;
+	struct timeval timeout;
+
+	FD_ZERO(&read_socket);
+	FD_ZERO(&write_socket);
+	if (directions & LIBSSH2_SESSION_BLOCK_INBOUND) {
+		FD_SET(session->socket_fd, &read_socket);
+	}
+	if (directions & LIBSSH2_SESSION_BLOCK_OUTBOUND) {
+		FD_SET(session->socket_fd, &write_socket);
+	}
+
+	timeout.tv_sec = 30;
+	timeout.tv_usec = 0;
+
+	return (select(session->socket_fd + 1, &read_socket, &write_socket, NULL, &timeout) <= 0) ? -1 : 0;
+#else
+	usleep(LIBSSH2_SOCKET_POLL_UDELAY);
+	return 0;
+#endif /* POLL/SELECT/SLEEP */
+}
+/* }}} */
+
+/* {{{ libssh2_socket_readable
+ * Whether a read would return straight away, with data or end of file, without touching the socket's mode
+ */
+static int libssh2_socket_readable(LIBSSH2_SESSION *session)
+{
+#ifdef HAVE_POLL
+	struct pollfd sock;
+
+	sock.fd = session->socket_fd;
+	sock.events = POLLIN;
+
+	return (poll(&sock, 1, 0) > 0);
+#elif defined(HAVE_SELECT)
+	fd_set read_socket;
+	struct timeval timeout;
+
+	FD_ZERO(&read_socket);
+	FD_SET(session->socket_fd, &read_socket);
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 0;
+
+	return (select(session->socket_fd + 1, &read_socket, NULL, NULL, &timeout) > 0);
+#elif defined(MSG_DONTWAIT)
+	char c;
+
+	return (recv(session->socket_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) >= 0);
+#else
+	/* No way to look without waiting, so the read will */
+	return 1;
+#endif /* POLL/SELECT/DONTWAIT */
+}
+/* }}} */
+
+/* {{{ libssh2_packet_send
+ * Write out whatever libssh2_packet_write() has left in the output buffer, in as few writes as the socket allows
+ * In a non-blocking session should_block=0 stops at EAGAIN, keeping the remainder for next time
+ */
+static int libssh2_packet_send(LIBSSH2_SESSION *session, int should_block)
+{
+	unsigned long written = 0;
+	int ret = 0;
+
+	session->block_directions &= ~LIBSSH2_SESSION_BLOCK_OUTBOUND;
+	if (!session->outbuf_len) {
+		return 0;
+	}
+
+	libssh2_socket_mode(session);
+#ifdef LIBSSH2_DEBUG_TRANSPORT
+	_libssh2_debug(session, LIBSSH2_DBG_TRANS, "Flushing %lu bytes of queued packets", session->outbuf_len);
+#endif
+	while (written < session->outbuf_len) {
+		ssize_t nwritten = LIBSSH2_WRITE(session, session->outbuf + written, session->outbuf_len - written);
+
+		if (nwritten > 0) {
+			written += nwritten;
+			continue;
+		}
+		if (nwritten < 0) {
+			libssh2_socket_errno();
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN) {
+				if (!should_block) {
+					ret = LIBSSH2_ERROR_EAGAIN;
+					break;
+				}
+				if (libssh2_socket_wait(session, LIBSSH2_SESSION_BLOCK_OUTBOUND) == 0) {
+					continue;
+				}
+			}
+		}
+		ret = -1;
+		break;
+	}
+
+	if (ret == LIBSSH2_ERROR_EAGAIN) {
+		memmove(session->outbuf, session->outbuf + written, session->outbuf_len - written);
+		session->outbuf_len -= written;
+		session->block_directions |= LIBSSH2_SESSION_BLOCK_OUTBOUND;
+		return ret;
+	}
+
+	session->outbuf_len = 0;
+	if (ret) {
+		/* Part of a packet on the wire and the rest lost, there's no recovering the stream from that */
+		libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send queued packets", 0);
+		return -1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_packet_flush
+ * Send whatever libssh2_packet_write() has left in the output buffer, waiting for the socket if need be
+ */
+int libssh2_packet_flush(LIBSSH2_SESSION *session)
+{
+	return libssh2_packet_send(session, 1);
+}
+/* }}} */
+
 /* {{{ libssh2_blocking_read
  * Force a blocking read, regardless of socket settings
  */
@@ -635,14 +1094,24 @@ static ssize_t libssh2_blocking_read(LIBSSH2_SESSION *session, unsigned char *bu
 	int polls = 0;
 #endif
 
-#ifndef WIN32
-	fcntl(session->socket_fd, F_SETFL, 0);
-#else
-	{
-		u_long block = FALSE;
-		ioctlsocket(session->socket_fd, FIONBIO, &block);
+	/* Anything non-blocking mode has already pulled off the socket comes first */
+	if (session->inbuf_len > session->inbuf_pos) {
+		bytes_read = session->inbuf_len - session->inbuf_pos;
+		if (bytes_read > count) {
+			bytes_read = count;
+		}
+		memcpy(buf, session->inbuf + session->inbuf_pos, bytes_read);
+		session->inbuf_pos += bytes_read;
+
+		if (bytes_read == count) {
+			return bytes_read;
+		}
+	}
+
+	/* About to wait on the remote end, which may well be waiting on something still held back here */
+	if (libssh2_packet_flush(session)) {
+		return -1;
 	}
-#endif
 
 #ifdef LIBSSH2_DEBUG_TRANSPORT
 	_libssh2_debug(session, LIBSSH2_DBG_TRANS, "Blocking read: %d bytes", (int)count);
@@ -653,44 +1122,16 @@ static ssize_t libssh2_blocking_read(LIBSSH2_SESSION *session, unsigned char *bu
 
 		ret = LIBSSH2_READ(session, buf + bytes_read, count - bytes_read);
 		if (ret < 0) {
-#ifdef WIN32
-			switch (WSAGetLastError()) {
-				case WSAEWOULDBLOCK:	errno = EAGAIN;		break;
-				case WSAENOTSOCK:		errno = EBADF;		break;
-				case WSAENOTCONN:
-				case WSAECONNABORTED:	errno = ENOTCONN;	break;
-				case WSAEINTR:			errno = EINTR;		break;
-			}
-#endif
+			libssh2_socket_errno();
 			if (errno == EAGAIN) {
-#ifdef HAVE_POLL
-				struct pollfd read_socket;
-
-				read_socket.fd = session->socket_fd;
-				read_socket.events = POLLIN;
-
-				if (poll(&read_socket, 1, 30000) <= 0) {
-					return -1;
-				}
-#elif defined(HAVE_SELECT)
-				fd_set read_socket;
-				struct timeval timeout;
-
-				FD_ZERO(&read_socket);
-				FD_SET(session->socket_fd, &read_socket);
-
-				timeout.tv_sec = 30;
-				timeout.tv_usec = 0;
-
-				if (select(session->socket_fd + 1, &read_socket, NULL, NULL, &timeout) <= 0) {
+#if !defined(HAVE_POLL) && !defined(HAVE_SELECT)
+				if (polls++ > LIBSSH2_SOCKET_POLL_MAXLOOPS) {
 					return -1;
 				}
-#else
-				if (polls++ > LIBSSH2_SOCKET_POLL_MAXLOOPS) {
+#endif
+				if (libssh2_socket_wait(session, LIBSSH2_SESSION_BLOCK_INBOUND)) {
 					return -1;
 				}
-				usleep(LIBSSH2_SOCKET_POLL_UDELAY);
-#endif /* POLL/SELECT/SLEEP */
 				continue;
 			}
 			if (errno == EINTR) {
@@ -701,7 +1142,11 @@ static ssize_t libssh2_blocking_read(LIBSSH2_SESSION *session, unsigned char *bu
 			}
 			return -1;
 		}
-		if (ret == 0) continue;
+		if (ret == 0) {
+			/* End of file, there's no more coming however long we wait */
+			session->socket_state = LIBSSH2_SOCKET_DISCONNECTED;
+			break;
+		}
 
 		bytes_read += ret;
 	}
@@ -714,6 +1159,194 @@ static ssize_t libssh2_blocking_read(LIBSSH2_SESSION *session, unsigned char *bu
 }
 /* }}} */
 
+/* {{{ libssh2_packet_buffered
+ * Non-blocking sessions: pull whatever the socket has into the input buffer without waiting,
+ * then work out whether a whole packet is sitting there, so that reading it can't block
+ * The first cipher block has to be decrypted to learn the length, read_preamble records that it has been
+ * Returns 1 if a packet is complete, 0 if not (yet), -1 on error
+ */
+static int libssh2_packet_buffered(LIBSSH2_SESSION *session)
+{
+	unsigned long avail, need, packet_len;
+	unsigned char *head;
+
+	for(;;) {
+		ssize_t ret;
+
+		if (session->inbuf_pos == session->inbuf_len) {
+			session->inbuf_pos = session->inbuf_len = 0;
+		}
+		if (session->inbuf_len == session->inbuf_size) {
+			if (session->inbuf_pos) {
+				/* Slide the unread tail down to make room */
+				memmove(session->inbuf, session->inbuf + session->inbuf_pos, session->inbuf_len - session->inbuf_pos);
+				session->inbuf_len -= session->inbuf_pos;
+				session->inbuf_pos = 0;
+			} else if (session->inbuf_size < LIBSSH2_INBUF_MAX) {
+				unsigned long newsize = session->inbuf_size ? (session->inbuf_size * 2) : LIBSSH2_INBUF_SIZE;
+				unsigned char *newbuf;
+
+				if (newsize > LIBSSH2_INBUF_MAX) {
+					newsize = LIBSSH2_INBUF_MAX;
+				}
+				newbuf = LIBSSH2_REALLOC(session, session->inbuf, newsize);
+				if (!newbuf) {
+					libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate input buffer", 0);
+					return -1;
+				}
+				session->inbuf = newbuf;
+				session->inbuf_size = newsize;
+			} else {
+				/* More than enough buffered already */
+				break;
+			}
+		}
+
+		ret = LIBSSH2_READ(session, session->inbuf + session->inbuf_len, session->inbuf_size - session->inbuf_len);
+		if (ret > 0) {
+			session->inbuf_len += ret;
+			continue;
+		}
+		if (ret == 0) {
+			/* Orderly shutdown from the remote end */
+			session->socket_state = LIBSSH2_SOCKET_DISCONNECTED;
+			break;
+		}
+		libssh2_socket_errno();
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno == EAGAIN) {
+			break;
+		}
+		if ((errno == EBADF) || (errno == EIO) || (errno == ENOTCONN)) {
+			session->socket_state = LIBSSH2_SOCKET_DISCONNECTED;
+		}
+		libssh2_error(session, LIBSSH2_ERROR_SOCKET_NONE, "Error reading from socket", 0);
+		return -1;
+	}
+
+	avail = session->inbuf_len - session->inbuf_pos;
+	head = session->inbuf + session->inbuf_pos;
+
+	if (!(session->state & LIBSSH2_STATE_NEWKEYS)) {
+		if (avail < 5) {
+			return 0;
+		}
+		packet_len = libssh2_ntohu32(head);
+		need = 4 + packet_len;
+	} else if (session->remote.crypt->flags & LIBSSH2_CRYPT_FLAG_AEAD) {
+		if (avail < 4) {
+			return 0;
+		}
+		if (session->remote.crypt->aead_length(session, session->remote.seqno, head, &packet_len, &session->remote.crypt_abstract)) {
+			libssh2_error(session, LIBSSH2_ERROR_DECRYPT, "Error decrypting packet length", 0);
+			return -1;
+		}
+		need = 4 + packet_len + session->remote.crypt->tag_len;
+	} else {
+		if (avail < session->remote.crypt->blocksize) {
+			return 0;
+		}
+		if (!session->read_preamble) {
+			if (session->remote.crypt->crypt(session, head, &session->remote.crypt_abstract)) {
+				libssh2_error(session, LIBSSH2_ERROR_DECRYPT, "Error decrypting packet preamble", 0);
+				return -1;
+			}
+			session->read_preamble = 1;
+		}
+		packet_len = libssh2_ntohu32(head);
+		need = 4 + packet_len + session->remote.mac->mac_len;
+	}
+
+	if (need > (LIBSSH2_INBUF_MAX / 2)) {
+		session->socket_state = LIBSSH2_SOCKET_DISCONNECTED;
+		libssh2_error(session, LIBSSH2_ERROR_PROTO, "Fatal protocol error, invalid payload size", 0);
+		return -1;
+	}
+
+	return (avail >= need) ? 1 : 0;
+}
+/* }}} */
+
+/* {{{ libssh2_packet_read_aead
+ * libssh2_packet_read() for AEAD ciphers
+ * packet_length isn't part of the first cipher block, and the tag replaces both the MAC and its separate pass
+ */
+static int libssh2_packet_read_aead(LIBSSH2_SESSION *session)
+{
+	LIBSSH2_CRYPT_METHOD *crypt = session->remote.crypt;
+	unsigned char head[4], *payload;
+	ssize_t read_len;
+	unsigned long packet_len, payload_len, payload_size;
+	int padding_len, packet_type;
+
+	read_len = libssh2_blocking_read(session, head, 4);
+	if (read_len <= 0) {
+		return read_len;
+	}
+	if (read_len < 4) {
+		return (session->socket_state == LIBSSH2_SOCKET_DISCONNECTED) ? 0 : -1;
+	}
+
+	if (crypt->aead_length(session, session->remote.seqno, head, &packet_len, &session->remote.crypt_abstract)) {
+		libssh2_error(session, LIBSSH2_ERROR_DECRYPT, "Error decrypting packet length", 0);
+		return -1;
+	}
+	/* Sanity Check */
+	if ((packet_len < 5) || ((packet_len - 1) > LIBSSH2_PACKET_MAXPAYLOAD) || (packet_len % crypt->blocksize)) {
+		session->socket_state = LIBSSH2_SOCKET_DISCONNECTED;
+		libssh2_error(session, LIBSSH2_ERROR_PROTO, "Fatal protocol error, invalid payload size", 0);
+		return -1;
+	}
+#ifdef LIBSSH2_DEBUG_TRANSPORT
+	_libssh2_debug(session, LIBSSH2_DBG_TRANS, "Processing AEAD packet %lu bytes long", packet_len);
+#endif
+
+	/* The whole packet, packet_length included, is authenticated, so it's opened as one piece
+	 * then the payload slid down to the front of the buffer
+	 */
+	payload = libssh2_packet_buffer_alloc(session, 4 + packet_len + crypt->tag_len, &payload_size);
+	if (!payload) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for packet payload", 0);
+		return -1;
+	}
+	memcpy(payload, head, 4);
+	if (libssh2_blocking_read(session, payload + 4, packet_len + crypt->tag_len) < (packet_len + crypt->tag_len)) {
+		LIBSSH2_FREE(session, payload);
+		return (session->socket_state == LIBSSH2_SOCKET_DISCONNECTED) ? 0 : -1;
+	}
+
+	if (crypt->aead_open(session, session->remote.seqno, payload, 4 + packet_len, payload + 4 + packet_len, &session->remote.crypt_abstract)) {
+		/* Unlike a bad MAC there's nothing trustworthy to hand LIBSSH2_MACERROR, the stream is done for */
+		session->socket_state = LIBSSH2_SOCKET_DISCONNECTED;
+		libssh2_error(session, LIBSSH2_ERROR_INVALID_MAC, "Packet failed authentication", 0);
+		LIBSSH2_FREE(session, payload);
+		return -1;
+	}
+	session->remote.seqno++;
+
+	padding_len = payload[4];
+	if (padding_len >= (packet_len - 1)) {
+		session->socket_state = LIBSSH2_SOCKET_DISCONNECTED;
+		libssh2_error(session, LIBSSH2_ERROR_PROTO, "Fatal protocol error, invalid padding length", 0);
+		LIBSSH2_FREE(session, payload);
+		return -1;
+	}
+	payload_len = packet_len - 1 - padding_len;
+	memmove(payload, payload + 5, payload_len);
+
+	if (libssh2_packet_decompress(session, &payload, &payload_len, &payload_size)) {
+		return -1;
+	}
+
+	packet_type = payload[0];
+	libssh2_packet_add(session, payload, payload_len, payload_size, LIBSSH2_MAC_CONFIRMED);
+
+	return packet_type;
+}
+/* }}} */
+
 /* {{{ libssh2_packet_read
  * Collect a packet into the input brigade
  * block only controls whether or not to wait for a packet to start,
@@ -728,54 +1361,73 @@ int libssh2_packet_read(LIBSSH2_SESSION *session, int should_block)
 		return 0;
 	}
 
-#ifndef WIN32
-	fcntl(session->socket_fd, F_SETFL, O_NONBLOCK);
-#else
-	{
-		u_long non_block = TRUE;
-		ioctlsocket(session->socket_fd, FIONBIO, &non_block);
-	}
-#endif
+	libssh2_socket_mode(session);
 
 #ifdef LIBSSH2_DEBUG_TRANSPORT
 	_libssh2_debug(session, LIBSSH2_DBG_TRANS, "Checking for packet: will%s block", should_block ? "" : " not");
 #endif
-	if (session->state & LIBSSH2_STATE_NEWKEYS) {
+	if (!session->socket_block) {
+		/* Only start on a packet once all of it is here, then the reads below can't block */
+		session->block_directions &= ~LIBSSH2_SESSION_BLOCK_INBOUND;
+		for(;;) {
+			int ret;
+
+			if (libssh2_packet_send(session, 0) == -1) {
+				return -1;
+			}
+			ret = libssh2_packet_buffered(session);
+			if (ret < 0) {
+				return -1;
+			}
+			if (ret) {
+				break;
+			}
+			if (session->socket_state == LIBSSH2_SOCKET_DISCONNECTED) {
+				return 0;
+			}
+			if (!should_block) {
+				session->block_directions |= LIBSSH2_SESSION_BLOCK_INBOUND;
+				return 0;
+			}
+			if (libssh2_socket_wait(session, LIBSSH2_SESSION_BLOCK_INBOUND | session->block_directions)) {
+				libssh2_error(session, LIBSSH2_ERROR_SOCKET_TIMEOUT, "Timed out waiting for packet", 0);
+				return -1;
+			}
+		}
+	} else if (!should_block && (session->inbuf_len == session->inbuf_pos) && !libssh2_socket_readable(session)) {
+		/* A blocking session's socket stays blocking, so look before reading rather than flip it to O_NONBLOCK */
+		return 0;
+	}
+	/* Past here a packet has started (or is wanted regardless), the rest is read without letting go */
+
+	if ((session->state & LIBSSH2_STATE_NEWKEYS) && (session->remote.crypt->flags & LIBSSH2_CRYPT_FLAG_AEAD)) {
+		packet_type = libssh2_packet_read_aead(session);
+	} else if (session->state & LIBSSH2_STATE_NEWKEYS) {
 		/* Temporary Buffer
 		 * The largest blocksize (currently) is 32, the largest MAC (currently) is 20
 		 */
-		unsigned char block[2 * 32], *payload, *s, *p, tmp[6];
+		unsigned char block[2 * 32], *payload, *s, tmp[6];
 		ssize_t read_len;
 		unsigned long blocksize = session->remote.crypt->blocksize;
-		unsigned long packet_len, payload_len;
+		unsigned long packet_len, payload_len, payload_size;
 		int padding_len;
 		int macstate;
-		int free_payload = 1;
 
 		/* Note: If we add any cipher with a blocksize less than 6 we'll need to get more creative with this
 		 * For now, all blocksize sizes are 8+
 		 */
-		if (should_block) {
-			read_len = libssh2_blocking_read(session, block, blocksize);
-			if(read_len <= 0)
-				return read_len;
-		} else {
-                        ssize_t nread;
-			read_len = LIBSSH2_READ(session, block, 1);
-			if (read_len <= 0) {
-				return 0;
-			}
-			nread = libssh2_blocking_read(session, block + read_len, blocksize - read_len);
-			if(nread <= 0)
-				return nread;
-
-			read_len += nread;
+		read_len = libssh2_blocking_read(session, block, blocksize);
+		if (read_len <= 0) {
+			return read_len;
 		}
 		if (read_len < blocksize) {
 			return (session->socket_state == LIBSSH2_SOCKET_DISCONNECTED) ? 0 : -1;
 		}
 
-		if (session->remote.crypt->crypt(session, block, &session->remote.crypt_abstract)) {
+		if (session->read_preamble) {
+			/* libssh2_packet_buffered() already decrypted it in place */
+			session->read_preamble = 0;
+		} else if (session->remote.crypt->crypt(session, block, &session->remote.crypt_abstract)) {
 			libssh2_error(session, LIBSSH2_ERROR_DECRYPT, "Error decrypting packet preamble", 0);
 			return -1;
 		}
@@ -809,33 +1461,27 @@ int libssh2_packet_read(LIBSSH2_SESSION *session, int should_block)
 			return -1;
 		}
 
-		s = payload = LIBSSH2_ALLOC(session, payload_len);
+		s = payload = libssh2_packet_buffer_alloc(session, payload_len, &payload_size);
+		if (!payload) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for packet payload", 0);
+			return -1;
+		}
 		memcpy(s, block + 5, blocksize - 5);
 		s += blocksize - 5;
 
-		p = s;
-		while (p - payload < payload_len) {
-			read_len = payload_len - (p - payload);
-			if (read_len > 4096) read_len = 4096;
-
-			if (libssh2_blocking_read(session, p, read_len) < read_len) {
+		/* Read the rest of the packet in one go, and decrypt it with a single call
+		 * It's a multiple of blocksize, since the whole packet is */
+		read_len = payload_len - (s - payload);
+		if (read_len > 0) {
+			if (libssh2_blocking_read(session, s, read_len) < read_len) {
 				LIBSSH2_FREE(session, payload);
 				return -1;
 			}
 
-			p += read_len;
-
-    			while (s < p) {
-				memcpy(block, s, blocksize);
-
-				if (session->remote.crypt->crypt(session, block, &session->remote.crypt_abstract)) {
-					libssh2_error(session, LIBSSH2_ERROR_DECRYPT, "Error decrypting packet preamble", 0);
-					LIBSSH2_FREE(session, payload);
-					return -1;
-				}
-				memcpy(s, block, blocksize);
-
-				s += blocksize;
+			if (libssh2_packet_crypt(session, &session->remote, s, read_len)) {
+				libssh2_error(session, LIBSSH2_ERROR_DECRYPT, "Error decrypting packet", 0);
+				LIBSSH2_FREE(session, payload);
+				return -1;
 			}
 		}
 
@@ -855,74 +1501,28 @@ int libssh2_packet_read(LIBSSH2_SESSION *session, int should_block)
 		/* Ignore padding */
 		payload_len -= padding_len;
 
-		if (session->remote.comp &&
-			strcmp(session->remote.comp->name, "none")) {
-			/* Decompress */
-			unsigned char *data;
-			unsigned long data_len;
-
-			if (session->remote.comp->comp(session, 0, &data, &data_len, LIBSSH2_PACKET_MAXDECOMP, &free_payload, payload, payload_len, &session->remote.comp_abstract)) {
-				LIBSSH2_FREE(session, payload);
-				return -1;
-			}
-#ifdef LIBSSH2_DEBUG_TRANSPORT
-	_libssh2_debug(session, LIBSSH2_DBG_TRANS, "Payload decompressed: %lu bytes(compressed) to %lu bytes(uncompressed)", data_len, payload_len);
-#endif
-			if (free_payload) {
-				LIBSSH2_FREE(session, payload);
-				payload = data;
-				payload_len = data_len;
-			} else {
-				if (data == payload) {
-					/* It's not to be freed, because the compression layer reused payload,
-					 * So let's do the same!
-					 */
-					payload_len = data_len;
-				} else {
-					/* No comp_method actually lets this happen, but let's prepare for the future */
-
-					LIBSSH2_FREE(session, payload);
-
-					/* We need a freeable struct otherwise the brigade won't know what to do with it */
-					payload = LIBSSH2_ALLOC(session, data_len);
-					if (!payload) {
-						libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for copy of uncompressed data", 0);
-						return -1;
-					}
-					memcpy(payload, data, data_len);
-					payload_len = data_len;
-				}
-			}
+		if (libssh2_packet_decompress(session, &payload, &payload_len, &payload_size)) {
+			return -1;
 		}
 
 		packet_type = payload[0];
-		libssh2_packet_add(session, payload, payload_len, macstate);
+		libssh2_packet_add(session, payload, payload_len, payload_size, macstate);
 
 	} else { /* No cipher active */
 		unsigned char *payload;
 		unsigned char buf[24];
 		ssize_t buf_len;
-		unsigned long payload_len;
+		unsigned long payload_len, payload_size;
 		uint32_t packet_length;
 		unsigned long padding_length;
 
-		if (should_block) {
-			buf_len = libssh2_blocking_read(session, buf, 5);
-		} else {
-			ssize_t nread;
-			buf_len = LIBSSH2_READ(session, buf, 1);
-			if (buf_len <= 0) {
-                                return buf_len;
-			}
-			nread = libssh2_blocking_read(session, buf, 5 - buf_len);
-			if(nread <= 0)
-				return -1;
-
-			buf_len += nread;
+		buf_len = libssh2_blocking_read(session, buf, 5);
+		if (buf_len <= 0) {
+			return buf_len;
 		}
 		if (buf_len < 5) {
 			/* Something bad happened */
-			return -1;
+			return (session->socket_state == LIBSSH2_SOCKET_DISCONNECTED) ? 0 : -1;
 		}
 		packet_length = libssh2_ntohu32(buf);
 		
@@ -943,13 +1543,14 @@ int libssh2_packet_read(LIBSSH2_SESSION *session, int should_block)
 #endif
 
 		payload_len = packet_length - padding_length - 1; /* padding_length(1) */
-		payload = LIBSSH2_ALLOC(session, payload_len);
+		payload = libssh2_packet_buffer_alloc(session, payload_len, &payload_size);
 		if (!payload) {
 			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for copy of plaintext data", 0);
 			return -1;
 		}
 
 		if (libssh2_blocking_read(session, payload, payload_len) < payload_len) {
+			LIBSSH2_FREE(session, payload);
 			return (session->socket_state == LIBSSH2_SOCKET_DISCONNECTED) ? 0 : -1;
 		}
 		while (padding_length) {
@@ -965,7 +1566,7 @@ int libssh2_packet_read(LIBSSH2_SESSION *session, int should_block)
 		packet_type = payload[0];
 
 		/* MACs don't exist in non-encrypted mode */
-		libssh2_packet_add(session, payload, payload_len, LIBSSH2_MAC_CONFIRMED);
+		libssh2_packet_add(session, payload, payload_len, payload_size, LIBSSH2_MAC_CONFIRMED);
 		session->remote.seqno++;
 	}
 	return packet_type;
@@ -1007,7 +1608,7 @@ int libssh2_packet_ask_ex(LIBSSH2_SESSION *session, unsigned char packet_type, u
 				session->packets.tail = packet->prev;
 			}
 
-			LIBSSH2_FREE(session, packet);
+			libssh2_packet_header_free(session, packet);
 
 			return 0;
 		}
@@ -1148,6 +1749,49 @@ int libssh2_packet_requirev_ex(LIBSSH2_SESSION *session, unsigned char *packet_t
 }
 /* }}} */
 
+/* {{{ libssh2_packet_outbuf_reserve
+ * Make room for size more bytes at the end of the output buffer, which only ever grows
+ */
+static unsigned char *libssh2_packet_outbuf_reserve(LIBSSH2_SESSION *session, unsigned long size)
+{
+	if (session->outbuf_len + size > session->outbuf_size) {
+		unsigned long newsize = session->outbuf_size ? session->outbuf_size : 1024;
+		unsigned char *newbuf;
+
+		while (newsize < session->outbuf_len + size) {
+			newsize <<= 1;
+		}
+		newbuf = LIBSSH2_REALLOC(session, session->outbuf, newsize);
+		if (!newbuf) {
+			return NULL;
+		}
+		session->outbuf = newbuf;
+		session->outbuf_size = newsize;
+	}
+
+	return session->outbuf + session->outbuf_len;
+}
+/* }}} */
+
+/* {{{ libssh2_packet_write_queued
+ * A packet has just been added to the output buffer, decide whether it goes out now
+ */
+static int libssh2_packet_write_queued(LIBSSH2_SESSION *session)
+{
+	/* Inside a batch small packets wait for company, anything else goes out now */
+	if (session->batch_depth && session->outbuf_len < LIBSSH2_OUTBUF_FLUSH_AT) {
+		return 0;
+	}
+
+	if (!session->socket_block) {
+		/* What the socket won't take yet stays queued, block_directions tells the caller to come back */
+		return (libssh2_packet_send(session, 0) == -1) ? -1 : 0;
+	}
+
+	return libssh2_packet_flush(session);
+}
+/* }}} */
+
 /* {{{ libssh2_packet_write
  * Send a packet, encrypting it and adding a MAC code if necessary
  * Returns 0 on success, non-zero on failure
@@ -1156,6 +1800,9 @@ int libssh2_packet_write(LIBSSH2_SESSION *session, unsigned char *data, unsigned
 {
 	unsigned long packet_length = data_len + 1;
 	unsigned long block_size = (session->state & LIBSSH2_STATE_NEWKEYS) ? session->local.crypt->blocksize : 8;
+	/* AEAD ciphers leave packet_length out of the blocks and replace the MAC with their tag */
+	int aead = (session->state & LIBSSH2_STATE_NEWKEYS) && (session->local.crypt->flags & LIBSSH2_CRYPT_FLAG_AEAD);
+	unsigned long auth_len = !(session->state & LIBSSH2_STATE_NEWKEYS) ? 0 : (aead ? session->local.crypt->tag_len : session->local.mac->mac_len);
 	/* At this point packet_length doesn't include the packet_len field itself */
 	unsigned long padding_length;
 	int free_data = 0;
@@ -1171,8 +1818,7 @@ int libssh2_packet_write(LIBSSH2_SESSION *session, unsigned char *data, unsigned
 	_libssh2_debug(session, LIBSSH2_DBG_TRANS, "Sending packet type %d, length=%lu, %s", (int)data[0], data_len, excerpt);
 }
 #endif
-	if ((session->state & LIBSSH2_STATE_NEWKEYS) &&
-		strcmp(session->local.comp->name, "none")) {
+	if ((session->state & LIBSSH2_STATE_NEWKEYS) && LIBSSH2_COMP_ACTIVE(session, &session->local)) {
 
 		if (session->local.comp->comp(session, 1, &data, &data_len, LIBSSH2_PACKET_MAXCOMP, &free_data, data, data_len, &session->local.comp_abstract)) {
 			return -1;
@@ -1182,17 +1828,8 @@ int libssh2_packet_write(LIBSSH2_SESSION *session, unsigned char *data, unsigned
 #endif
 	}
 
-#ifndef WIN32
-	fcntl(session->socket_fd, F_SETFL, 0);
-#else
-	{
-		u_long non_block = FALSE;
-		ioctlsocket(session->socket_fd, FIONBIO, &non_block);
-	}
-#endif
-
 	packet_length = data_len + 1; /* padding_length(1) -- MAC doesn't count -- Padding to be added soon */
-	padding_length = block_size - ((packet_length + 4) % block_size);
+	padding_length = block_size - ((packet_length + (aead ? 0 : 4)) % block_size);
 	if (padding_length < 4) {
 		padding_length += block_size;
 	}
@@ -1207,11 +1844,12 @@ int libssh2_packet_write(LIBSSH2_SESSION *session, unsigned char *data, unsigned
 
 	if (session->state & LIBSSH2_STATE_NEWKEYS) {
 		/* Encryption is in effect */
-		unsigned char *encbuf, *s;
-		int ret, size, written = 0;
-
+		unsigned char *encbuf;
 		/* include packet_length(4) itself and room for the hash at the end */
-		encbuf = LIBSSH2_ALLOC(session, 4 + packet_length + session->local.mac->mac_len);
+		unsigned long size = 4 + packet_length + auth_len;
+
+		/* Packets are built straight into the session's output buffer */
+		encbuf = libssh2_packet_outbuf_reserve(session, size);
 		if (!encbuf) {
 			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate encryption buffer", 0);
 			if (free_data) {
@@ -1228,36 +1866,53 @@ int libssh2_packet_write(LIBSSH2_SESSION *session, unsigned char *data, unsigned
 			LIBSSH2_FREE(session, data);
 		}
 
-		/* Calculate MAC hash */
- 		session->local.mac->hash(session, encbuf + 4 + packet_length , session->local.seqno, encbuf, 4 + packet_length, NULL, 0, &session->local.mac_abstract);
+		if (aead) {
+			if (session->local.crypt->aead_seal(session, session->local.seqno, encbuf, 4 + packet_length, encbuf + 4 + packet_length, &session->local.crypt_abstract)) {
+				libssh2_error(session, LIBSSH2_ERROR_ENCRYPT, "Unable to encrypt packet", 0);
+				return -1;
+			}
+		} else {
+			/* Calculate MAC hash */
+			session->local.mac->hash(session, encbuf + 4 + packet_length , session->local.seqno, encbuf, 4 + packet_length, NULL, 0, &session->local.mac_abstract);
 
-		/* Encrypt data */
-		for(s = encbuf; (s - encbuf) < (4 + packet_length) ; s += session->local.crypt->blocksize) {
-			session->local.crypt->crypt(session, s, &session->local.crypt_abstract);
+			/* Encrypt data */
+			if (libssh2_packet_crypt(session, &session->local, encbuf, 4 + packet_length)) {
+				libssh2_error(session, LIBSSH2_ERROR_ENCRYPT, "Unable to encrypt packet", 0);
+				return -1;
+			}
 		}
 
 		session->local.seqno++;
+		session->outbuf_len += size;
 
-		/* Send It */
-		size = 4 + packet_length + session->local.mac->mac_len;
-		written = 0;
+		return libssh2_packet_write_queued(session);
+	} else if (!session->socket_block) {
+		/* Non-blocking sessions can't writev() around a partly sent output buffer, so queue it there too */
+		unsigned char *outbuf = libssh2_packet_outbuf_reserve(session, 4 + packet_length);
 
-		while(written < size) {
-		    ret = LIBSSH2_WRITE(session, encbuf + written, size - written);
-		    if(ret > 0) written += ret;
-		    else break;
+		if (!outbuf) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate output buffer", 0);
+			return -1;
 		}
+		memcpy(outbuf, buf, 5);
+		memcpy(outbuf + 5, data, data_len);
+		memcpy(outbuf + 5 + data_len, buf + 5, padding_length);
+		session->outbuf_len += 4 + packet_length;
+		session->local.seqno++;
 
-		ret = written == size ? 0 : -1;
-
-		/* Cleanup environment */
-		LIBSSH2_FREE(session, encbuf);
-
-		return ret;
+		return libssh2_packet_write_queued(session);
 	} else { /* LIBSSH2_ENDPOINT_CRYPT_NONE */
 		/* Simplified write for non-encrypted mode */
 		struct iovec data_vector[3];
 
+		if (libssh2_packet_flush(session)) {
+			if (free_data) {
+				LIBSSH2_FREE(session, data);
+			}
+			return -1;
+		}
+		libssh2_socket_mode(session);
+
 		/* Using vectors means we don't have to alloc a new buffer -- a byte saved is a byte earned
 		 * No MAC during unencrypted phase
 		 */
@@ -1279,3 +1934,40 @@ int libssh2_packet_write(LIBSSH2_SESSION *session, unsigned char *data, unsigned
 	}
 }
 /* }}} */
+
+/* {{{ libssh2_session_batch_begin
+ * Hold outgoing packets until libssh2_session_batch_end() so that a run of small ones goes out in a single write
+ * Calls nest; any blocking read flushes whatever is held so a batch can't wait on its own reply
+ */
+LIBSSH2_API void libssh2_session_batch_begin(LIBSSH2_SESSION *session)
+{
+	session->batch_depth++;
+}
+/* }}} */
+
+/* {{{ libssh2_session_batch_end
+ * Close the innermost batch, sending the held packets once the outermost one ends
+ * A non-blocking session returns LIBSSH2_ERROR_EAGAIN if the socket wouldn't take them all, the rest stays queued
+ */
+LIBSSH2_API int libssh2_session_batch_end(LIBSSH2_SESSION *session)
+{
+	if (session->batch_depth > 0) {
+		session->batch_depth--;
+	}
+	if (session->batch_depth) {
+		return 0;
+	}
+
+	return libssh2_packet_send(session, session->socket_block);
+}
+/* }}} */
+
+/* {{{ libssh2_session_flush
+ * Push queued output at the socket
+ * A non-blocking session returns LIBSSH2_ERROR_EAGAIN (and sets LIBSSH2_SESSION_BLOCK_OUTBOUND) if some is still left
+ */
+LIBSSH2_API int libssh2_session_flush(LIBSSH2_SESSION *session)
+{
+	return libssh2_packet_send(session, session->socket_block);
+}
+/* }}} */
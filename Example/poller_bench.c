@@ -0,0 +1,271 @@
+/* Times libssh2_poller_wait() against libssh2_poll() with many idle sessions and one busy at a time
+ *
+ * Not part of the library, build it against the same objects:
+ *   cc -I. -o poller_bench poller_bench.c <libssh2 .c files> -lcrypto -lz
+ *
+ *   poller_bench [-n sessions] [-r rounds] host port username password
+ *     Opens n sessions to an SSH server (sshd on 127.0.0.1, say), each with a channel running cat.
+ *     Every round writes a byte to the next channel and times how long each API takes to report it ready
+ *
+ *   poller_bench -s [-n sockets] [-r rounds]
+ *     The same with plain loopback socket pairs registered as LIBSSH2_POLLFD_SOCKET, no server needed
+ *
+ * libssh2_poll() rebuilds its pollfd array and walks every descriptor on each call, so its cost grows with n;
+ * libssh2_poller_wait() should stay flat. Which OS mechanism the poller uses is decided by libssh2_config.h
+ */
+
+#include "libssh2.h"
+#include "libssh2_config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct bench_target {
+	int socket;					/* TCP connection, or our end of the socket pair */
+	int peer;					/* Far end of the socket pair, -1 for sessions */
+	LIBSSH2_SESSION *session;
+	LIBSSH2_CHANNEL *channel;
+};
+
+static double bench_now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+/* {{{ bench_open_session
+ * Connect, authenticate and start cat on a channel
+ */
+static int bench_open_session(struct bench_target *target, const char *host, int port, const char *username, const char *password)
+{
+	struct sockaddr_in sin;
+
+	memset(target, 0, sizeof(struct bench_target));
+	target->peer = -1;
+
+	target->socket = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = inet_addr(host);
+	if (connect(target->socket, (struct sockaddr *)&sin, sizeof(sin))) {
+		perror("connect");
+		return -1;
+	}
+
+	target->session = libssh2_session_init();
+	if (!target->session || libssh2_session_startup(target->session, target->socket)) {
+		fprintf(stderr, "Session startup failed\n");
+		return -1;
+	}
+	if (libssh2_userauth_password(target->session, username, password)) {
+		fprintf(stderr, "Authentication failed\n");
+		return -1;
+	}
+
+	target->channel = libssh2_channel_open_session(target->session);
+	if (!target->channel || libssh2_channel_exec(target->channel, "cat")) {
+		fprintf(stderr, "Unable to start cat\n");
+		return -1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ bench_open_socket
+ */
+static int bench_open_socket(struct bench_target *target)
+{
+	int pair[2];
+
+	memset(target, 0, sizeof(struct bench_target));
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair)) {
+		perror("socketpair");
+		return -1;
+	}
+	target->socket = pair[0];
+	target->peer = pair[1];
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ bench_kick
+ * Make target readable: one byte, echoed back by cat for sessions
+ */
+static void bench_kick(struct bench_target *target)
+{
+	if (target->channel) {
+		libssh2_channel_write(target->channel, "x", 1);
+	} else {
+		write(target->peer, "x", 1);
+	}
+}
+/* }}} */
+
+/* {{{ bench_consume
+ */
+static void bench_consume(struct bench_target *target)
+{
+	char c;
+
+	if (target->channel) {
+		libssh2_channel_read(target->channel, &c, 1);
+	} else {
+		read(target->socket, &c, 1);
+	}
+}
+/* }}} */
+
+/* {{{ bench_run
+ * Returns the mean microseconds from kicking a target to having consumed it, -1 if a wait came back empty
+ */
+static double bench_run(struct bench_target *targets, LIBSSH2_POLLFD *fds, unsigned int count, unsigned int rounds, LIBSSH2_POLLER *poller)
+{
+	LIBSSH2_POLLFD *ready[16];
+	double total = 0;
+	unsigned int round, i;
+
+	for(round = 0; round < rounds; round++) {
+		struct bench_target *target = targets + (round % count);
+		double started;
+		int found = 0;
+
+		bench_kick(target);
+		started = bench_now_us();
+
+		while (!found) {
+			if (poller) {
+				int ready_count = libssh2_poller_wait(poller, ready, 16, 1000);
+
+				if (ready_count <= 0) {
+					return -1;
+				}
+				for(i = 0; i < (unsigned int)ready_count; i++) {
+					bench_consume(targets + (ready[i] - fds));
+					found = 1;
+				}
+			} else {
+				/* What a caller of libssh2_poll() has to do too: look through everything for the ready ones */
+				if (libssh2_poll(fds, count, 1000) <= 0) {
+					return -1;
+				}
+				for(i = 0; i < count; i++) {
+					if (fds[i].revents & LIBSSH2_POLLFD_POLLIN) {
+						bench_consume(targets + i);
+						found = 1;
+					}
+					fds[i].revents = 0;
+				}
+			}
+		}
+		total += bench_now_us() - started;
+	}
+
+	return total / rounds;
+}
+/* }}} */
+
+static int bench_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-n sessions] [-r rounds] host port username password\n"
+					"       %s -s [-n sockets] [-r rounds]\n", name, name);
+	return 2;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int count = 200, rounds = 2000, i;
+	int sockets_only = 0, opt;
+	struct bench_target *targets;
+	LIBSSH2_POLLFD *fds;
+	LIBSSH2_POLLER *poller;
+	double poll_us, poller_us;
+
+	while ((opt = getopt(argc, argv, "n:r:s")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 'r':
+				rounds = atoi(optarg);
+				break;
+			case 's':
+				sockets_only = 1;
+				break;
+			default:
+				return bench_usage(argv[0]);
+		}
+	}
+	if (!count || !rounds || (!sockets_only && ((argc - optind) != 4))) {
+		return bench_usage(argv[0]);
+	}
+
+	targets = calloc(count, sizeof(struct bench_target));
+	fds = calloc(count, sizeof(LIBSSH2_POLLFD));
+	for(i = 0; i < count; i++) {
+		if (sockets_only ? bench_open_socket(targets + i) :
+						   bench_open_session(targets + i, argv[optind], atoi(argv[optind + 1]), argv[optind + 2], argv[optind + 3])) {
+			fprintf(stderr, "Gave up after %u %s\n", i, sockets_only ? "sockets" : "sessions");
+			return 1;
+		}
+		if (targets[i].channel) {
+			fds[i].type = LIBSSH2_POLLFD_CHANNEL;
+			fds[i].fd.channel = targets[i].channel;
+		} else {
+			fds[i].type = LIBSSH2_POLLFD_SOCKET;
+			fds[i].fd.socket = targets[i].socket;
+		}
+		fds[i].events = LIBSSH2_POLLFD_POLLIN;
+	}
+
+	poll_us = bench_run(targets, fds, count, rounds, NULL);
+
+	poller = libssh2_poller_init();
+	for(i = 0; i < count; i++) {
+		if (libssh2_poller_add(poller, fds + i)) {
+			fprintf(stderr, "libssh2_poller_add failed\n");
+			return 1;
+		}
+	}
+	poller_us = bench_run(targets, fds, count, rounds, poller);
+
+	printf("%u %s, %u rounds (poller uses %s)\n", count, sockets_only ? "loopback socket pairs" : "loopback sessions", rounds,
+#ifdef HAVE_SYS_EPOLL_H
+		   "epoll"
+#else
+		   "poll()"
+#endif
+		   );
+	printf("  libssh2_poll         %8.1f us per wakeup\n", poll_us);
+	printf("  libssh2_poller_wait  %8.1f us per wakeup\n", poller_us);
+
+	for(i = 0; i < count; i++) {
+		libssh2_poller_remove(poller, fds + i);
+	}
+	libssh2_poller_free(poller);
+	for(i = 0; i < count; i++) {
+		if (targets[i].channel) {
+			libssh2_channel_free(targets[i].channel);
+			libssh2_session_disconnect(targets[i].session, "Benchmark done");
+			libssh2_session_free(targets[i].session);
+		} else {
+			close(targets[i].peer);
+		}
+		close(targets[i].socket);
+	}
+	free(fds);
+	free(targets);
+
+	return ((poll_us < 0) || (poller_us < 0)) ? 1 : 0;
+}
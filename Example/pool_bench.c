@@ -0,0 +1,337 @@
+/* Times streaming channel data through libssh2_packet_read() and libssh2_channel_read(), with the packet pool's counters
+ *
+ * Not part of the library, build it against the same objects:
+ *   cc -I. -o pool_bench pool_bench.c <libssh2 .c files> -lcrypto -lz
+ * Against a libssh2 from before the packet pool, add -DPOOL_BENCH_NO_STATS to leave out libssh2_session_pool_stats()
+ *
+ *   pool_bench [-b bufsize] host port username password path
+ *     Downloads path over SFTP from an SSH server (sshd on 127.0.0.1, say) and reports the rate
+ *
+ *   pool_bench -s [-n packets] [-w window] [datalen ...]
+ *     A loopback stand-in needing no server: a child process writes n plaintext SSH_MSG_CHANNEL_DATA packets
+ *     of each datalen (1000, 8000 and 32000 by default) down a socket pair, keeping within the channel window
+ *     (LIBSSH2_CHANNEL_WINDOW_DEFAULT unless given) as a server would, and a session with a channel wired
+ *     straight onto the other end reads them out. Nothing is encrypted, so this is the packet allocation and
+ *     brigade cost plus the copies, about as bare as the inbound path gets
+ *
+ * Every payload buffer and packet header used to be a fresh LIBSSH2_ALLOC()/LIBSSH2_FREE() pair;
+ * with the pool most of them should be hits once the first few packets are through
+ */
+
+#include "libssh2_priv.h"
+#include "libssh2_sftp.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_CHANNEL	7
+/* Keeps a packet inside the 35000 bytes libssh2_packet_read() accepts */
+#define BENCH_MAX_DATALEN	34900
+
+static double bench_now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+/* {{{ bench_print_pool
+ */
+static void bench_print_pool(LIBSSH2_SESSION *session)
+{
+#ifndef POOL_BENCH_NO_STATS
+	LIBSSH2_POOL_STATS stats;
+
+	libssh2_session_pool_stats(session, &stats);
+	printf("    pool: %lu hits, %lu misses, %lu bytes cached, %lu high water\n", stats.hits, stats.misses, stats.cached_bytes, stats.high_water);
+#else
+	(void)session;
+#endif
+}
+/* }}} */
+
+/* {{{ bench_send
+ * The far end of the stand-in: write that many channel data packets, no more than the window allows,
+ * and take in the window adjusts coming back the way a server would
+ */
+static void bench_send(int sock, unsigned long packets, unsigned long datalen, unsigned long window)
+{
+	unsigned long payload_len = 9 + datalen, padding_len, packet_len, sent = 0, pos = 0, in_len = 0;
+	unsigned char *packet, *s, in[1024];
+
+	padding_len = 8 - ((4 + 1 + payload_len) % 8);
+	if (padding_len < 4) {
+		padding_len += 8;
+	}
+	packet_len = 4 + 1 + payload_len + padding_len;
+
+	s = packet = calloc(1, packet_len);
+	libssh2_htonu32(s, packet_len - 4);				s += 4;
+	*(s++) = padding_len;
+	*(s++) = SSH_MSG_CHANNEL_DATA;
+	libssh2_htonu32(s, BENCH_CHANNEL);				s += 4;
+	libssh2_htonu32(s, datalen);					s += 4;
+	memset(s, 'x', datalen);
+
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+	for(;;) {
+		/* Partway through a packet, or the window has room for the next */
+		int can_send = pos || ((sent < packets) && (window >= datalen));
+		struct pollfd fd;
+
+		fd.fd = sock;
+		fd.events = POLLIN | (can_send ? POLLOUT : 0);
+		if (poll(&fd, 1, -1) < 0) {
+			break;
+		}
+		if (fd.revents & (POLLIN | POLLHUP)) {
+			ssize_t ret = read(sock, in + in_len, sizeof(in) - in_len);
+
+			if (ret <= 0) {
+				/* Reader's done */
+				break;
+			}
+			in_len += ret;
+			while ((in_len >= 4) && (in_len >= (4 + libssh2_ntohu32(in)))) {
+				unsigned long len = 4 + libssh2_ntohu32(in);
+
+				if ((len >= 14) && (in[5] == SSH_MSG_CHANNEL_WINDOW_ADJUST)) {
+					window += libssh2_ntohu32(in + 10);
+				}
+				memmove(in, in + len, in_len - len);
+				in_len -= len;
+			}
+		}
+		if (can_send && (fd.revents & POLLOUT)) {
+			ssize_t ret = write(sock, packet + pos, packet_len - pos);
+
+			if (ret > 0) {
+				if (!pos) {
+					window -= datalen;
+				}
+				pos += ret;
+				if (pos == packet_len) {
+					sent++;
+					pos = 0;
+				}
+			}
+		}
+	}
+	free(packet);
+}
+/* }}} */
+
+/* {{{ bench_socket_run
+ * Returns the mean nanoseconds per packet, -1 if the data didn't all arrive
+ */
+static double bench_socket_run(unsigned long packets, unsigned long datalen, unsigned long window)
+{
+	LIBSSH2_SESSION *session;
+	LIBSSH2_CHANNEL *channel;
+	unsigned long long want = (unsigned long long)packets * datalen, got = 0;
+	double started, elapsed;
+	char buf[32768];
+	int pair[2], status;
+	pid_t child;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair)) {
+		perror("socketpair");
+		return -1;
+	}
+	child = fork();
+	if (child < 0) {
+		perror("fork");
+		return -1;
+	}
+	if (!child) {
+		close(pair[0]);
+		bench_send(pair[1], packets, datalen, window);
+		_exit(0);
+	}
+	close(pair[1]);
+
+	/* A session which has never been through key exchange reads plaintext packets, which is all the sender writes */
+	session = libssh2_session_init();
+	session->socket_fd = pair[0];
+
+	channel = LIBSSH2_ALLOC(session, sizeof(LIBSSH2_CHANNEL));
+	memset(channel, 0, sizeof(LIBSSH2_CHANNEL));
+	channel->session = session;
+	channel->blocking = 1;
+	channel->local.id = BENCH_CHANNEL;
+	channel->remote.id = BENCH_CHANNEL;
+	channel->remote.window_size = window;
+	channel->remote.window_size_initial = window;
+	channel->remote.packet_size = LIBSSH2_PACKET_MAXPAYLOAD;
+	libssh2_channel_add(session, channel);
+
+	started = bench_now_us();
+	while (got < want) {
+		int ret = libssh2_channel_read(channel, buf, sizeof(buf));
+
+		if (ret <= 0) {
+			break;
+		}
+		got += ret;
+	}
+	elapsed = bench_now_us() - started;
+
+	bench_print_pool(session);
+
+	/* Nothing to tell the sender, it just goes once the socket closes */
+	libssh2_channel_unlink(session, channel);
+	LIBSSH2_FREE(session, channel);
+	session->socket_state = LIBSSH2_SOCKET_DISCONNECTED;
+	close(pair[0]);
+	libssh2_session_free(session);
+	waitpid(child, &status, 0);
+
+	if (got != want) {
+		return -1;
+	}
+	return (elapsed * 1000.0) / packets;
+}
+/* }}} */
+
+/* {{{ bench_sftp_run
+ */
+static int bench_sftp_run(const char *host, int port, const char *username, const char *password, const char *path, size_t bufsize)
+{
+	LIBSSH2_SESSION *session;
+	LIBSSH2_SFTP *sftp;
+	LIBSSH2_SFTP_HANDLE *handle;
+	struct sockaddr_in sin;
+	unsigned long long total = 0;
+	double started, elapsed;
+	char *buf;
+	int sock, ret;
+
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = inet_addr(host);
+	if (connect(sock, (struct sockaddr *)&sin, sizeof(sin))) {
+		perror("connect");
+		return 1;
+	}
+
+	session = libssh2_session_init();
+	if (!session || libssh2_session_startup(session, sock)) {
+		fprintf(stderr, "Session startup failed\n");
+		return 1;
+	}
+	if (libssh2_userauth_password(session, username, password)) {
+		fprintf(stderr, "Authentication failed\n");
+		return 1;
+	}
+	sftp = libssh2_sftp_init(session);
+	if (!sftp) {
+		fprintf(stderr, "Unable to start SFTP\n");
+		return 1;
+	}
+	handle = libssh2_sftp_open(sftp, path, LIBSSH2_FXF_READ, 0);
+	if (!handle) {
+		fprintf(stderr, "Unable to open %s\n", path);
+		return 1;
+	}
+
+	buf = malloc(bufsize);
+	started = bench_now_us();
+	while ((ret = libssh2_sftp_read(handle, buf, bufsize)) > 0) {
+		total += ret;
+	}
+	elapsed = bench_now_us() - started;
+	free(buf);
+
+	if (ret < 0) {
+		fprintf(stderr, "Read failed after %llu bytes\n", total);
+	}
+	printf("%llu bytes in %.3f s, %.1f MB/s\n", total, elapsed / 1000000.0, elapsed ? (total / elapsed) : 0.0);
+	bench_print_pool(session);
+
+	libssh2_sftp_close(handle);
+	libssh2_sftp_shutdown(sftp);
+	libssh2_session_disconnect(session, "Normal Shutdown");
+	libssh2_session_free(session);
+	close(sock);
+
+	return (ret < 0);
+}
+/* }}} */
+
+int main(int argc, char *argv[])
+{
+	unsigned long default_lens[] = { 1000, 8000, 32000 };
+	unsigned long packets = 100000, window = LIBSSH2_CHANNEL_WINDOW_DEFAULT, i, count;
+	size_t bufsize = 32768;
+	int opt, use_sockets = 0, failed = 0;
+
+	while ((opt = getopt(argc, argv, "sn:w:b:")) != -1) {
+		switch (opt) {
+			case 's':
+				use_sockets = 1;
+				break;
+			case 'n':
+				packets = strtoul(optarg, NULL, 10);
+				break;
+			case 'w':
+				window = strtoul(optarg, NULL, 10);
+				break;
+			case 'b':
+				bufsize = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				goto usage;
+		}
+	}
+
+	if (!use_sockets) {
+		if (((argc - optind) != 5) || !bufsize) {
+			goto usage;
+		}
+		return bench_sftp_run(argv[optind], atoi(argv[optind + 1]), argv[optind + 2], argv[optind + 3], argv[optind + 4], bufsize);
+	}
+
+	if (!packets || !window) {
+		goto usage;
+	}
+	count = (optind < argc) ? (unsigned long)(argc - optind) : (sizeof(default_lens) / sizeof(default_lens[0]));
+
+	printf("%lu packets through a socket pair, %lu byte window\n", packets, window);
+	for(i = 0; i < count; i++) {
+		unsigned long datalen = (optind < argc) ? strtoul(argv[optind + i], NULL, 10) : default_lens[i];
+		double ns;
+
+		if (!datalen || (datalen > BENCH_MAX_DATALEN)) {
+			fprintf(stderr, "Skipping datalen %lu\n", datalen);
+			continue;
+		}
+		printf("  datalen %lu\n", datalen);
+		ns = bench_socket_run(packets, datalen, window);
+		if (ns < 0) {
+			fprintf(stderr, "Channel data went missing with datalen %lu\n", datalen);
+			failed = 1;
+			break;
+		}
+		printf("    %.1f ns/packet, %.1f MB/s\n", ns, (datalen * 1000.0) / ns);
+	}
+
+	return failed;
+
+ usage:
+	fprintf(stderr, "Usage: %s [-b bufsize] host port username password path\n"
+					"       %s -s [-n packets] [-w window] [datalen ...]\n", argv[0], argv[0]);
+	return 2;
+}
@@ -38,13 +38,21 @@
 #include "libssh2_priv.h"
 #include <errno.h>
 #include <stdlib.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
 
 #define LIBSSH2_SCP_RESPONSE_BUFLEN		256
 
-/* {{{ libssh2_scp_recv
- * Open a channel and request a remote file via SCP
+/* Streaming transfers: receive window offered to the remote, largest packet accepted from it, and how much is moved per read/write */
+#define LIBSSH2_SCP_STREAM_WINDOW		(1024 * 1024)
+#define LIBSSH2_SCP_STREAM_PACKET		32768
+#define LIBSSH2_SCP_STREAM_CHUNK		(256 * 1024)
+
+/* {{{ libssh2_scp_recv_channel
+ * Open a channel with the given receive window and request a remote file via SCP
  */
-LIBSSH2_API LIBSSH2_CHANNEL *libssh2_scp_recv(LIBSSH2_SESSION *session, const char *path, struct stat *sb)
+static LIBSSH2_CHANNEL *libssh2_scp_recv_channel(LIBSSH2_SESSION *session, const char *path, struct stat *sb, unsigned long window_size, unsigned long packet_size)
 {
 	int path_len = strlen(path);
 	unsigned char *command, response[LIBSSH2_SCP_RESPONSE_BUFLEN];
@@ -74,7 +82,7 @@ LIBSSH2_API LIBSSH2_CHANNEL *libssh2_scp_recv(LIBSSH2_SESSION *session, const ch
 	_libssh2_debug(session, LIBSSH2_DBG_SCP, "Opening channel for SCP receive");
 #endif
 	/* Allocate a channel */
-	if ((channel = libssh2_channel_open_session(session)) == NULL) {
+	if ((channel = libssh2_channel_open_ex(session, "session", sizeof("session") - 1, window_size, packet_size, NULL, 0)) == NULL) {
 		LIBSSH2_FREE(session, command);
 		return NULL;
 	}
@@ -327,6 +335,15 @@ LIBSSH2_API LIBSSH2_CHANNEL *libssh2_scp_recv(LIBSSH2_SESSION *session, const ch
 }
 /* }}} */
 
+/* {{{ libssh2_scp_recv
+ * Open a channel and request a remote file via SCP
+ */
+LIBSSH2_API LIBSSH2_CHANNEL *libssh2_scp_recv(LIBSSH2_SESSION *session, const char *path, struct stat *sb)
+{
+	return libssh2_scp_recv_channel(session, path, sb, LIBSSH2_CHANNEL_WINDOW_DEFAULT, LIBSSH2_CHANNEL_PACKET_DEFAULT);
+}
+/* }}} */
+
 /* {{{ libssh2_scp_send_ex
  * Send a file using SCP
  */
@@ -435,3 +452,243 @@ LIBSSH2_API LIBSSH2_CHANNEL *libssh2_scp_send_ex(LIBSSH2_SESSION *session, const
 }
 /* }}} */
 
+/* {{{ libssh2_scp_send_stream
+ * Send size bytes from fd (or buf when fd is -1) as path
+ * Data goes to the channel a large chunk at a time inside a session batch, so it leaves as full sized packets in few writes
+ */
+static int libssh2_scp_send_stream(LIBSSH2_SESSION *session, const char *path, int fd, const char *buf, size_t size, int mode, long mtime, long atime,
+									LIBSSH2_SCP_PROGRESS_FUNC((*progress)), void *abstract)
+{
+	LIBSSH2_CHANNEL *channel;
+	char *chunk = NULL, ack;
+	size_t sent = 0;
+
+	channel = libssh2_scp_send_ex(session, path, mode, size, mtime, atime);
+	if (!channel) {
+		return -1;
+	}
+	libssh2_channel_set_blocking(channel, 1);
+
+	if (fd >= 0) {
+		chunk = LIBSSH2_ALLOC(session, LIBSSH2_SCP_STREAM_CHUNK);
+		if (!chunk) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate SCP transfer buffer", 0);
+			goto scp_send_error;
+		}
+	}
+
+	while (sent < size) {
+		const char *data;
+		size_t len = size - sent;
+		int written;
+
+		if (len > LIBSSH2_SCP_STREAM_CHUNK) {
+			len = LIBSSH2_SCP_STREAM_CHUNK;
+		}
+		if (fd >= 0) {
+			ssize_t nread = read(fd, chunk, len);
+
+			if ((nread < 0) && (errno == EINTR)) {
+				continue;
+			}
+			if (nread <= 0) {
+				libssh2_error(session, LIBSSH2_ERROR_FILE, "Unable to read local file for SCP send", 0);
+				goto scp_send_error;
+			}
+			data = chunk;
+			len = nread;
+		} else {
+			data = buf + sent;
+		}
+
+		libssh2_session_batch_begin(session);
+		written = libssh2_channel_write(channel, data, len);
+		if ((libssh2_session_batch_end(session) == -1) || (written != len)) {
+			libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send SCP file data", 0);
+			goto scp_send_error;
+		}
+		sent += len;
+
+		if (progress && progress(session, sent, size, abstract)) {
+			libssh2_error(session, LIBSSH2_ERROR_SCP_PROTOCOL, "SCP transfer cancelled", 0);
+			goto scp_send_error;
+		}
+	}
+
+	/* End of file marker, then wait for the remote's verdict */
+	ack = '\0';
+	if (libssh2_channel_write(channel, &ack, 1) != 1) {
+		libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send SCP end of file", 0);
+		goto scp_send_error;
+	}
+	if ((libssh2_channel_read(channel, &ack, 1) <= 0) || (ack != 0)) {
+		libssh2_error(session, LIBSSH2_ERROR_SCP_PROTOCOL, "Invalid ACK response from remote", 0);
+		goto scp_send_error;
+	}
+
+	if (chunk) {
+		LIBSSH2_FREE(session, chunk);
+	}
+	libssh2_channel_send_eof(channel);
+	libssh2_channel_free(channel);
+
+	return 0;
+
+ scp_send_error:
+	if (chunk) {
+		LIBSSH2_FREE(session, chunk);
+	}
+	libssh2_channel_free(channel);
+
+	return -1;
+}
+/* }}} */
+
+/* {{{ libssh2_scp_send_fd
+ * Send size bytes read from fd as path, reporting progress as it goes
+ * Returns 0 on success, -1 on failure
+ */
+LIBSSH2_API int libssh2_scp_send_fd(LIBSSH2_SESSION *session, const char *path, int fd, int mode, size_t size, long mtime, long atime,
+										LIBSSH2_SCP_PROGRESS_FUNC((*progress)), void *abstract)
+{
+	if (fd < 0) {
+		libssh2_error(session, LIBSSH2_ERROR_INVAL, "Invalid file descriptor", 0);
+		return -1;
+	}
+	return libssh2_scp_send_stream(session, path, fd, NULL, size, mode, mtime, atime, progress, abstract);
+}
+/* }}} */
+
+/* {{{ libssh2_scp_send_mem
+ * Send size bytes from memory (e.g. an mmap'd file) as path, reporting progress as it goes
+ * Returns 0 on success, -1 on failure
+ */
+LIBSSH2_API int libssh2_scp_send_mem(LIBSSH2_SESSION *session, const char *path, const char *buf, int mode, size_t size, long mtime, long atime,
+										LIBSSH2_SCP_PROGRESS_FUNC((*progress)), void *abstract)
+{
+	return libssh2_scp_send_stream(session, path, -1, buf, size, mode, mtime, atime, progress, abstract);
+}
+/* }}} */
+
+/* {{{ libssh2_scp_recv_stream
+ * Receive path into fd (or buf when fd is -1)
+ * The channel is opened with a large receive window so the remote can keep sending while data is written out here
+ */
+static int libssh2_scp_recv_stream(LIBSSH2_SESSION *session, const char *path, int fd, char *buf, size_t buf_len, struct stat *sb,
+									LIBSSH2_SCP_PROGRESS_FUNC((*progress)), void *abstract)
+{
+	LIBSSH2_CHANNEL *channel;
+	struct stat local_sb;
+	char *chunk = NULL, ack;
+	size_t size, received = 0;
+
+	channel = libssh2_scp_recv_channel(session, path, &local_sb, LIBSSH2_SCP_STREAM_WINDOW, LIBSSH2_SCP_STREAM_PACKET);
+	if (!channel) {
+		return -1;
+	}
+	if (sb) {
+		memcpy(sb, &local_sb, sizeof(struct stat));
+	}
+	size = local_sb.st_size;
+	libssh2_channel_set_blocking(channel, 1);
+	libssh2_channel_window_autotune(channel, LIBSSH2_CHANNEL_WINDOW_MAX);
+
+	if (fd >= 0) {
+		chunk = LIBSSH2_ALLOC(session, LIBSSH2_SCP_STREAM_CHUNK);
+		if (!chunk) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate SCP transfer buffer", 0);
+			goto scp_recv_error;
+		}
+	} else if (size > buf_len) {
+		libssh2_error(session, LIBSSH2_ERROR_INVAL, "Remote file is larger than the buffer provided", 0);
+		goto scp_recv_error;
+	}
+
+	while (received < size) {
+		char *data = (fd >= 0) ? chunk : (buf + received);
+		size_t len = size - received;
+		int nread;
+
+		if (len > LIBSSH2_SCP_STREAM_CHUNK) {
+			len = LIBSSH2_SCP_STREAM_CHUNK;
+		}
+		nread = libssh2_channel_read(channel, data, len);
+		if (nread <= 0) {
+			libssh2_error(session, LIBSSH2_ERROR_SCP_PROTOCOL, "Unexpected end of SCP file data", 0);
+			goto scp_recv_error;
+		}
+
+		if (fd >= 0) {
+			size_t written = 0;
+
+			while (written < nread) {
+				ssize_t ret = write(fd, data + written, nread - written);
+
+				if ((ret < 0) && (errno == EINTR)) {
+					continue;
+				}
+				if (ret <= 0) {
+					libssh2_error(session, LIBSSH2_ERROR_FILE, "Unable to write local file for SCP receive", 0);
+					goto scp_recv_error;
+				}
+				written += ret;
+			}
+		}
+		received += nread;
+
+		if (progress && progress(session, received, size, abstract)) {
+			libssh2_error(session, LIBSSH2_ERROR_SCP_PROTOCOL, "SCP transfer cancelled", 0);
+			goto scp_recv_error;
+		}
+	}
+
+	/* The remote's end of file marker, acknowledged to let it finish */
+	if ((libssh2_channel_read(channel, &ack, 1) <= 0) || (ack != 0)) {
+		libssh2_error(session, LIBSSH2_ERROR_SCP_PROTOCOL, "Invalid end of file marker from remote", 0);
+		goto scp_recv_error;
+	}
+	ack = '\0';
+	libssh2_channel_write(channel, &ack, 1);
+
+	if (chunk) {
+		LIBSSH2_FREE(session, chunk);
+	}
+	libssh2_channel_free(channel);
+
+	return 0;
+
+ scp_recv_error:
+	if (chunk) {
+		LIBSSH2_FREE(session, chunk);
+	}
+	libssh2_channel_free(channel);
+
+	return -1;
+}
+/* }}} */
+
+/* {{{ libssh2_scp_recv_fd
+ * Receive path into fd, reporting progress as it goes, sb (if given) gets the remote file's size, mode and times
+ * Returns 0 on success, -1 on failure
+ */
+LIBSSH2_API int libssh2_scp_recv_fd(LIBSSH2_SESSION *session, const char *path, int fd, struct stat *sb,
+										LIBSSH2_SCP_PROGRESS_FUNC((*progress)), void *abstract)
+{
+	if (fd < 0) {
+		libssh2_error(session, LIBSSH2_ERROR_INVAL, "Invalid file descriptor", 0);
+		return -1;
+	}
+	return libssh2_scp_recv_stream(session, path, fd, NULL, 0, sb, progress, abstract);
+}
+/* }}} */
+
+/* {{{ libssh2_scp_recv_mem
+ * Receive path into buf (e.g. an mmap'd region), which must be large enough for the whole file
+ * Returns 0 on success, -1 on failure
+ */
+LIBSSH2_API int libssh2_scp_recv_mem(LIBSSH2_SESSION *session, const char *path, char *buf, size_t buf_len, struct stat *sb,
+										LIBSSH2_SCP_PROGRESS_FUNC((*progress)), void *abstract)
+{
+	return libssh2_scp_recv_stream(session, path, -1, buf, buf_len, sb, progress, abstract);
+}
+/* }}} */
@@ -47,6 +47,12 @@
 #include <math.h>
 #endif
 
+/* libssh2_config.h only turns this on for Linux, other platforms' pollers keep a persistent pollfd array for poll() */
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+# define LIBSSH2_POLLER_EPOLL 1
+#endif
+
 #ifdef HAVE_POLL
 # include <sys/poll.h>
 #else
@@ -295,6 +301,8 @@ LIBSSH2_API LIBSSH2_SESSION *libssh2_session_init_ex(
 	session->abstract	= abstract;
 	session->ssh_write	= local_write;
 	session->ssh_read	= local_read;
+	session->socket_block	= 1;
+	session->comp_level		= -1;
 #ifdef LIBSSH2_DEBUG_TRANSPORT
 	_libssh2_debug(session, LIBSSH2_DBG_TRANS, "New session resource allocated");
 #endif
@@ -370,6 +378,7 @@ LIBSSH2_API int libssh2_session_startup(LIBSSH2_SESSION *session, int socket)
 		return LIBSSH2_ERROR_SOCKET_NONE;
 	}
 	session->socket_fd = socket;
+	session->socket_mode = LIBSSH2_SOCKET_MODE_UNKNOWN;
 
 	/* TODO: Liveness check */
 	if (libssh2_banner_send(session)) {
@@ -427,6 +436,10 @@ LIBSSH2_API void libssh2_session_free(LIBSSH2_SESSION *session)
 #ifdef LIBSSH2_DEBUG_TRANSPORT
 	_libssh2_debug(session, LIBSSH2_DBG_TRANS, "Freeing session resource", session->remote.banner);
 #endif
+	if (session->poller_socket) {
+		libssh2_poller_detach_session(session);
+	}
+
 	while (session->channels.head) {
 		LIBSSH2_CHANNEL *tmp = session->channels.head;
 
@@ -439,6 +452,7 @@ LIBSSH2_API void libssh2_session_free(LIBSSH2_SESSION *session)
 			session->channels.head = tmp->next;
 
 			/* free */
+			libssh2_channel_data_free(tmp);
 			LIBSSH2_FREE(session, tmp);
 
 			/* reverse linking isn't important here, we're killing the structure */
@@ -489,6 +503,13 @@ LIBSSH2_API void libssh2_session_free(LIBSSH2_SESSION *session)
 		}
 	}
 
+	if (session->outbuf) {
+		LIBSSH2_FREE(session, session->outbuf);
+	}
+	if (session->inbuf) {
+		LIBSSH2_FREE(session, session->inbuf);
+	}
+
 	/* Free banner(s) */
 	if (session->remote.banner) {
 		LIBSSH2_FREE(session, session->remote.banner);
@@ -539,10 +560,11 @@ LIBSSH2_API void libssh2_session_free(LIBSSH2_SESSION *session)
 		session->packets.head = tmp->next;
 
 		/* free */
-		LIBSSH2_FREE(session, tmp->data);
-		LIBSSH2_FREE(session, tmp);
+		libssh2_packet_free(session, tmp);
 	}
 
+	libssh2_packet_pool_empty(session);
+
 	LIBSSH2_FREE(session, session);
 }
 /* }}} */
@@ -586,6 +608,8 @@ LIBSSH2_API int libssh2_session_disconnect_ex(LIBSSH2_SESSION *session, int reas
 		s += lang_len;
 	}
 
+	/* Last thing this session will say, don't leave it (or anything before it) sitting in a batch */
+	session->batch_depth = 0;
 	libssh2_packet_write(session, data, data_len);
 
 	LIBSSH2_FREE(session, data);
@@ -730,18 +754,80 @@ LIBSSH2_API int libssh2_session_flag(LIBSSH2_SESSION *session, int flag, int val
 }
 /* }}} */
 
+/* {{{ libssh2_session_pool_stats
+ * Report how well the packet pool is doing
+ */
+LIBSSH2_API void libssh2_session_pool_stats(LIBSSH2_SESSION *session, LIBSSH2_POOL_STATS *stats)
+{
+	memcpy(stats, &session->packet_pool.stats, sizeof(LIBSSH2_POOL_STATS));
+}
+/* }}} */
+
+/* {{{ libssh2_session_compression_level
+ * Trade CPU for bandwidth on outgoing packets when zlib compression has been negotiated
+ * level runs from 0 (store only) to 9 (best), -1 restores zlib's default; it applies from the next packet sent
+ */
+LIBSSH2_API int libssh2_session_compression_level(LIBSSH2_SESSION *session, int level)
+{
+	if ((level < -1) || (level > 9)) {
+		libssh2_error(session, LIBSSH2_ERROR_INVAL, "Compression level must be between -1 and 9", 0);
+		return -1;
+	}
+	session->comp_level = level;
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_session_set_blocking
+ * In a non-blocking session the socket stays O_NONBLOCK, packets are only read once they've fully arrived,
+ * and output the socket won't take yet is kept queued
+ * Channel reads and writes return LIBSSH2_ERROR_EAGAIN rather than wait,
+ * libssh2_session_block_directions() says what to wait for before trying again
+ * Everything else still runs to completion, waiting on the socket as it must; the key exchange's plaintext writes
+ * assume a blocking socket, so only switch once libssh2_session_startup() has returned
+ * A blocking session only touches O_NONBLOCK to clear it after non-blocking mode, it polls before any read it mustn't wait on
+ */
+LIBSSH2_API void libssh2_session_set_blocking(LIBSSH2_SESSION *session, int blocking)
+{
+#ifdef LIBSSH2_DEBUG_TRANSPORT
+	_libssh2_debug(session, LIBSSH2_DBG_TRANS, "Setting session blocking mode %s", blocking ? "ON" : "OFF");
+#endif
+	session->socket_block = blocking ? 1 : 0;
+	session->block_directions = 0;
+}
+/* }}} */
+
+/* {{{ libssh2_session_get_blocking
+ * Returns non-zero if the session is in blocking mode
+ */
+LIBSSH2_API int libssh2_session_get_blocking(LIBSSH2_SESSION *session)
+{
+	return session->socket_block;
+}
+/* }}} */
+
+/* {{{ libssh2_session_block_directions
+ * After LIBSSH2_ERROR_EAGAIN, which way(s) the session is waiting on the socket:
+ * LIBSSH2_SESSION_BLOCK_INBOUND to become readable, LIBSSH2_SESSION_BLOCK_OUTBOUND to become writable
+ */
+LIBSSH2_API int libssh2_session_block_directions(LIBSSH2_SESSION *session)
+{
+	return session->block_directions;
+}
+/* }}} */
+
 /* {{{ libssh2_poll_channel_read
  * Returns 0 if no data is waiting on channel,
  * non-0 if data is available
  */
 LIBSSH2_API int libssh2_poll_channel_read(LIBSSH2_CHANNEL *channel, int extended)
 {
-	LIBSSH2_SESSION *session = channel->session;
-	LIBSSH2_PACKET *packet = session->packets.head;
+	LIBSSH2_PACKET *packet = channel->data.head;
 
 	while (packet) {
-		if (((packet->data[0] == SSH_MSG_CHANNEL_DATA) && (extended == 0) && (channel->local.id == libssh2_ntohu32(packet->data + 1))) ||
-			((packet->data[0] == SSH_MSG_CHANNEL_EXTENDED_DATA) && (extended != 0) && (channel->local.id == libssh2_ntohu32(packet->data + 1)))) {
+		if (((packet->data[0] == SSH_MSG_CHANNEL_DATA) && (extended == 0)) ||
+			((packet->data[0] == SSH_MSG_CHANNEL_EXTENDED_DATA) && (extended != 0))) {
 			/* Found data waiting to be read */
 			return 1;
 		}
@@ -1016,3 +1102,596 @@ LIBSSH2_API int libssh2_poll(LIBSSH2_POLLFD *fds, unsigned int nfds, long timeou
 }
 /* }}} */
 
+
+/* Most OS events collected by one epoll_wait() */
+#define LIBSSH2_POLLER_EVENTS		64
+
+/* One OS descriptor registered with a poller, shared by all the channels and listeners of its session */
+struct _LIBSSH2_POLLER_SOCKET {
+	LIBSSH2_POLLER *poller;
+	int fd;
+
+	/* Owning session once a channel or listener is registered, NULL for plain sockets */
+	LIBSSH2_SESSION *session;
+
+	/* Registered descriptors which wait on fd */
+	LIBSSH2_POLLFD **entries;
+	unsigned int entries_count, entries_size;
+
+	/* LIBSSH2_POLLFD_* events currently asked of the OS */
+	unsigned long events;
+#if !defined(LIBSSH2_POLLER_EPOLL) && defined(HAVE_POLL)
+	/* Slot in poller->pollfds */
+	unsigned int pollfd_index;
+#endif
+
+	/* The OS has reported a hangup or error */
+	int hangup;
+	/* On poller->dirty, so its channels and listeners get checked at the next wait */
+	int dirty;
+
+	LIBSSH2_POLLER_SOCKET *next, *prev, *next_dirty;
+};
+
+struct _LIBSSH2_POLLER {
+	/* Memory management callbacks */
+	void *abstract;
+	LIBSSH2_ALLOC_FUNC((*alloc));
+	LIBSSH2_REALLOC_FUNC((*realloc));
+	LIBSSH2_FREE_FUNC((*free));
+
+	LIBSSH2_POLLER_SOCKET *sockets;
+	/* Sockets whose sessions have taken packets, or reported ready, since they were last checked */
+	LIBSSH2_POLLER_SOCKET *dirty;
+
+#ifdef LIBSSH2_POLLER_EPOLL
+	int epoll_fd;
+#elif defined(HAVE_POLL)
+	/* Kept in step with sockets as they come and go, rather than rebuilt on every wait */
+	struct pollfd *pollfds;
+	LIBSSH2_POLLER_SOCKET **pollfd_sockets;
+	unsigned int pollfds_count, pollfds_size;
+#endif
+};
+
+/* {{{ libssh2_poller_mark
+ * Queue a socket to have its channels and listeners checked at the next wait
+ */
+void libssh2_poller_mark(LIBSSH2_POLLER_SOCKET *sock)
+{
+	if (!sock->dirty) {
+		sock->dirty = 1;
+		sock->next_dirty = sock->poller->dirty;
+		sock->poller->dirty = sock;
+	}
+}
+/* }}} */
+
+/* {{{ libssh2_poller_init_ex
+ * Allocate a persistent poller, memory callbacks as for libssh2_session_init_ex()
+ */
+LIBSSH2_API LIBSSH2_POLLER *libssh2_poller_init_ex(
+			LIBSSH2_ALLOC_FUNC((*my_alloc)),
+			LIBSSH2_FREE_FUNC((*my_free)),
+			LIBSSH2_REALLOC_FUNC((*my_realloc)),
+			void *abstract)
+{
+	LIBSSH2_ALLOC_FUNC((*local_alloc))		= libssh2_default_alloc;
+	LIBSSH2_FREE_FUNC((*local_free))		= libssh2_default_free;
+	LIBSSH2_REALLOC_FUNC((*local_realloc))	= libssh2_default_realloc;
+	LIBSSH2_POLLER *poller;
+
+	if (my_alloc)	local_alloc		= my_alloc;
+	if (my_free)	local_free		= my_free;
+	if (my_realloc)	local_realloc	= my_realloc;
+
+	poller = local_alloc(sizeof(LIBSSH2_POLLER), &abstract);
+	if (!poller) {
+		return NULL;
+	}
+	memset(poller, 0, sizeof(LIBSSH2_POLLER));
+	poller->alloc		= local_alloc;
+	poller->free		= local_free;
+	poller->realloc		= local_realloc;
+	poller->abstract	= abstract;
+
+#ifdef LIBSSH2_POLLER_EPOLL
+	poller->epoll_fd = epoll_create(LIBSSH2_POLLER_EVENTS);
+	if (poller->epoll_fd < 0) {
+		LIBSSH2_FREE(poller, poller);
+		return NULL;
+	}
+#endif
+
+	return poller;
+}
+/* }}} */
+
+/* {{{ libssh2_poller_os_events
+ * Translate LIBSSH2_POLLFD_* events to and from the OS's own flags
+ */
+#ifdef LIBSSH2_POLLER_EPOLL
+static unsigned int libssh2_poller_to_os(unsigned long events)
+{
+	return ((events & LIBSSH2_POLLFD_POLLIN) ? EPOLLIN : 0) |
+		   ((events & LIBSSH2_POLLFD_POLLPRI) ? EPOLLPRI : 0) |
+		   ((events & LIBSSH2_POLLFD_POLLOUT) ? EPOLLOUT : 0);
+}
+
+static unsigned long libssh2_poller_from_os(unsigned int revents)
+{
+	return ((revents & EPOLLIN) ? LIBSSH2_POLLFD_POLLIN : 0) |
+		   ((revents & EPOLLPRI) ? LIBSSH2_POLLFD_POLLPRI : 0) |
+		   ((revents & EPOLLOUT) ? LIBSSH2_POLLFD_POLLOUT : 0) |
+		   ((revents & EPOLLERR) ? LIBSSH2_POLLFD_POLLERR : 0) |
+		   ((revents & EPOLLHUP) ? LIBSSH2_POLLFD_POLLHUP : 0);
+}
+#elif defined(HAVE_POLL)
+static short libssh2_poller_to_os(unsigned long events)
+{
+	return ((events & LIBSSH2_POLLFD_POLLIN) ? POLLIN : 0) |
+		   ((events & LIBSSH2_POLLFD_POLLPRI) ? POLLPRI : 0) |
+		   ((events & LIBSSH2_POLLFD_POLLOUT) ? POLLOUT : 0);
+}
+
+static unsigned long libssh2_poller_from_os(short revents)
+{
+	return ((revents & POLLIN) ? LIBSSH2_POLLFD_POLLIN : 0) |
+		   ((revents & POLLPRI) ? LIBSSH2_POLLFD_POLLPRI : 0) |
+		   ((revents & POLLOUT) ? LIBSSH2_POLLFD_POLLOUT : 0) |
+		   ((revents & POLLERR) ? LIBSSH2_POLLFD_POLLERR : 0) |
+		   ((revents & POLLHUP) ? LIBSSH2_POLLFD_POLLHUP : 0) |
+		   ((revents & POLLNVAL) ? LIBSSH2_POLLFD_POLLNVAL : 0);
+}
+#endif
+/* }}} */
+
+/* {{{ libssh2_poller_socket_update
+ * Recalculate what a socket waits on and pass it to the OS
+ * Sessions are always read from, raw sockets wait on whatever their registrations ask for
+ */
+static int libssh2_poller_socket_update(LIBSSH2_POLLER *poller, LIBSSH2_POLLER_SOCKET *sock, int op)
+{
+	unsigned long events = sock->session ? LIBSSH2_POLLFD_POLLIN : 0;
+	unsigned int i;
+#ifdef LIBSSH2_POLLER_EPOLL
+	struct epoll_event event;
+#endif
+
+	for(i = 0; i < sock->entries_count; i++) {
+		if (sock->entries[i]->type == LIBSSH2_POLLFD_SOCKET) {
+			events |= sock->entries[i]->events & (LIBSSH2_POLLFD_POLLIN | LIBSSH2_POLLFD_POLLPRI | LIBSSH2_POLLFD_POLLOUT);
+		}
+	}
+	if ((events == sock->events) && (op != 0)) {
+		return 0;
+	}
+	sock->events = events;
+
+#ifdef LIBSSH2_POLLER_EPOLL
+	memset(&event, 0, sizeof(event));
+	event.events = libssh2_poller_to_os(events);
+	event.data.ptr = sock;
+	if (epoll_ctl(poller->epoll_fd, (op == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, sock->fd, &event)) {
+		return -1;
+	}
+#elif defined(HAVE_POLL)
+	if (op == 0) {
+		if (poller->pollfds_count == poller->pollfds_size) {
+			unsigned int size = poller->pollfds_size ? (2 * poller->pollfds_size) : 16;
+			struct pollfd *pollfds;
+			LIBSSH2_POLLER_SOCKET **pollfd_sockets;
+
+			pollfds = LIBSSH2_REALLOC(poller, poller->pollfds, size * sizeof(struct pollfd));
+			if (!pollfds) {
+				return -1;
+			}
+			poller->pollfds = pollfds;
+			pollfd_sockets = LIBSSH2_REALLOC(poller, poller->pollfd_sockets, size * sizeof(LIBSSH2_POLLER_SOCKET *));
+			if (!pollfd_sockets) {
+				return -1;
+			}
+			poller->pollfd_sockets = pollfd_sockets;
+			poller->pollfds_size = size;
+		}
+		sock->pollfd_index = poller->pollfds_count++;
+		poller->pollfds[sock->pollfd_index].fd = sock->fd;
+		poller->pollfds[sock->pollfd_index].revents = 0;
+		poller->pollfd_sockets[sock->pollfd_index] = sock;
+	}
+	poller->pollfds[sock->pollfd_index].events = libssh2_poller_to_os(events);
+#else
+	(void)poller;
+#endif
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_poller_socket_free
+ * Drop a socket and all its registrations
+ */
+static void libssh2_poller_socket_free(LIBSSH2_POLLER *poller, LIBSSH2_POLLER_SOCKET *sock)
+{
+	LIBSSH2_POLLER_SOCKET **dirty;
+
+#ifdef LIBSSH2_POLLER_EPOLL
+	/* Fails harmlessly if the descriptor has already been closed */
+	epoll_ctl(poller->epoll_fd, EPOLL_CTL_DEL, sock->fd, NULL);
+#elif defined(HAVE_POLL)
+	/* Move the last slot into the gap */
+	poller->pollfds_count--;
+	if (sock->pollfd_index != poller->pollfds_count) {
+		poller->pollfds[sock->pollfd_index] = poller->pollfds[poller->pollfds_count];
+		poller->pollfd_sockets[sock->pollfd_index] = poller->pollfd_sockets[poller->pollfds_count];
+		poller->pollfd_sockets[sock->pollfd_index]->pollfd_index = sock->pollfd_index;
+	}
+#endif
+
+	if (sock->dirty) {
+		for(dirty = &poller->dirty; *dirty; dirty = &(*dirty)->next_dirty) {
+			if (*dirty == sock) {
+				*dirty = sock->next_dirty;
+				break;
+			}
+		}
+	}
+
+	if (sock->prev) {
+		sock->prev->next = sock->next;
+	} else {
+		poller->sockets = sock->next;
+	}
+	if (sock->next) {
+		sock->next->prev = sock->prev;
+	}
+
+	if (sock->session) {
+		sock->session->poller_socket = NULL;
+	}
+	if (sock->entries) {
+		LIBSSH2_FREE(poller, sock->entries);
+	}
+	LIBSSH2_FREE(poller, sock);
+}
+/* }}} */
+
+/* {{{ libssh2_poller_locate
+ * Find the socket fd is registered under, and its session if it has one
+ */
+static LIBSSH2_POLLER_SOCKET *libssh2_poller_locate(LIBSSH2_POLLER *poller, LIBSSH2_POLLFD *fd, int *socket_fd, LIBSSH2_SESSION **session)
+{
+	LIBSSH2_POLLER_SOCKET *sock;
+
+	switch (fd->type) {
+		case LIBSSH2_POLLFD_SOCKET:
+			*session = NULL;
+			*socket_fd = fd->fd.socket;
+			break;
+		case LIBSSH2_POLLFD_CHANNEL:
+			*session = fd->fd.channel->session;
+			*socket_fd = (*session)->socket_fd;
+			break;
+		case LIBSSH2_POLLFD_LISTENER:
+			*session = fd->fd.listener->session;
+			*socket_fd = (*session)->socket_fd;
+			break;
+		default:
+			return NULL;
+	}
+
+	/* Sessions know where they're registered, only raw sockets need looking up */
+	if (*session && (*session)->poller_socket) {
+		return ((*session)->poller_socket->poller == poller) ? (*session)->poller_socket : NULL;
+	}
+	for(sock = poller->sockets; sock; sock = sock->next) {
+		if (sock->fd == *socket_fd) {
+			return sock;
+		}
+	}
+
+	return NULL;
+}
+/* }}} */
+
+/* {{{ libssh2_poller_add
+ * Register a socket, channel or listener, fd->events says what to wait for
+ */
+LIBSSH2_API int libssh2_poller_add(LIBSSH2_POLLER *poller, LIBSSH2_POLLFD *fd)
+{
+	LIBSSH2_POLLER_SOCKET *sock;
+	LIBSSH2_SESSION *session;
+	int socket_fd;
+
+	if ((fd->type != LIBSSH2_POLLFD_SOCKET) && (fd->type != LIBSSH2_POLLFD_CHANNEL) && (fd->type != LIBSSH2_POLLFD_LISTENER)) {
+		return -1;
+	}
+
+	sock = libssh2_poller_locate(poller, fd, &socket_fd, &session);
+	if (session && session->poller_socket && (session->poller_socket->poller != poller)) {
+		libssh2_error(session, LIBSSH2_ERROR_INVAL, "Session is already registered with another poller", 0);
+		return -1;
+	}
+
+	if (!sock) {
+		sock = LIBSSH2_ALLOC(poller, sizeof(LIBSSH2_POLLER_SOCKET));
+		if (!sock) {
+			if (session) libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate poller socket", 0);
+			return -1;
+		}
+		memset(sock, 0, sizeof(LIBSSH2_POLLER_SOCKET));
+		sock->poller = poller;
+		sock->fd = socket_fd;
+		if (libssh2_poller_socket_update(poller, sock, 0)) {
+			if (session) libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to register socket with poller", 0);
+			LIBSSH2_FREE(poller, sock);
+			return -1;
+		}
+
+		sock->next = poller->sockets;
+		if (sock->next) {
+			sock->next->prev = sock;
+		}
+		poller->sockets = sock;
+	}
+
+	if (sock->entries_count == sock->entries_size) {
+		unsigned int size = sock->entries_size ? (2 * sock->entries_size) : 4;
+		LIBSSH2_POLLFD **entries = LIBSSH2_REALLOC(poller, sock->entries, size * sizeof(LIBSSH2_POLLFD *));
+
+		if (!entries) {
+			if (session) libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate poller entries", 0);
+			if (!sock->entries_count) {
+				libssh2_poller_socket_free(poller, sock);
+			}
+			return -1;
+		}
+		sock->entries = entries;
+		sock->entries_size = size;
+	}
+	sock->entries[sock->entries_count++] = fd;
+	fd->revents = 0;
+
+	if (session) {
+		sock->session = session;
+		session->poller_socket = sock;
+		/* Anything already buffered gets reported at the next wait */
+		libssh2_poller_mark(sock);
+	}
+
+	return libssh2_poller_socket_update(poller, sock, 1);
+}
+/* }}} */
+
+/* {{{ libssh2_poller_remove
+ * Unregister a descriptor previously passed to libssh2_poller_add()
+ */
+LIBSSH2_API int libssh2_poller_remove(LIBSSH2_POLLER *poller, LIBSSH2_POLLFD *fd)
+{
+	LIBSSH2_POLLER_SOCKET *sock;
+	LIBSSH2_SESSION *session;
+	unsigned int i;
+	int socket_fd;
+
+	sock = libssh2_poller_locate(poller, fd, &socket_fd, &session);
+	if (!sock) {
+		return -1;
+	}
+
+	for(i = 0; i < sock->entries_count; i++) {
+		if (sock->entries[i] == fd) {
+			sock->entries[i] = sock->entries[--sock->entries_count];
+
+			if (!sock->entries_count) {
+				libssh2_poller_socket_free(poller, sock);
+				return 0;
+			}
+
+			return libssh2_poller_socket_update(poller, sock, 1);
+		}
+	}
+
+	return -1;
+}
+/* }}} */
+
+/* {{{ libssh2_poller_detach_session
+ * Session is being freed, forget everything registered through it
+ */
+void libssh2_poller_detach_session(LIBSSH2_SESSION *session)
+{
+	LIBSSH2_POLLER_SOCKET *sock = session->poller_socket;
+
+	libssh2_poller_socket_free(sock->poller, sock);
+}
+/* }}} */
+
+/* {{{ libssh2_poller_socket_ready
+ * The OS reports activity on a socket: pull in a session's packets, report raw sockets straight away
+ */
+static void libssh2_poller_socket_ready(LIBSSH2_POLLER_SOCKET *sock, unsigned long revents,
+										LIBSSH2_POLLFD **ready, unsigned int max_ready, unsigned int *ready_count)
+{
+	unsigned int i;
+
+	if (sock->session) {
+		if (revents & LIBSSH2_POLLFD_POLLIN) {
+			/* Spin session until no data available, each packet marks the socket dirty */
+			while (libssh2_packet_read(sock->session, 0) > 0);
+		}
+		if (revents & (LIBSSH2_POLLFD_POLLERR | LIBSSH2_POLLFD_POLLHUP)) {
+			sock->hangup = 1;
+			libssh2_poller_mark(sock);
+		}
+	}
+
+	for(i = 0; i < sock->entries_count; i++) {
+		LIBSSH2_POLLFD *fd = sock->entries[i];
+
+		if (fd->type == LIBSSH2_POLLFD_SOCKET) {
+			fd->revents = revents & (fd->events | LIBSSH2_POLLFD_POLLERR | LIBSSH2_POLLFD_POLLHUP | LIBSSH2_POLLFD_POLLNVAL);
+			/* Level triggered, so anything that doesn't fit is reported again next time */
+			if (fd->revents && (*ready_count < max_ready)) {
+				ready[(*ready_count)++] = fd;
+			}
+		}
+	}
+}
+/* }}} */
+
+/* {{{ libssh2_poller_entry_revents
+ * Buffered state of a channel or listener, as libssh2_poll() reports it
+ */
+static unsigned long libssh2_poller_entry_revents(LIBSSH2_POLLFD *fd, int hangup)
+{
+	unsigned long revents = 0;
+
+	switch (fd->type) {
+		case LIBSSH2_POLLFD_CHANNEL:
+			if ((fd->events & LIBSSH2_POLLFD_POLLIN) && libssh2_poll_channel_read(fd->fd.channel, 0)) {
+				revents |= LIBSSH2_POLLFD_POLLIN;
+			}
+			if ((fd->events & LIBSSH2_POLLFD_POLLEXT) && libssh2_poll_channel_read(fd->fd.channel, 1)) {
+				revents |= LIBSSH2_POLLFD_POLLEXT;
+			}
+			if ((fd->events & LIBSSH2_POLLFD_POLLOUT) && libssh2_poll_channel_write(fd->fd.channel)) {
+				revents |= LIBSSH2_POLLFD_POLLOUT;
+			}
+			if (fd->fd.channel->remote.close || fd->fd.channel->local.close) {
+				revents |= LIBSSH2_POLLFD_CHANNEL_CLOSED;
+			}
+			if (hangup || (fd->fd.channel->session->socket_state == LIBSSH2_SOCKET_DISCONNECTED)) {
+				revents |= LIBSSH2_POLLFD_CHANNEL_CLOSED | LIBSSH2_POLLFD_SESSION_CLOSED;
+			}
+			break;
+		case LIBSSH2_POLLFD_LISTENER:
+			if ((fd->events & LIBSSH2_POLLFD_POLLIN) && libssh2_poll_listener_queued(fd->fd.listener)) {
+				revents |= LIBSSH2_POLLFD_POLLIN;
+			}
+			if (hangup || (fd->fd.listener->session->socket_state == LIBSSH2_SOCKET_DISCONNECTED)) {
+				revents |= LIBSSH2_POLLFD_LISTENER_CLOSED | LIBSSH2_POLLFD_SESSION_CLOSED;
+			}
+			break;
+	}
+
+	return revents;
+}
+/* }}} */
+
+/* {{{ libssh2_poller_wait
+ * Wait up to timeout milliseconds for registered descriptors to become ready
+ * Fills ready with up to max_ready of them (revents set) and returns how many, or -1 on error
+ * Cost is proportional to the sockets with activity, not the number registered
+ */
+LIBSSH2_API int libssh2_poller_wait(LIBSSH2_POLLER *poller, LIBSSH2_POLLFD **ready, unsigned int max_ready, long timeout)
+{
+	unsigned long started = libssh2_time_ms();
+	long timeout_remaining = timeout;
+	unsigned int ready_count = 0;
+
+#if !defined(LIBSSH2_POLLER_EPOLL) && !defined(HAVE_POLL)
+	/* No poll(), only buffered data can be reported */
+	timeout = timeout_remaining = 0;
+#endif
+
+	do {
+		LIBSSH2_POLLER_SOCKET *sock, *dirty;
+		unsigned int i;
+		/* Don't block on the sockets if there are channels/listeners to check */
+		int wait_ms = poller->dirty ? 0 : (int)timeout_remaining;
+#ifdef LIBSSH2_POLLER_EPOLL
+		struct epoll_event events[LIBSSH2_POLLER_EVENTS];
+		int sysret;
+
+		sysret = epoll_wait(poller->epoll_fd, events, LIBSSH2_POLLER_EVENTS, wait_ms);
+		if ((sysret < 0) && (errno != EINTR)) {
+			return -1;
+		}
+		for(i = 0; (int)i < sysret; i++) {
+			libssh2_poller_socket_ready(events[i].data.ptr, libssh2_poller_from_os(events[i].events), ready, max_ready, &ready_count);
+		}
+#elif defined(HAVE_POLL)
+		int sysret;
+
+		sysret = poll(poller->pollfds, poller->pollfds_count, wait_ms);
+		if ((sysret < 0) && (errno != EINTR)) {
+			return -1;
+		}
+		for(i = 0; (sysret > 0) && (i < poller->pollfds_count); i++) {
+			short revents = poller->pollfds[i].revents;
+
+			if (revents) {
+				poller->pollfds[i].revents = 0;
+				sysret--;
+				libssh2_poller_socket_ready(poller->pollfd_sockets[i], libssh2_poller_from_os(revents), ready, max_ready, &ready_count);
+			}
+		}
+#else
+		(void)wait_ms;
+#endif
+
+		/* Check the channels and listeners of sessions which have taken packets */
+		dirty = poller->dirty;
+		poller->dirty = NULL;
+		while (dirty) {
+			int still_ready = 0;
+
+			sock = dirty;
+			dirty = sock->next_dirty;
+			sock->dirty = 0;
+			sock->next_dirty = NULL;
+
+			for(i = 0; i < sock->entries_count; i++) {
+				LIBSSH2_POLLFD *fd = sock->entries[i];
+
+				if (fd->type == LIBSSH2_POLLFD_SOCKET) {
+					continue;
+				}
+				fd->revents = libssh2_poller_entry_revents(fd, sock->hangup);
+				if (fd->revents) {
+					still_ready = 1;
+					if (ready_count < max_ready) {
+						ready[ready_count++] = fd;
+					}
+				}
+			}
+
+			/* Level triggered: keep checking until whatever's buffered has been consumed */
+			if (still_ready) {
+				libssh2_poller_mark(sock);
+			}
+		}
+
+		if (ready_count || (timeout <= 0)) {
+			break;
+		}
+		timeout_remaining = timeout - (long)(libssh2_time_ms() - started);
+	} while (timeout_remaining > 0);
+
+	return ready_count;
+}
+/* }}} */
+
+/* {{{ libssh2_poller_free
+ * Unregister everything and release the poller
+ */
+LIBSSH2_API void libssh2_poller_free(LIBSSH2_POLLER *poller)
+{
+	while (poller->sockets) {
+		libssh2_poller_socket_free(poller, poller->sockets);
+	}
+
+#ifdef LIBSSH2_POLLER_EPOLL
+	close(poller->epoll_fd);
+#elif defined(HAVE_POLL)
+	if (poller->pollfds) {
+		LIBSSH2_FREE(poller, poller->pollfds);
+	}
+	if (poller->pollfd_sockets) {
+		LIBSSH2_FREE(poller, poller->pollfd_sockets);
+	}
+#endif
+
+	LIBSSH2_FREE(poller, poller);
+}
+/* }}} */
@@ -74,26 +74,60 @@
 #define SSH_FXP_EXTENDED			200
 #define SSH_FXP_EXTENDED_REPLY		201
 
+/* Must be a power of two */
+#define LIBSSH2_SFTP_PACKET_BUCKETS	64
+
+/* VERSION carries no request_id, it's filed as request 0 */
+#define LIBSSH2_SFTP_PACKET_REQUEST_ID(data, data_len)	((((data)[0] == SSH_FXP_VERSION) || ((data_len) < 5)) ? 0 : libssh2_ntohu32((data) + 1))
+#define LIBSSH2_SFTP_PACKET_BUCKET(sftp, request_id)	(&(sftp)->packets[(request_id) & (LIBSSH2_SFTP_PACKET_BUCKETS - 1)])
+
 struct _LIBSSH2_SFTP {
 	LIBSSH2_CHANNEL *channel;
 
 	unsigned long request_id, version;
 
-	LIBSSH2_PACKET_BRIGADE packets;
+	/* Replies not yet claimed, hashed on request_id so matching one doesn't walk every queued packet */
+	LIBSSH2_PACKET_BRIGADE packets[LIBSSH2_SFTP_PACKET_BUCKETS];
 
 	LIBSSH2_SFTP_HANDLE *handles;
 
 	unsigned long last_errno;
+
+	/* LIBSSH2_SFTP_EXT_* the server advertised in its FXP_VERSION */
+	unsigned long extensions;
 };
 
 #define LIBSSH2_SFTP_HANDLE_FILE	0
 #define LIBSSH2_SFTP_HANDLE_DIR		1
 
+/* Extension names recognised in FXP_VERSION, the version string that comes with each isn't needed by any of them */
+static const struct {
+	const char *name;
+	unsigned long flag;
+} libssh2_sftp_extension_names[] = {
+	{ "copy-data",					LIBSSH2_SFTP_EXT_COPY_DATA			},
+	{ "copy-file",					LIBSSH2_SFTP_EXT_COPY_FILE			},
+	{ "check-file-handle",			LIBSSH2_SFTP_EXT_CHECK_FILE_HANDLE	},
+	{ "check-file-name",			LIBSSH2_SFTP_EXT_CHECK_FILE_NAME	},
+	{ "posix-rename@openssh.com",	LIBSSH2_SFTP_EXT_POSIX_RENAME		},
+	{ "statvfs@openssh.com",		LIBSSH2_SFTP_EXT_STATVFS			},
+	{ "fstatvfs@openssh.com",		LIBSSH2_SFTP_EXT_FSTATVFS			},
+	{ "fsync@openssh.com",			LIBSSH2_SFTP_EXT_FSYNC				},
+	{ NULL, 0 }
+};
+
 /* S_IFREG */
 #define LIBSSH2_SFTP_ATTR_PFILETYPE_FILE	0100000
 /* S_IFDIR */
 #define LIBSSH2_SFTP_ATTR_PFILETYPE_DIR		0040000
 
+/* An FXP_READ or FXP_WRITE which has been sent, but whose reply hasn't been dealt with yet */
+typedef struct _libssh2_sftp_request {
+	unsigned long request_id;
+	libssh2_uint64_t offset;
+	unsigned long len;
+} libssh2_sftp_request;
+
 struct _LIBSSH2_SFTP_HANDLE {
 	LIBSSH2_SFTP *sftp;
 	LIBSSH2_SFTP_HANDLE *prev, *next;
@@ -106,11 +140,42 @@ struct _LIBSSH2_SFTP_HANDLE {
 	union _libssh2_sftp_handle_data {
 		struct _libssh2_sftp_handle_file_data {
 			libssh2_uint64_t offset;
+
+			/* Pipelined reads -- A ring of up to read_window outstanding FXP_READ requests */
+			libssh2_sftp_request *read_requests;
+			unsigned long read_window, read_chunk;
+			unsigned long read_head, read_count;
+			libssh2_uint64_t read_offset; /* Where the next FXP_READ will be issued from */
+			int read_eof;
+
+			/* FXP_DATA reply which has only been partially copied out to the caller */
+			unsigned char *read_data;
+			unsigned long read_data_len, read_data_head;
+			libssh2_uint64_t read_data_offset;
+
+			/* Pipelined writes -- A ring of up to write_window unacknowledged FXP_WRITE requests */
+			libssh2_sftp_request *write_requests;
+			unsigned long write_window;
+			unsigned long write_head, write_count;
+			unsigned char *write_packet;
+
+			/* First failure reported by an FXP_WRITE ack, held until libssh2_sftp_write_flush() */
+			unsigned long write_errno;
+			libssh2_uint64_t write_error_offset;
 		} file;
 		struct _libssh2_sftp_handle_dir_data {
 			unsigned long names_left;
 			void *names_packet;
+			unsigned long names_packet_len;
 			char *next_name;
+
+			/* Outstanding FXP_READDIR, at most one, kept in flight ahead of the caller when prefetch is on */
+			unsigned long readdir_id;
+			int readdir_pending, prefetch, eof;
+
+			/* libssh2_sftp_readdir_batch() results, grown as needed */
+			LIBSSH2_SFTP_DIRENT *entries;
+			unsigned long entries_size;
 		} dir;
 	} u;
 };
@@ -125,30 +190,30 @@ static int libssh2_sftp_packet_add(LIBSSH2_SFTP *sftp, unsigned char *data, unsi
 		return -1;
 	}
 	LIBSSH2_SESSION *session = sftp->channel->session;
+	LIBSSH2_PACKET_BRIGADE *brigade = LIBSSH2_SFTP_PACKET_BUCKET(sftp, LIBSSH2_SFTP_PACKET_REQUEST_ID(data, data_len));
 	LIBSSH2_PACKET *packet;
 
 #ifdef LIBSSH2_DEBUG_SFTP
 	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Received packet %d", (int)data[0]);
 #endif
-	packet = LIBSSH2_ALLOC(session, sizeof(LIBSSH2_PACKET));
+	packet = libssh2_packet_header_alloc(session);
 	if (!packet) {
 		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate datablock for SFTP packet", 0);
 		return -1;
 	}
-	memset(packet, 0, sizeof(LIBSSH2_PACKET));
 
 	packet->data = data;
 	packet->data_len = data_len;
 	packet->data_head = 5;
-	packet->brigade = &sftp->packets;
+	packet->brigade = brigade;
 	packet->next = NULL;
-	packet->prev = sftp->packets.tail;
+	packet->prev = brigade->tail;
 	if (packet->prev) {
 		packet->prev->next = packet;
 	} else {
-		sftp->packets.head = packet;
+		brigade->head = packet;
 	}
-	sftp->packets.tail = packet;
+	brigade->tail = packet;
 
 	return 0;
 }
@@ -236,9 +301,8 @@ static int libssh2_sftp_packet_ask(LIBSSH2_SFTP *sftp, unsigned char packet_type
 		return -1;
 	}
 	LIBSSH2_SESSION *session = sftp->channel->session;
-	LIBSSH2_PACKET *packet = sftp->packets.head;
-	unsigned char match_buf[5];
-	int match_len = 5;
+	LIBSSH2_PACKET_BRIGADE *brigade;
+	LIBSSH2_PACKET *packet;
 
 #ifdef LIBSSH2_DEBUG_SFTP
 	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Asking for %d packet", (int)packet_type);
@@ -249,32 +313,32 @@ static int libssh2_sftp_packet_ask(LIBSSH2_SFTP *sftp, unsigned char packet_type
 		}
 	}
 
-	match_buf[0] = packet_type;
 	if (packet_type == SSH_FXP_VERSION) {
 		/* Special consideration when matching VERSION packet */
-		match_len = 1;
-	} else {
-		libssh2_htonu32(match_buf + 1, request_id);
+		request_id = 0;
 	}
 
+	brigade = LIBSSH2_SFTP_PACKET_BUCKET(sftp, request_id);
+	packet = brigade->head;
 	while (packet) {
-		if (strncmp((const char *)packet->data, (const char *)match_buf, match_len) == 0) {
+		if ((packet->data[0] == packet_type) &&
+			(LIBSSH2_SFTP_PACKET_REQUEST_ID(packet->data, packet->data_len) == request_id)) {
 			*data = packet->data;
 			*data_len = packet->data_len;
 
 			if (packet->prev) {
 				packet->prev->next = packet->next;
 			} else {
-				sftp->packets.head = packet->next;
+				brigade->head = packet->next;
 			}
 
 			if (packet->next) {
 				packet->next->prev = packet->prev;
 			} else {
-				sftp->packets.tail = packet->prev;
+				brigade->tail = packet->prev;
 			}
 
-			LIBSSH2_FREE(session, packet);
+			libssh2_packet_header_free(session, packet);
 
 			return 0;
 		}
@@ -455,10 +519,37 @@ static int libssh2_sftp_bin2attr(LIBSSH2_SFTP_ATTRIBUTES *attrs, unsigned char *
 }
 /* }}} */
 
+/* {{{ libssh2_sftp_bin2attr_len
+ * How many bytes libssh2_sftp_bin2attr() will consume, going by the flags in the first 4 bytes
+ */
+static unsigned long libssh2_sftp_bin2attr_len(const unsigned char *p)
+{
+	unsigned long flags = libssh2_ntohu32(p);
+	unsigned long len = 4;
+
+	if (flags & LIBSSH2_SFTP_ATTR_SIZE) {
+		len += 8;
+	}
+	if (flags & LIBSSH2_SFTP_ATTR_UIDGID) {
+		len += 8;
+	}
+	if (flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) {
+		len += 4;
+	}
+	if (flags & LIBSSH2_SFTP_ATTR_ACMODTIME) {
+		len += 8;
+	}
+
+	return len;
+}
+/* }}} */
+
 /* ************
    * SFTP API *
    ************ */
 
+static void libssh2_sftp_handle_release(LIBSSH2_SFTP_HANDLE *handle);
+
 /* {{{ libssh2_sftp_dtor
  * Shutdown an SFTP stream when the channel closes
  */
@@ -467,7 +558,14 @@ LIBSSH2_CHANNEL_CLOSE_FUNC(libssh2_sftp_dtor) {
 
 	/* Loop through handles closing them */
 	while (sftp->handles) {
-		libssh2_sftp_close_handle(sftp->handles);
+		LIBSSH2_SFTP_HANDLE *handle = sftp->handles;
+
+		if (libssh2_sftp_close_handle(handle) && (sftp->handles == handle)) {
+			/* FXP_CLOSE didn't get through, and won't on a retry either (the channel may well be dead already)
+			 * so let the handle go regardless rather than go round again
+			 */
+			libssh2_sftp_handle_release(handle);
+		}
 	}
 
 	LIBSSH2_FREE(session, sftp);
@@ -503,6 +601,8 @@ LIBSSH2_API LIBSSH2_SFTP *libssh2_sftp_init(LIBSSH2_SESSION *session)
 	}
 
 	libssh2_channel_set_blocking(channel, 1);
+	/* Bulk reads would otherwise be capped at one window per round trip */
+	libssh2_channel_window_autotune(channel, LIBSSH2_CHANNEL_WINDOW_MAX);
 
 	libssh2_channel_handle_extended_data(channel, LIBSSH2_CHANNEL_EXTENDED_DATA_IGNORE);
 
@@ -554,17 +654,36 @@ LIBSSH2_API LIBSSH2_SFTP *libssh2_sftp_init(LIBSSH2_SESSION *session)
 #ifdef LIBSSH2_DEBUG_SFTP
 	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Enabling SFTP version %lu compatability", sftp->version);
 #endif
-	while (s < (data + data_len)) {
-		char *extension_name, *extension_data;
+	while ((s + 4) <= (data + data_len)) {
+		char *extension_name;
 		unsigned long extname_len, extdata_len;
+		int i;
 
 		extname_len = libssh2_ntohu32(s);				s += 4;
-		extension_name = (char *)s;								s += extname_len;
+		/* Each length is checked against what's left before stepping over it */
+		if ((extname_len > (unsigned long)((data + data_len) - s)) ||
+			(((unsigned long)((data + data_len) - s) - extname_len) < 4)) {
+			break;
+		}
+		extension_name = (char *)s;						s += extname_len;
 
 		extdata_len = libssh2_ntohu32(s);				s += 4;
-		extension_data = (char *)s;								s += extdata_len;
+		if (extdata_len > (unsigned long)((data + data_len) - s)) {
+			break;
+		}
+		/* Nothing uses the extension data yet */
+		s += extdata_len;
 
-		/* TODO: Actually process extensions */
+		for(i = 0; libssh2_sftp_extension_names[i].name; i++) {
+			if ((extname_len == strlen(libssh2_sftp_extension_names[i].name)) &&
+				(memcmp(extension_name, libssh2_sftp_extension_names[i].name, extname_len) == 0)) {
+				sftp->extensions |= libssh2_sftp_extension_names[i].flag;
+#ifdef LIBSSH2_DEBUG_SFTP
+				_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Server supports %s extension", libssh2_sftp_extension_names[i].name);
+#endif
+				break;
+			}
+		}
 	}
 	LIBSSH2_FREE(session, data);
 
@@ -681,6 +800,7 @@ LIBSSH2_API LIBSSH2_SFTP_HANDLE *libssh2_sftp_open_ex(LIBSSH2_SFTP *sftp, char *
 	if (fp->next) {
 		fp->next->prev = fp;
 	}
+	sftp->handles = fp;
 	fp->sftp = sftp;
 
 	fp->u.file.offset = 0;
@@ -692,6 +812,351 @@ LIBSSH2_API LIBSSH2_SFTP_HANDLE *libssh2_sftp_open_ex(LIBSSH2_SFTP *sftp, char *
 }
 /* }}} */
 
+/* {{{ libssh2_sftp_read_send
+ * Issue the next FXP_READ for a pipelined handle and queue it at the tail of the ring
+ */
+static int libssh2_sftp_read_send(LIBSSH2_SFTP_HANDLE *handle)
+{
+	LIBSSH2_SFTP	*sftp	 = handle->sftp;
+	LIBSSH2_CHANNEL *channel = sftp->channel;
+	LIBSSH2_SESSION *session = channel->session;
+	libssh2_sftp_request *request;
+	unsigned long packet_len = handle->handle_len + 25; /* packet_len(4) + packet_type(1) + request_id(4) + handle_len(4) + offset(8) + length(4) */
+	unsigned char packet[256 + 25], *s = packet;
+
+	request = &handle->u.file.read_requests[(handle->u.file.read_head + handle->u.file.read_count) % handle->u.file.read_window];
+	request->request_id = sftp->request_id++;
+	request->offset = handle->u.file.read_offset;
+	request->len = handle->u.file.read_chunk;
+
+	libssh2_htonu32(s, packet_len - 4);					s += 4;
+	*(s++) = SSH_FXP_READ;
+	libssh2_htonu32(s, request->request_id);			s += 4;
+	libssh2_htonu32(s, handle->handle_len);				s += 4;
+	memcpy(s, handle->handle, handle->handle_len);		s += handle->handle_len;
+	libssh2_htonu64(s, request->offset);				s += 8;
+	libssh2_htonu32(s, request->len);					s += 4;
+
+#ifdef LIBSSH2_DEBUG_SFTP
+	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Pipelining FXP_READ #%lu for %lu bytes (%lu in flight)", request->request_id, request->len, handle->u.file.read_count + 1);
+#endif
+	if (packet_len != libssh2_channel_write(channel, packet, packet_len)) {
+		libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send FXP_READ command", 0);
+		return -1;
+	}
+
+	handle->u.file.read_count++;
+	handle->u.file.read_offset += request->len;
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_read_collect
+ * Pop the oldest outstanding FXP_READ off the ring and wait for its reply
+ * Replies to later requests which arrive first are left in the brigade until their turn comes
+ */
+static int libssh2_sftp_read_collect(LIBSSH2_SFTP_HANDLE *handle, libssh2_sftp_request *request, unsigned char **data, unsigned long *data_len)
+{
+	LIBSSH2_SFTP *sftp = handle->sftp;
+	unsigned char read_responses[2] = { SSH_FXP_DATA,		SSH_FXP_STATUS };
+
+	*request = handle->u.file.read_requests[handle->u.file.read_head];
+	handle->u.file.read_head = (handle->u.file.read_head + 1) % handle->u.file.read_window;
+	handle->u.file.read_count--;
+
+	if (libssh2_sftp_packet_requirev(sftp, 2, read_responses, request->request_id, data, data_len)) {
+		libssh2_error(sftp->channel->session, LIBSSH2_ERROR_SOCKET_TIMEOUT, "Timeout waiting for status message", 0);
+		return -1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_read_discard
+ * Throw away any read-ahead, e.g. after a seek or a write, or before the handle is closed
+ * Replies already on their way still have to be reaped, otherwise they'd sit in the brigade forever
+ */
+static int libssh2_sftp_read_discard(LIBSSH2_SFTP_HANDLE *handle)
+{
+	LIBSSH2_SESSION *session = handle->sftp->channel->session;
+	libssh2_sftp_request request;
+	unsigned char *data;
+	unsigned long data_len;
+	int retcode = 0;
+
+	if (handle->u.file.read_data) {
+		LIBSSH2_FREE(session, handle->u.file.read_data);
+		handle->u.file.read_data = NULL;
+	}
+
+	while (handle->u.file.read_count) {
+		if (libssh2_sftp_read_collect(handle, &request, &data, &data_len)) {
+			/* The channel is gone, nothing more is going to arrive */
+			handle->u.file.read_count = 0;
+			retcode = -1;
+			break;
+		}
+		LIBSSH2_FREE(session, data);
+	}
+
+	handle->u.file.read_head = 0;
+	handle->u.file.read_offset = handle->u.file.offset;
+	handle->u.file.read_eof = 0;
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_read_fill
+ * Make sure the handle holds an FXP_DATA reply for the current offset
+ * Returns 1 if read_data has bytes to hand out, 0 at EOF, -1 on error
+ */
+static int libssh2_sftp_read_fill(LIBSSH2_SFTP_HANDLE *handle)
+{
+	LIBSSH2_SFTP	*sftp	 = handle->sftp;
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	libssh2_sftp_request request;
+	libssh2_uint64_t expected_offset;
+	unsigned char *data;
+	unsigned long data_len, bytes_read;
+
+	/* Read-ahead for any other offset is left over from a seek */
+	if (handle->u.file.read_data) {
+		expected_offset = handle->u.file.read_data_offset;
+	} else if (handle->u.file.read_count) {
+		expected_offset = handle->u.file.read_requests[handle->u.file.read_head].offset;
+	} else {
+		expected_offset = handle->u.file.read_offset;
+	}
+	if (expected_offset != handle->u.file.offset) {
+#ifdef LIBSSH2_DEBUG_SFTP
+		_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Handle offset moved, discarding %lu pipelined reads", handle->u.file.read_count);
+#endif
+		libssh2_sftp_read_discard(handle);
+	}
+
+	if (handle->u.file.read_data && (handle->u.file.read_data_head >= handle->u.file.read_data_len)) {
+		/* Used up, but held on to for a borrower until now */
+		LIBSSH2_FREE(session, handle->u.file.read_data);
+		handle->u.file.read_data = NULL;
+	}
+
+	if (!handle->u.file.read_data) {
+		/* Top up the window */
+		while (!handle->u.file.read_eof && (handle->u.file.read_count < handle->u.file.read_window)) {
+			if (libssh2_sftp_read_send(handle)) {
+				return -1;
+			}
+		}
+
+		if (!handle->u.file.read_count) {
+			/* EOF has been seen and there's nothing left in flight */
+			return 0;
+		}
+
+		if (libssh2_sftp_read_collect(handle, &request, &data, &data_len)) {
+			return -1;
+		}
+
+		if (data[0] == SSH_FXP_STATUS) {
+			unsigned long retcode = libssh2_ntohu32(data + 5);
+
+			LIBSSH2_FREE(session, data);
+
+			/* Everything queued behind this request lies beyond it, so is no use either */
+			libssh2_sftp_read_discard(handle);
+			if (retcode == LIBSSH2_FX_EOF) {
+				handle->u.file.read_eof = 1;
+				return 0;
+			}
+			sftp->last_errno = retcode;
+			libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP Protocol Error", 0);
+			return -1;
+		}
+
+		bytes_read = libssh2_ntohu32(data + 5);
+		if ((bytes_read > (data_len - 9)) || (bytes_read > request.len)) {
+			LIBSSH2_FREE(session, data);
+			libssh2_sftp_read_discard(handle);
+			libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "Invalid FXP_DATA length", 0);
+			return -1;
+		}
+#ifdef LIBSSH2_DEBUG_SFTP
+		_libssh2_debug(session, LIBSSH2_DBG_SFTP, "%lu bytes returned for FXP_READ #%lu", bytes_read, request.request_id);
+#endif
+
+		if (bytes_read < request.len) {
+			/* Short read, the requests behind this one would leave a hole
+			 * Drop them and pick up again from where this reply ends
+			 */
+			libssh2_sftp_read_discard(handle);
+			handle->u.file.read_offset = request.offset + bytes_read;
+		}
+
+		handle->u.file.read_data = data;
+		handle->u.file.read_data_len = 9 + bytes_read;
+		handle->u.file.read_data_head = 9;
+		handle->u.file.read_data_offset = request.offset;
+	}
+
+	return (handle->u.file.read_data_head < handle->u.file.read_data_len) ? 1 : 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_read_pipelined
+ * libssh2_sftp_read() for handles with a read window
+ */
+static size_t libssh2_sftp_read_pipelined(LIBSSH2_SFTP_HANDLE *handle, char *buffer, size_t buffer_maxlen)
+{
+	LIBSSH2_SESSION *session = handle->sftp->channel->session;
+	unsigned long bytes_read;
+	int rc = libssh2_sftp_read_fill(handle);
+
+	if (rc <= 0) {
+		return rc;
+	}
+
+	/* Hand out as much of the current reply as will fit */
+	bytes_read = handle->u.file.read_data_len - handle->u.file.read_data_head;
+	if (bytes_read > buffer_maxlen) {
+		bytes_read = buffer_maxlen;
+	}
+	memcpy(buffer, handle->u.file.read_data + handle->u.file.read_data_head, bytes_read);
+	handle->u.file.read_data_head += bytes_read;
+	handle->u.file.read_data_offset += bytes_read;
+	handle->u.file.offset += bytes_read;
+
+	if (handle->u.file.read_data_head >= handle->u.file.read_data_len) {
+		LIBSSH2_FREE(session, handle->u.file.read_data);
+		handle->u.file.read_data = NULL;
+	}
+
+	return bytes_read;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_read_borrow
+ * Read from a handle with a read window without copying
+ * *buffer is pointed straight into the FXP_DATA reply, it stays valid until libssh2_sftp_read_release(),
+ * or any other read, write, or close on the same handle
+ */
+LIBSSH2_API size_t libssh2_sftp_read_borrow(LIBSSH2_SFTP_HANDLE *handle, const char **buffer, size_t buffer_maxlen)
+{
+	if (!handle)
+	{
+		return -1;
+	}
+	unsigned long bytes_read;
+	int rc;
+
+	if ((handle->handle_type != LIBSSH2_SFTP_HANDLE_FILE) || !handle->u.file.read_window) {
+		libssh2_error(handle->sftp->channel->session, LIBSSH2_ERROR_INVAL, "Borrowed reads need a read window, see libssh2_sftp_read_window()", 0);
+		return -1;
+	}
+
+	rc = libssh2_sftp_read_fill(handle);
+	if (rc <= 0) {
+		*buffer = NULL;
+		return rc;
+	}
+
+	bytes_read = handle->u.file.read_data_len - handle->u.file.read_data_head;
+	if (bytes_read > buffer_maxlen) {
+		bytes_read = buffer_maxlen;
+	}
+	*buffer = (const char *)handle->u.file.read_data + handle->u.file.read_data_head;
+	handle->u.file.read_data_head += bytes_read;
+	handle->u.file.read_data_offset += bytes_read;
+	handle->u.file.offset += bytes_read;
+
+	return bytes_read;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_read_release
+ * Done with the slice handed out by libssh2_sftp_read_borrow()
+ * Frees the reply underneath it once all of it has been borrowed
+ */
+LIBSSH2_API void libssh2_sftp_read_release(LIBSSH2_SFTP_HANDLE *handle)
+{
+	if (!handle || (handle->handle_type != LIBSSH2_SFTP_HANDLE_FILE))
+	{
+		return;
+	}
+
+	if (handle->u.file.read_data && (handle->u.file.read_data_head >= handle->u.file.read_data_len)) {
+		LIBSSH2_FREE(handle->sftp->channel->session, handle->u.file.read_data);
+		handle->u.file.read_data = NULL;
+	}
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_read_window_ex
+ * Allow up to window FXP_READ requests of chunk_len bytes to be in flight on a file handle at once
+ * A window of 0 or 1 goes back to one round trip per libssh2_sftp_read()
+ */
+LIBSSH2_API int libssh2_sftp_read_window_ex(LIBSSH2_SFTP_HANDLE *handle, unsigned int window, unsigned long chunk_len)
+{
+	if (!handle)
+	{
+		return -1;
+	}
+	LIBSSH2_CHANNEL *channel = handle->sftp->channel;
+	LIBSSH2_SESSION *session = channel->session;
+	libssh2_sftp_request *requests = NULL;
+	unsigned long channel_window;
+
+	if (handle->handle_type != LIBSSH2_SFTP_HANDLE_FILE) {
+		libssh2_error(session, LIBSSH2_ERROR_INVAL, "Read window can only be set on a file handle", 0);
+		return -1;
+	}
+
+	if (!chunk_len || (chunk_len > LIBSSH2_SFTP_READ_CHUNK_MAX)) {
+		chunk_len = LIBSSH2_SFTP_READ_CHUNK_MAX;
+	}
+
+	if (window > 1) {
+		requests = LIBSSH2_ALLOC(session, window * sizeof(libssh2_sftp_request));
+		if (!requests) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate SFTP read window", 0);
+			return -1;
+		}
+	}
+
+	/* Anything already in flight was issued for the old window */
+	if (handle->u.file.read_requests) {
+		libssh2_sftp_read_discard(handle);
+		LIBSSH2_FREE(session, handle->u.file.read_requests);
+	}
+	handle->u.file.read_requests = requests;
+	handle->u.file.read_window = requests ? window : 0;
+	handle->u.file.read_chunk = chunk_len;
+	handle->u.file.read_head = 0;
+	handle->u.file.read_count = 0;
+	handle->u.file.read_offset = handle->u.file.offset;
+	handle->u.file.read_eof = 0;
+
+	/* Pipelining buys nothing if the channel window won't let all the replies through at once
+	 * Capped at the largest window we'd auto-tune to, which also keeps the multiplication from overflowing */
+	if (window > (LIBSSH2_CHANNEL_WINDOW_MAX / (chunk_len + 13))) {
+		channel_window = LIBSSH2_CHANNEL_WINDOW_MAX;
+	} else {
+		channel_window = window * (chunk_len + 13); /* packet_len(4) + packet_type(1) + request_id(4) + data_len(4) */
+	}
+	if (requests && (channel->remote.window_size_initial < channel_window)) {
+#ifdef LIBSSH2_DEBUG_SFTP
+		_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Growing SFTP channel window to %lu bytes", channel_window);
+#endif
+		libssh2_channel_receive_window_adjust(channel, channel_window - channel->remote.window_size_initial, 1);
+		channel->remote.window_size_initial = channel_window;
+	}
+
+	return 0;
+}
+/* }}} */
+
 /* {{{ libssh2_sftp_read
  * Read from an SFTP file handle
  */
@@ -710,6 +1175,10 @@ LIBSSH2_API size_t libssh2_sftp_read(LIBSSH2_SFTP_HANDLE *handle, char *buffer,
 	unsigned char read_responses[2] = { SSH_FXP_DATA,		SSH_FXP_STATUS };
 	size_t bytes_read = 0;
 
+	if (handle->u.file.read_window) {
+		return libssh2_sftp_read_pipelined(handle, buffer, buffer_maxlen);
+	}
+
 #ifdef LIBSSH2_DEBUG_SFTP
 	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Reading %lu bytes from SFTP handle", (unsigned long)buffer_maxlen);
 #endif
@@ -764,52 +1233,16 @@ LIBSSH2_API size_t libssh2_sftp_read(LIBSSH2_SFTP_HANDLE *handle, char *buffer,
 }
 /* }}} */
 
-/* {{{ libssh2_sftp_readdir
- * Read from an SFTP directory handle
+/* {{{ libssh2_sftp_readdir_send
+ * Issue an FXP_READDIR for the next batch of names
  */
-LIBSSH2_API int libssh2_sftp_readdir(LIBSSH2_SFTP_HANDLE *handle, char *buffer, size_t buffer_maxlen, LIBSSH2_SFTP_ATTRIBUTES *attrs) 
+static int libssh2_sftp_readdir_send(LIBSSH2_SFTP_HANDLE *handle)
 {
-	if (!handle)
-	{
-		return -1;
-	}
 	LIBSSH2_SFTP	*sftp	 = handle->sftp;
 	LIBSSH2_CHANNEL *channel = sftp->channel;
 	LIBSSH2_SESSION *session = channel->session;
-	LIBSSH2_SFTP_ATTRIBUTES attrs_dummy;
-	unsigned long data_len, request_id, filename_len, num_names;
 	unsigned long packet_len = handle->handle_len + 13; /* packet_len(4) + packet_type(1) + request_id(4) + handle_len(4) */
-	unsigned char *packet, *s, *data;
-	unsigned char read_responses[2] = { SSH_FXP_NAME,		SSH_FXP_STATUS };
-
-	if (handle->u.dir.names_left) {
-		/* A prior request returned more than one directory entry, feed it back from the buffer */
-		unsigned char *s = (unsigned char *)handle->u.dir.next_name;
-		unsigned long real_filename_len = libssh2_ntohu32(s);
-
-		filename_len = real_filename_len;			s += 4;
-		if (filename_len > buffer_maxlen) {
-			filename_len = buffer_maxlen;
-		}
-		memcpy(buffer, s, filename_len);			s += real_filename_len;
-
-		/* Skip longname */
-		s += 4 + libssh2_ntohu32(s);
-
-		if (attrs) {
-			memset(attrs, 0, sizeof(LIBSSH2_SFTP_ATTRIBUTES));
-		}
-		s += libssh2_sftp_bin2attr(attrs ? attrs : &attrs_dummy, s);
-
-		handle->u.dir.next_name = (char *)s;
-		if ((--handle->u.dir.names_left) == 0) {
-			LIBSSH2_FREE(session, handle->u.dir.names_packet);
-		}
-
-		return filename_len;
-	}
-
-	/* Request another entry(entries?) */
+	unsigned char *packet, *s;
 
 	s = packet = LIBSSH2_ALLOC(session, packet_len);
 	if (!packet) {
@@ -819,25 +1252,62 @@ LIBSSH2_API int libssh2_sftp_readdir(LIBSSH2_SFTP_HANDLE *handle, char *buffer,
 
 	libssh2_htonu32(s, packet_len - 4);					s += 4;
 	*(s++) = SSH_FXP_READDIR;
-	request_id = sftp->request_id++;
-	libssh2_htonu32(s, request_id);						s += 4;
+	handle->u.dir.readdir_id = sftp->request_id++;
+	libssh2_htonu32(s, handle->u.dir.readdir_id);		s += 4;
 	libssh2_htonu32(s, handle->handle_len);				s += 4;
 	memcpy(s, handle->handle, handle->handle_len);		s += handle->handle_len;
 
 #ifdef LIBSSH2_DEBUG_SFTP
-	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Reading entries from directory handle");
+	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Requesting entries from directory handle");
 #endif
-	if (packet_len != libssh2_channel_write(channel, packet, packet_len)) {
-		libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send FXP_READ command", 0);
+	if (packet_len != libssh2_channel_write(channel, (char *)packet, packet_len)) {
+		libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send FXP_READDIR command", 0);
 		LIBSSH2_FREE(session, packet);
 		return -1;
 	}
 	LIBSSH2_FREE(session, packet);
+	handle->u.dir.readdir_pending = 1;
 
-	if (libssh2_sftp_packet_requirev(sftp, 2, read_responses, request_id, &data, &data_len)) {
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_readdir_fill
+ * Make sure there's a batch of names to hand out, fetching the next one if the current batch is used up
+ * With prefetch on, the following FXP_READDIR goes out as soon as a batch arrives, so it's in flight while this one is consumed
+ * Returns 1 if names are available, 0 at the end of the directory, -1 on error
+ */
+static int libssh2_sftp_readdir_fill(LIBSSH2_SFTP_HANDLE *handle)
+{
+	LIBSSH2_SFTP	*sftp	 = handle->sftp;
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned long data_len, num_names;
+	unsigned char *data;
+	unsigned char read_responses[2] = { SSH_FXP_NAME,		SSH_FXP_STATUS };
+
+	if (handle->u.dir.names_left) {
+		return 1;
+	}
+
+	/* Released lazily so that names handed out by libssh2_sftp_readdir_batch() stay valid until the next call */
+	if (handle->u.dir.names_packet) {
+		LIBSSH2_FREE(session, handle->u.dir.names_packet);
+		handle->u.dir.names_packet = NULL;
+	}
+
+	if (handle->u.dir.eof) {
+		return 0;
+	}
+
+	if (!handle->u.dir.readdir_pending && libssh2_sftp_readdir_send(handle)) {
+		return -1;
+	}
+
+	if (libssh2_sftp_packet_requirev(sftp, 2, read_responses, handle->u.dir.readdir_id, &data, &data_len)) {
 		libssh2_error(session, LIBSSH2_ERROR_SOCKET_TIMEOUT, "Timeout waiting for status message", 0);
 		return -1;
 	}
+	handle->u.dir.readdir_pending = 0;
 
 	if (data[0] == SSH_FXP_STATUS) {
 		int retcode;
@@ -845,6 +1315,7 @@ LIBSSH2_API int libssh2_sftp_readdir(LIBSSH2_SFTP_HANDLE *handle, char *buffer,
 		retcode = libssh2_ntohu32(data + 5);
 		LIBSSH2_FREE(session, data);
 		if (retcode == LIBSSH2_FX_EOF) {
+			handle->u.dir.eof = 1;
 			return 0;
 		} else {
 			sftp->last_errno = retcode;
@@ -857,40 +1328,415 @@ LIBSSH2_API int libssh2_sftp_readdir(LIBSSH2_SFTP_HANDLE *handle, char *buffer,
 #ifdef LIBSSH2_DEBUG_SFTP
 	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "%lu entries returned", num_names);
 #endif
-	if (num_names <= 0) {
+	if (num_names == 0) {
 		LIBSSH2_FREE(session, data);
-		return (num_names == 0) ? 0 : -1;
+		handle->u.dir.eof = 1;
+		return 0;
 	}
 
-	if (num_names == 1) {
-		unsigned long real_filename_len = libssh2_ntohu32(data + 9);
-
-		filename_len = real_filename_len;
-		if (filename_len > buffer_maxlen) {
-			filename_len = buffer_maxlen;
-		}
-		memcpy(buffer, data + 13, filename_len);
-		
-		/* The filename is not null terminated, make it so if possible */
-		if (filename_len < buffer_maxlen) {
-			buffer[filename_len] = '\0';
+	handle->u.dir.names_left = num_names;
+	handle->u.dir.names_packet = data;
+	handle->u.dir.names_packet_len = data_len;
+	handle->u.dir.next_name = (char *)data + 9;
+
+	if (handle->u.dir.prefetch && libssh2_sftp_readdir_send(handle)) {
+		return -1;
+	}
+
+	return 1;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_readdir_prefetch
+ * Turn directory read-ahead on or off
+ * While on, the next FXP_READDIR is always in flight, so a large listing doesn't stall for a round trip per batch
+ */
+LIBSSH2_API int libssh2_sftp_readdir_prefetch(LIBSSH2_SFTP_HANDLE *handle, int enable)
+{
+	if (!handle)
+	{
+		return -1;
+	}
+	if (handle->handle_type != LIBSSH2_SFTP_HANDLE_DIR) {
+		libssh2_error(handle->sftp->channel->session, LIBSSH2_ERROR_INVAL, "Directory prefetch requires a directory handle", 0);
+		return -1;
+	}
+
+	handle->u.dir.prefetch = enable ? 1 : 0;
+
+	/* Nothing to wait for while the current batch lasts, so get the next one started now */
+	if (handle->u.dir.prefetch && handle->u.dir.names_left && !handle->u.dir.readdir_pending && !handle->u.dir.eof) {
+		return libssh2_sftp_readdir_send(handle);
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_readdir
+ * Read from an SFTP directory handle
+ */
+LIBSSH2_API int libssh2_sftp_readdir(LIBSSH2_SFTP_HANDLE *handle, char *buffer, size_t buffer_maxlen, LIBSSH2_SFTP_ATTRIBUTES *attrs) 
+{
+	if (!handle)
+	{
+		return -1;
+	}
+	LIBSSH2_SFTP_ATTRIBUTES attrs_dummy;
+	unsigned long real_filename_len, filename_len;
+	unsigned char *s;
+	int ret;
+
+	ret = libssh2_sftp_readdir_fill(handle);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	s = (unsigned char *)handle->u.dir.next_name;
+	real_filename_len = libssh2_ntohu32(s);
+
+	filename_len = real_filename_len;			s += 4;
+	if (filename_len > buffer_maxlen) {
+		filename_len = buffer_maxlen;
+	}
+	memcpy(buffer, s, filename_len);			s += real_filename_len;
+
+	/* The filename is not null terminated, make it so if possible */
+	if (filename_len < buffer_maxlen) {
+		buffer[filename_len] = '\0';
+	}
+
+	/* Skip longname */
+	s += 4 + libssh2_ntohu32(s);
+
+	if (attrs) {
+		memset(attrs, 0, sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+	}
+	s += libssh2_sftp_bin2attr(attrs ? attrs : &attrs_dummy, s);
+
+	handle->u.dir.next_name = (char *)s;
+	handle->u.dir.names_left--;
+
+	return filename_len;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_readdir_batch
+ * Hand back every name left in the current FXP_NAME batch at once, fetching a batch first if need be
+ * Entries are decoded in place: filename and longentry point into the reply, which gets null terminators written over
+ * the length fields that follow them (already read by then). The array and the strings belong to the handle and stay
+ * valid until the next readdir call on it or it's closed
+ * Returns the number of entries, 0 at the end of the directory, -1 on error
+ */
+LIBSSH2_API int libssh2_sftp_readdir_batch(LIBSSH2_SFTP_HANDLE *handle, LIBSSH2_SFTP_DIRENT **entries)
+{
+	if (!handle)
+	{
+		return -1;
+	}
+	LIBSSH2_SESSION *session = handle->sftp->channel->session;
+	unsigned char *s, *end;
+	unsigned long i, count;
+	int ret;
+
+	ret = libssh2_sftp_readdir_fill(handle);
+	if (ret <= 0) {
+		return ret;
+	}
+
+	count = handle->u.dir.names_left;
+	if (count > handle->u.dir.entries_size) {
+		LIBSSH2_SFTP_DIRENT *newentries = LIBSSH2_REALLOC(session, handle->u.dir.entries, count * sizeof(LIBSSH2_SFTP_DIRENT));
+
+		if (!newentries) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for directory entries", 0);
+			return -1;
+		}
+		handle->u.dir.entries = newentries;
+		handle->u.dir.entries_size = count;
+	}
+
+	s = (unsigned char *)handle->u.dir.next_name;
+	end = (unsigned char *)handle->u.dir.names_packet + handle->u.dir.names_packet_len;
+	for(i = 0; i < count; i++) {
+		LIBSSH2_SFTP_DIRENT *entry = handle->u.dir.entries + i;
+		unsigned char *filename_end, *longentry_end;
+
+		/* Every length is checked against what's left of the packet before anything is read past it */
+		if ((end - s) < 4) {
+			goto malformed;
 		}
-		
-		if (attrs) {
-			memset(attrs, 0, sizeof(LIBSSH2_SFTP_ATTRIBUTES));
-			libssh2_sftp_bin2attr(attrs, data + 13 + real_filename_len + (4 + libssh2_ntohu32(data + 13 + real_filename_len)));
+		entry->filename_len = libssh2_ntohu32(s);					s += 4;
+		if (entry->filename_len > (unsigned long)(end - s)) {
+			goto malformed;
 		}
-		LIBSSH2_FREE(session, data);
+		entry->filename = (char *)s;								s += entry->filename_len;
+		filename_end = s;
+
+		if ((end - s) < 4) {
+			goto malformed;
+		}
+		entry->longentry_len = libssh2_ntohu32(s);					s += 4;
+		if (entry->longentry_len > (unsigned long)(end - s)) {
+			goto malformed;
+		}
+		entry->longentry = (char *)s;								s += entry->longentry_len;
+		longentry_end = s;
+
+		if (((end - s) < 4) || (libssh2_sftp_bin2attr_len(s) > (unsigned long)(end - s))) {
+			goto malformed;
+		}
+		memset(&entry->attrs, 0, sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+		s += libssh2_sftp_bin2attr(&entry->attrs, s);
 
-		return filename_len; 
+		*filename_end = '\0';
+		*longentry_end = '\0';
 	}
 
-	handle->u.dir.names_left = num_names;
-	handle->u.dir.names_packet = data;
-	handle->u.dir.next_name = (char *)data + 9;
+	handle->u.dir.next_name = (char *)s;
+	handle->u.dir.names_left = 0;
+	*entries = handle->u.dir.entries;
+
+	return count;
+
+ malformed:
+	handle->u.dir.names_left = 0;
+	libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "Malformed FXP_NAME packet", 0);
+	return -1;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_write_status
+ * Pop the oldest unacknowledged FXP_WRITE off the ring and record its outcome
+ * Only the first failure is kept, that's the offset the caller needs to restart from
+ */
+static void libssh2_sftp_write_status(LIBSSH2_SFTP_HANDLE *handle, unsigned char *data)
+{
+	LIBSSH2_SESSION *session = handle->sftp->channel->session;
+	libssh2_sftp_request *request = &handle->u.file.write_requests[handle->u.file.write_head];
+	unsigned long retcode = libssh2_ntohu32(data + 5);
+
+	LIBSSH2_FREE(session, data);
+
+	if ((retcode != LIBSSH2_FX_OK) && !handle->u.file.write_errno) {
+#ifdef LIBSSH2_DEBUG_SFTP
+		_libssh2_debug(session, LIBSSH2_DBG_SFTP, "FXP_WRITE #%lu failed with status %lu", request->request_id, retcode);
+#endif
+		handle->u.file.write_errno = retcode;
+		handle->u.file.write_error_offset = request->offset;
+	}
+
+	handle->u.file.write_head = (handle->u.file.write_head + 1) % handle->u.file.write_window;
+	handle->u.file.write_count--;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_write_reap
+ * Collect FXP_WRITE acks which have already arrived
+ * If should_block is set, wait for at least the oldest one first
+ */
+static int libssh2_sftp_write_reap(LIBSSH2_SFTP_HANDLE *handle, int should_block)
+{
+	LIBSSH2_SFTP *sftp = handle->sftp;
+	unsigned char *data;
+	unsigned long data_len;
+
+	if (should_block && handle->u.file.write_count) {
+		if (libssh2_sftp_packet_require(sftp, SSH_FXP_STATUS, handle->u.file.write_requests[handle->u.file.write_head].request_id, &data, &data_len)) {
+			libssh2_error(sftp->channel->session, LIBSSH2_ERROR_SOCKET_TIMEOUT, "Timeout waiting for status message", 0);
+			return -1;
+		}
+		libssh2_sftp_write_status(handle, data);
+	}
+
+	/* Pull in whatever the channel already has, without waiting */
+	while (libssh2_sftp_packet_read(sftp, 0) > 0);
+
+	while (handle->u.file.write_count &&
+		   (libssh2_sftp_packet_ask(sftp, SSH_FXP_STATUS, handle->u.file.write_requests[handle->u.file.write_head].request_id, &data, &data_len, 0) == 0)) {
+		libssh2_sftp_write_status(handle, data);
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_write_drain
+ * Wait for every outstanding FXP_WRITE to be acknowledged
+ */
+static int libssh2_sftp_write_drain(LIBSSH2_SFTP_HANDLE *handle)
+{
+	while (handle->u.file.write_count) {
+		if (libssh2_sftp_write_reap(handle, 1)) {
+			/* The channel is gone, there are no more acks coming */
+			handle->u.file.write_count = 0;
+			handle->u.file.write_head = 0;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_write_pipelined
+ * libssh2_sftp_write() for handles with a write window
+ * Data is considered written once the FXP_WRITE has been sent, acks are collected lazily
+ */
+static size_t libssh2_sftp_write_pipelined(LIBSSH2_SFTP_HANDLE *handle, const char *buffer, size_t count)
+{
+	LIBSSH2_SFTP	*sftp	 = handle->sftp;
+	LIBSSH2_CHANNEL *channel = sftp->channel;
+	LIBSSH2_SESSION *session = channel->session;
+	size_t bytes_written = 0;
+
+	if (handle->u.file.write_errno) {
+		/* Don't pile more data on after a failure, let the caller find out where to resume from */
+		sftp->last_errno = handle->u.file.write_errno;
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP Protocol Error, earlier write failed", 0);
+		return -1;
+	}
+
+	if (libssh2_sftp_write_reap(handle, 0)) {
+		return -1;
+	}
+
+	while (bytes_written < count) {
+		libssh2_sftp_request *request;
+		unsigned long chunk_len = count - bytes_written;
+		unsigned long packet_len;
+		unsigned char *s = handle->u.file.write_packet;
+
+		if (chunk_len > LIBSSH2_SFTP_WRITE_CHUNK_MAX) {
+			chunk_len = LIBSSH2_SFTP_WRITE_CHUNK_MAX;
+		}
+		packet_len = handle->handle_len + chunk_len + 25; /* packet_len(4) + packet_type(1) + request_id(4) + handle_len(4) + offset(8) + count(4) */
+
+		if ((handle->u.file.write_count == handle->u.file.write_window) &&
+			libssh2_sftp_write_reap(handle, 1)) {
+			return bytes_written ? bytes_written : -1;
+		}
+
+		request = &handle->u.file.write_requests[(handle->u.file.write_head + handle->u.file.write_count) % handle->u.file.write_window];
+		request->request_id = sftp->request_id++;
+		request->offset = handle->u.file.offset;
+		request->len = chunk_len;
+
+		libssh2_htonu32(s, packet_len - 4);					s += 4;
+		*(s++) = SSH_FXP_WRITE;
+		libssh2_htonu32(s, request->request_id);			s += 4;
+		libssh2_htonu32(s, handle->handle_len);				s += 4;
+		memcpy(s, handle->handle, handle->handle_len);		s += handle->handle_len;
+		libssh2_htonu64(s, request->offset);				s += 8;
+		libssh2_htonu32(s, chunk_len);						s += 4;
+		memcpy(s, buffer + bytes_written, chunk_len);		s += chunk_len;
+
+#ifdef LIBSSH2_DEBUG_SFTP
+		_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Pipelining FXP_WRITE #%lu for %lu bytes (%lu unacknowledged)", request->request_id, chunk_len, handle->u.file.write_count + 1);
+#endif
+		if (packet_len != libssh2_channel_write(channel, handle->u.file.write_packet, packet_len)) {
+			libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send FXP_WRITE command", 0);
+			return bytes_written ? bytes_written : -1;
+		}
+
+		handle->u.file.write_count++;
+		handle->u.file.offset += chunk_len;
+		bytes_written += chunk_len;
+	}
+
+	return bytes_written;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_write_window
+ * Allow up to window FXP_WRITE requests to go unacknowledged on a file handle
+ * A window of 0 or 1 goes back to waiting for the status of every libssh2_sftp_write()
+ */
+LIBSSH2_API int libssh2_sftp_write_window(LIBSSH2_SFTP_HANDLE *handle, unsigned int window)
+{
+	if (!handle)
+	{
+		return -1;
+	}
+	LIBSSH2_SESSION *session = handle->sftp->channel->session;
+	libssh2_sftp_request *requests = NULL;
+	unsigned char *packet = NULL;
+
+	if (handle->handle_type != LIBSSH2_SFTP_HANDLE_FILE) {
+		libssh2_error(session, LIBSSH2_ERROR_INVAL, "Write window can only be set on a file handle", 0);
+		return -1;
+	}
+
+	if (window > 1) {
+		requests = LIBSSH2_ALLOC(session, window * sizeof(libssh2_sftp_request));
+		packet = LIBSSH2_ALLOC(session, handle->handle_len + LIBSSH2_SFTP_WRITE_CHUNK_MAX + 25);
+		if (!requests || !packet) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate SFTP write window", 0);
+			if (requests) {
+				LIBSSH2_FREE(session, requests);
+			}
+			if (packet) {
+				LIBSSH2_FREE(session, packet);
+			}
+			return -1;
+		}
+	}
+
+	/* The ring is about to be replaced, so everything in it has to be accounted for first
+	 * Any failure stays recorded for libssh2_sftp_write_flush()
+	 */
+	if (handle->u.file.write_requests) {
+		libssh2_sftp_write_drain(handle);
+		LIBSSH2_FREE(session, handle->u.file.write_requests);
+		LIBSSH2_FREE(session, handle->u.file.write_packet);
+	}
+	handle->u.file.write_requests = requests;
+	handle->u.file.write_packet = packet;
+	handle->u.file.write_window = requests ? window : 0;
+	handle->u.file.write_head = 0;
+	handle->u.file.write_count = 0;
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_write_flush
+ * Wait until every pipelined write has been acknowledged
+ * On failure returns -1, libssh2_sftp_last_error() gives the status of the first write which failed,
+ * and failed_offset (if passed) the file offset that write started at.
+ * The failure is cleared once reported
+ */
+LIBSSH2_API int libssh2_sftp_write_flush(LIBSSH2_SFTP_HANDLE *handle, libssh2_uint64_t *failed_offset)
+{
+	if (!handle)
+	{
+		return -1;
+	}
+	LIBSSH2_SFTP	*sftp	 = handle->sftp;
+	LIBSSH2_SESSION *session = sftp->channel->session;
+
+	if (handle->handle_type != LIBSSH2_SFTP_HANDLE_FILE) {
+		return 0;
+	}
+
+#ifdef LIBSSH2_DEBUG_SFTP
+	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Flushing %lu unacknowledged writes", handle->u.file.write_count);
+#endif
+	if (libssh2_sftp_write_drain(handle)) {
+		return -1;
+	}
+
+	if (handle->u.file.write_errno) {
+		sftp->last_errno = handle->u.file.write_errno;
+		if (failed_offset) {
+			*failed_offset = handle->u.file.write_error_offset;
+		}
+		handle->u.file.write_errno = 0;
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP Protocol Error", 0);
+		return -1;
+	}
 
-	/* Be lazy, just use the name popping mechanism from the start of the function */
-	return libssh2_sftp_readdir(handle, buffer, buffer_maxlen, attrs);
+	return 0;
 }
 /* }}} */
 
@@ -913,6 +1759,15 @@ LIBSSH2_API size_t libssh2_sftp_write(LIBSSH2_SFTP_HANDLE *handle, const char *b
 #ifdef LIBSSH2_DEBUG_SFTP
 	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Writing %lu bytes", (unsigned long)count);
 #endif
+	if (handle->u.file.read_window) {
+		/* Read-ahead may overlap what's about to be written */
+		libssh2_sftp_read_discard(handle);
+	}
+
+	if (handle->u.file.write_window) {
+		return libssh2_sftp_write_pipelined(handle, buffer, count);
+	}
+
 	s = packet = LIBSSH2_ALLOC(session, packet_len);
 	if (!packet) {
 		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for FXP_WRITE packet", 0);
@@ -1046,9 +1901,52 @@ LIBSSH2_API size_t libssh2_sftp_tell(LIBSSH2_SFTP_HANDLE *handle)
 /* }}} */
 
 
+/* {{{ libssh2_sftp_handle_release
+ * Unlink a handle from its SFTP structure and free it, without telling the server
+ */
+static void libssh2_sftp_handle_release(LIBSSH2_SFTP_HANDLE *handle)
+{
+	LIBSSH2_SFTP	*sftp	 = handle->sftp;
+	LIBSSH2_SESSION *session = sftp->channel->session;
+
+	if (handle->prev) {
+		handle->prev->next = handle->next;
+	} else if (handle == sftp->handles) {
+		sftp->handles = handle->next;
+	}
+	if (handle->next) {
+		handle->next->prev = handle->prev;
+	}
+
+	if (handle->handle_type == LIBSSH2_SFTP_HANDLE_DIR) {
+		if (handle->u.dir.names_packet) {
+			LIBSSH2_FREE(session, handle->u.dir.names_packet);
+		}
+		if (handle->u.dir.entries) {
+			LIBSSH2_FREE(session, handle->u.dir.entries);
+		}
+	}
+
+	if (handle->handle_type == LIBSSH2_SFTP_HANDLE_FILE) {
+		if (handle->u.file.read_requests) {
+			LIBSSH2_FREE(session, handle->u.file.read_requests);
+		}
+		if (handle->u.file.write_requests) {
+			LIBSSH2_FREE(session, handle->u.file.write_requests);
+			LIBSSH2_FREE(session, handle->u.file.write_packet);
+		}
+	}
+
+	LIBSSH2_FREE(session, handle->handle);
+	LIBSSH2_FREE(session, handle);
+}
+/* }}} */
+
 /* {{{ libssh2_sftp_close_handle
  * Close a file or directory handle
  * Also frees handle resource and unlinks it from the SFTP structure
+ * A pipelined write which failed is reported here (-1, with libssh2_sftp_last_error() giving its status),
+ * though the handle is still closed and freed
  */
 LIBSSH2_API int libssh2_sftp_close_handle(LIBSSH2_SFTP_HANDLE *handle)
 {
@@ -1062,14 +1960,39 @@ LIBSSH2_API int libssh2_sftp_close_handle(LIBSSH2_SFTP_HANDLE *handle)
 	unsigned long data_len, retcode, request_id;
 	unsigned long packet_len = handle->handle_len + 13; /* packet_len(4) + packet_type(1) + request_id(4) + handle_len(4) */
 	unsigned char *packet, *s, *data;
+	unsigned long write_errno = 0;
+	int write_failed = 0;
 
 #ifdef LIBSSH2_DEBUG_SFTP
 	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Closing handle");
 #endif
+	if (handle->handle_type == LIBSSH2_SFTP_HANDLE_FILE) {
+		if (handle->u.file.read_window) {
+			libssh2_sftp_read_discard(handle);
+		}
+		/* Pending write failures get reported here rather than silently lost with the handle
+		 * The handle still has to be closed, so the failure is held on to till that's done
+		 */
+		if ((handle->u.file.write_count || handle->u.file.write_errno) &&
+			libssh2_sftp_write_flush(handle, NULL)) {
+			write_failed = 1;
+			write_errno = sftp->last_errno;
+		}
+	}
+	if ((handle->handle_type == LIBSSH2_SFTP_HANDLE_DIR) && handle->u.dir.readdir_pending) {
+		/* Reap the read-ahead reply, otherwise it'd sit in the brigade forever */
+		unsigned char readdir_responses[2] = { SSH_FXP_NAME,		SSH_FXP_STATUS };
+
+		if (libssh2_sftp_packet_requirev(sftp, 2, readdir_responses, handle->u.dir.readdir_id, &data, &data_len) == 0) {
+			LIBSSH2_FREE(session, data);
+		}
+		handle->u.dir.readdir_pending = 0;
+	}
+
 	s = packet = LIBSSH2_ALLOC(session, packet_len);
 	if (!packet) {
 		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for FXP_CLOSE packet", 0);
-		return -1;
+		goto close_failed;
 	}
 
 	libssh2_htonu32(s, packet_len - 4);					s += 4;
@@ -1082,13 +2005,13 @@ LIBSSH2_API int libssh2_sftp_close_handle(LIBSSH2_SFTP_HANDLE *handle)
 	if (packet_len != libssh2_channel_write(channel, packet, packet_len)) {
 		libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send FXP_CLOSE command", 0);
 		LIBSSH2_FREE(session, packet);
-		return -1;
+		goto close_failed;
 	}
 	LIBSSH2_FREE(session, packet);
 
 	if (libssh2_sftp_packet_require(sftp, SSH_FXP_STATUS, request_id, &data, &data_len)) {
 		libssh2_error(session, LIBSSH2_ERROR_SOCKET_TIMEOUT, "Timeout waiting for status message", 0);
-		return -1;
+		goto close_failed;
 	}
 
 	retcode = libssh2_ntohu32(data + 5);
@@ -1097,25 +2020,28 @@ LIBSSH2_API int libssh2_sftp_close_handle(LIBSSH2_SFTP_HANDLE *handle)
 	if (retcode != LIBSSH2_FX_OK) {
 		sftp->last_errno = retcode;
 		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP Protocol Error", 0);
-		return -1;
+		goto close_failed;
 	}
 
-	if (handle == sftp->handles) {
-		sftp->handles = handle->next;
-	}
-	if (handle->next) {
-		handle->next->prev = NULL;
-	}
+	libssh2_sftp_handle_release(handle);
 
-	if ((handle->handle_type == LIBSSH2_SFTP_HANDLE_DIR) &&
-		handle->u.dir.names_left) {
-		LIBSSH2_FREE(session, handle->u.dir.names_packet);
+	if (write_failed) {
+		sftp->last_errno = write_errno;
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP Protocol Error", 0);
+		return -1;
 	}
 
-	LIBSSH2_FREE(session, handle->handle);
-	LIBSSH2_FREE(session, handle);
-
 	return 0;
+
+ close_failed:
+	/* Once its write failure has been taken, the handle has to go too, or the failure would be lost on a retry
+	 * The write failure is the one worth reporting
+	 */
+	if (write_failed) {
+		libssh2_sftp_handle_release(handle);
+		sftp->last_errno = write_errno;
+	}
+	return -1;
 }
 /* }}} */
 
@@ -1381,29 +2307,23 @@ LIBSSH2_API int libssh2_sftp_rmdir_ex(LIBSSH2_SFTP *sftp, char *path, unsigned i
 }
 /* }}} */
 
-/* {{{ libssh2_sftp_stat_ex
- * Stat a file or symbolic link
+/* {{{ libssh2_sftp_stat_send
+ * Issue an FXP_STAT/LSTAT/SETSTAT without waiting for the reply
  */
-LIBSSH2_API int libssh2_sftp_stat_ex(LIBSSH2_SFTP *sftp, char *path, unsigned int path_len, int stat_type, LIBSSH2_SFTP_ATTRIBUTES *attrs)
+static int libssh2_sftp_stat_send(LIBSSH2_SFTP *sftp, const char *path, unsigned int path_len, int stat_type, LIBSSH2_SFTP_ATTRIBUTES *attrs, unsigned long *request_id)
 {
-	if (!sftp)
-	{
-		return -1;
-	}
 	LIBSSH2_CHANNEL *channel = sftp->channel;
 	LIBSSH2_SESSION *session = channel->session;
-	unsigned long data_len, request_id;
 	unsigned long packet_len = path_len + 13 + ((stat_type == LIBSSH2_SFTP_SETSTAT) ? libssh2_sftp_attrsize(attrs) : 0); 
 									/* packet_len(4) + packet_type(1) + request_id(4) + path_len(4) */
-	unsigned char *packet, *s, *data;
-	unsigned char stat_responses[2] = { SSH_FXP_ATTRS,		SSH_FXP_STATUS	};
+	unsigned char *packet, *s;
 
 #ifdef LIBSSH2_DEBUG_SFTP
 	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "%s %s", (stat_type == LIBSSH2_SFTP_SETSTAT) ? "Set-statting" : (stat_type == LIBSSH2_SFTP_LSTAT ? "LStatting" : "Statting"), path);
 #endif
 	s = packet = LIBSSH2_ALLOC(session, packet_len);
 	if (!packet) {
-		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for FXP_MKDIR packet", 0);
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for FXP_STAT packet", 0);
 		return -1;
 	}
 
@@ -1419,45 +2339,153 @@ LIBSSH2_API int libssh2_sftp_stat_ex(LIBSSH2_SFTP *sftp, char *path, unsigned in
 		default:
 			*(s++) = SSH_FXP_STAT;
 	}
-	request_id = sftp->request_id++;
-	libssh2_htonu32(s, request_id);						s += 4;
+	*request_id = sftp->request_id++;
+	libssh2_htonu32(s, *request_id);					s += 4;
 	libssh2_htonu32(s, path_len);						s += 4;
 	memcpy(s, path, path_len);							s += path_len;
 	if (stat_type == LIBSSH2_SFTP_SETSTAT) {
 		s += libssh2_sftp_attr2bin(s, attrs);
 	}
 
-	if (packet_len != libssh2_channel_write(channel, packet, packet_len)) {
+	if (packet_len != libssh2_channel_write(channel, (char *)packet, packet_len)) {
 		libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send STAT/LSTAT/SETSTAT command", 0);
 		LIBSSH2_FREE(session, packet);
 		return -1;
 	}
 	LIBSSH2_FREE(session, packet);
 
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_stat_reply
+ * Wait for the reply to an FXP_STAT/LSTAT/SETSTAT, filling in attrs from an FXP_ATTRS
+ * *status gets LIBSSH2_FX_OK or the server's failure code, only a lost channel returns -1
+ */
+static int libssh2_sftp_stat_reply(LIBSSH2_SFTP *sftp, unsigned long request_id, LIBSSH2_SFTP_ATTRIBUTES *attrs, unsigned long *status)
+{
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned long data_len;
+	unsigned char *data;
+	unsigned char stat_responses[2] = { SSH_FXP_ATTRS,		SSH_FXP_STATUS	};
+
 	if (libssh2_sftp_packet_requirev(sftp, 2, stat_responses, request_id, &data, &data_len)) {
 		libssh2_error(session, LIBSSH2_ERROR_SOCKET_TIMEOUT, "Timeout waiting for status message", 0);
 		return -1;
 	}
 
 	if (data[0] == SSH_FXP_STATUS) {
-		int retcode;
+		*status = libssh2_ntohu32(data + 5);
+	} else {
+		*status = LIBSSH2_FX_OK;
+		memset(attrs, 0, sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+		libssh2_sftp_bin2attr(attrs, data + 5);
+	}
+	LIBSSH2_FREE(session, data);
 
-		retcode = libssh2_ntohu32(data + 5);
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_stat_ex
+ * Stat a file or symbolic link
+ */
+LIBSSH2_API int libssh2_sftp_stat_ex(LIBSSH2_SFTP *sftp, char *path, unsigned int path_len, int stat_type, LIBSSH2_SFTP_ATTRIBUTES *attrs)
+{
+	if (!sftp)
+	{
+		return -1;
+	}
+	unsigned long request_id, retcode;
+
+	if (libssh2_sftp_stat_send(sftp, path, path_len, stat_type, attrs, &request_id) ||
+		libssh2_sftp_stat_reply(sftp, request_id, attrs, &retcode)) {
+		return -1;
+	}
+
+	if (retcode != LIBSSH2_FX_OK) {
+		sftp->last_errno = retcode;
+		libssh2_error(sftp->channel->session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP Protocol Error", 0);
+		return -1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_stat_discard
+ * Reap the replies to request ids first to last - 1 unread, so a batch that gives up part way doesn't leave them
+ * in the brigade forever. Stops at the first failure, since then the channel is gone and nothing more will arrive
+ */
+static void libssh2_sftp_stat_discard(LIBSSH2_SFTP *sftp, unsigned long first, unsigned long last)
+{
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned char stat_responses[2] = { SSH_FXP_ATTRS,		SSH_FXP_STATUS	};
+	unsigned long data_len;
+	unsigned char *data;
+
+	for(; first != last; first++) {
+		if (libssh2_sftp_packet_requirev(sftp, 2, stat_responses, first, &data, &data_len)) {
+			break;
+		}
 		LIBSSH2_FREE(session, data);
-		if (retcode == LIBSSH2_FX_OK) {
-			return 0;
-		} else {
-			sftp->last_errno = retcode;
-			libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP Protocol Error", 0);
+	}
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_stat_batch
+ * Stat (or lstat, or setstat) a list of paths with up to LIBSSH2_SFTP_STAT_WINDOW requests in flight,
+ * so the whole list costs about one round trip rather than one each
+ * attrs[i] receives the attributes of paths[i] (or supplies them, for SETSTAT), errors[i] its LIBSSH2_FX_* result
+ * Returns the number of paths which failed, or -1 if the channel failed part way (entries not yet reached are left alone)
+ */
+LIBSSH2_API int libssh2_sftp_stat_batch(LIBSSH2_SFTP *sftp, const char **paths, unsigned int count, int stat_type, LIBSSH2_SFTP_ATTRIBUTES *attrs, unsigned long *errors)
+{
+	if (!sftp)
+	{
+		return -1;
+	}
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned long first_id = sftp->request_id, request_id;
+	unsigned int sent = 0, received = 0;
+	int failed = 0, send_failed = 0;
+
+#ifdef LIBSSH2_DEBUG_SFTP
+	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Batch stat of %u paths", count);
+#endif
+	while (received < count) {
+		/* Top the window up, the requests are tiny so let them leave in as few writes as possible */
+		if (!send_failed && (sent < count) && ((sent - received) < LIBSSH2_SFTP_STAT_WINDOW)) {
+			libssh2_session_batch_begin(session);
+			while ((sent < count) && ((sent - received) < LIBSSH2_SFTP_STAT_WINDOW)) {
+				if (libssh2_sftp_stat_send(sftp, paths[sent], strlen(paths[sent]), stat_type, attrs + sent, &request_id)) {
+					send_failed = 1;
+					break;
+				}
+				sent++;
+			}
+			if (libssh2_session_batch_end(session) == -1) {
+				send_failed = 1;
+			}
+		}
+
+		if (received == sent) {
+			/* Only once sending failed: everything that made it out has been answered and reaped, the rest never will be */
 			return -1;
 		}
-	}
 
-	memset(attrs, 0, sizeof(LIBSSH2_SFTP_ATTRIBUTES));
-	libssh2_sftp_bin2attr(attrs, data + 5);
-	LIBSSH2_FREE(session, data);
+		/* Ids were handed out consecutively, so replies can be matched back to their paths without a table */
+		if (libssh2_sftp_stat_reply(sftp, first_id + received, attrs + received, errors + received)) {
+			libssh2_sftp_stat_discard(sftp, first_id + received, first_id + sent);
+			return -1;
+		}
+		if (errors[received] != LIBSSH2_FX_OK) {
+			failed++;
+		}
+		received++;
+	}
 
-	return 0;
+	return failed;
 }
 /* }}} */
 
@@ -1559,15 +2587,1235 @@ LIBSSH2_API int libssh2_sftp_symlink_ex(LIBSSH2_SFTP *sftp, const char *path, un
 }
 /* }}} */
 
-/* {{{ libssh2_sftp_last_error
- * Returns the last error code reported by SFTP
+/* {{{ libssh2_sftp_extended
+ * Send an FXP_EXTENDED request and wait for its FXP_STATUS or FXP_EXTENDED_REPLY
+ * payload is everything which follows the extension name
  */
-LIBSSH2_API unsigned long libssh2_sftp_last_error(LIBSSH2_SFTP *sftp)
+static int libssh2_sftp_extended(LIBSSH2_SFTP *sftp, const char *name, const unsigned char *payload, unsigned long payload_len,
+																		unsigned char **data, unsigned long *data_len)
+{
+	LIBSSH2_CHANNEL *channel = sftp->channel;
+	LIBSSH2_SESSION *session = channel->session;
+	unsigned long name_len = strlen(name), request_id;
+	unsigned long packet_len = name_len + payload_len + 13; /* packet_len(4) + packet_type(1) + request_id(4) + name_len(4) */
+	unsigned char *packet, *s;
+	unsigned char extended_responses[2] = { SSH_FXP_STATUS,	SSH_FXP_EXTENDED_REPLY };
+
+#ifdef LIBSSH2_DEBUG_SFTP
+	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Sending %s request", name);
+#endif
+	s = packet = LIBSSH2_ALLOC(session, packet_len);
+	if (!packet) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for FXP_EXTENDED packet", 0);
+		return -1;
+	}
+
+	libssh2_htonu32(s, packet_len - 4);					s += 4;
+	*(s++) = SSH_FXP_EXTENDED;
+	request_id = sftp->request_id++;
+	libssh2_htonu32(s, request_id);						s += 4;
+	libssh2_htonu32(s, name_len);						s += 4;
+	memcpy(s, name, name_len);							s += name_len;
+	memcpy(s, payload, payload_len);					s += payload_len;
+
+	if (packet_len != libssh2_channel_write(channel, (char *)packet, packet_len)) {
+		libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, "Unable to send FXP_EXTENDED command", 0);
+		LIBSSH2_FREE(session, packet);
+		return -1;
+	}
+	LIBSSH2_FREE(session, packet);
+
+	if (libssh2_sftp_packet_requirev(sftp, 2, extended_responses, request_id, data, data_len)) {
+		libssh2_error(session, LIBSSH2_ERROR_SOCKET_TIMEOUT, "Timeout waiting for status message", 0);
+		return -1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_extended_status
+ * libssh2_sftp_extended() for requests which are only ever answered with an FXP_STATUS
+ */
+static int libssh2_sftp_extended_status(LIBSSH2_SFTP *sftp, const char *name, const unsigned char *payload, unsigned long payload_len)
+{
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned long data_len, retcode;
+	unsigned char *data;
+
+	if (libssh2_sftp_extended(sftp, name, payload, payload_len, &data, &data_len)) {
+		return -1;
+	}
+	if (data[0] != SSH_FXP_STATUS) {
+		LIBSSH2_FREE(session, data);
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "Unexpected reply to FXP_EXTENDED command", 0);
+		return -1;
+	}
+
+	retcode = libssh2_ntohu32(data + 5);
+	LIBSSH2_FREE(session, data);
+
+	if (retcode != LIBSSH2_FX_OK) {
+		sftp->last_errno = retcode;
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP Protocol Error", 0);
+		return -1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_extension_missing
+ * Raise LIBSSH2_ERROR_METHOD_NOT_SUPPORTED for an extension the server didn't advertise
+ * Callers check for that code to fall back to doing the work themselves
+ */
+static int libssh2_sftp_extension_missing(LIBSSH2_SFTP *sftp, const char *errmsg)
+{
+	libssh2_error(sftp->channel->session, LIBSSH2_ERROR_METHOD_NOT_SUPPORTED, (char *)errmsg, 0);
+	return -1;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_extensions
+ * Returns the LIBSSH2_SFTP_EXT_* flags of the extensions the server advertised
+ */
+LIBSSH2_API unsigned long libssh2_sftp_extensions(LIBSSH2_SFTP *sftp)
 {
 	if (!sftp)
+	{
+		return 0;
+	}
+	return sftp->extensions;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_copy_data
+ * Have the server copy len bytes (0 meaning up to EOF) from one open handle to another, without the data coming through here
+ */
+LIBSSH2_API int libssh2_sftp_copy_data(LIBSSH2_SFTP_HANDLE *src, libssh2_uint64_t src_offset, libssh2_uint64_t len,
+																LIBSSH2_SFTP_HANDLE *dest, libssh2_uint64_t dest_offset)
+{
+	if (!src || !dest)
 	{
 		return -1;
 	}
-	return sftp->last_errno;
+	LIBSSH2_SFTP	*sftp	 = src->sftp;
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned long payload_len = src->handle_len + dest->handle_len + 32; /* src_len(4) + src_offset(8) + len(8) + dest_len(4) + dest_offset(8) */
+	unsigned char *payload, *s;
+	int retcode;
+
+	if (!(sftp->extensions & LIBSSH2_SFTP_EXT_COPY_DATA)) {
+		return libssh2_sftp_extension_missing(sftp, "Server does not support copy-data");
+	}
+	/* Anything still queued for either file has to land before the server copies from one over the other,
+	 * and a write that already failed should be reported rather than copied past
+	 */
+	if ((src->handle_type == LIBSSH2_SFTP_HANDLE_FILE) && (src->u.file.write_count || src->u.file.write_errno) &&
+		libssh2_sftp_write_flush(src, NULL)) {
+		return -1;
+	}
+	if ((dest != src) && (dest->handle_type == LIBSSH2_SFTP_HANDLE_FILE) && (dest->u.file.write_count || dest->u.file.write_errno) &&
+		libssh2_sftp_write_flush(dest, NULL)) {
+		return -1;
+	}
+
+	s = payload = LIBSSH2_ALLOC(session, payload_len);
+	if (!payload) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for copy-data request", 0);
+		return -1;
+	}
+	libssh2_htonu32(s, src->handle_len);				s += 4;
+	memcpy(s, src->handle, src->handle_len);			s += src->handle_len;
+	libssh2_htonu64(s, src_offset);						s += 8;
+	libssh2_htonu64(s, len);							s += 8;
+	libssh2_htonu32(s, dest->handle_len);				s += 4;
+	memcpy(s, dest->handle, dest->handle_len);			s += dest->handle_len;
+	libssh2_htonu64(s, dest_offset);					s += 8;
+
+	retcode = libssh2_sftp_extended_status(sftp, "copy-data", payload, payload_len);
+	LIBSSH2_FREE(session, payload);
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_copy_file_ex
+ * Duplicate a file on the server, using copy-file or failing that copy-data between two handles
+ */
+LIBSSH2_API int libssh2_sftp_copy_file_ex(LIBSSH2_SFTP *sftp, const char *source_filename, unsigned int source_filename_len,
+															const char *dest_filename, unsigned int dest_filename_len, int overwrite)
+{
+	if (!sftp)
+	{
+		return -1;
+	}
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	LIBSSH2_SFTP_HANDLE *src, *dest;
+	LIBSSH2_SFTP_ATTRIBUTES attrs;
+	int retcode;
+
+	if (sftp->extensions & LIBSSH2_SFTP_EXT_COPY_FILE) {
+		unsigned long payload_len = source_filename_len + dest_filename_len + 9; /* source_len(4) + dest_len(4) + overwrite(1) */
+		unsigned char *payload, *s;
+
+		s = payload = LIBSSH2_ALLOC(session, payload_len);
+		if (!payload) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for copy-file request", 0);
+			return -1;
+		}
+		libssh2_htonu32(s, source_filename_len);			s += 4;
+		memcpy(s, source_filename, source_filename_len);	s += source_filename_len;
+		libssh2_htonu32(s, dest_filename_len);				s += 4;
+		memcpy(s, dest_filename, dest_filename_len);		s += dest_filename_len;
+		*(s++) = overwrite ? 1 : 0;
+
+		retcode = libssh2_sftp_extended_status(sftp, "copy-file", payload, payload_len);
+		LIBSSH2_FREE(session, payload);
+
+		return retcode;
+	}
+
+	if (!(sftp->extensions & LIBSSH2_SFTP_EXT_COPY_DATA)) {
+		return libssh2_sftp_extension_missing(sftp, "Server supports neither copy-file nor copy-data");
+	}
+
+	src = libssh2_sftp_open_ex(sftp, (char *)source_filename, source_filename_len, LIBSSH2_FXF_READ, 0, LIBSSH2_SFTP_OPENFILE);
+	if (!src) {
+		return -1;
+	}
+	if (libssh2_sftp_fstat(src, &attrs)) {
+		libssh2_sftp_close_handle(src);
+		return -1;
+	}
+	dest = libssh2_sftp_open_ex(sftp, (char *)dest_filename, dest_filename_len,
+								LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC | (overwrite ? 0 : LIBSSH2_FXF_EXCL),
+								(attrs.flags & LIBSSH2_SFTP_ATTR_PERMISSIONS) ? (attrs.permissions & 07777) : 0644, LIBSSH2_SFTP_OPENFILE);
+	if (!dest) {
+		libssh2_sftp_close_handle(src);
+		return -1;
+	}
+
+	retcode = libssh2_sftp_copy_data(src, 0, 0, dest, 0);
+
+	libssh2_sftp_close_handle(src);
+	if (libssh2_sftp_close_handle(dest)) {
+		retcode = -1;
+	}
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_check_file
+ * Common body of check-file-handle and check-file-name, target is the already encoded handle or filename string
+ * Returns the number of hash bytes placed in hashes (the full count is returned even if hashes_maxlen truncated them)
+ */
+static int libssh2_sftp_check_file(LIBSSH2_SFTP *sftp, const char *request, const unsigned char *target, unsigned long target_len,
+									const char *algorithms, libssh2_uint64_t offset, libssh2_uint64_t length, unsigned long block_size,
+									char *algorithm, size_t algorithm_maxlen, unsigned char *hashes, size_t hashes_maxlen)
+{
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned long algorithms_len = strlen(algorithms);
+	unsigned long payload_len = target_len + algorithms_len + 28; /* target_len(4) + algorithms_len(4) + offset(8) + length(8) + block_size(4) */
+	unsigned long data_len, name_len, algorithm_len, hash_len;
+	unsigned char *payload, *s, *data, *end;
+
+	s = payload = LIBSSH2_ALLOC(session, payload_len);
+	if (!payload) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for check-file request", 0);
+		return -1;
+	}
+	libssh2_htonu32(s, target_len);						s += 4;
+	memcpy(s, target, target_len);						s += target_len;
+	libssh2_htonu32(s, algorithms_len);					s += 4;
+	memcpy(s, algorithms, algorithms_len);				s += algorithms_len;
+	libssh2_htonu64(s, offset);							s += 8;
+	libssh2_htonu64(s, length);							s += 8;
+	libssh2_htonu32(s, block_size);						s += 4;
+
+	if (libssh2_sftp_extended(sftp, request, payload, payload_len, &data, &data_len)) {
+		LIBSSH2_FREE(session, payload);
+		return -1;
+	}
+	LIBSSH2_FREE(session, payload);
+
+	if (data[0] == SSH_FXP_STATUS) {
+		sftp->last_errno = libssh2_ntohu32(data + 5);
+		LIBSSH2_FREE(session, data);
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP Protocol Error", 0);
+		return -1;
+	}
+
+	/* packet_type(1) + request_id(4) + string "check-file" + string hash-algorithm + hashes */
+	s = data + 5;
+	end = data + data_len;
+	name_len = ((s + 4) <= end) ? libssh2_ntohu32(s) : 0;
+	if ((s + 4 + name_len + 4) > end) {
+		LIBSSH2_FREE(session, data);
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "Invalid check-file response", 0);
+		return -1;
+	}
+	s += 4 + name_len;
+	algorithm_len = libssh2_ntohu32(s);					s += 4;
+	if ((s + algorithm_len) > end) {
+		LIBSSH2_FREE(session, data);
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "Invalid check-file response", 0);
+		return -1;
+	}
+	if (algorithm && algorithm_maxlen) {
+		unsigned long copy_len = (algorithm_len < algorithm_maxlen) ? algorithm_len : (algorithm_maxlen - 1);
+
+		memcpy(algorithm, s, copy_len);
+		algorithm[copy_len] = '\0';
+	}
+	s += algorithm_len;
+
+	hash_len = end - s;
+	memcpy(hashes, s, (hash_len < hashes_maxlen) ? hash_len : hashes_maxlen);
+	LIBSSH2_FREE(session, data);
+
+	return hash_len;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_check_file_handle
+ * Have the server hash a range of an open file, one hash per block_size bytes (0 for a single hash of the whole range)
+ * algorithms is a comma separated preference list, e.g. "sha256,sha1,md5", the one used comes back in algorithm
+ */
+LIBSSH2_API int libssh2_sftp_check_file_handle(LIBSSH2_SFTP_HANDLE *handle, const char *algorithms, libssh2_uint64_t offset, libssh2_uint64_t length,
+												unsigned long block_size, char *algorithm, size_t algorithm_maxlen, unsigned char *hashes, size_t hashes_maxlen)
+{
+	if (!handle)
+	{
+		return -1;
+	}
+	LIBSSH2_SFTP *sftp = handle->sftp;
+
+	if (!(sftp->extensions & LIBSSH2_SFTP_EXT_CHECK_FILE_HANDLE)) {
+		return libssh2_sftp_extension_missing(sftp, "Server does not support check-file-handle");
+	}
+	/* Hash what's really on the server, not what it's still to be sent */
+	if ((handle->handle_type == LIBSSH2_SFTP_HANDLE_FILE) && (handle->u.file.write_count || handle->u.file.write_errno) &&
+		libssh2_sftp_write_flush(handle, NULL)) {
+		return -1;
+	}
+
+	return libssh2_sftp_check_file(sftp, "check-file-handle", (unsigned char *)handle->handle, handle->handle_len,
+									algorithms, offset, length, block_size, algorithm, algorithm_maxlen, hashes, hashes_maxlen);
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_check_file_name_ex
+ * libssh2_sftp_check_file_handle() by path, opening the file to use check-file-handle if check-file-name isn't offered
+ */
+LIBSSH2_API int libssh2_sftp_check_file_name_ex(LIBSSH2_SFTP *sftp, const char *path, unsigned int path_len, const char *algorithms,
+												libssh2_uint64_t offset, libssh2_uint64_t length, unsigned long block_size,
+												char *algorithm, size_t algorithm_maxlen, unsigned char *hashes, size_t hashes_maxlen)
+{
+	if (!sftp)
+	{
+		return -1;
+	}
+	LIBSSH2_SFTP_HANDLE *handle;
+	int retcode;
+
+	if (sftp->extensions & LIBSSH2_SFTP_EXT_CHECK_FILE_NAME) {
+		return libssh2_sftp_check_file(sftp, "check-file-name", (const unsigned char *)path, path_len,
+										algorithms, offset, length, block_size, algorithm, algorithm_maxlen, hashes, hashes_maxlen);
+	}
+	if (!(sftp->extensions & LIBSSH2_SFTP_EXT_CHECK_FILE_HANDLE)) {
+		return libssh2_sftp_extension_missing(sftp, "Server supports neither check-file-name nor check-file-handle");
+	}
+
+	handle = libssh2_sftp_open_ex(sftp, (char *)path, path_len, LIBSSH2_FXF_READ, 0, LIBSSH2_SFTP_OPENFILE);
+	if (!handle) {
+		return -1;
+	}
+	retcode = libssh2_sftp_check_file_handle(handle, algorithms, offset, length, block_size, algorithm, algorithm_maxlen, hashes, hashes_maxlen);
+	libssh2_sftp_close_handle(handle);
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_posix_rename_ex
+ * Rename with POSIX rename(2) semantics, atomically replacing any existing destination
+ * Without posix-rename@openssh.com this is a plain FXP_RENAME, which most version 3 servers refuse if the destination exists
+ */
+LIBSSH2_API int libssh2_sftp_posix_rename_ex(LIBSSH2_SFTP *sftp, const char *source_filename, unsigned int source_filename_len,
+																const char *dest_filename, unsigned int dest_filename_len)
+{
+	if (!sftp)
+	{
+		return -1;
+	}
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned long payload_len = source_filename_len + dest_filename_len + 8; /* source_len(4) + dest_len(4) */
+	unsigned char *payload, *s;
+	int retcode;
+
+	if (!(sftp->extensions & LIBSSH2_SFTP_EXT_POSIX_RENAME)) {
+		return libssh2_sftp_rename_ex(sftp, (char *)source_filename, source_filename_len, (char *)dest_filename, dest_filename_len,
+										LIBSSH2_SFTP_RENAME_OVERWRITE | LIBSSH2_SFTP_RENAME_ATOMIC | LIBSSH2_SFTP_RENAME_NATIVE);
+	}
+
+	s = payload = LIBSSH2_ALLOC(session, payload_len);
+	if (!payload) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for posix-rename request", 0);
+		return -1;
+	}
+	libssh2_htonu32(s, source_filename_len);			s += 4;
+	memcpy(s, source_filename, source_filename_len);	s += source_filename_len;
+	libssh2_htonu32(s, dest_filename_len);				s += 4;
+	memcpy(s, dest_filename, dest_filename_len);		s += dest_filename_len;
+
+	retcode = libssh2_sftp_extended_status(sftp, "posix-rename@openssh.com", payload, payload_len);
+	LIBSSH2_FREE(session, payload);
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_statvfs_reply
+ * Decode the statvfs@openssh.com / fstatvfs@openssh.com reply, eleven uint64s
+ */
+static int libssh2_sftp_statvfs_reply(LIBSSH2_SFTP *sftp, const char *request, const unsigned char *payload, unsigned long payload_len, LIBSSH2_SFTP_STATVFS *st)
+{
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned long data_len;
+	unsigned char *data, *s;
+
+	if (libssh2_sftp_extended(sftp, request, payload, payload_len, &data, &data_len)) {
+		return -1;
+	}
+	if (data[0] == SSH_FXP_STATUS) {
+		sftp->last_errno = libssh2_ntohu32(data + 5);
+		LIBSSH2_FREE(session, data);
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP Protocol Error", 0);
+		return -1;
+	}
+	if (data_len < (5 + 11 * 8)) {
+		LIBSSH2_FREE(session, data);
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "Invalid statvfs response", 0);
+		return -1;
+	}
+
+	s = data + 5;
+	st->f_bsize = libssh2_ntohu64(s);					s += 8;
+	st->f_frsize = libssh2_ntohu64(s);					s += 8;
+	st->f_blocks = libssh2_ntohu64(s);					s += 8;
+	st->f_bfree = libssh2_ntohu64(s);					s += 8;
+	st->f_bavail = libssh2_ntohu64(s);					s += 8;
+	st->f_files = libssh2_ntohu64(s);					s += 8;
+	st->f_ffree = libssh2_ntohu64(s);					s += 8;
+	st->f_favail = libssh2_ntohu64(s);					s += 8;
+	st->f_fsid = libssh2_ntohu64(s);					s += 8;
+	st->f_flag = libssh2_ntohu64(s);					s += 8;
+	st->f_namemax = libssh2_ntohu64(s);					s += 8;
+	LIBSSH2_FREE(session, data);
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_statvfs_ex
+ * Free space and limits of the filesystem holding path
+ */
+LIBSSH2_API int libssh2_sftp_statvfs_ex(LIBSSH2_SFTP *sftp, const char *path, unsigned int path_len, LIBSSH2_SFTP_STATVFS *st)
+{
+	if (!sftp)
+	{
+		return -1;
+	}
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned char *payload;
+	int retcode;
+
+	if (!(sftp->extensions & LIBSSH2_SFTP_EXT_STATVFS)) {
+		return libssh2_sftp_extension_missing(sftp, "Server does not support statvfs@openssh.com");
+	}
+
+	payload = LIBSSH2_ALLOC(session, path_len + 4);
+	if (!payload) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for statvfs request", 0);
+		return -1;
+	}
+	libssh2_htonu32(payload, path_len);
+	memcpy(payload + 4, path, path_len);
+
+	retcode = libssh2_sftp_statvfs_reply(sftp, "statvfs@openssh.com", payload, path_len + 4, st);
+	LIBSSH2_FREE(session, payload);
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_fstatvfs
+ * libssh2_sftp_statvfs() for an open handle
+ */
+LIBSSH2_API int libssh2_sftp_fstatvfs(LIBSSH2_SFTP_HANDLE *handle, LIBSSH2_SFTP_STATVFS *st)
+{
+	if (!handle)
+	{
+		return -1;
+	}
+	LIBSSH2_SFTP	*sftp	 = handle->sftp;
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned char *payload;
+	int retcode;
+
+	if (!(sftp->extensions & LIBSSH2_SFTP_EXT_FSTATVFS)) {
+		return libssh2_sftp_extension_missing(sftp, "Server does not support fstatvfs@openssh.com");
+	}
+
+	payload = LIBSSH2_ALLOC(session, handle->handle_len + 4);
+	if (!payload) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for fstatvfs request", 0);
+		return -1;
+	}
+	libssh2_htonu32(payload, handle->handle_len);
+	memcpy(payload + 4, handle->handle, handle->handle_len);
+
+	retcode = libssh2_sftp_statvfs_reply(sftp, "fstatvfs@openssh.com", payload, handle->handle_len + 4, st);
+	LIBSSH2_FREE(session, payload);
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_fsync
+ * Ask the server to commit an open file to stable storage, after any pipelined writes have been acknowledged
+ */
+LIBSSH2_API int libssh2_sftp_fsync(LIBSSH2_SFTP_HANDLE *handle)
+{
+	if (!handle)
+	{
+		return -1;
+	}
+	LIBSSH2_SFTP	*sftp	 = handle->sftp;
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	unsigned char *payload;
+	int retcode;
+
+	if ((handle->handle_type == LIBSSH2_SFTP_HANDLE_FILE) && (handle->u.file.write_count || handle->u.file.write_errno) &&
+		libssh2_sftp_write_flush(handle, NULL)) {
+		return -1;
+	}
+	if (!(sftp->extensions & LIBSSH2_SFTP_EXT_FSYNC)) {
+		return libssh2_sftp_extension_missing(sftp, "Server does not support fsync@openssh.com");
+	}
+
+	payload = LIBSSH2_ALLOC(session, handle->handle_len + 4);
+	if (!payload) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate memory for fsync request", 0);
+		return -1;
+	}
+	libssh2_htonu32(payload, handle->handle_len);
+	memcpy(payload + 4, handle->handle, handle->handle_len);
+
+	retcode = libssh2_sftp_extended_status(sftp, "fsync@openssh.com", payload, handle->handle_len + 4);
+	LIBSSH2_FREE(session, payload);
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_last_error
+ * Returns the last error code reported by SFTP
+ */
+LIBSSH2_API unsigned long libssh2_sftp_last_error(LIBSSH2_SFTP *sftp)
+{
+	if (!sftp)
+	{
+		return -1;
+	}
+	return sftp->last_errno;
+}
+/* }}} */
+
+/* ***************
+   * SFTP Groups *
+   *************** */
+
+/* A part of the file an SFTP group transfer still has to move */
+typedef struct _libssh2_sftp_range {
+	libssh2_uint64_t offset, end;
+} libssh2_sftp_range;
+
+/* One "sftp" channel of a group, and the stripe it's working through during a transfer */
+typedef struct _libssh2_sftp_group_channel {
+	LIBSSH2_SFTP *sftp; /* NULL once the channel has failed */
+	LIBSSH2_SFTP_HANDLE *handle;
+
+	/* Ring of up to group->window outstanding FXP_READ or FXP_WRITE requests */
+	libssh2_sftp_request *requests;
+	unsigned long head, count;
+
+	/* What's left of the current stripe, not yet requested */
+	libssh2_uint64_t offset, end;
+
+	/* Took an SFTP error, so gets no more work this transfer; its outstanding requests are still collected */
+	int excluded;
+} libssh2_sftp_group_channel;
+
+struct _LIBSSH2_SFTP_GROUP {
+	LIBSSH2_SESSION *session;
+
+	libssh2_sftp_group_channel *members;
+	unsigned int member_count;
+
+	unsigned long stripe_len;
+	unsigned int window;
+
+	/* Current transfer -- the untouched remainder of the file, and ranges handed back by failed members */
+	libssh2_uint64_t next_offset, end;
+	libssh2_sftp_range *retries;
+	unsigned long retry_count, retry_size;
+	unsigned char *write_packet;
+
+	unsigned long last_errno;
+	unsigned long retries_total;
+};
+
+/* {{{ libssh2_sftp_group_init
+ * Open up to channels "sftp" subsystems on one session
+ * Servers cap the channels a session may have open (OpenSSH's MaxSessions), so a group keeps however many it got
+ */
+LIBSSH2_API LIBSSH2_SFTP_GROUP *libssh2_sftp_group_init(LIBSSH2_SESSION *session, unsigned int channels)
+{
+	if (!session || !channels)
+	{
+		return NULL;
+	}
+	LIBSSH2_SFTP_GROUP *group;
+	unsigned int i;
+
+	group = LIBSSH2_ALLOC(session, sizeof(LIBSSH2_SFTP_GROUP));
+	if (!group) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate SFTP group", 0);
+		return NULL;
+	}
+	memset(group, 0, sizeof(LIBSSH2_SFTP_GROUP));
+	group->session = session;
+	group->stripe_len = LIBSSH2_SFTP_GROUP_STRIPE_DEFAULT;
+	group->window = LIBSSH2_SFTP_GROUP_WINDOW_DEFAULT;
+
+	group->members = LIBSSH2_ALLOC(session, channels * sizeof(libssh2_sftp_group_channel));
+	if (!group->members) {
+		libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate SFTP group members", 0);
+		LIBSSH2_FREE(session, group);
+		return NULL;
+	}
+	memset(group->members, 0, channels * sizeof(libssh2_sftp_group_channel));
+
+	for(i = 0; i < channels; i++) {
+		group->members[i].sftp = libssh2_sftp_init(session);
+		if (!group->members[i].sftp) {
+			break;
+		}
+		group->member_count++;
+	}
+
+	if (!group->member_count) {
+		/* libssh2_sftp_init() has already said why */
+		LIBSSH2_FREE(session, group->members);
+		LIBSSH2_FREE(session, group);
+		return NULL;
+	}
+
+#ifdef LIBSSH2_DEBUG_SFTP
+	_libssh2_debug(session, LIBSSH2_DBG_SFTP, "Opened %u of %u SFTP group channels", group->member_count, channels);
+#endif
+	return group;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_shutdown
+ * Close every channel in the group
+ */
+LIBSSH2_API int libssh2_sftp_group_shutdown(LIBSSH2_SFTP_GROUP *group)
+{
+	if (!group)
+	{
+		return -1;
+	}
+	LIBSSH2_SESSION *session = group->session;
+	unsigned int i;
+	int retcode = 0;
+
+	for(i = 0; i < group->member_count; i++) {
+		if (group->members[i].sftp && libssh2_sftp_shutdown(group->members[i].sftp)) {
+			retcode = -1;
+		}
+	}
+
+	LIBSSH2_FREE(session, group->members);
+	LIBSSH2_FREE(session, group);
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_channels
+ * Number of channels still usable
+ */
+LIBSSH2_API unsigned int libssh2_sftp_group_channels(LIBSSH2_SFTP_GROUP *group)
+{
+	unsigned int i, live = 0;
+
+	if (!group)
+	{
+		return 0;
+	}
+	for(i = 0; i < group->member_count; i++) {
+		if (group->members[i].sftp) {
+			live++;
+		}
+	}
+
+	return live;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_member
+ * The index'th usable channel, for metadata operations or for moving a whole file per channel
+ * Must not be shut down by the caller, and should not be used while a group transfer is running
+ */
+LIBSSH2_API LIBSSH2_SFTP *libssh2_sftp_group_member(LIBSSH2_SFTP_GROUP *group, unsigned int index)
+{
+	unsigned int i;
+
+	if (!group)
+	{
+		return NULL;
+	}
+	for(i = 0; i < group->member_count; i++) {
+		if (group->members[i].sftp && (index-- == 0)) {
+			return group->members[i].sftp;
+		}
+	}
+
+	return NULL;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_stripe
+ * How much of a file each channel takes on at a time, and how many requests each keeps in flight
+ * Zero for either restores the default
+ */
+LIBSSH2_API void libssh2_sftp_group_stripe(LIBSSH2_SFTP_GROUP *group, unsigned long stripe_len, unsigned int window)
+{
+	if (!group)
+	{
+		return;
+	}
+	group->stripe_len = stripe_len ? stripe_len : LIBSSH2_SFTP_GROUP_STRIPE_DEFAULT;
+	group->window = window ? window : LIBSSH2_SFTP_GROUP_WINDOW_DEFAULT;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_requeue
+ * Hand a range back so another member picks it up
+ */
+static int libssh2_sftp_group_requeue(LIBSSH2_SFTP_GROUP *group, libssh2_uint64_t offset, libssh2_uint64_t end)
+{
+	LIBSSH2_SESSION *session = group->session;
+
+	if (offset >= end) {
+		return 0;
+	}
+
+	if (group->retry_count == group->retry_size) {
+		unsigned long retry_size = group->retry_size ? (group->retry_size * 2) : 16;
+		libssh2_sftp_range *retries;
+
+		retries = group->retries ? LIBSSH2_REALLOC(session, group->retries, retry_size * sizeof(libssh2_sftp_range)) :
+								   LIBSSH2_ALLOC(session, retry_size * sizeof(libssh2_sftp_range));
+		if (!retries) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate SFTP group retry list", 0);
+			return -1;
+		}
+		group->retries = retries;
+		group->retry_size = retry_size;
+	}
+
+	group->retries[group->retry_count].offset = offset;
+	group->retries[group->retry_count].end = end;
+	group->retry_count++;
+	group->retries_total++;
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_next_stripe
+ * Give a member its next stripe, retries first
+ * Returns 0 once there's nothing left to hand out
+ */
+static int libssh2_sftp_group_next_stripe(LIBSSH2_SFTP_GROUP *group, libssh2_sftp_group_channel *member)
+{
+	while (group->retry_count) {
+		libssh2_sftp_range *range = &group->retries[--group->retry_count];
+
+		/* An EOF may have cut the file short since this was queued */
+		if (range->offset < group->end) {
+			member->offset = range->offset;
+			member->end = (range->end < group->end) ? range->end : group->end;
+			return 1;
+		}
+	}
+
+	if (group->next_offset < group->end) {
+		member->offset = group->next_offset;
+		member->end = ((group->end - group->next_offset) > group->stripe_len) ? (group->next_offset + group->stripe_len) : group->end;
+		group->next_offset = member->end;
+		return 1;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_pending
+ * Whether any of the file is still to be requested, ignoring retries an EOF has made moot
+ */
+static int libssh2_sftp_group_pending(LIBSSH2_SFTP_GROUP *group)
+{
+	unsigned long i = 0;
+
+	while (i < group->retry_count) {
+		if (group->retries[i].offset >= group->end) {
+			group->retries[i] = group->retries[--group->retry_count];
+		} else {
+			i++;
+		}
+	}
+
+	return group->retry_count || (group->next_offset < group->end);
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_send
+ * Top up a member's requests from its stripe
+ * Returns -1 if the channel failed, -2 if the source callback abandoned the transfer
+ */
+static int libssh2_sftp_group_send(LIBSSH2_SFTP_GROUP *group, libssh2_sftp_group_channel *member, int upload,
+								   LIBSSH2_SFTP_STRIPE_FUNC((*func)), void **abstract)
+{
+	LIBSSH2_SFTP_HANDLE *handle = member->handle;
+	LIBSSH2_CHANNEL *channel = member->sftp->channel;
+	LIBSSH2_SESSION *session = group->session;
+	unsigned char read_packet[256 + 25];
+	unsigned char *packet = upload ? group->write_packet : read_packet;
+
+	while (!member->excluded && (member->count < group->window)) {
+		libssh2_sftp_request *request;
+		unsigned long chunk_max = upload ? LIBSSH2_SFTP_WRITE_CHUNK_MAX : LIBSSH2_SFTP_READ_CHUNK_MAX;
+		unsigned long packet_len;
+		unsigned char *s = packet;
+
+		if (member->end > group->end) {
+			member->end = group->end;
+		}
+		if ((member->offset >= member->end) && !libssh2_sftp_group_next_stripe(group, member)) {
+			break;
+		}
+
+		request = &member->requests[(member->head + member->count) % group->window];
+		request->request_id = member->sftp->request_id++;
+		request->offset = member->offset;
+		request->len = ((member->end - member->offset) > chunk_max) ? chunk_max : (member->end - member->offset);
+		packet_len = handle->handle_len + 25 + (upload ? request->len : 0);
+					/* packet_len(4) + packet_type(1) + request_id(4) + handle_len(4) + offset(8) + length(4) */
+
+		libssh2_htonu32(s, packet_len - 4);					s += 4;
+		*(s++) = upload ? SSH_FXP_WRITE : SSH_FXP_READ;
+		libssh2_htonu32(s, request->request_id);			s += 4;
+		libssh2_htonu32(s, handle->handle_len);				s += 4;
+		memcpy(s, handle->handle, handle->handle_len);		s += handle->handle_len;
+		libssh2_htonu64(s, request->offset);				s += 8;
+		libssh2_htonu32(s, request->len);					s += 4;
+		if (upload && func(request->offset, (char *)s, request->len, abstract)) {
+			return -2;
+		}
+
+		if (packet_len != libssh2_channel_write(channel, packet, packet_len)) {
+			libssh2_error(session, LIBSSH2_ERROR_SOCKET_SEND, upload ? "Unable to send FXP_WRITE command" : "Unable to send FXP_READ command", 0);
+			return -1;
+		}
+
+		member->count++;
+		member->offset += request->len;
+	}
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_exclude
+ * Stop handing a member work for the rest of this transfer, returning its unrequested stripe
+ */
+static int libssh2_sftp_group_exclude(LIBSSH2_SFTP_GROUP *group, libssh2_sftp_group_channel *member, unsigned long status)
+{
+#ifdef LIBSSH2_DEBUG_SFTP
+	_libssh2_debug(group->session, LIBSSH2_DBG_SFTP, "SFTP group member failed with status %lu, retrying its stripe elsewhere", status);
+#endif
+	group->last_errno = status;
+	member->excluded = 1;
+	if (libssh2_sftp_group_requeue(group, member->offset, member->end)) {
+		return -1;
+	}
+	member->offset = member->end = 0;
+
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_drop
+ * A member's channel has failed, give everything it held back and close it
+ * The handle goes with the channel, there's no way left to send FXP_CLOSE for it, so it's released
+ * (unlinked, its request rings freed) before the shutdown rather than left for the dtor to try closing
+ */
+static int libssh2_sftp_group_drop(LIBSSH2_SFTP_GROUP *group, libssh2_sftp_group_channel *member)
+{
+	int retcode = 0;
+
+#ifdef LIBSSH2_DEBUG_SFTP
+	_libssh2_debug(group->session, LIBSSH2_DBG_SFTP, "SFTP group channel failed with %lu requests outstanding", member->count);
+#endif
+	while (member->count) {
+		libssh2_sftp_request *request = &member->requests[member->head];
+
+		if (libssh2_sftp_group_requeue(group, request->offset, request->offset + request->len)) {
+			retcode = -1;
+		}
+		member->head = (member->head + 1) % group->window;
+		member->count--;
+	}
+	if (libssh2_sftp_group_requeue(group, member->offset, member->end)) {
+		retcode = -1;
+	}
+
+	if (member->handle) {
+		libssh2_sftp_handle_release(member->handle);
+		member->handle = NULL;
+	}
+	libssh2_sftp_shutdown(member->sftp);
+	member->sftp = NULL;
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_collect
+ * Deal with the reply to a member's oldest request
+ * Returns -1 if the channel failed, -2 if the sink callback abandoned the transfer, -3 on allocation failure
+ */
+static int libssh2_sftp_group_collect(LIBSSH2_SFTP_GROUP *group, libssh2_sftp_group_channel *member, int upload, int discard,
+									  LIBSSH2_SFTP_STRIPE_FUNC((*func)), void **abstract)
+{
+	LIBSSH2_SESSION *session = group->session;
+	unsigned char responses[2] = { SSH_FXP_STATUS,		SSH_FXP_DATA };
+	libssh2_sftp_request request = member->requests[member->head];
+	unsigned char *data;
+	unsigned long data_len, status;
+
+	if (libssh2_sftp_packet_requirev(member->sftp, upload ? 1 : 2, responses, request.request_id, &data, &data_len)) {
+		libssh2_error(session, LIBSSH2_ERROR_SOCKET_TIMEOUT, "Timeout waiting for status message", 0);
+		return -1;
+	}
+	member->head = (member->head + 1) % group->window;
+	member->count--;
+
+	if (discard) {
+		LIBSSH2_FREE(session, data);
+		return 0;
+	}
+
+	if (data[0] == SSH_FXP_DATA) {
+		unsigned long len = (data_len >= 9) ? libssh2_ntohu32(data + 5) : 0;
+		int abandon;
+
+		if (!len || (len > data_len - 9) || (len > request.len)) {
+			LIBSSH2_FREE(session, data);
+			if (libssh2_sftp_group_requeue(group, request.offset, request.offset + request.len) ||
+				libssh2_sftp_group_exclude(group, member, LIBSSH2_FX_BAD_MESSAGE)) {
+				return -3;
+			}
+			return 0;
+		}
+
+		abandon = func(request.offset, (char *)data + 9, len, abstract);
+		LIBSSH2_FREE(session, data);
+		if (abandon) {
+			return -2;
+		}
+
+		/* Servers may return less than asked for without being at EOF */
+		if ((len < request.len) && libssh2_sftp_group_requeue(group, request.offset + len, request.offset + request.len)) {
+			return -3;
+		}
+		return 0;
+	}
+
+	status = (data_len >= 9) ? libssh2_ntohu32(data + 5) : LIBSSH2_FX_BAD_MESSAGE;
+	LIBSSH2_FREE(session, data);
+
+	if (status == LIBSSH2_FX_OK) {
+		return 0;
+	}
+	if (!upload && (status == LIBSSH2_FX_EOF)) {
+		/* File is shorter than we were told, nothing at or past here is coming */
+		if (request.offset < group->end) {
+			group->end = request.offset;
+		}
+		return 0;
+	}
+
+	if (libssh2_sftp_group_requeue(group, request.offset, request.offset + request.len) ||
+		(!member->excluded && libssh2_sftp_group_exclude(group, member, status))) {
+		return -3;
+	}
+	return 0;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_transfer
+ * Stripe offset..offset+length of path across every member of the group
+ */
+static int libssh2_sftp_group_transfer(LIBSSH2_SFTP_GROUP *group, const char *path, unsigned int path_len, int upload, long mode,
+									   libssh2_uint64_t offset, libssh2_uint64_t length,
+									   LIBSSH2_SFTP_STRIPE_FUNC((*func)), void *abstract)
+{
+	LIBSSH2_SESSION *session = group->session;
+	unsigned int i, opened = 0;
+	int retcode = 0, abandoned = 0;
+
+	group->last_errno = LIBSSH2_FX_OK;
+	group->retry_count = 0;
+
+	/* Every member gets its own handle; an upload has to create/truncate the file once, before anyone else opens it */
+	for(i = 0; i < group->member_count; i++) {
+		libssh2_sftp_group_channel *member = &group->members[i];
+		unsigned long flags = upload ? (LIBSSH2_FXF_WRITE | (opened ? 0 : (LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC))) : LIBSSH2_FXF_READ;
+
+		member->handle = NULL;
+		member->head = member->count = 0;
+		member->offset = member->end = 0;
+		member->excluded = 1;
+		if (!member->sftp) {
+			continue;
+		}
+
+		member->requests = LIBSSH2_ALLOC(session, group->window * sizeof(libssh2_sftp_request));
+		if (!member->requests) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate SFTP group request ring", 0);
+			retcode = -1;
+			break;
+		}
+
+		member->handle = libssh2_sftp_open_ex(member->sftp, (char *)path, path_len, flags, mode, LIBSSH2_SFTP_OPENFILE);
+		if (!member->handle) {
+			group->last_errno = member->sftp->last_errno;
+			if (upload && !opened) {
+				/* Couldn't create it, the others won't fare any better */
+				break;
+			}
+			continue;
+		}
+		member->excluded = 0;
+		opened++;
+	}
+
+	if (!opened) {
+		retcode = -1;
+	}
+
+	if (!retcode && upload) {
+		group->write_packet = LIBSSH2_ALLOC(session, 256 + 25 + LIBSSH2_SFTP_WRITE_CHUNK_MAX);
+		if (!group->write_packet) {
+			libssh2_error(session, LIBSSH2_ERROR_ALLOC, "Unable to allocate SFTP group write buffer", 0);
+			retcode = -1;
+		}
+	}
+
+	if (!retcode && !upload && !length) {
+		LIBSSH2_SFTP_ATTRIBUTES attrs;
+
+		for(i = 0; group->members[i].excluded; i++);
+		if (libssh2_sftp_fstat(group->members[i].handle, &attrs)) {
+			group->last_errno = group->members[i].sftp->last_errno;
+			retcode = -1;
+		} else if (!(attrs.flags & LIBSSH2_SFTP_ATTR_SIZE)) {
+			libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "Server did not report the size of the file", 0);
+			retcode = -1;
+		} else {
+			length = (attrs.filesize > offset) ? (attrs.filesize - offset) : 0;
+		}
+	}
+
+	group->next_offset = offset;
+	group->end = offset + length;
+
+	while (!retcode) {
+		int busy = 0, usable = 0;
+
+		for(i = 0; i < group->member_count; i++) {
+			libssh2_sftp_group_channel *member = &group->members[i];
+			int rc;
+
+			if (!member->sftp || !member->handle) {
+				continue;
+			}
+			rc = libssh2_sftp_group_send(group, member, upload, func, &abstract);
+			if (rc == -2) {
+				abandoned = 1;
+				break;
+			}
+			if ((rc == -1) && libssh2_sftp_group_drop(group, member)) {
+				retcode = -1;
+				break;
+			}
+			if (member->sftp && !member->excluded) {
+				usable++;
+			}
+			if (member->sftp && member->count) {
+				busy++;
+			}
+		}
+		if (abandoned || retcode) {
+			break;
+		}
+		if (!busy) {
+			if (!libssh2_sftp_group_pending(group)) {
+				break;
+			}
+			if (!usable) {
+				libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "Every channel in the SFTP group failed", 0);
+				retcode = -1;
+				break;
+			}
+			/* A member dropped after the others had looked for work, they'll pick up its ranges next time round */
+			continue;
+		}
+
+		for(i = 0; i < group->member_count; i++) {
+			libssh2_sftp_group_channel *member = &group->members[i];
+			int rc;
+
+			if (!member->sftp || !member->count) {
+				continue;
+			}
+			rc = libssh2_sftp_group_collect(group, member, upload, 0, func, &abstract);
+			if (rc == -2) {
+				abandoned = 1;
+				break;
+			}
+			if (rc == -3) {
+				retcode = -1;
+				break;
+			}
+			if ((rc == -1) && libssh2_sftp_group_drop(group, member)) {
+				retcode = -1;
+				break;
+			}
+		}
+	}
+
+	if (abandoned) {
+		libssh2_error(session, LIBSSH2_ERROR_SFTP_PROTOCOL, "SFTP group transfer abandoned by callback", 0);
+		retcode = -1;
+	}
+
+	/* Reap whatever's still in flight so it doesn't sit in the brigades, then close up */
+	for(i = 0; i < group->member_count; i++) {
+		libssh2_sftp_group_channel *member = &group->members[i];
+
+		while (member->sftp && member->count) {
+			if (libssh2_sftp_group_collect(group, member, upload, 1, func, &abstract) == -1) {
+				member->count = 0;
+				libssh2_sftp_group_drop(group, member);
+			}
+		}
+		if (member->sftp && member->handle && libssh2_sftp_close_handle(member->handle)) {
+			/* For an upload this is where the server reports e.g. a full disk */
+			group->last_errno = member->sftp->last_errno;
+			retcode = -1;
+		}
+		member->handle = NULL;
+		if (member->requests) {
+			LIBSSH2_FREE(session, member->requests);
+			member->requests = NULL;
+		}
+	}
+
+	if (group->write_packet) {
+		LIBSSH2_FREE(session, group->write_packet);
+		group->write_packet = NULL;
+	}
+	if (group->retries) {
+		LIBSSH2_FREE(session, group->retries);
+		group->retries = NULL;
+		group->retry_size = group->retry_count = 0;
+	}
+
+	return retcode;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_download_ex
+ * Fetch length bytes of path from offset, or the rest of the file if length is 0, handing each range to sink
+ */
+LIBSSH2_API int libssh2_sftp_group_download_ex(LIBSSH2_SFTP_GROUP *group, const char *path, unsigned int path_len,
+											   libssh2_uint64_t offset, libssh2_uint64_t length,
+											   LIBSSH2_SFTP_STRIPE_FUNC((*sink)), void *abstract)
+{
+	if (!group || !sink)
+	{
+		return -1;
+	}
+	return libssh2_sftp_group_transfer(group, path, path_len, 0, 0, offset, length, sink, abstract);
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_upload_ex
+ * Create or truncate path and write length bytes to it, asking source for each range
+ * source must be able to produce any range more than once, failed ranges are asked for again
+ */
+LIBSSH2_API int libssh2_sftp_group_upload_ex(LIBSSH2_SFTP_GROUP *group, const char *path, unsigned int path_len, long mode,
+											 libssh2_uint64_t length, LIBSSH2_SFTP_STRIPE_FUNC((*source)), void *abstract)
+{
+	if (!group || !source)
+	{
+		return -1;
+	}
+	return libssh2_sftp_group_transfer(group, path, path_len, 1, mode, 0, length, source, abstract);
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_last_error
+ * SFTP status of the last failure seen by a group transfer
+ */
+LIBSSH2_API unsigned long libssh2_sftp_group_last_error(LIBSSH2_SFTP_GROUP *group)
+{
+	if (!group)
+	{
+		return -1;
+	}
+	return group->last_errno;
+}
+/* }}} */
+
+/* {{{ libssh2_sftp_group_retries
+ * Ranges which had to be requested again, after a failure or a short read, over the life of the group
+ */
+LIBSSH2_API unsigned long libssh2_sftp_group_retries(LIBSSH2_SFTP_GROUP *group)
+{
+	if (!group)
+	{
+		return 0;
+	}
+	return group->retries_total;
 }
 /* }}} */
@@ -0,0 +1,277 @@
+/* Checks what happens to an SFTP handle when its channel fails under it
+ *
+ * Not part of the library. sftp.c is included directly to get at its static functions, so build it against
+ * the same objects, less sftp.c:
+ *   cc -I. -o sftp_group_check sftp_group_check.c <libssh2 .c files other than sftp.c> -lcrypto -lz && ./sftp_group_check
+ * Defining SFTP_SOURCE builds it against some other sftp.c instead, as with sftp_reply_bench
+ *
+ * The channels sit on a socket pair whose far end is already closed, so every FXP_CLOSE fails the way it would
+ * on a dead channel. Allocations go through a table, so a leak, a double free or a free of something never
+ * allocated is counted rather than left to the C library, and freed blocks are scribbled over first so a use
+ * after free tends to show. Anything that spins is caught by an alarm
+ */
+
+#ifndef SFTP_SOURCE
+#define SFTP_SOURCE "sftp.c"
+#endif
+#include SFTP_SOURCE
+
+#include <sys/socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define CHECK_MAX_BLOCKS	1024
+
+static int failures = 0;
+
+static struct {
+	void *ptr;
+	size_t len;
+} blocks[CHECK_MAX_BLOCKS];
+static int block_count = 0, bad_frees = 0;
+
+static void check(const char *name, int ok)
+{
+	if (ok) {
+		printf("ok   %s\n", name);
+	} else {
+		printf("FAIL %s\n", name);
+		failures++;
+	}
+}
+
+static void timed_out(int sig)
+{
+	(void)sig;
+	printf("FAIL timed out, closing handles on a dead channel went round forever\n");
+	fflush(stdout);
+	_exit(1);
+}
+
+/* {{{ Tracked allocator
+ */
+static int check_find(void *ptr)
+{
+	int i;
+
+	for(i = 0; i < block_count; i++) {
+		if (blocks[i].ptr == ptr) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static LIBSSH2_ALLOC_FUNC(check_alloc)
+{
+	void *ptr = malloc(count);
+
+	(void)abstract;
+	if (ptr && (block_count < CHECK_MAX_BLOCKS)) {
+		blocks[block_count].ptr = ptr;
+		blocks[block_count].len = count;
+		block_count++;
+	}
+	return ptr;
+}
+
+static LIBSSH2_FREE_FUNC(check_free)
+{
+	int i = check_find(ptr);
+
+	(void)abstract;
+	if (i < 0) {
+		/* Already freed, or never ours; leave it be */
+		bad_frees++;
+		return;
+	}
+	memset(ptr, 0xdd, blocks[i].len);
+	free(ptr);
+	blocks[i] = blocks[--block_count];
+}
+
+static LIBSSH2_REALLOC_FUNC(check_realloc)
+{
+	int i = check_find(ptr);
+	void *newptr;
+
+	(void)abstract;
+	if (i < 0) {
+		bad_frees++;
+		return NULL;
+	}
+	newptr = realloc(ptr, count);
+	if (newptr) {
+		blocks[i].ptr = newptr;
+		blocks[i].len = count;
+	}
+	return newptr;
+}
+/* }}} */
+
+/* {{{ check_sftp
+ * An SFTP structure on its own channel, wired up the way libssh2_sftp_init() leaves it
+ */
+static LIBSSH2_SFTP *check_sftp(LIBSSH2_SESSION *session, unsigned long id)
+{
+	LIBSSH2_CHANNEL *channel;
+	LIBSSH2_SFTP *sftp;
+
+	channel = LIBSSH2_ALLOC(session, sizeof(LIBSSH2_CHANNEL));
+	memset(channel, 0, sizeof(LIBSSH2_CHANNEL));
+	channel->session = session;
+	channel->blocking = 1;
+	channel->local.id = channel->remote.id = id;
+	channel->local.window_size = channel->local.window_size_initial = LIBSSH2_CHANNEL_WINDOW_DEFAULT;
+	channel->local.packet_size = LIBSSH2_CHANNEL_PACKET_DEFAULT;
+	channel->remote.window_size = channel->remote.window_size_initial = LIBSSH2_CHANNEL_WINDOW_DEFAULT;
+	channel->remote.packet_size = LIBSSH2_CHANNEL_PACKET_DEFAULT;
+	libssh2_channel_add(session, channel);
+
+	sftp = LIBSSH2_ALLOC(session, sizeof(LIBSSH2_SFTP));
+	memset(sftp, 0, sizeof(LIBSSH2_SFTP));
+	sftp->channel = channel;
+	channel->abstract = sftp;
+	channel->close_cb = libssh2_sftp_dtor;
+
+	return sftp;
+}
+/* }}} */
+
+/* {{{ check_handle
+ * A file handle linked in the way libssh2_sftp_open_ex() does, with read and write rings as pipelined I/O leaves them
+ */
+static LIBSSH2_SFTP_HANDLE *check_handle(LIBSSH2_SFTP *sftp)
+{
+	LIBSSH2_SESSION *session = sftp->channel->session;
+	LIBSSH2_SFTP_HANDLE *fp;
+
+	fp = LIBSSH2_ALLOC(session, sizeof(LIBSSH2_SFTP_HANDLE));
+	memset(fp, 0, sizeof(LIBSSH2_SFTP_HANDLE));
+	fp->handle_type = LIBSSH2_SFTP_HANDLE_FILE;
+	fp->handle_len = 4;
+	fp->handle = LIBSSH2_ALLOC(session, fp->handle_len);
+	memcpy(fp->handle, "h001", 4);
+
+	fp->next = sftp->handles;
+	if (fp->next) {
+		fp->next->prev = fp;
+	}
+	sftp->handles = fp;
+	fp->sftp = sftp;
+
+	fp->u.file.read_requests = LIBSSH2_ALLOC(session, 4 * sizeof(libssh2_sftp_request));
+	fp->u.file.write_requests = LIBSSH2_ALLOC(session, 4 * sizeof(libssh2_sftp_request));
+	fp->u.file.write_packet = LIBSSH2_ALLOC(session, 64);
+
+	return fp;
+}
+/* }}} */
+
+static LIBSSH2_SESSION *new_session(void)
+{
+	LIBSSH2_SESSION *session;
+	int pair[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair)) {
+		perror("socketpair");
+		exit(2);
+	}
+	/* The server's gone, but nothing's noticed yet */
+	close(pair[1]);
+
+	session = libssh2_session_init_ex(check_alloc, check_free, check_realloc, NULL);
+	session->socket_fd = pair[0];
+	session->socket_state = LIBSSH2_SOCKET_CONNECTED;
+
+	return session;
+}
+
+static void free_session(LIBSSH2_SESSION *session)
+{
+	int sock = session->socket_fd;
+
+	session->socket_state = LIBSSH2_SOCKET_DISCONNECTED;
+	libssh2_session_free(session);
+	close(sock);
+}
+
+static void check_group_drop(void)
+{
+	LIBSSH2_SESSION *session = new_session();
+	LIBSSH2_SFTP_GROUP *group;
+	libssh2_sftp_group_channel *member;
+	LIBSSH2_SFTP *other;
+
+	group = LIBSSH2_ALLOC(session, sizeof(LIBSSH2_SFTP_GROUP));
+	memset(group, 0, sizeof(LIBSSH2_SFTP_GROUP));
+	group->session = session;
+	group->window = 4;
+	group->members = LIBSSH2_ALLOC(session, 2 * sizeof(libssh2_sftp_group_channel));
+	memset(group->members, 0, 2 * sizeof(libssh2_sftp_group_channel));
+	group->member_count = 2;
+
+	/* Two requests out and some of its stripe still to go when the channel fails */
+	member = &group->members[0];
+	member->sftp = check_sftp(session, 1);
+	member->handle = check_handle(member->sftp);
+	member->requests = LIBSSH2_ALLOC(session, group->window * sizeof(libssh2_sftp_request));
+	member->requests[0].offset = 0;
+	member->requests[0].len = 100;
+	member->requests[1].offset = 100;
+	member->requests[1].len = 100;
+	member->count = 2;
+	member->offset = 200;
+	member->end = 400;
+
+	/* Another member with a handle of its own, which mustn't be disturbed */
+	other = group->members[1].sftp = check_sftp(session, 2);
+	group->members[1].handle = check_handle(other);
+
+	check("drop: returns 0", libssh2_sftp_group_drop(group, member) == 0);
+	check("drop: member has no channel or handle left", !member->sftp && !member->handle && !member->count);
+	check("drop: both requests and the stripe are requeued", group->retry_count == 3);
+	check("drop: nothing freed twice", bad_frees == 0);
+	check("drop: the other member's handle is still linked", (other->handles == group->members[1].handle) && !other->handles->next);
+
+	libssh2_sftp_shutdown(other);
+	check("shutdown: the other member's handle went with its channel", bad_frees == 0);
+
+	LIBSSH2_FREE(session, member->requests);
+	LIBSSH2_FREE(session, group->retries);
+	LIBSSH2_FREE(session, group->members);
+	LIBSSH2_FREE(session, group);
+	free_session(session);
+	check("drop: nothing leaked", block_count == 0);
+}
+
+static void check_dtor(void)
+{
+	LIBSSH2_SESSION *session = new_session();
+	LIBSSH2_SFTP *sftp = check_sftp(session, 1);
+
+	check_handle(sftp);
+	check_handle(sftp);
+	check_handle(sftp);
+
+	libssh2_sftp_shutdown(sftp);
+	check("dtor: handles on a dead channel are let go", bad_frees == 0);
+
+	free_session(session);
+	check("dtor: nothing leaked", block_count == 0);
+}
+
+int main(void)
+{
+	signal(SIGALRM, timed_out);
+	signal(SIGPIPE, SIG_IGN);
+	alarm(10);
+
+	check_group_drop();
+	bad_frees = 0;
+	check_dtor();
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+/* Times libssh2_sftp_packet_ask() against the number of replies queued alongside the one wanted
+ *
+ * Not part of the library. sftp.c is included directly to get at its static functions, so build it against
+ * the same objects, less sftp.c:
+ *   cc -I. -o sftp_reply_bench sftp_reply_bench.c <libssh2 .c files other than sftp.c> -lcrypto -lz
+ * Defining SFTP_SOURCE builds it against some other sftp.c instead, e.g. an older one to compare with:
+ *   cc -I. -DSFTP_SOURCE='"/tmp/old/sftp.c"' -o sftp_reply_bench_old sftp_reply_bench.c ...
+ *
+ *   sftp_reply_bench [-r rounds] [queued ...]
+ *     For each count (1, 10, 100, 1000 and 10000 by default), queues that many FXP_STATUS replies and times
+ *     taking one out and filing it again. "oldest" takes them in the order they were queued, the way a single
+ *     pipelined handle reaps its acks; "newest" always takes the most recent, the worst case for a linear scan,
+ *     and about what one of many interleaved handles sees
+ *
+ * Request ids start at 0x01010101: sftp.c used to match replies with strncmp(), which stops at the first zero
+ * byte, so with small ids any FXP_STATUS would have done and an older sftp.c would look misleadingly quick.
+ * Each reply taken out is checked to be the one asked for
+ */
+
+#ifndef SFTP_SOURCE
+#define SFTP_SOURCE "sftp.c"
+#endif
+#include SFTP_SOURCE
+
+#include <sys/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BENCH_FIRST_ID	0x01010101UL
+
+static double bench_now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000000.0) + tv.tv_usec;
+}
+
+/* {{{ bench_queue_reply
+ * An FXP_STATUS reply to request_id, as libssh2_sftp_packet_read() would file it
+ */
+static int bench_queue_reply(LIBSSH2_SFTP *sftp, unsigned long request_id)
+{
+	unsigned char *data = malloc(9);
+
+	if (!data) {
+		return -1;
+	}
+	data[0] = SSH_FXP_STATUS;
+	libssh2_htonu32(data + 1, request_id);
+	libssh2_htonu32(data + 5, LIBSSH2_FX_OK);
+
+	return libssh2_sftp_packet_add(sftp, data, 9);
+}
+/* }}} */
+
+/* {{{ bench_run
+ * Returns the mean nanoseconds per lookup, -1 if a reply couldn't be found or the wrong one came back
+ */
+static double bench_run(LIBSSH2_SFTP *sftp, unsigned long queued, unsigned long rounds, int newest)
+{
+	unsigned char *data;
+	unsigned long data_len, round;
+	double started, elapsed;
+
+	for(round = 0; round < queued; round++) {
+		if (bench_queue_reply(sftp, BENCH_FIRST_ID + round)) {
+			return -1;
+		}
+	}
+
+	started = bench_now_us();
+	for(round = 0; round < rounds; round++) {
+		unsigned long request_id = BENCH_FIRST_ID + (newest ? (queued - 1) : (round % queued));
+
+		if (libssh2_sftp_packet_ask(sftp, SSH_FXP_STATUS, request_id, &data, &data_len, 0) ||
+			(libssh2_ntohu32(data + 1) != request_id)) {
+			return -1;
+		}
+		/* Back in again at the tail, so the queue stays the same length */
+		if (libssh2_sftp_packet_add(sftp, data, data_len)) {
+			return -1;
+		}
+	}
+	elapsed = bench_now_us() - started;
+
+	for(round = 0; round < queued; round++) {
+		if (libssh2_sftp_packet_ask(sftp, SSH_FXP_STATUS, BENCH_FIRST_ID + round, &data, &data_len, 0)) {
+			return -1;
+		}
+		free(data);
+	}
+
+	return (elapsed * 1000.0) / rounds;
+}
+/* }}} */
+
+int main(int argc, char *argv[])
+{
+	unsigned long default_counts[] = { 1, 10, 100, 1000, 10000 };
+	unsigned long rounds = 100000, i, count;
+	LIBSSH2_SESSION *session;
+	LIBSSH2_CHANNEL channel;
+	LIBSSH2_SFTP *sftp;
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "r:")) != -1) {
+		switch (opt) {
+			case 'r':
+				rounds = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-r rounds] [queued ...]\n", argv[0]);
+				return 2;
+		}
+	}
+	count = (optind < argc) ? (unsigned long)(argc - optind) : (sizeof(default_counts) / sizeof(default_counts[0]));
+	if (!rounds) {
+		fprintf(stderr, "Usage: %s [-r rounds] [queued ...]\n", argv[0]);
+		return 2;
+	}
+
+	/* Only the session's allocator is used, nothing goes over the wire */
+	session = libssh2_session_init();
+	memset(&channel, 0, sizeof(channel));
+	channel.session = session;
+	sftp = calloc(1, sizeof(LIBSSH2_SFTP));
+	sftp->channel = &channel;
+
+	printf("%lu rounds, sftp.c from %s\n", rounds, SFTP_SOURCE);
+	printf("  %8s  %12s  %12s\n", "queued", "oldest ns", "newest ns");
+	for(i = 0; i < count; i++) {
+		unsigned long queued = (optind < argc) ? strtoul(argv[optind + i], NULL, 10) : default_counts[i];
+		double oldest, newest;
+
+		if (!queued) {
+			continue;
+		}
+		oldest = bench_run(sftp, queued, rounds, 0);
+		newest = bench_run(sftp, queued, rounds, 1);
+		if ((oldest < 0) || (newest < 0)) {
+			fprintf(stderr, "Lost a queued reply, or got the wrong one, with %lu queued\n", queued);
+			failed = 1;
+			break;
+		}
+		printf("  %8lu  %12.1f  %12.1f\n", queued, oldest, newest);
+	}
+
+	free(sftp);
+	libssh2_session_free(session);
+
+	return failed;
+}
@@ -7,6 +7,7 @@
 #import "KMSServer.h"
 
 #import "CKUploader.h"
+#import "CK2FileOperation.h"
 
 #import <XCTest/XCTest.h>
 #import <curl/curl.h>
@@ -18,6 +19,7 @@
 @property (assign, nonatomic) BOOL finished;
 @property (assign, nonatomic) BOOL uploading;
 @property (assign, nonatomic) BOOL failAuthentication;
+@property (assign, nonatomic) NSUInteger peakRunningCount;
 
 @end
 
@@ -79,6 +81,14 @@
 - (void)uploader:(CKUploader *)uploader didBeginUploadToPath:(NSString *)path
 {
     self.uploading = YES;
+
+    NSUInteger running = 0;
+    for (CK2FileOperation *anOperation in uploader.operations)
+    {
+        if (anOperation.state == CK2FileOperationStateRunning) running++;
+    }
+    self.peakRunningCount = MAX(self.peakRunningCount, running);
+
     NSLog(@"uploading");
 }
 
@@ -188,6 +198,43 @@
     [self testRemoveFileAtPath];
 }
 
+- (void)testConcurrentUploads
+{
+    CKUploader* uploader = [self setupUploader];
+    if (uploader)
+    {
+        uploader.maximumConcurrentOperationsPerHost = 4;
+        XCTAssertEqual(uploader.maximumConcurrentOperationsPerHost, (NSUInteger)4);
+
+        NSData* testData = [@"Some test content" dataUsingEncoding:NSUTF8StringEncoding];
+        NSMutableArray *records = [NSMutableArray array];
+        for (NSUInteger i = 0; i < 6; i++)
+        {
+            NSString *path = [NSString stringWithFormat:@"test/concurrent/test%lu.txt", (unsigned long)i];
+            CKTransferRecord *record = [uploader uploadToURL:[CK2FileManager URLWithPath:path relativeToURL:uploader.baseRequest.URL]
+                                                    fromData:testData];
+            XCTAssertNotNil(record, @"got a transfer record");
+            [records addObject:record];
+        }
+
+        // Only the first upload into the new directory should be under way; the rest wait for it to create the directory
+        XCTAssertEqual(uploader.operations.count, (NSUInteger)6);
+        XCTAssertEqual([[uploader.operations objectAtIndex:1] state], CK2FileOperationStateSuspended);
+
+        [uploader finishOperationsAndInvalidate];
+
+        [self runUntilPaused];
+        for (CKTransferRecord *record in records)
+        {
+            [self checkResultForRecord:record uploading:YES];
+        }
+
+        // The five waiting on the directory should then have gone four at a time
+        XCTAssertTrue(self.peakRunningCount > 1, @"Uploads should have overlapped, but at most %lu ran at once", (unsigned long)self.peakRunningCount);
+        XCTAssertTrue(self.peakRunningCount <= 4);
+    }
+}
+
 - (void)testCancel
 {
     CKUploader* uploader = [self setupUploader];
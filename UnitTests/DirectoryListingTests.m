@@ -0,0 +1,240 @@
+//
+//  DirectoryListingTests.m
+//  Connection
+//
+//  Created by agent on 18/10/2026.
+//
+//
+
+#import "CK2FTPProtocol.h"
+
+#import <XCTest/XCTest.h>
+
+
+@interface CK2CURLBasedProtocol (DirectoryListingTests)
+- (NSError*)processData:(NSData*)data consumedLength:(NSUInteger *)consumed request:(NSURLRequest *)request url:(NSURL*)directoryURL path:(NSString*)directoryPath options:(NSDirectoryEnumerationOptions)mask;
+@end
+
+
+// Collects whatever the protocol discovers
+@interface DirectoryListingTestsClient : NSObject
+{
+  @public
+    NSMutableArray  *_URLs;
+}
+@end
+
+
+@implementation DirectoryListingTestsClient
+
+- (id)init;
+{
+    if (self = [super init])
+    {
+        _URLs = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc;
+{
+    [_URLs release];
+    [super dealloc];
+}
+
+- (void)protocol:(CK2Protocol *)protocol didDiscoverItemAtURL:(NSURL *)url;
+{
+    [_URLs addObject:url];
+}
+
+@end
+
+
+@interface DirectoryListingTests : XCTestCase
+
+@end
+
+@implementation DirectoryListingTests
+
+- (NSArray *)URLsByParsingListing:(NSData *)listing;
+{
+    NSURL *directoryURL = [NSURL URLWithString:@"ftp://example.com/dir/"];
+    NSURLRequest *request = [NSURLRequest requestWithURL:directoryURL];
+
+    DirectoryListingTestsClient *client = [[[DirectoryListingTestsClient alloc] init] autorelease];
+    CK2FTPProtocol *protocol = [[CK2FTPProtocol alloc] initWithRequest:request client:(id <CK2ProtocolClient>)client];
+
+    NSUInteger consumed = 0;
+    NSError *error = [protocol processData:listing consumedLength:&consumed request:request url:directoryURL path:@"/dir/" options:0];
+    XCTAssertNil(error);
+    XCTAssertEqual(consumed, listing.length);
+
+    [protocol release];
+    return client->_URLs;
+}
+
+// Feeds the listing over in chunks the way -initForEnumeratingDirectoryWithRequest:… does, including cutting parsed bytes from the front of the buffer.
+// discoveredCounts receives how many items were known after each chunk
+- (NSArray *)URLsByParsingChunks:(NSArray *)chunks discoveredCounts:(NSMutableArray *)discoveredCounts;
+{
+    NSURL *directoryURL = [NSURL URLWithString:@"ftp://example.com/dir/"];
+    NSURLRequest *request = [NSURLRequest requestWithURL:directoryURL];
+
+    DirectoryListingTestsClient *client = [[[DirectoryListingTestsClient alloc] init] autorelease];
+    CK2FTPProtocol *protocol = [[CK2FTPProtocol alloc] initWithRequest:request client:(id <CK2ProtocolClient>)client];
+
+    NSMutableData *buffer = [NSMutableData data];
+    NSUInteger consumed = 0;
+
+    for (NSData *aChunk in chunks)
+    {
+        [buffer appendData:aChunk];
+        NSError *error = [protocol processData:buffer consumedLength:&consumed request:request url:directoryURL path:@"/dir/" options:0];
+        XCTAssertNil(error);
+        XCTAssertLessThanOrEqual(consumed, buffer.length);
+
+        if (consumed > buffer.length / 2)
+        {
+            [buffer replaceBytesInRange:NSMakeRange(0, consumed) withBytes:NULL length:0];
+            consumed = 0;
+        }
+
+        [discoveredCounts addObject:@(client->_URLs.count)];
+    }
+
+    // Everything should have been parsed by the end; nothing left over for the completion handler
+    XCTAssertEqual(consumed, buffer.length);
+
+    [protocol release];
+    return client->_URLs;
+}
+
+- (void)testListingSplitMidLineAndMidCharacter
+{
+    NSData *listing = [@"-rw-r--r--   1 user  group  1234 Jan  1 12:00 index.html\r\n"
+                       @"-rw-r--r--   1 user  group    10 Jan  1 12:00 caf\u00e9.txt\r\n"
+                       @"drwxr-xr-x   2 user  group  4096 Jan  1 12:00 images\r\n"
+                       dataUsingEncoding:NSUTF8StringEncoding];
+
+    // Split partway into the second line, then between the two bytes of the é
+    NSRange accent = [listing rangeOfData:[@"\u00e9" dataUsingEncoding:NSUTF8StringEncoding] options:0 range:NSMakeRange(0, listing.length)];
+    XCTAssertEqual(accent.length, (NSUInteger)2);
+
+    NSUInteger firstSplit = accent.location - 20;
+    NSUInteger secondSplit = accent.location + 1;
+    NSArray *chunks = @[[listing subdataWithRange:NSMakeRange(0, firstSplit)],
+                        [listing subdataWithRange:NSMakeRange(firstSplit, secondSplit - firstSplit)],
+                        [listing subdataWithRange:NSMakeRange(secondSplit, listing.length - secondSplit)]];
+
+    NSMutableArray *counts = [NSMutableArray array];
+    NSArray *URLs = [self URLsByParsingChunks:chunks discoveredCounts:counts];
+
+    // Items are reported as soon as their line is complete, not once the whole listing's in
+    XCTAssertEqualObjects(counts, (@[@1, @1, @3]));
+
+    XCTAssertEqual(URLs.count, (NSUInteger)3);
+    XCTAssertEqualObjects([[URLs objectAtIndex:0] lastPathComponent], @"index.html");
+    XCTAssertEqualObjects([[URLs objectAtIndex:1] lastPathComponent], @"caf\u00e9.txt");
+    XCTAssertEqualObjects([[URLs objectAtIndex:2] lastPathComponent], @"images");
+
+    id value;
+    XCTAssertTrue([[URLs objectAtIndex:1] getResourceValue:&value forKey:NSURLFileSizeKey error:NULL]);
+    XCTAssertEqualObjects(value, @10);
+}
+
+- (void)testCompactingBufferKeepsPlace
+{
+    NSMutableData *listing = [NSMutableData data];
+    for (NSUInteger i = 0; i < 50; i++)
+    {
+        NSString *line = [NSString stringWithFormat:@"-rw-r--r--   1 user  group  %lu Jan  1 12:00 file%02lu.txt\r\n", (unsigned long)i, (unsigned long)i];
+        [listing appendData:[line dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+
+    // Chunk sizes that don't line up with the entries, so the buffer is cut with a partial line left in it.
+    // A single byte at a time has the cursor land on every possible offset
+    for (NSNumber *aLength in @[@1, @7, @64, @333])
+    {
+        NSUInteger length = aLength.unsignedIntegerValue;
+        NSMutableArray *chunks = [NSMutableArray array];
+        for (NSUInteger offset = 0; offset < listing.length; offset += length)
+        {
+            [chunks addObject:[listing subdataWithRange:NSMakeRange(offset, MIN(length, listing.length - offset))]];
+        }
+
+        NSMutableArray *counts = [NSMutableArray array];
+        NSArray *URLs = [self URLsByParsingChunks:chunks discoveredCounts:counts];
+
+        // Each entry exactly once and in order, so nothing was skipped or parsed twice across a compaction
+        XCTAssertEqual(URLs.count, (NSUInteger)50, @"%lu byte chunks", (unsigned long)length);
+        [URLs enumerateObjectsUsingBlock:^(NSURL *aURL, NSUInteger idx, BOOL *stop) {
+            NSString *name = [NSString stringWithFormat:@"file%02lu.txt", (unsigned long)idx];
+            XCTAssertEqualObjects([aURL lastPathComponent], name, @"%lu byte chunks", (unsigned long)length);
+        }];
+
+        XCTAssertLessThan([[counts objectAtIndex:counts.count / 2] unsignedIntegerValue], (NSUInteger)50, @"%lu byte chunks", (unsigned long)length);
+        XCTAssertGreaterThan([[counts objectAtIndex:counts.count / 2] unsignedIntegerValue], (NSUInteger)0, @"%lu byte chunks", (unsigned long)length);
+    }
+}
+
+- (void)testResourceValuesAreProvidedOnDemand
+{
+    NSData *listing = [@"-rw-r--r--   1 user  group  1234 Jan  1 12:00 index.html\r\n"
+                       @"drwxr-xr-x   2 user  group  4096 Jan  1 12:00 images\r\n"
+                       @"lrwxrwxrwx   1 user  group     9 Jan  1 12:00 latest -> index.html\r\n"
+                       @"-rw-r--r--   1 user  group     0 Jan  1 12:00 .htaccess\r\n"
+                       dataUsingEncoding:NSUTF8StringEncoding];
+
+    NSArray *URLs = [self URLsByParsingListing:listing];
+    XCTAssertEqual(URLs.count, (NSUInteger)4);
+
+    NSURL *file = [URLs objectAtIndex:0];
+    id value;
+    XCTAssertTrue([file getResourceValue:&value forKey:NSURLFileSizeKey error:NULL]);
+    XCTAssertEqualObjects(value, @1234);
+    XCTAssertTrue([file getResourceValue:&value forKey:NSURLIsDirectoryKey error:NULL]);
+    XCTAssertEqualObjects(value, @NO);
+    XCTAssertTrue([file getResourceValue:&value forKey:NSURLTypeIdentifierKey error:NULL]);
+    XCTAssertEqualObjects(value, @"public.html");
+    XCTAssertTrue([file getResourceValue:&value forKey:NSURLNameKey error:NULL]);
+    XCTAssertEqualObjects(value, @"index.html");
+
+    NSURL *directory = [URLs objectAtIndex:1];
+    XCTAssertTrue(CFURLHasDirectoryPath((CFURLRef)directory));
+    XCTAssertTrue([directory getResourceValue:&value forKey:NSURLIsDirectoryKey error:NULL]);
+    XCTAssertEqualObjects(value, @YES);
+
+    NSURL *link = [URLs objectAtIndex:2];
+    XCTAssertTrue([link getResourceValue:&value forKey:NSURLIsSymbolicLinkKey error:NULL]);
+    XCTAssertEqualObjects(value, @YES);
+    XCTAssertTrue([link getResourceValue:&value forKey:CK2URLSymbolicLinkDestinationKey error:NULL]);
+    XCTAssertEqualObjects([value lastPathComponent], @"index.html");
+
+    NSURL *hidden = [URLs objectAtIndex:3];
+    XCTAssertTrue([hidden getResourceValue:&value forKey:NSURLIsHiddenKey error:NULL]);
+    XCTAssertEqualObjects(value, @YES);
+
+    // Second lookup comes from the cache
+    XCTAssertTrue([file getResourceValue:&value forKey:NSURLFileSizeKey error:NULL]);
+    XCTAssertEqualObjects(value, @1234);
+}
+
+- (void)testEnumeratingLargeListingPerformance
+{
+    NSMutableData *listing = [NSMutableData data];
+    for (NSUInteger i = 0; i < 100000; i++)
+    {
+        NSString *line = [NSString stringWithFormat:@"-rw-r--r--   1 user  group  %lu Jan  1 12:00 file%06lu.txt\r\n", (unsigned long)i, (unsigned long)i];
+        [listing appendData:[line dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+
+    [self measureBlock:^{
+        @autoreleasepool
+        {
+            NSArray *URLs = [self URLsByParsingListing:listing];
+            XCTAssertEqual(URLs.count, (NSUInteger)100000);
+        }
+    }];
+}
+
+@end
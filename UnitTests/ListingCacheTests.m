@@ -0,0 +1,413 @@
+//
+//  ListingCacheTests.m
+//  Connection
+//
+//  Created by agent on 18/10/2026.
+//
+//
+
+#import "CK2ListingCache.h"
+#import "CK2FileOperation.h"
+#import "CK2Protocol.h"
+
+#import <XCTest/XCTest.h>
+
+
+@interface CK2ListingCache (ListingCacheTests)
+- (void)storeURLs:(NSArray *)URLs forURL:(NSURL *)url ifNotInvalidatedSince:(NSUInteger)invalidationCount;
+- (NSUInteger)invalidationCountForHost:(NSString *)host;
+@end
+
+
+static NSMutableDictionary  *sListings;         // names by directory path
+static NSDate               *sModificationDate; // reported for each directory, if set
+static NSUInteger           sEnumerationCount;
+
+
+/**
+ Serves listings out of sListings in place of a server, counting how often it's asked for one.
+ Every other operation just succeeds.
+ */
+@interface ListingCacheTestsProtocol : CK2Protocol
+{
+  @private
+    BOOL                            _isEnumeration;
+    NSDirectoryEnumerationOptions   _mask;
+    BOOL                            _stopped;
+}
+@end
+
+
+@implementation ListingCacheTestsProtocol
+
++ (BOOL)canHandleURL:(NSURL *)url;
+{
+    return [url.scheme isEqualToString:@"ck2listingcachetest"];
+}
+
+- (id)initForEnumeratingDirectoryWithRequest:(NSURLRequest *)request includingPropertiesForKeys:(NSArray *)keys options:(NSDirectoryEnumerationOptions)mask client:(id<CK2ProtocolClient>)client;
+{
+    if (self = [self initWithRequest:request client:client])
+    {
+        _isEnumeration = YES;
+        _mask = mask;
+    }
+    return self;
+}
+
+- (id)initForCreatingDirectoryWithRequest:(NSURLRequest *)request withIntermediateDirectories:(BOOL)createIntermediates openingAttributes:(NSDictionary *)attributes client:(id<CK2ProtocolClient>)client;
+{
+    return [self initWithRequest:request client:client];
+}
+
+- (id)initForRemovingItemWithRequest:(NSURLRequest *)request client:(id<CK2ProtocolClient>)client;
+{
+    return [self initWithRequest:request client:client];
+}
+
+- (id)initForRenamingItemWithRequest:(NSURLRequest *)request newName:(NSString *)newName client:(id<CK2ProtocolClient>)client;
+{
+    return [self initWithRequest:request client:client];
+}
+
+- (id)initForSettingAttributes:(NSDictionary *)keyedValues ofItemWithRequest:(NSURLRequest *)request client:(id<CK2ProtocolClient>)client;
+{
+    return [self initWithRequest:request client:client];
+}
+
+- (void)start;
+{
+    if (_isEnumeration)
+    {
+        NSURL *directoryURL = self.request.URL;
+        NSArray *names;
+        @synchronized([ListingCacheTestsProtocol class])
+        {
+            sEnumerationCount++;
+            names = [[[sListings objectForKey:directoryURL.path] copy] autorelease];
+            if (sModificationDate) [CK2FileManager setTemporaryResourceValue:sModificationDate forKey:NSURLContentModificationDateKey inURL:directoryURL];
+        }
+
+        if (_mask & CK2DirectoryEnumerationIncludesDirectory)
+        {
+            [self.client protocol:self didDiscoverItemAtURL:directoryURL];
+        }
+
+        for (NSString *aName in names)
+        {
+            if (_stopped) return;
+            if ((_mask & NSDirectoryEnumerationSkipsHiddenFiles) && [aName hasPrefix:@"."]) continue;
+            [self.client protocol:self didDiscoverItemAtURL:[directoryURL URLByAppendingPathComponent:aName]];
+        }
+        if (_stopped) return;
+    }
+
+    [self.client protocol:self didCompleteWithError:nil];
+}
+
+- (void)stop;
+{
+    _stopped = YES;
+}
+
+@end
+
+
+@interface ListingCacheTests : XCTestCase
+
+@end
+
+@implementation ListingCacheTests
+
+- (void)storeListingOfDirectoryAtURL:(NSURL *)url names:(NSArray *)names inCache:(CK2ListingCache *)cache;
+{
+    NSMutableArray *URLs = [NSMutableArray arrayWithObject:url];
+    for (NSString *aName in names)
+    {
+        [URLs addObject:[url URLByAppendingPathComponent:aName]];
+    }
+
+    [cache storeURLs:URLs forURL:url ifNotInvalidatedSince:[cache invalidationCountForHost:url.host]];
+}
+
+- (void)setUp
+{
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        [CK2Protocol registerClass:[ListingCacheTestsProtocol class]];
+    });
+
+    @synchronized([ListingCacheTestsProtocol class])
+    {
+        [sListings release]; sListings = [[NSMutableDictionary alloc] init];
+        [sModificationDate release]; sModificationDate = nil;
+        sEnumerationCount = 0;
+    }
+}
+
+- (CK2FileManager *)fileManagerWithCache:(CK2ListingCache *)cache;
+{
+    CK2FileManager *result = [CK2FileManager fileManagerWithDelegate:nil delegateQueue:nil];
+    result.listingCache = cache;
+    return result;
+}
+
+- (NSArray *)contentsOfDirectoryAtURL:(NSURL *)url options:(NSDirectoryEnumerationOptions)mask manager:(CK2FileManager *)manager;
+{
+    __block NSArray *result = nil;
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+
+    [manager contentsOfDirectoryAtURL:url includingPropertiesForKeys:nil options:mask completionHandler:^(NSArray *contents, NSError *error) {
+        XCTAssertNil(error);
+        result = [contents copy];
+        dispatch_semaphore_signal(done);
+    }];
+
+    XCTAssertEqual(dispatch_semaphore_wait(done, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_SEC)), 0L, @"Listing never completed");
+    dispatch_release(done);
+
+    return [result autorelease];
+}
+
+// block is handed a completion handler to pass to the operation, and returns the operation
+- (void)performOperation:(CK2FileOperation *(^)(void (^completionHandler)(NSError *error)))block;
+{
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+
+    CK2FileOperation *operation = block(^(NSError *error) {
+        XCTAssertNil(error);
+        dispatch_semaphore_signal(done);
+    });
+    [operation resume];
+
+    XCTAssertEqual(dispatch_semaphore_wait(done, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_SEC)), 0L, @"Operation never completed");
+    dispatch_release(done);
+}
+
+- (NSArray *)namesOfURLs:(NSArray *)URLs;
+{
+    return [URLs valueForKey:@"lastPathComponent"];
+}
+
+- (void)testListingIsReturnedUntilItExpires
+{
+    CK2ListingCache *cache = [[[CK2ListingCache alloc] init] autorelease];
+    NSURL *url = [NSURL URLWithString:@"ftp://example.com/dir/"];
+    [self storeListingOfDirectoryAtURL:url names:@[@"a.txt", @"b.txt"] inCache:cache];
+
+    NSArray *contents = [cache cachedContentsOfDirectoryAtURL:[NSURL URLWithString:@"ftp://EXAMPLE.com/dir"]];
+    XCTAssertEqual(contents.count, (NSUInteger)2, @"Directory itself shouldn't be included, and host case or trailing slash shouldn't matter");
+    XCTAssertEqual(cache.totalCost, (NSUInteger)3);
+
+    [cache setTimeToLive:0 forHost:@"example.com"];
+    XCTAssertNil([cache cachedContentsOfDirectoryAtURL:url]);
+
+    [cache setTimeToLive:-1 forHost:@"example.com"];
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:url]);
+}
+
+- (void)testInvalidation
+{
+    CK2ListingCache *cache = [[[CK2ListingCache alloc] init] autorelease];
+    NSURL *parent = [NSURL URLWithString:@"sftp://example.com/parent/"];
+    NSURL *child = [NSURL URLWithString:@"sftp://example.com/parent/child/"];
+    NSURL *grandchild = [NSURL URLWithString:@"sftp://example.com/parent/child/grandchild/"];
+    NSURL *sibling = [NSURL URLWithString:@"sftp://example.com/parent/children/"];
+
+    [self storeListingOfDirectoryAtURL:parent names:@[@"child", @"children"] inCache:cache];
+    [self storeListingOfDirectoryAtURL:child names:@[@"grandchild"] inCache:cache];
+    [self storeListingOfDirectoryAtURL:grandchild names:@[] inCache:cache];
+    [self storeListingOfDirectoryAtURL:sibling names:@[] inCache:cache];
+
+    // e.g. a file being created in child
+    [cache invalidateListingContainingURL:[child URLByAppendingPathComponent:@"new.txt"]];
+    XCTAssertNil([cache cachedContentsOfDirectoryAtURL:child]);
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:parent]);
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:grandchild]);
+
+    // e.g. child being removed
+    [cache invalidateListingOfDirectoryAtURL:child];
+    XCTAssertNil([cache cachedContentsOfDirectoryAtURL:grandchild]);
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:sibling], @"Only paths within the directory should go");
+
+    [cache removeListingsForHost:@"Example.com"];
+    XCTAssertEqual(cache.totalCost, (NSUInteger)0);
+}
+
+- (void)testListingFetchedAcrossInvalidationIsNotStored
+{
+    CK2ListingCache *cache = [[[CK2ListingCache alloc] init] autorelease];
+    NSURL *url = [NSURL URLWithString:@"ftp://example.com/dir/"];
+
+    NSUInteger invalidationCount = [cache invalidationCountForHost:url.host];
+    [cache invalidateListingContainingURL:[url URLByAppendingPathComponent:@"removed.txt"]];
+    [cache storeURLs:@[url] forURL:url ifNotInvalidatedSince:invalidationCount];
+
+    XCTAssertNil([cache cachedContentsOfDirectoryAtURL:url]);
+}
+
+- (void)testInvalidatingOtherHostDoesNotStopListingBeingStored
+{
+    CK2ListingCache *cache = [[[CK2ListingCache alloc] init] autorelease];
+    NSURL *url = [NSURL URLWithString:@"ftp://example.com/dir/"];
+
+    NSUInteger invalidationCount = [cache invalidationCountForHost:url.host];
+    [cache invalidateListingContainingURL:[NSURL URLWithString:@"ftp://example.org/dir/removed.txt"]];
+    [cache removeListingsForHost:@"example.net"];
+    [cache storeURLs:@[url] forURL:url ifNotInvalidatedSince:invalidationCount];
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:url]);
+
+    // Whereas removing everything affects every host
+    invalidationCount = [cache invalidationCountForHost:url.host];
+    [cache removeAllListings];
+    [cache storeURLs:@[url] forURL:url ifNotInvalidatedSince:invalidationCount];
+    XCTAssertNil([cache cachedContentsOfDirectoryAtURL:url]);
+}
+
+- (void)testLeastRecentlyUsedListingIsEvicted
+{
+    CK2ListingCache *cache = [[[CK2ListingCache alloc] init] autorelease];
+    cache.totalCostLimit = 5;
+
+    NSURL *first = [NSURL URLWithString:@"ftp://example.com/first/"];
+    NSURL *second = [NSURL URLWithString:@"ftp://example.com/second/"];
+    NSURL *third = [NSURL URLWithString:@"ftp://example.com/third/"];
+
+    [self storeListingOfDirectoryAtURL:first names:@[@"1"] inCache:cache];
+    [self storeListingOfDirectoryAtURL:second names:@[@"2"] inCache:cache];
+    [cache cachedContentsOfDirectoryAtURL:first];
+    [self storeListingOfDirectoryAtURL:third names:@[@"3"] inCache:cache];
+
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:first]);
+    XCTAssertNil([cache cachedContentsOfDirectoryAtURL:second]);
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:third]);
+    XCTAssertTrue(cache.totalCost <= cache.totalCostLimit);
+}
+
+- (void)testEvictionOrderSurvivesInvalidation
+{
+    CK2ListingCache *cache = [[[CK2ListingCache alloc] init] autorelease];
+    cache.totalCostLimit = 6;
+
+    NSURL *first = [NSURL URLWithString:@"ftp://example.com/first/"];
+    NSURL *second = [NSURL URLWithString:@"ftp://example.com/second/"];
+    NSURL *third = [NSURL URLWithString:@"ftp://example.com/third/"];
+    NSURL *fourth = [NSURL URLWithString:@"ftp://example.com/fourth/"];
+    NSURL *fifth = [NSURL URLWithString:@"ftp://example.com/fifth/"];
+
+    [self storeListingOfDirectoryAtURL:first names:@[@"1"] inCache:cache];
+    [self storeListingOfDirectoryAtURL:second names:@[@"2"] inCache:cache];
+    [self storeListingOfDirectoryAtURL:third names:@[@"3"] inCache:cache];
+
+    // Taken out of the middle of the order, then the oldest used again
+    [cache invalidateListingOfDirectoryAtURL:second];
+    [cache cachedContentsOfDirectoryAtURL:first];
+    [self storeListingOfDirectoryAtURL:fourth names:@[@"4"] inCache:cache];
+    XCTAssertEqual(cache.totalCost, (NSUInteger)6);
+
+    // Only room by losing one, which has to be third
+    [self storeListingOfDirectoryAtURL:fifth names:@[@"5"] inCache:cache];
+    XCTAssertNil([cache cachedContentsOfDirectoryAtURL:third]);
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:first]);
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:fourth]);
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:fifth]);
+    XCTAssertEqual(cache.totalCost, (NSUInteger)6);
+
+    // Emptying out the list and starting it again
+    [cache removeAllListings];
+    [self storeListingOfDirectoryAtURL:first names:@[@"1"] inCache:cache];
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:first]);
+    XCTAssertEqual(cache.totalCost, (NSUInteger)2);
+}
+
+#pragma mark Through CK2FileManager
+
+- (void)testReplayedListingIsFilteredForEachClient
+{
+    CK2ListingCache *cache = [[[CK2ListingCache alloc] init] autorelease];
+    CK2FileManager *manager = [self fileManagerWithCache:cache];
+    NSURL *url = [NSURL URLWithString:@"ck2listingcachetest://example.com/dir/"];
+    [sListings setObject:@[@"a.txt", @".hidden", @"b.txt"] forKey:@"/dir"];
+
+    // The real protocol's asked for everything, but this client only gets what it asked for
+    NSArray *contents = [self contentsOfDirectoryAtURL:url options:0 manager:manager];
+    XCTAssertEqualObjects([self namesOfURLs:contents], (@[@"a.txt", @".hidden", @"b.txt"]));
+    XCTAssertEqual(sEnumerationCount, (NSUInteger)1);
+
+    contents = [self contentsOfDirectoryAtURL:url options:NSDirectoryEnumerationSkipsHiddenFiles manager:manager];
+    XCTAssertEqualObjects([self namesOfURLs:contents], (@[@"a.txt", @"b.txt"]));
+
+    contents = [self contentsOfDirectoryAtURL:url options:CK2DirectoryEnumerationIncludesDirectory manager:manager];
+    XCTAssertEqual(contents.count, (NSUInteger)4);
+    XCTAssertEqualObjects([[contents objectAtIndex:0] path], @"/dir");
+
+    XCTAssertEqual(sEnumerationCount, (NSUInteger)1, @"Repeat listings should have come from the cache");
+    XCTAssertEqual(cache.hitCount, (NSUInteger)2);
+}
+
+- (void)testExpiredListingIsFetchedAgain
+{
+    CK2ListingCache *cache = [[[CK2ListingCache alloc] init] autorelease];
+    [cache setTimeToLive:0.01 forHost:@"example.com"];
+    CK2FileManager *manager = [self fileManagerWithCache:cache];
+    NSURL *url = [NSURL URLWithString:@"ck2listingcachetest://example.com/dir/"];
+
+    [sListings setObject:@[@"a.txt"] forKey:@"/dir"];
+    sModificationDate = [[NSDate dateWithTimeIntervalSinceReferenceDate:1000] retain];
+    [self contentsOfDirectoryAtURL:url options:0 manager:manager];
+
+    // The directory reports the same date, as WebDAV's getlastmodified would, but the fresh listing is what counts
+    [NSThread sleepForTimeInterval:0.05];
+    [sListings setObject:@[@"a.txt", @"b.txt"] forKey:@"/dir"];
+    NSArray *contents = [self contentsOfDirectoryAtURL:url options:0 manager:manager];
+    XCTAssertEqualObjects([self namesOfURLs:contents], (@[@"a.txt", @"b.txt"]));
+    XCTAssertEqual(sEnumerationCount, (NSUInteger)2);
+    XCTAssertEqual(cache.hitCount, (NSUInteger)0);
+
+    // And it's the one remembered
+    [cache setTimeToLive:-1 forHost:@"example.com"];
+    XCTAssertEqualObjects([self namesOfURLs:[cache cachedContentsOfDirectoryAtURL:url]], (@[@"a.txt", @"b.txt"]));
+}
+
+- (void)checkOperationInvalidatesListingOfDirectoryAtURL:(NSURL *)url
+                                                   cache:(CK2ListingCache *)cache
+                                                 manager:(CK2FileManager *)manager
+                                              usingBlock:(CK2FileOperation *(^)(void (^completionHandler)(NSError *error)))block;
+{
+    [self contentsOfDirectoryAtURL:url options:0 manager:manager];
+    XCTAssertNotNil([cache cachedContentsOfDirectoryAtURL:url]);
+    NSUInteger enumerationCount = sEnumerationCount;
+
+    [self performOperation:block];
+    XCTAssertNil([cache cachedContentsOfDirectoryAtURL:url]);
+
+    [self contentsOfDirectoryAtURL:url options:0 manager:manager];
+    XCTAssertEqual(sEnumerationCount, enumerationCount + 1, @"Listing should have been fetched afresh");
+}
+
+- (void)testChangingServerContentsInvalidatesListing
+{
+    CK2ListingCache *cache = [[[CK2ListingCache alloc] init] autorelease];
+    CK2FileManager *manager = [self fileManagerWithCache:cache];
+    NSURL *url = [NSURL URLWithString:@"ck2listingcachetest://example.com/dir/"];
+    NSURL *file = [url URLByAppendingPathComponent:@"a.txt"];
+    [sListings setObject:@[@"a.txt"] forKey:@"/dir"];
+
+    [self checkOperationInvalidatesListingOfDirectoryAtURL:url cache:cache manager:manager usingBlock:^CK2FileOperation *(void (^completionHandler)(NSError *)) {
+        return [manager createDirectoryAtURL:[url URLByAppendingPathComponent:@"new"] withIntermediateDirectories:NO openingAttributes:nil completionHandler:completionHandler];
+    }];
+
+    [self checkOperationInvalidatesListingOfDirectoryAtURL:url cache:cache manager:manager usingBlock:^CK2FileOperation *(void (^completionHandler)(NSError *)) {
+        return [manager removeItemAtURL:file completionHandler:completionHandler];
+    }];
+
+    [self checkOperationInvalidatesListingOfDirectoryAtURL:url cache:cache manager:manager usingBlock:^CK2FileOperation *(void (^completionHandler)(NSError *)) {
+        return [manager renameItemAtURL:file toFilename:@"b.txt" completionHandler:completionHandler];
+    }];
+
+    [self checkOperationInvalidatesListingOfDirectoryAtURL:url cache:cache manager:manager usingBlock:^CK2FileOperation *(void (^completionHandler)(NSError *)) {
+        return [manager setAttributesOperationWithURL:file attributes:@{ NSFilePosixPermissions : @0644 } completionHandler:completionHandler];
+    }];
+}
+
+@end
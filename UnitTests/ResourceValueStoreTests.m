@@ -0,0 +1,128 @@
+//
+//  ResourceValueStoreTests.m
+//  Connection
+//
+//  Created by agent on 18/10/2026.
+//
+//
+
+#import "CK2ResourceValueStore.h"
+
+#import <XCTest/XCTest.h>
+#import <objc/runtime.h>
+
+@interface ResourceValueStoreTests : XCTestCase
+
+@end
+
+@implementation ResourceValueStoreTests
+
+- (void)testValuesRoundTrip
+{
+    NSURL *url = [NSURL URLWithString:@"ftp://example.com/file.txt"];
+    [CK2FileManager setTemporaryResourceValue:@123 forKey:NSURLFileSizeKey inURL:url];
+    [CK2FileManager setTemporaryResourceValue:@"custom" forKey:@"CK2TestKey" inURL:url];
+    [CK2FileManager setTemporaryResourceValue:nil forKey:NSURLCreationDateKey inURL:url];
+
+    id value;
+    XCTAssertTrue([url getResourceValue:&value forKey:NSURLFileSizeKey error:NULL]);
+    XCTAssertEqualObjects(value, @123);
+
+    // Keys are compared by value, not just pointer
+    XCTAssertTrue([url getResourceValue:&value forKey:[@"CK2Test" stringByAppendingString:@"Key"] error:NULL]);
+    XCTAssertEqualObjects(value, @"custom");
+
+    value = @"not nil";
+    XCTAssertTrue([url getResourceValue:&value forKey:NSURLCreationDateKey error:NULL]);
+    XCTAssertNil(value);
+
+    // Overwriting
+    [CK2FileManager setTemporaryResourceValue:@456 forKey:NSURLFileSizeKey inURL:url];
+    XCTAssertTrue([url getResourceValue:&value forKey:NSURLFileSizeKey error:NULL]);
+    XCTAssertEqualObjects(value, @456);
+}
+
+- (void)testGuessesOnlyForURLsWithValues
+{
+    NSURL *listed = [NSURL URLWithString:@"ftp://example.com/Listed.app"];
+    [CK2FileManager setTemporaryResourceValue:@YES forKey:NSURLIsDirectoryKey inURL:listed];
+
+    id value = nil;
+    XCTAssertTrue([listed getResourceValue:&value forKey:NSURLLocalizedNameKey error:NULL]);
+    XCTAssertEqualObjects(value, @"Listed.app");
+
+    // The store isn't empty, but has nothing for this URL, so it's none of CK2's business
+    NSURL *unrelated = [NSURL URLWithString:@"http://example.com/Unrelated.app"];
+    value = nil;
+    [unrelated getResourceValue:&value forKey:NSURLLocalizedNameKey error:NULL];
+    XCTAssertFalse([value isEqual:@"Unrelated.app"]);
+    value = nil;
+    [unrelated getResourceValue:&value forKey:NSURLIsPackageKey error:NULL];
+    XCTAssertFalse([value isEqual:@YES]);
+}
+
+- (void)testURLStillLooksLikeNSURL
+{
+    NSURL *url = [NSURL URLWithString:@"sftp://example.com/file.txt"];
+    Class class = object_getClass(url);
+    [CK2FileManager setTemporaryResourceValue:@YES forKey:NSURLIsRegularFileKey inURL:url];
+
+    // The URL itself is left alone
+    XCTAssertEqual(object_getClass(url), class);
+    XCTAssertEqual([url class], [NSURL class]);
+    XCTAssertEqualObjects(url, [NSURL URLWithString:@"sftp://example.com/file.txt"]);
+    XCTAssertEqualObjects([NSKeyedUnarchiver unarchiveObjectWithData:[NSKeyedArchiver archivedDataWithRootObject:url]], url);
+}
+
+- (void)testEntriesGoAwayWithURL
+{
+    CK2ResourceValueStore *store = [CK2ResourceValueStore sharedStore];
+    NSUInteger count = store.numberOfURLs;
+
+    @autoreleasepool
+    {
+        NSURL *url = [[NSURL alloc] initWithString:@"ftp://example.com/gone.txt"];
+        [CK2FileManager setTemporaryResourceValue:@1 forKey:NSURLFileSizeKey inURL:url];
+        XCTAssertEqual(store.numberOfURLs, count + 1);
+        XCTAssertTrue(store.footprint > 0);
+        [url release];
+    }
+
+    XCTAssertEqual(store.numberOfURLs, count);
+}
+
+- (void)testConcurrentAccess
+{
+    CK2ResourceValueStore *store = [CK2ResourceValueStore sharedStore];
+    NSUInteger count = store.numberOfURLs;
+
+    NSURL *shared = [[NSURL alloc] initWithString:@"ftp://example.com/shared.txt"];
+
+    dispatch_apply(1000, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        @autoreleasepool
+        {
+            // URLs of their own, which come and go while other threads are using the store
+            NSURL *url = [[NSURL alloc] initWithString:[NSString stringWithFormat:@"ftp://example.com/%zu.txt", i]];
+            [CK2FileManager setTemporaryResourceValue:@(i) forKey:NSURLFileSizeKey inURL:url];
+            [CK2FileManager setTemporaryResourceValue:@(i) forKey:@"CK2TestKey" inURL:url];
+
+            id value;
+            XCTAssertTrue([url getResourceValue:&value forKey:NSURLFileSizeKey error:NULL]);
+            XCTAssertEqualObjects(value, @(i));
+            XCTAssertTrue([url getResourceValue:&value forKey:@"CK2TestKey" error:NULL]);
+            XCTAssertEqualObjects(value, @(i));
+            [url release];
+
+            // And one they all fight over
+            [CK2FileManager setTemporaryResourceValue:@(i) forKey:NSURLFileSizeKey inURL:shared];
+            XCTAssertTrue([shared getResourceValue:&value forKey:NSURLFileSizeKey error:NULL]);
+            XCTAssertNotNil(value);
+        }
+    });
+
+    XCTAssertEqual(store.numberOfURLs, count + 1);
+    [shared release];
+    XCTAssertEqual(store.numberOfURLs, count);
+}
+
+@end
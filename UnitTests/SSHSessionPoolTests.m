@@ -0,0 +1,220 @@
+//
+//  SSHSessionPoolTests.m
+//  Connection
+//
+//  Created by agent on 18/10/2026.
+//
+//
+
+#import "CK2SSHSessionPool.h"
+
+#import <XCTest/XCTest.h>
+
+@interface SSHSessionPoolTests : XCTestCase
+
+@end
+
+@implementation SSHSessionPoolTests
+
+- (void)testReturnedSessionIsReused
+{
+    CK2SSHSessionPool *pool = [[[CK2SSHSessionPool alloc] init] autorelease];
+    NSURL *url = [NSURL URLWithString:@"sftp://example.com/file.txt"];
+
+    CURLTransferStack *first = [pool borrowTransferStackForURL:url user:@"user"];
+    XCTAssertNotNil(first);
+    [pool returnTransferStack:first reusable:YES];
+
+    CURLTransferStack *second = [pool borrowTransferStackForURL:[NSURL URLWithString:@"sftp://EXAMPLE.com/other/"] user:@"user"];
+    XCTAssertEqual(second, first, @"Idle authenticated session should be handed out again");
+    [pool returnTransferStack:second reusable:YES];
+}
+
+- (void)testOnlyTransfersCountTowardsHandshakes
+{
+    CK2SSHSessionPool *pool = [[[CK2SSHSessionPool alloc] init] autorelease];
+    NSURL *url = [NSURL URLWithString:@"sftp://example.com/"];
+
+    CURLTransferStack *stack = [pool borrowTransferStackForURL:url user:@"user"];
+    [pool recordTransferReusingConnection:NO];
+    [pool returnTransferStack:stack reusable:YES];
+
+    // Whether libcurl finds the connection still open is only known once the transfer's run
+    stack = [pool borrowTransferStackForURL:url user:@"user"];
+    XCTAssertEqual(pool.handshakesAvoided, (NSUInteger)0, @"Borrowing alone isn't reuse");
+    [pool recordTransferReusingConnection:YES];
+    [pool returnTransferStack:stack reusable:YES];
+
+    // e.g. the server dropped the idle connection, so libcurl had to log in again
+    stack = [pool borrowTransferStackForURL:url user:@"user"];
+    [pool recordTransferReusingConnection:NO];
+    [pool returnTransferStack:stack reusable:YES];
+
+    XCTAssertEqual(pool.handshakesAvoided, (NSUInteger)1);
+    XCTAssertEqual(pool.handshakesPerformed, (NSUInteger)2);
+}
+
+- (void)testSessionsAreKeyedOnUserAndHost
+{
+    CK2SSHSessionPool *pool = [[[CK2SSHSessionPool alloc] init] autorelease];
+    NSURL *url = [NSURL URLWithString:@"sftp://example.com/"];
+
+    CURLTransferStack *stack = [pool borrowTransferStackForURL:url user:@"user"];
+    [pool returnTransferStack:stack reusable:YES];
+
+    CURLTransferStack *otherUser = [pool borrowTransferStackForURL:url user:@"someone-else"];
+    XCTAssertNotEqual(otherUser, stack);
+    [pool returnTransferStack:otherUser reusable:YES];
+
+    CURLTransferStack *otherPort = [pool borrowTransferStackForURL:[NSURL URLWithString:@"sftp://example.com:2222/"] user:@"user"];
+    XCTAssertNotEqual(otherPort, stack);
+    [pool returnTransferStack:otherPort reusable:YES];
+}
+
+- (void)testNoStackIsLentTwice
+{
+    CK2SSHSessionPool *pool = [[[CK2SSHSessionPool alloc] init] autorelease];
+    pool.maximumSessionsPerHost = 2;
+    NSURL *url = [NSURL URLWithString:@"sftp://example.com/"];
+
+    CURLTransferStack *first = [pool borrowTransferStackForURL:url user:@"user"];
+    CURLTransferStack *second = [pool borrowTransferStackForURL:url user:@"user"];
+    XCTAssertNotEqual(first, second);
+
+    // At the limit, so sharing one would mean libcurl opening a third connection
+    XCTAssertNil([pool borrowTransferStackForURL:url user:@"user"]);
+
+    [pool returnTransferStack:first reusable:YES];
+    XCTAssertEqual([pool borrowTransferStackForURL:url user:@"user"], first);
+
+    [pool returnTransferStack:first reusable:YES];
+    [pool returnTransferStack:second reusable:YES];
+}
+
+- (void)testBorrowersBeyondTheLimitWait
+{
+    CK2SSHSessionPool *pool = [[[CK2SSHSessionPool alloc] init] autorelease];
+    pool.maximumSessionsPerHost = 2;
+    NSURL *url = [NSURL URLWithString:@"sftp://example.com/"];
+
+    // Each stack runs one transfer over one connection, so the stacks out at once are the connections open
+    NSMutableArray *lent = [NSMutableArray array];
+    NSMutableSet *everLent = [NSMutableSet set];
+    __block NSUInteger mostLentAtOnce = 0;
+    __block BOOL lentTwice = NO;
+    dispatch_semaphore_t borrowed = dispatch_semaphore_create(0);
+
+    NSUInteger borrowers = 6;
+    for (NSUInteger i = 0; i < borrowers; i++)
+    {
+        [pool borrowTransferStackForURL:url user:@"user" completionHandler:^(CURLTransferStack *stack) {
+            @synchronized(lent)
+            {
+                if ([lent indexOfObjectIdenticalTo:stack] != NSNotFound) lentTwice = YES;
+                [lent addObject:stack];
+                [everLent addObject:[NSValue valueWithNonretainedObject:stack]];
+                mostLentAtOnce = MAX(mostLentAtOnce, lent.count);
+            }
+            dispatch_semaphore_signal(borrowed);
+        }];
+    }
+
+    // Two straight away, the rest queued
+    for (NSUInteger i = 0; i < 2; i++)
+    {
+        XCTAssertEqual(dispatch_semaphore_wait(borrowed, DISPATCH_TIME_NOW), 0L);
+    }
+    XCTAssertNotEqual(dispatch_semaphore_wait(borrowed, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC / 10)), 0L, @"Should have waited for a stack to come back");
+
+    // Hand them back one at a time, each letting the next borrower in
+    for (NSUInteger i = 2; i < borrowers; i++)
+    {
+        CURLTransferStack *stack;
+        @synchronized(lent)
+        {
+            stack = [[[lent objectAtIndex:0] retain] autorelease];
+            [lent removeObjectAtIndex:0];
+        }
+        [pool returnTransferStack:stack reusable:YES];
+
+        XCTAssertEqual(dispatch_semaphore_wait(borrowed, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_SEC)), 0L, @"Waiting borrower never got a stack");
+    }
+
+    XCTAssertEqual(mostLentAtOnce, (NSUInteger)2);
+    XCTAssertFalse(lentTwice);
+    XCTAssertEqual(everLent.count, (NSUInteger)2, @"Returned stacks should be handed on rather than new ones made");
+
+    for (CURLTransferStack *stack in [[lent copy] autorelease])
+    {
+        [pool returnTransferStack:stack reusable:YES];
+    }
+    dispatch_release(borrowed);
+}
+
+- (void)testDiscardedStackIsReplacedForWaitingBorrower
+{
+    CK2SSHSessionPool *pool = [[[CK2SSHSessionPool alloc] init] autorelease];
+    pool.maximumSessionsPerHost = 1;
+    NSURL *url = [NSURL URLWithString:@"sftp://example.com/"];
+
+    CURLTransferStack *failed = [[pool borrowTransferStackForURL:url user:@"user"] retain];
+
+    __block CURLTransferStack *next = nil;
+    dispatch_semaphore_t borrowed = dispatch_semaphore_create(0);
+    [pool borrowTransferStackForURL:url user:@"user" completionHandler:^(CURLTransferStack *stack) {
+        next = stack;
+        dispatch_semaphore_signal(borrowed);
+    }];
+
+    [pool returnTransferStack:failed reusable:NO];
+    XCTAssertEqual(dispatch_semaphore_wait(borrowed, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_SEC)), 0L, @"Waiting borrower never got a stack");
+    XCTAssertNotNil(next);
+    XCTAssertNotEqual(next, failed);
+
+    [pool returnTransferStack:next reusable:YES];
+    [failed release];
+    dispatch_release(borrowed);
+}
+
+- (void)testFailedSessionIsDiscarded
+{
+    CK2SSHSessionPool *pool = [[[CK2SSHSessionPool alloc] init] autorelease];
+    NSURL *url = [NSURL URLWithString:@"sftp://example.com/"];
+
+    // Kept alive so the comparison below can't be fooled by a new stack at the same address
+    CURLTransferStack *failed = [[pool borrowTransferStackForURL:url user:@"user"] retain];
+    NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:nil];
+    XCTAssertFalse([CK2SSHSessionPool isConnectionReusableAfterError:error]);
+    [pool returnTransferStack:failed reusable:NO];
+
+    CURLTransferStack *stack = [pool borrowTransferStackForURL:url user:@"user"];
+    XCTAssertNotEqual(stack, failed, @"Should have to reconnect after the connection was lost");
+    [pool returnTransferStack:stack reusable:YES];
+
+    [failed release];
+}
+
+- (void)testIdleSessionsExpire
+{
+    CK2SSHSessionPool *pool = [[[CK2SSHSessionPool alloc] init] autorelease];
+    pool.idleTimeout = 0;
+    NSURL *url = [NSURL URLWithString:@"sftp://example.com/"];
+
+    CURLTransferStack *expired = [[pool borrowTransferStackForURL:url user:@"user"] retain];
+    [pool returnTransferStack:expired reusable:YES];
+
+    CURLTransferStack *stack = [pool borrowTransferStackForURL:url user:@"user"];
+    XCTAssertNotEqual(stack, expired);
+    [pool returnTransferStack:stack reusable:YES];
+
+    [expired release];
+}
+
+- (void)testOperationErrorsLeaveConnectionReusable
+{
+    XCTAssertTrue([CK2SSHSessionPool isConnectionReusableAfterError:nil]);
+    XCTAssertTrue([CK2SSHSessionPool isConnectionReusableAfterError:[NSError errorWithDomain:CURLcodeErrorDomain code:CURLE_QUOTE_ERROR userInfo:nil]]);
+    XCTAssertFalse([CK2SSHSessionPool isConnectionReusableAfterError:[NSError errorWithDomain:CURLcodeErrorDomain code:CURLE_RECV_ERROR userInfo:nil]]);
+}
+
+@end